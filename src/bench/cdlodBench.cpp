@@ -0,0 +1,99 @@
+/*
+ * cdlodBench.cpp
+ * Triangles per frame and CPU selection time of the CDLOD quadtree
+ * at view distances from 64 to 4096 units (one more level for every
+ * doubling), against a uniform grid with the same finest spacing and
+ * against the uniform tiles of TileManager.
+ * Usage: cdlodbench [triangle budget]
+ * The camera flies 2 units above the ground along +z, looking ahead.
+ * No OpenGL is needed. The GPU side is compared in the program itself
+ * (--cdlod against the default tiles, with the FPS display).
+ */
+
+#include "../common/CDLODQuadtree.hpp"
+#include "../common/TerrainHeight.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+/* Column-major 4x4 product c = a * b */
+static void multiply(const float *a, const float *b, float *c) {
+    for(int col=0; col<4; col++) {
+        for(int row=0; row<4; row++) {
+            float sum = 0.0f;
+            for(int k=0; k<4; k++) sum += a[4*k + row] * b[4*col + k];
+            c[4*col + row] = sum;
+        }
+    }
+}
+
+/* The matrices of glm::perspective() and glm::lookAt() with up = +y, looking along +z */
+static void viewProjection(const float *eye, float fovy, float aspect, float znear, float zfar, float *vp) {
+    float f = 1.0f / tanf(0.5f * fovy);
+    float proj[16] = { f/aspect, 0, 0, 0,   0, f, 0, 0,
+                       0, 0, (zfar+znear)/(znear-zfar), -1,   0, 0, 2*zfar*znear/(znear-zfar), 0 };
+    // Right = -x, up = +y, forward = +z
+    float view[16] = { -1, 0, 0, 0,   0, 1, 0, 0,   0, 0, -1, 0,
+                       eye[0], -eye[1], eye[2], 1 };
+    multiply(proj, view, vp);
+}
+
+static double seconds() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[]) {
+
+    const float leafsize = 2.0f, range0 = 8.0f;
+    const int griddim = 32;
+    const float fovy = 45.0f * 3.14159265f / 180.0f, aspect = 4.0f / 3.0f;
+    const int frames = 200;
+    int budget = (argc > 1) ? atoi(argv[1]) : 0;
+
+    // Horizontal field of view, for the area of the visible wedge
+    float fovx = 2.0f * atanf(aspect * tanf(0.5f * fovy));
+    float finest = leafsize / griddim;
+    float tilespacing = 8.0f / 64; // TileManager's default tiles
+    float tileradius = 5 * 8.0f;
+
+    printf("CDLOD: %dx%d patches, finest spacing %.3f, level 0 range %.0f, budget %s\n",
+        griddim, griddim, finest, range0, budget > 0 ? argv[1] : "none");
+    printf("%6s %9s %8s %10s %6s %12s %12s %10s\n", "levels", "distance", "nodes", "triangles",
+        "scale", "select (ms)", "uniform", "tiles");
+
+    // The view distance doubles with every level added
+    for(int levels = 4; levels <= 10; levels++) {
+
+        CDLODQuadtree tree(leafsize, levels, griddim,
+            Terrain::BASEHEIGHT - Terrain::MAXAMPLITUDE, Terrain::BASEHEIGHT + Terrain::MAXAMPLITUDE);
+        tree.setDetail(range0);
+        tree.setTriangleBudget(budget);
+        float distance = range0 * (float)(1 << (levels-1));
+
+        double t0 = seconds();
+        long totaltriangles = 0, totalnodes = 0;
+        for(int frame=0; frame<frames; frame++) {
+            float eye[3] = { 0.0f, 2.0f, frame * 0.5f };
+            float vp[16];
+            viewProjection(eye, fovy, aspect, 0.1f, distance, vp);
+            totaltriangles += tree.select(vp, eye);
+            totalnodes += (long)tree.nodes().size();
+        }
+        double t1 = seconds();
+
+        // A uniform grid at the finest CDLOD spacing over the same visible wedge,
+        // and TileManager's tiles, which cover a fixed disc around the camera
+        double reach = tree.range(levels-1);
+        double uniform = 2.0 * (0.5 * fovx * reach * reach) / (finest * finest);
+        double tiles = 2.0 * 3.14159265 * tileradius * tileradius / (tilespacing * tilespacing);
+
+        printf("%6d %9.0f %8ld %10ld %6.2f %12.3f %12.0f %10.0f\n", levels, reach,
+            totalnodes / frames, totaltriangles / frames, tree.detailScale(),
+            1000.0 * (t1 - t0) / frames, uniform, tiles);
+    }
+    return 0;
+}
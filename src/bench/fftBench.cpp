@@ -0,0 +1,148 @@
+/*
+ * fftBench.cpp
+ * Speed of the FFTs of common/FFT.hpp and of one step of the ocean
+ * simulation (common/OceanSimulation.hpp) that uses them: a 2-D
+ * transform of n x n points one line at a time with the scalar kernel,
+ * then with the SIMD column kernel on one worker and on all of them.
+ * Also checks the results: 1-D transforms against a plain DFT, a 2-D
+ * transform and its inverse, and the slopes of a simulated surface
+ * against differences of its heights.
+ * Usage: fftbench [n]
+ * No OpenGL is needed.
+ */
+
+#include "../common/FFT.hpp"
+#include "../common/OceanSimulation.hpp"
+#include "../common/ThreadPool.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+static double seconds() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Milliseconds per call of f, the best of a few rounds */
+template<class F> static double timeMs(F f, int repeats) {
+    double best = 1e30;
+    for(int round=0; round<5; round++) {
+        double t0 = seconds();
+        for(int r=0; r<repeats; r++) f();
+        best = fmin(best, 1000.0 * (seconds() - t0) / repeats);
+    }
+    return best;
+}
+
+/* Largest difference between the FFT and a DFT in double precision, relative to the largest value */
+static double checkDFT(int n, bool inverse) {
+    FFT fft(n);
+    vector<float> re(n), im(n);
+    for(int i=0; i<n; i++) {
+        re[i] = (float)rand() / RAND_MAX - 0.5f;
+        im[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+    vector<double> dre(n, 0.0), dim(n, 0.0);
+    double sign = inverse ? 1.0 : -1.0, largest = 0.0, error = 0.0;
+    for(int k=0; k<n; k++) {
+        for(int j=0; j<n; j++) {
+            double a = sign * 2.0 * M_PI * ((long)j * k % n) / n;
+            dre[k] += re[j] * cos(a) - im[j] * sin(a);
+            dim[k] += re[j] * sin(a) + im[j] * cos(a);
+        }
+        largest = fmax(largest, fmax(fabs(dre[k]), fabs(dim[k])));
+    }
+    fft.transform(&re[0], &im[0], inverse);
+    for(int k=0; k<n; k++) error = fmax(error, fmax(fabs(re[k] - dre[k]), fabs(im[k] - dim[k])));
+    return error / largest;
+}
+
+static void transpose(float *data, int n) {
+    for(int i=0; i<n; i++) {
+        for(int j=i+1; j<n; j++) swap(data[i*n + j], data[j*n + i]);
+    }
+}
+
+/* The 2-D transform one line at a time with the scalar kernel, for comparison */
+static void scalar2D(const FFT &fft, float *re, float *im) {
+    int n = fft.size();
+    for(int pass=0; pass<2; pass++) {
+        for(int row=0; row<n; row++) fft.transform(re + row*n, im + row*n, true);
+        transpose(re, n);
+        transpose(im, n);
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    int n = (argc > 1) ? atoi(argv[1]) : 256;
+    FFT fft(n);
+    n = fft.size();
+    ThreadPool single(1);
+    ThreadPool &all = ThreadPool::global();
+
+    printf("FFT: %d x %d, %s kernel, %d workers\n", n, n, FFT::simd() ? "SSE" : "scalar", all.size());
+    int sizes[] = { 4, 16, 64, n };
+    for(int s=0; s<4; s++) {
+        printf("  1-D %4d points against a DFT: forward %.1e, inverse %.1e\n",
+            sizes[s], checkDFT(sizes[s], false), checkDFT(sizes[s], true));
+    }
+
+    vector<float> re(n*n), im(n*n), re0(n*n), im0(n*n);
+    for(int k=0; k<n*n; k++) {
+        re0[k] = re[k] = (float)rand() / RAND_MAX - 0.5f;
+        im0[k] = im[k] = (float)rand() / RAND_MAX - 0.5f;
+    }
+    fft.transform2D(&re[0], &im[0], false);
+    fft.transform2D(&re[0], &im[0], true);
+    double roundtrip = 0.0;
+    for(int k=0; k<n*n; k++) {
+        roundtrip = fmax(roundtrip, fmax(fabs(re[k] / (n*n) - re0[k]), fabs(im[k] / (n*n) - im0[k])));
+    }
+    printf("  2-D forward and inverse: largest error %.1e\n\n", roundtrip);
+
+    // One 2-D transform takes well under a frame, so repeat it
+    int repeats = max(1, (1 << 22) / (n*n));
+    double lines = timeMs([&]() { scalar2D(fft, &re[0], &im[0]); }, repeats);
+    double one = timeMs([&]() { fft.transform2D(&re[0], &im[0], true, &single); }, repeats);
+    double pool = timeMs([&]() { fft.transform2D(&re[0], &im[0], true, &all); }, repeats);
+    double flops = 5.0 * n * n * log2((double)n * n); // The usual count for a complex FFT
+    printf("%-32s %10s %10s\n", "2-D transform", "ms", "GFLOP/s");
+    printf("%-32s %10.3f %10.2f\n", "scalar, line by line", lines, flops / (lines * 1e6));
+    printf("%-32s %10.3f %10.2f\n", "SIMD columns, 1 worker", one, flops / (one * 1e6));
+    printf("%-32s %10.3f %10.2f\n\n", "SIMD columns, all workers", pool, flops / (pool * 1e6));
+
+    // The ocean: three transforms plus the spectrum and the unpacking
+    OceanSimulation ocean(n);
+    vector<float> displacement(4*n*n), slopes(2*n*n);
+    float t = 0.0f;
+    double stepone = timeMs([&]() { ocean.step(t += 0.016f, &displacement[0], &slopes[0], &single); }, 4);
+    double stepall = timeMs([&]() { ocean.step(t += 0.016f, &displacement[0], &slopes[0], &all); }, 4);
+    printf("%-32s %10s %10s\n", "Ocean step", "ms", "of 60 Hz");
+    printf("%-32s %10.3f %9.0f%%\n", "1 worker", stepone, 100.0 * stepone / 16.667);
+    printf("%-32s %10.3f %9.0f%%\n", "all workers", stepall, 100.0 * stepall / 16.667);
+
+    // The slopes are exact derivatives; central differences of the heights
+    // should agree closely for the long waves that carry most of the height
+    double rms = 0.0, dot = 0.0, spectral = 0.0, differences = 0.0;
+    float spacing = ocean.patchSize() / n;
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            int k = j*n + i;
+            float h = displacement[4*k + 1];
+            float dhdx = (displacement[4*(j*n + (i+1)%n) + 1] - displacement[4*(j*n + (i+n-1)%n) + 1]) / (2.0f * spacing);
+            rms += h * h;
+            dot += dhdx * slopes[2*k];
+            spectral += slopes[2*k] * slopes[2*k];
+            differences += dhdx * dhdx;
+        }
+    }
+    printf("\nSurface: rms height %.4f, slope against height differences: correlation %.3f\n",
+        sqrt(rms / (n*n)), dot / sqrt(spectral * differences));
+    return 0;
+}
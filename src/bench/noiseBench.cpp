@@ -0,0 +1,104 @@
+/*
+ * noiseBench.cpp
+ * Throughput benchmark and conformance check for the CPU simplex noise.
+ * Every kernel the CPU supports is compared against the scalar reference
+ * Noise::snoise() on a set of random points (results must match bit for
+ * bit), and then timed on a single core.
+ * Usage: noisebench [number of points]
+ * Exit status is nonzero if any kernel disagrees with the reference.
+ */
+
+#include "../common/SimplexNoise.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+/* Number of mismatching values (compared bitwise) */
+static int countMismatches(const float *a, const float *b, int n) {
+    int bad = 0;
+    for(int i=0; i<n; i++) {
+        if(memcmp(&a[i], &b[i], sizeof(float)) != 0) bad++;
+    }
+    return bad;
+}
+
+int main(int argc, char *argv[]) {
+
+    int n = 1 << 20;
+    if(argc > 1) n = atoi(argv[1]);
+    if(n < 1) n = 1;
+
+    vector<float> x(n), y(n), z(n);
+    vector<float> refN(n), refGx(n), refGy(n), refGz(n);
+    vector<float> res(n), gx(n), gy(n), gz(n);
+
+    // Points spread over the range the shaders use, and well beyond it
+    srand(1234);
+    for(int i=0; i<n; i++) {
+        x[i] = 200.0f * rand() / RAND_MAX - 100.0f;
+        y[i] = 200.0f * rand() / RAND_MAX - 100.0f;
+        z[i] = 200.0f * rand() / RAND_MAX - 100.0f;
+    }
+
+    for(int i=0; i<n; i++) {
+        float g[3];
+        refN[i] = Noise::snoise(x[i], y[i], z[i], g);
+        refGx[i] = g[0]; refGy[i] = g[1]; refGz[i] = g[2];
+        if(Noise::snoise(x[i], y[i], z[i]) != refN[i]) {
+            printf("Reference mismatch between snoise() variants at point %d\n", i);
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    const Noise::Kernel kernels[] = { Noise::KERNEL_SCALAR, Noise::KERNEL_SSE41, Noise::KERNEL_AVX2 };
+
+    printf("%d points, blocks of %d\n", n, Noise::BLOCKSIZE);
+    printf("%-8s %12s %14s %14s\n", "kernel", "mismatches", "Mpoints/s", "Mpoints/s grad");
+
+    for(int k=0; k<3; k++) {
+        if(!Noise::setKernel(kernels[k])) {
+            printf("%-8s %12s\n", Noise::kernelName(kernels[k]), "unsupported");
+            continue;
+        }
+
+        // Conformance
+        Noise::snoiseBatch(&x[0], &y[0], &z[0], &res[0], n);
+        int bad = countMismatches(&res[0], &refN[0], n);
+        Noise::snoiseBatch(&x[0], &y[0], &z[0], &res[0], &gx[0], &gy[0], &gz[0], n);
+        bad += countMismatches(&res[0], &refN[0], n);
+        bad += countMismatches(&gx[0], &refGx[0], n);
+        bad += countMismatches(&gy[0], &refGy[0], n);
+        bad += countMismatches(&gz[0], &refGz[0], n);
+        if(bad) failures++;
+
+        // Throughput, best of a few runs
+        double best = 1e30, bestGrad = 1e30;
+        for(int run=0; run<5; run++) {
+            chrono::high_resolution_clock::time_point t0 = chrono::high_resolution_clock::now();
+            Noise::snoiseBatch(&x[0], &y[0], &z[0], &res[0], n);
+            chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+            Noise::snoiseBatch(&x[0], &y[0], &z[0], &res[0], &gx[0], &gy[0], &gz[0], n);
+            chrono::high_resolution_clock::time_point t2 = chrono::high_resolution_clock::now();
+            double s = chrono::duration<double>(t1 - t0).count();
+            double sg = chrono::duration<double>(t2 - t1).count();
+            if(s < best) best = s;
+            if(sg < bestGrad) bestGrad = sg;
+        }
+
+        printf("%-8s %12d %14.1f %14.1f\n", Noise::kernelName(kernels[k]), bad,
+               n / best * 1e-6, n / bestGrad * 1e-6);
+    }
+
+    if(failures) {
+        printf("FAILED: %d kernel(s) disagree with the reference\n", failures);
+        return 1;
+    }
+    printf("All kernels match the reference\n");
+    return 0;
+}
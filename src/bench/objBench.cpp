@@ -0,0 +1,172 @@
+/*
+ * objBench.cpp
+ * Compare the parallel ObjLoader with the original fgets()/sscanf()
+ * parser from TriangleSoup::readOBJ() on a generated terrain grid.
+ * Usage: objbench [grid size] [file name]
+ * The default 1200x1200 grid gives 2.9 million triangles (about 130 MB).
+ * Only parsing is timed, no OpenGL context is needed.
+ */
+
+#include "../common/ObjLoader.hpp"
+#include "../common/ThreadPool.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+/* Write an n x n grid of quads, split into triangles, on f v/t/n v/t/n v/t/n form */
+static bool writeGrid(const char *filename, int n) {
+    FILE *file = fopen(filename, "w");
+    if(!file) return false;
+    fprintf(file, "# %dx%d terrain grid for objbench\n", n, n);
+    for(int j=0; j<=n; j++) {
+        for(int i=0; i<=n; i++) {
+            float x = 20.0f * i / n - 10.0f, z = 20.0f * j / n - 10.0f;
+            fprintf(file, "v %f %f %f\n", x, 0.3f * sinf(x) * cosf(z), z);
+        }
+    }
+    for(int j=0; j<=n; j++) {
+        for(int i=0; i<=n; i++) {
+            fprintf(file, "vt %f %f\n", (float)i / n, (float)j / n);
+        }
+    }
+    fprintf(file, "vn 0.000000 1.000000 0.000000\n");
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            int a = j*(n+1) + i + 1, b = a + 1, c = a + n + 1, d = c + 1;
+            fprintf(file, "f %d/%d/1 %d/%d/1 %d/%d/1\n", a, a, c, c, b, b);
+            fprintf(file, "f %d/%d/1 %d/%d/1 %d/%d/1\n", b, b, c, c, d, d);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+/*
+ * The parsing part of the original TriangleSoup::readOBJ(), unchanged
+ * apart from leaving out the OpenGL upload. Returns the triangle count.
+ */
+static int legacyReadOBJ(const char *filename) {
+
+    FILE *objfile;
+    int numverts = 0, numnormals = 0, numtexcoords = 0, numfaces = 0;
+    int i_v = 0, i_n = 0, i_t = 0, i_f = 0;
+    float *verts, *normals, *texcoords, *vertexarray;
+    unsigned int *indexarray;
+    char line[256];
+    char tag[3];
+    int v1, v2, v3, n1, n2, n3, t1, t2, t3;
+    int currentv;
+
+    objfile = fopen(filename, "r");
+    if(!objfile) return -1;
+
+    while(fgets(line, 256, objfile)) {
+        sscanf(line, "%2s ", tag);
+        if(!strcmp(tag, "v")) numverts++;
+        else if(!strcmp(tag, "vn")) numnormals++;
+        else if(!strcmp(tag, "vt")) numtexcoords++;
+        else if(!strcmp(tag, "f")) numfaces++;
+    }
+
+    verts = new float[3*numverts];
+    normals = new float[3*numnormals];
+    texcoords = new float[2*numtexcoords];
+    vertexarray = new float[8*3*numfaces];
+    indexarray = new unsigned int[3*numfaces];
+
+    rewind(objfile);
+
+    while(fgets(line, 256, objfile)) {
+        tag[0] = '\0';
+        sscanf(line, "%2s ", tag);
+        if(!strcmp(tag, "v")) {
+            sscanf(line, "v %f %f %f", &verts[3*i_v], &verts[3*i_v+1], &verts[3*i_v+2]);
+            i_v++;
+        }
+        else if(!strcmp(tag, "vn")) {
+            sscanf(line, "vn %f %f %f", &normals[3*i_n], &normals[3*i_n+1], &normals[3*i_n+2]);
+            i_n++;
+        }
+        else if(!strcmp(tag, "vt"))  {
+            sscanf(line, "vt %f %f", &texcoords[2*i_t], &texcoords[2*i_t+1]);
+            i_t++;
+        }
+        else if(!strcmp(tag, "f")) {
+            sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
+                &v1, &t1, &n1, &v2, &t2, &n2, &v3, &t3, &n3);
+            v1--; v2--; v3--; n1--; n2--; n3--; t1--; t2--; t3--;
+            int vi[3] = { v1, v2, v3 }, ni[3] = { n1, n2, n3 }, ti[3] = { t1, t2, t3 };
+            currentv = 8*3*i_f;
+            for(int k=0; k<3; k++) {
+                memcpy(&vertexarray[currentv+8*k], &verts[3*vi[k]], 3*sizeof(float));
+                memcpy(&vertexarray[currentv+8*k+3], &normals[3*ni[k]], 3*sizeof(float));
+                memcpy(&vertexarray[currentv+8*k+6], &texcoords[2*ti[k]], 2*sizeof(float));
+                indexarray[3*i_f+k] = 3*i_f+k;
+            }
+            i_f++;
+        }
+    }
+
+    fclose(objfile);
+    delete[] verts;
+    delete[] normals;
+    delete[] texcoords;
+    delete[] vertexarray;
+    delete[] indexarray;
+    return i_f;
+}
+
+static double seconds() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[]) {
+
+    int n = 1200;
+    const char *filename = "objbench_grid.obj";
+    if(argc > 1) n = atoi(argv[1]);
+    if(argc > 2) filename = argv[2];
+    if(n < 1) n = 1;
+
+    printf("Writing %dx%d grid to %s...\n", n, n, filename);
+    if(!writeGrid(filename, n)) {
+        fprintf(stderr, "Cannot write %s\n", filename);
+        return 1;
+    }
+    FILE *file = fopen(filename, "rb");
+    fseek(file, 0, SEEK_END);
+    double megabytes = ftell(file) / (1024.0 * 1024.0);
+    fclose(file);
+
+    // Warm the page cache so both parsers read from memory
+    legacyReadOBJ(filename);
+
+    double t0 = seconds();
+    int legacytris = legacyReadOBJ(filename);
+    double t1 = seconds();
+
+    ObjLoader loader;
+    ThreadPool::global(); // Start the workers outside the timed region
+    double t2 = seconds();
+    bool ok = loader.load(filename);
+    double t3 = seconds();
+
+    if(!ok || loader.ntris != legacytris) {
+        fprintf(stderr, "Triangle count mismatch: %d (legacy) vs %d (ObjLoader)\n",
+            legacytris, loader.ntris);
+        return 1;
+    }
+
+    printf("%.1f MB, %d triangles, %d threads\n", megabytes, loader.ntris, ThreadPool::global().size());
+    printf("readOBJ (fgets/sscanf): %8.3f s %8.1f MB/s\n", t1 - t0, megabytes / (t1 - t0));
+    printf("ObjLoader             : %8.3f s %8.1f MB/s (%.1fx)\n", t3 - t2, megabytes / (t3 - t2),
+        (t1 - t0) / (t3 - t2));
+
+    remove(filename);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * scatterBench.cpp
+ * Throughput of the blue-noise vegetation scatter (common/Scatter.hpp),
+ * in instances per millisecond, on one core and on all workers of the
+ * thread pool, for a few spacings. Also checks the result: no two
+ * instances closer than the spacing over a block of tiles, borders
+ * included, and the same instances when a tile is sampled again.
+ * Usage: scatterbench [tiles per side]
+ * No OpenGL is needed.
+ */
+
+#include "../common/Scatter.hpp"
+#include "../common/ThreadPool.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+static double seconds() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* The closest pair among all instances, by brute force over neighbouring tiles */
+static float closestPair(const vector<vector<Scatter::Instance> > &tiles, int side) {
+    float best = 1e30f;
+    for(int t=0; t<side*side; t++) {
+        for(int u=0; u<side*side; u++) {
+            if(abs(t % side - u % side) > 1 || abs(t / side - u / side) > 1) continue;
+            for(size_t i=0; i<tiles[t].size(); i++) {
+                for(size_t j=0; j<tiles[u].size(); j++) {
+                    if(t == u && i == j) continue;
+                    float dx = tiles[t][i].x - tiles[u][j].x, dz = tiles[t][i].z - tiles[u][j].z;
+                    best = fminf(best, sqrtf(dx*dx + dz*dz));
+                }
+            }
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+
+    const float tilesize = 8.0f;
+    int side = (argc > 1) ? atoi(argv[1]) : 16;
+    if(side < 1) side = 1;
+    int ntiles = side * side;
+    vector<int> ix(ntiles), iz(ntiles);
+    for(int t=0; t<ntiles; t++) {
+        ix[t] = t % side - side / 2;
+        iz[t] = t / side - side / 2;
+    }
+
+    printf("Scatter: %dx%d tiles of %.0f units, %d phases, %d workers\n",
+        side, side, tilesize, Scatter::PHASES, ThreadPool::global().size());
+    printf("%8s %10s %12s %14s %14s %10s %6s\n", "spacing", "instances", "per unit^2",
+        "1 core (/ms)", "pool (/ms)", "closest", "same");
+
+    const float spacings[] = { 2.0f, 1.0f, 0.5f, 0.25f };
+    for(int s=0; s<4; s++) {
+
+        // The scene's forest filters: water level, slope and altitude bands
+        Scatter scatter(tilesize, spacings[s], 1);
+        scatter.setWaterLevel(-0.6f);
+        scatter.setMaxSlope(0.8f);
+        scatter.addBand(-0.6f, 1.2f, 0);
+        scatter.addBand(1.2f, 2.0f, 1, 0.5f);
+
+        // One core: the tiles one after the other on this thread
+        vector<vector<Scatter::Instance> > serial(ntiles);
+        double t0 = seconds();
+        for(int t=0; t<ntiles; t++) scatter.scatterTile(ix[t], iz[t], serial[t]);
+        double t1 = seconds();
+
+        // All workers
+        vector<vector<Scatter::Instance> > parallel(ntiles);
+        double t2 = seconds();
+        scatter.scatterTiles(&ix[0], &iz[0], ntiles, &parallel[0]);
+        double t3 = seconds();
+
+        long count = 0;
+        bool same = true;
+        for(int t=0; t<ntiles; t++) {
+            count += (long)serial[t].size();
+            same = same && serial[t].size() == parallel[t].size()
+                && (serial[t].empty() || !memcmp(&serial[t][0], &parallel[t][0], serial[t].size()*sizeof(Scatter::Instance)));
+        }
+        float closest = (side <= 24) ? closestPair(serial, side) : -1.0f;
+
+        printf("%8.2f %10ld %12.3f %14.0f %14.0f %10.3f %6s\n", spacings[s], count,
+            count / (ntiles * tilesize * tilesize),
+            count / (1000.0 * (t1 - t0)), count / (1000.0 * (t3 - t2)), closest, same ? "yes" : "NO");
+    }
+    return 0;
+}
@@ -0,0 +1,321 @@
+#include "Benchmark.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Nearest-rank percentile of sorted values, p in (0,1] */
+double percentile(const std::vector<double> &sorted, double p) {
+    if(sorted.empty()) return 0.0;
+    int rank = (int)ceil(p * sorted.size()) - 1;
+    if(rank < 0) rank = 0;
+    return sorted[rank];
+}
+
+/* A string as a JSON string literal */
+std::string quote(const std::string &text) {
+    std::string quoted = "\"";
+    for(size_t i=0; i<text.size(); i++) {
+        if(text[i] == '"' || text[i] == '\\') quoted += '\\';
+        if((unsigned char)text[i] >= ' ') quoted += text[i];
+    }
+    return quoted + "\"";
+}
+
+/* Uniform Catmull-Rom spline through p1 and p2, u in [0,1] */
+float catmullRom(float p0, float p1, float p2, float p3, float u) {
+    return 0.5f * (2.0f*p1 + (p2 - p0)*u + (2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3)*u*u
+                   + (3.0f*p1 - p0 - 3.0f*p2 + p3)*u*u*u);
+}
+
+}
+
+
+Benchmark::Benchmark() {
+    frames = 0;
+    framewidth = 800;
+    frameheight = 600;
+    frame = 0;
+    framebuffer = colorbuffer = depthbuffer = 0;
+    trianglequery = 0;
+    framestart = 0.0;
+    imagehash = 0;
+}
+
+
+Benchmark::~Benchmark() {
+    if(framebuffer) glDeleteFramebuffers(1, &framebuffer);
+    if(colorbuffer) glDeleteRenderbuffers(1, &colorbuffer);
+    if(depthbuffer) glDeleteRenderbuffers(1, &depthbuffer);
+    if(trianglequery) glDeleteQueries(1, &trianglequery);
+}
+
+
+bool Benchmark::loadPath(const char *filename) {
+
+    FILE *file = fopen(filename, "r");
+    if(!file) {
+        Utilities::printError("Benchmark: cannot open camera path", filename);
+        return false;
+    }
+
+    keys.clear();
+    char line[256];
+    int linenumber = 0;
+    bool ok = true;
+    while(ok && fgets(line, sizeof(line), file)) {
+        linenumber++;
+        Key key;
+        char first = 0;
+        if(sscanf(line, " %c", &first) < 1 || first == '#') continue; // Blank or comment
+        if(sscanf(line, "%lf %f %f %f %f %f %f", &key.time,
+                  &key.position[0], &key.position[1], &key.position[2],
+                  &key.target[0], &key.target[1], &key.target[2]) != 7
+           || (!keys.empty() && key.time <= keys.back().time)) {
+            printf("Benchmark: %s line %d: expected \"time px py pz tx ty tz\" with increasing times\n",
+                filename, linenumber);
+            ok = false;
+        }
+        keys.push_back(key);
+    }
+    fclose(file);
+
+    if(ok && keys.empty()) {
+        Utilities::printError("Benchmark: no keys in camera path", filename);
+        ok = false;
+    }
+    if(!ok) keys.clear();
+    else pathname = filename;
+    return ok;
+}
+
+
+void Benchmark::setFrames(int frames) {
+    this->frames = frames;
+}
+
+
+void Benchmark::setSize(int width, int height) {
+    framewidth = width;
+    frameheight = height;
+}
+
+
+int Benchmark::width() const {
+    return framewidth;
+}
+
+
+int Benchmark::height() const {
+    return frameheight;
+}
+
+
+void Benchmark::initHeadless() {
+#ifdef GLFW_PLATFORM_NULL
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+}
+
+
+GLFWwindow *Benchmark::createWindow() {
+
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+
+    GLFWwindow *window = NULL;
+#ifdef GLFW_EGL_CONTEXT_API
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    window = glfwCreateWindow(framewidth, frameheight, "Benchmark", NULL, NULL);
+#endif
+#ifdef GLFW_OSMESA_CONTEXT_API
+    if(!window) {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        window = glfwCreateWindow(framewidth, frameheight, "Benchmark", NULL, NULL);
+    }
+#endif
+    if(!window) {
+#ifdef GLFW_NATIVE_CONTEXT_API
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_NATIVE_CONTEXT_API);
+#endif
+        window = glfwCreateWindow(framewidth, frameheight, "Benchmark", NULL, NULL);
+    }
+    return window;
+}
+
+
+void Benchmark::begin() {
+
+    glGenRenderbuffers(1, &colorbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, framewidth, frameheight);
+    glGenRenderbuffers(1, &depthbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, framewidth, frameheight); // Stencil for the overdraw count
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorbuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        Utilities::printError("Benchmark", "offscreen framebuffer is incomplete");
+    }
+
+    glGenQueries(1, &trianglequery);
+    frame = 0;
+    frametimes.clear();
+    triangles.clear();
+    imagehash = 0;
+    const GLubyte *name = glGetString(GL_RENDERER);
+    renderer = name ? (const char*)name : "unknown";
+    printf("Benchmark: %d frames (+%d warmup) at %dx%d on %s\n", totalFrames() - WARMUP, WARMUP,
+        framewidth, frameheight, renderer.c_str());
+}
+
+
+bool Benchmark::running() const {
+    return frame < totalFrames();
+}
+
+
+/* The warmup frames are all drawn at time 0 */
+double Benchmark::time() const {
+    return (double)std::max(0, frame - WARMUP) / FRAMERATE;
+}
+
+
+/* The path is repeated if there are more frames than it lasts */
+void Benchmark::camera(float *position, float *target) const {
+
+    if(keys.empty()) return;
+    int n = (int)keys.size();
+    double length = keys[n-1].time - keys[0].time;
+    double t = (length > 0.0) ? fmod(time(), length) + keys[0].time : keys[0].time;
+
+    int i = 0;
+    while(i < n-2 && keys[i+1].time <= t) i++;
+    const Key &k0 = keys[i > 0 ? i-1 : 0], &k1 = keys[i];
+    const Key &k2 = keys[i+1 < n ? i+1 : n-1], &k3 = keys[i+2 < n ? i+2 : n-1];
+    float u = (k2.time > k1.time) ? (float)((t - k1.time) / (k2.time - k1.time)) : 0.0f;
+    u = std::max(0.0f, std::min(u, 1.0f));
+    for(int c=0; c<3; c++) {
+        position[c] = catmullRom(k0.position[c], k1.position[c], k2.position[c], k3.position[c], u);
+        target[c] = catmullRom(k0.target[c], k1.target[c], k2.target[c], k3.target[c], u);
+    }
+}
+
+
+void Benchmark::beginFrame() {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    framestart = seconds();
+    glBeginQuery(GL_PRIMITIVES_GENERATED, trianglequery);
+}
+
+
+void Benchmark::endFrame() {
+
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+    glFinish(); // Count the frame's GPU work in its own time
+    double milliseconds = 1000.0 * (seconds() - framestart);
+
+    GLuint count = 0;
+    glGetQueryObjectuiv(trianglequery, GL_QUERY_RESULT, &count);
+    if(frame >= WARMUP) {
+        frametimes.push_back(milliseconds);
+        triangles.push_back((double)count);
+    }
+    if(frame == totalFrames() - 1) imagehash = hashImage();
+    frame++;
+}
+
+
+bool Benchmark::writeResults(const char *filename) const {
+
+    FILE *file = fopen(filename, "w");
+    if(!file) {
+        Utilities::printError("Benchmark: cannot write results", filename);
+        return false;
+    }
+
+    std::vector<double> times(frametimes);
+    std::sort(times.begin(), times.end());
+    double meantime = 0.0, meantriangles = 0.0;
+    for(size_t i=0; i<times.size(); i++) meantime += times[i];
+    for(size_t i=0; i<triangles.size(); i++) meantriangles += triangles[i];
+    if(!times.empty()) {
+        meantime /= times.size();
+        meantriangles /= triangles.size();
+    }
+    std::vector<double> counts(triangles);
+    std::sort(counts.begin(), counts.end());
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"path\": %s,\n", quote(pathname).c_str());
+    fprintf(file, "  \"renderer\": %s,\n", quote(renderer).c_str());
+    fprintf(file, "  \"frames\": %d,\n  \"warmup\": %d,\n", (int)times.size(), WARMUP);
+    fprintf(file, "  \"width\": %d,\n  \"height\": %d,\n", framewidth, frameheight);
+    fprintf(file, "  \"frametime\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+        meantime, percentile(times, 0.50), percentile(times, 0.95), percentile(times, 0.99),
+        times.empty() ? 0.0 : times.back());
+    fprintf(file, "  \"triangles\": {\"mean\": %.1f, \"min\": %.0f, \"max\": %.0f},\n",
+        meantriangles, counts.empty() ? 0.0 : counts.front(), counts.empty() ? 0.0 : counts.back());
+    fprintf(file, "  \"imagehash\": \"%016llx\",\n", imagehash);
+    fprintf(file, "  \"passes\": ");
+#ifdef PROFILER
+    Profiler::global().writeSummary(file);
+#else
+    fprintf(file, "null");
+#endif
+    fprintf(file, "\n}\n");
+
+    bool ok = !ferror(file);
+    fclose(file);
+    if(ok) {
+        printf("Benchmark: %.3f ms/frame median, %.3f ms p99, %.0f triangles/frame, image %016llx\n",
+            percentile(times, 0.50), percentile(times, 0.99), meantriangles, imagehash);
+        printf("Benchmark: wrote %s\n", filename);
+    }
+    return ok;
+}
+
+
+/* private: warmup, then the frames asked for or the length of the path */
+int Benchmark::totalFrames() const {
+    int measured = frames;
+    if(measured <= 0) {
+        double length = keys.size() > 1 ? keys.back().time - keys[0].time : 0.0;
+        measured = std::max(1, (int)(length * FRAMERATE) + 1);
+    }
+    return WARMUP + measured;
+}
+
+
+/*
+ * private
+ * hashImage() - FNV-1a hash of the framebuffer, to check that two runs
+ * (or two versions of a shader) drew the same image.
+ */
+unsigned long long Benchmark::hashImage() const {
+
+    std::vector<unsigned char> pixels(4 * framewidth * frameheight);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, framewidth, frameheight, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    unsigned long long hash = 14695981039346656037ULL;
+    for(size_t i=0; i<pixels.size(); i++) {
+        hash = (hash ^ pixels[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
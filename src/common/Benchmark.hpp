@@ -0,0 +1,128 @@
+/* Benchmark.hpp */
+/*
+ * Headless, repeatable benchmark runs (main.cpp --bench). The scene is
+ * drawn into an offscreen framebuffer of a fixed size, with no window
+ * on screen. With GLFW 3.4 or later no display is needed at all: GLFW's
+ * null platform is used with an EGL (or OSMesa) context, so a software
+ * OpenGL like Mesa's llvmpipe works on a build server. Older GLFW
+ * versions need a display, e.g. Xvfb.
+ * Time is virtual: measured frame n is drawn at time n / FRAMERATE no
+ * matter how long it took, and the camera follows a path loaded from a file, so
+ * every run draws exactly the same frames.
+ * Each frame is finished (glFinish()) before the next one starts, and
+ * its wall clock time and triangle count are recorded. writeResults()
+ * writes frame time percentiles, triangle counts, the per-pass times of
+ * Profiler.hpp (when built with -DPROFILER) and a hash of the last image
+ * as JSON, to compare shader and mesh changes between runs.
+ */
+/* Camera path files have one key per line: "time  px py pz  tx ty tz",
+ * time in seconds, then the camera position and the point it looks at.
+ * Lines starting with # are comments. Positions between keys are
+ * interpolated with Catmull-Rom splines. See paths/flyover.txt. */
+
+#ifndef BENCHMARK_HPP // Avoid including this header twice
+#define BENCHMARK_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <string>
+#include <vector>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+
+class Benchmark {
+
+public:
+
+/* Frames per second of virtual time */
+static const int FRAMERATE = 60;
+
+/* Frames drawn before the measurements start, for shader compilation and first use */
+static const int WARMUP = 10;
+
+/* Constructor: no path, 800x600. No OpenGL calls are made here. */
+Benchmark();
+
+/* Destructor: delete the framebuffer */
+~Benchmark();
+
+/* Load a camera path. Returns false (and prints why) if it cannot be read. */
+bool loadPath(const char *filename);
+
+/* Frames to measure after the warmup. 0 (the default) means the length of the path. */
+void setFrames(int frames);
+
+/* Size of the offscreen framebuffer */
+void setSize(int width, int height);
+int width() const;
+int height() const;
+
+/*
+ * initHeadless() - call before glfwInit(). Selects GLFW's null platform
+ * if this GLFW has one, so that no display is needed.
+ */
+static void initHeadless();
+
+/*
+ * createWindow() - an invisible window with an OpenGL 3.3 core context,
+ * from EGL if possible and OSMesa otherwise. Returns NULL on failure.
+ */
+GLFWwindow *createWindow();
+
+/* Create the framebuffer. Call with the context current. */
+void begin();
+
+/* True until all frames have been drawn */
+bool running() const;
+
+/* Virtual time of the current frame, in seconds */
+double time() const;
+
+/* Camera position and target for the current frame */
+void camera(float *position, float *target) const;
+
+/*
+ * Frame boundaries: beginFrame() binds the framebuffer and starts the
+ * measurements, endFrame() waits for the GPU and records the frame.
+ */
+void beginFrame();
+void endFrame();
+
+/* Write the results as JSON. Returns false on failure. */
+bool writeResults(const char *filename) const;
+
+private:
+
+struct Key {
+    double time;
+    float position[3], target[3];
+};
+
+std::vector<Key> keys;
+std::string pathname;
+int frames;             // Measured frames, 0 for the length of the path
+int framewidth, frameheight;
+int frame;              // Current frame, counting the warmup
+
+GLuint framebuffer, colorbuffer, depthbuffer;
+GLuint trianglequery;
+double framestart;
+
+std::vector<double> frametimes; // Milliseconds, measured frames only
+std::vector<double> triangles;
+unsigned long long imagehash;
+std::string renderer;           // GL_RENDERER, to tell runs on different drivers apart
+
+int totalFrames() const;
+unsigned long long hashImage() const;
+
+Benchmark(const Benchmark&);            // Not copyable
+Benchmark &operator=(const Benchmark&);
+
+};
+
+#endif // BENCHMARK_HPP
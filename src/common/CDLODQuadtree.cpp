@@ -0,0 +1,206 @@
+#include "CDLODQuadtree.hpp"
+
+#include <cmath>
+
+namespace {
+
+/* Morphing to the next level starts this far into a level's range */
+const float MORPHSTART = 0.66f;
+
+/* Steps of the detail scale when adapting to the triangle budget */
+const float SCALEDOWN = 0.8f;
+const float SCALEUP = 1.02f;
+
+}
+
+
+CDLODQuadtree::CDLODQuadtree(float leafsize, int levels, int griddim, float minheight, float maxheight) {
+
+    this->leafsize = leafsize;
+    numlevels = levels < 1 ? 1 : (levels > MAXLEVELS ? MAXLEVELS : levels);
+    this->griddim = (griddim < 2) ? 2 : griddim & ~1; // Even, so that quadrants are whole
+    this->minheight = minheight;
+    this->maxheight = maxheight;
+    detail = 4.0f * leafsize;
+    scale = 1.0f;
+    budget = 0;
+    ntriangles = 0;
+    for(int k=0; k<3; k++) camera[k] = 0.0f;
+    setRanges(detail);
+}
+
+
+void CDLODQuadtree::setDetail(float range0) {
+    detail = (range0 < minDetail()) ? minDetail() : range0;
+    scale = 1.0f;
+}
+
+
+void CDLODQuadtree::setTriangleBudget(int triangles) {
+    budget = triangles;
+}
+
+
+int CDLODQuadtree::select(const float *viewproj, const float *campos) {
+
+    frustum.set(viewproj);
+    for(int k=0; k<3; k++) camera[k] = campos[k];
+
+    // Start a little above last frame's detail, and lower it while the
+    // selection is over budget (but never below what is crack free)
+    if(budget > 0) {
+        scale *= SCALEUP;
+        if(scale > 1.0f) scale = 1.0f;
+    }
+    for(;;) {
+        setRanges(detail * scale);
+        selectAll();
+        if(budget <= 0 || ntriangles <= budget || detail * scale <= minDetail()) break;
+        scale *= SCALEDOWN;
+        if(detail * scale < minDetail()) scale = minDetail() / detail;
+    }
+    return ntriangles;
+}
+
+
+const std::vector<CDLODNode> &CDLODQuadtree::nodes() const {
+    return selection;
+}
+
+
+int CDLODQuadtree::triangles() const {
+    return ntriangles;
+}
+
+
+float CDLODQuadtree::range(int lod) const {
+    return ranges[lod];
+}
+
+
+float CDLODQuadtree::morphStart(int lod) const {
+    float previous = (lod > 0) ? ranges[lod-1] : 0.0f;
+    return previous + MORPHSTART * (ranges[lod] - previous);
+}
+
+
+int CDLODQuadtree::levels() const {
+    return numlevels;
+}
+
+
+int CDLODQuadtree::gridDim() const {
+    return griddim;
+}
+
+
+/*
+ * A level 'lod' node can border a level lod-1 node whose far corner is
+ * a node diagonal outside range(lod-1). The level 'lod' vertices there
+ * must not have started morphing yet, so the morph start of each level
+ * has to be at least one diagonal of the finer level past its range:
+ * MORPHSTART * range0 * 2^(lod-1) >= sqrt(2) * leafsize * 2^(lod-1).
+ */
+float CDLODQuadtree::minDetail() const {
+    return 1.5f * sqrtf(2.0f) * leafsize / MORPHSTART;
+}
+
+
+float CDLODQuadtree::detailScale() const {
+    return scale;
+}
+
+
+/*
+ * private
+ * setRanges() - level 0 reaches range0, every level after that twice as far.
+ */
+void CDLODQuadtree::setRanges(float range0) {
+    for(int lod=0; lod<numlevels; lod++) {
+        ranges[lod] = range0 * (float)(1 << lod);
+    }
+}
+
+
+/*
+ * private
+ * selectAll() - run the selection from every root node within the view
+ * distance. The roots tile the world, so the terrain has no edge.
+ */
+void CDLODQuadtree::selectAll() {
+
+    selection.clear();
+    ntriangles = 0;
+
+    int top = numlevels - 1;
+    float rootsize = leafsize * (float)(1 << top);
+    float reach = ranges[top];
+    int x0 = (int)floorf((camera[0] - reach) / rootsize);
+    int x1 = (int)floorf((camera[0] + reach) / rootsize);
+    int z0 = (int)floorf((camera[2] - reach) / rootsize);
+    int z1 = (int)floorf((camera[2] + reach) / rootsize);
+    for(int iz=z0; iz<=z1; iz++) {
+        for(int ix=x0; ix<=x1; ix++) {
+            selectNode(ix * rootsize, iz * rootsize, rootsize, top);
+        }
+    }
+}
+
+
+/*
+ * private
+ * selectNode() - Strugar's recursive selection. Returns false if the
+ * node is out of range of its level, so that the parent has to cover
+ * the area itself. A node that is only outside the frustum counts as
+ * handled.
+ */
+bool CDLODQuadtree::selectNode(float x, float z, float size, int lod) {
+
+    if(!inRange(x, z, size, ranges[lod])) return false;
+    if(!inFrustum(x, z, size)) return true;
+
+    if(lod == 0 || !inRange(x, z, size, ranges[lod-1])) {
+        add(x, z, size, lod, 15); // The whole node at this level
+        return true;
+    }
+
+    // Let the children take what is within their range, and draw the rest
+    float half = 0.5f * size;
+    int quadrants = 0;
+    for(int q=0; q<4; q++) {
+        float cx = x + ((q & 1) ? half : 0.0f);
+        float cz = z + ((q & 2) ? half : 0.0f);
+        if(!selectNode(cx, cz, half, lod-1)) quadrants |= 1 << q;
+    }
+    if(quadrants) add(x, z, size, lod, quadrants);
+    return true;
+}
+
+
+/*
+ * private
+ * inFrustum() - conservative box test, false only if the node's box is
+ * entirely outside one of the planes.
+ */
+bool CDLODQuadtree::inFrustum(float x, float z, float size) const {
+    float min[3] = { x, minheight, z }, max[3] = { x + size, maxheight, z + size };
+    return frustum.boxVisible(min, max);
+}
+
+
+/* private: true if the node's box comes within 'range' of the camera */
+bool CDLODQuadtree::inRange(float x, float z, float size, float range) const {
+    float dx = (camera[0] < x) ? x - camera[0] : (camera[0] > x + size ? camera[0] - x - size : 0.0f);
+    float dy = (camera[1] < minheight) ? minheight - camera[1] : (camera[1] > maxheight ? camera[1] - maxheight : 0.0f);
+    float dz = (camera[2] < z) ? z - camera[2] : (camera[2] > z + size ? camera[2] - z - size : 0.0f);
+    return dx*dx + dy*dy + dz*dz <= range*range;
+}
+
+
+void CDLODQuadtree::add(float x, float z, float size, int lod, int quadrants) {
+    CDLODNode node = { x, z, size, lod, quadrants };
+    selection.push_back(node);
+    // Two triangles per quad, a quarter of the patch per quadrant
+    int bits = (quadrants & 1) + ((quadrants >> 1) & 1) + ((quadrants >> 2) & 1) + ((quadrants >> 3) & 1);
+    ntriangles += bits * griddim * griddim / 2;
+}
@@ -0,0 +1,111 @@
+/* CDLODQuadtree.hpp */
+/*
+ * Node selection for continuous distance-dependent level of detail
+ * terrain (CDLOD, Filip Strugar 2010). The world is covered by an
+ * implicit quadtree: a node at level 'lod' is leafsize * 2^lod wide, and
+ * every node is drawn with the same griddim x griddim patch of quads.
+ * Level 'lod' is used out to range(lod) from the camera, and the ranges
+ * double per level, so the triangle density falls off with distance.
+ * The vertex shader morphs each level into the next one over the last
+ * part of its range (morphStart() to range()), so there is no popping
+ * and no cracks between levels.
+ * This part has no OpenGL calls. CDLODTerrain draws the selection.
+ */
+/* Usage: call select() once per frame with the view-projection matrix
+ * and the camera position. nodes() is then the list of patches to draw.
+ * A node that is only partly covered by its children is drawn as the
+ * quadrants in its 'quadrants' bit mask. */
+
+#ifndef CDLODQUADTREE_HPP // Avoid including this header twice
+#define CDLODQUADTREE_HPP
+
+#include <vector>
+
+#include "Frustum.hpp"
+
+/* One selected patch */
+struct CDLODNode {
+    float x, z;    // Corner with the smallest x and z
+    float size;    // Width in world units
+    int lod;       // Level, 0 is the finest
+    int quadrants; // Bit 0: -x-z, 1: +x-z, 2: -x+z, 3: +x+z. 15 is the whole node.
+};
+
+class CDLODQuadtree {
+
+public:
+
+/* Most levels supported, also the size of the shader's morph constant array */
+static const int MAXLEVELS = 16;
+
+/*
+ * Constructor: finest nodes of leafsize x leafsize world units,
+ * 'levels' levels and patches of griddim x griddim quads (even).
+ * Heights are assumed to lie in [minheight, maxheight].
+ */
+CDLODQuadtree(float leafsize, int levels, int griddim, float minheight, float maxheight);
+
+/*
+ * setDetail() - the range of level 0. The view distance is
+ * range0 * 2^(levels-1). Values below minDetail() are raised to it.
+ */
+void setDetail(float range0);
+
+/*
+ * setTriangleBudget() - largest number of triangles to select.
+ * select() lowers the detail (and with it the view distance) when the
+ * budget is exceeded, and raises it slowly again when there is room.
+ * 0 means no limit.
+ */
+void setTriangleBudget(int triangles);
+
+/*
+ * select() - choose the nodes to draw. 'viewproj' is a column-major
+ * 4x4 matrix (as in OpenGL and glm), 'campos' the camera position.
+ * Returns the number of triangles selected.
+ */
+int select(const float *viewproj, const float *campos);
+
+/* Result of the last select() */
+const std::vector<CDLODNode> &nodes() const;
+int triangles() const;
+
+/* Ranges used by the last select(), for the morph constants in the shader */
+float range(int lod) const;
+float morphStart(int lod) const;
+
+int levels() const;
+int gridDim() const;
+
+/* The smallest range0 that keeps the morph regions crack free */
+float minDetail() const;
+
+/* Current detail as a fraction of the one set by setDetail() */
+float detailScale() const;
+
+private:
+
+float leafsize;
+int numlevels;
+int griddim;
+float minheight, maxheight;
+float detail;       // range0 from setDetail()
+float scale;        // Applied to 'detail' to meet the budget
+int budget;
+
+float ranges[MAXLEVELS];
+Frustum frustum;
+float camera[3];
+std::vector<CDLODNode> selection;
+int ntriangles;
+
+void setRanges(float range0);
+void selectAll();
+bool selectNode(float x, float z, float size, int lod);
+bool inFrustum(float x, float z, float size) const;
+bool inRange(float x, float z, float size, float range) const;
+void add(float x, float z, float size, int lod, int quadrants);
+
+};
+
+#endif // CDLODQUADTREE_HPP
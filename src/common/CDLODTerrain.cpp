@@ -0,0 +1,387 @@
+#include "CDLODTerrain.hpp"
+#include "TerrainHeight.hpp"
+#include "SimplexNoise.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/* Height layers made at first; the texture doubles when a frame needs more */
+const int INITIALLAYERS = 256;
+
+/* A node's place in the quadtree: nodes are aligned to their own size */
+unsigned long long nodeKey(const CDLODNode &node) {
+    long long ix = (long long)floorf(node.x / node.size + 0.5f);
+    long long iz = (long long)floorf(node.z / node.size + 0.5f);
+    return ((unsigned long long)node.lod << 58)
+         | ((unsigned long long)(ix & 0x1fffffff) << 29)
+         | (unsigned long long)(iz & 0x1fffffff);
+}
+
+}
+
+CDLODTerrain::CDLODTerrain(float leafsize, int levels, int griddim)
+    : tree(leafsize, levels, griddim,
+           Terrain::BASEHEIGHT - Terrain::MAXAMPLITUDE,
+           Terrain::BASEHEIGHT + Terrain::MAXAMPLITUDE) {
+
+    vao = 0;
+    vertexbuffer = 0;
+    indexbuffer = 0;
+    instancebuffer = 0;
+    quadrantindices = 0;
+    heighttexture = 0;
+    heightlayers = 0;
+    frame = 0;
+    for(int g=0; g<6; g++) groupstart[g] = 0;
+    uniformprogram = 0;
+    location_morphconsts = location_griddim = location_camerapos = location_heights = -1;
+    camerapos[0] = camerapos[1] = camerapos[2] = 0.0f;
+}
+
+
+CDLODTerrain::~CDLODTerrain() {
+    if(vao) glDeleteVertexArrays(1, &vao);
+    if(vertexbuffer) glDeleteBuffers(1, &vertexbuffer);
+    if(indexbuffer) glDeleteBuffers(1, &indexbuffer);
+    if(instancebuffer) glDeleteBuffers(1, &instancebuffer);
+    if(heighttexture) glDeleteTextures(1, &heighttexture);
+}
+
+
+void CDLODTerrain::setDetail(float range0) {
+    tree.setDetail(range0);
+}
+
+
+void CDLODTerrain::setTriangleBudget(int triangles) {
+    tree.setTriangleBudget(triangles);
+}
+
+
+int CDLODTerrain::update(const float *viewproj, const float *campos) {
+
+    int triangles = tree.select(viewproj, campos);
+    for(int k=0; k<3; k++) camerapos[k] = campos[k];
+    frame++;
+
+    // Find the height layer of every node. If the layers run out, grow
+    // the texture (which forgets all heights) and start over.
+    if(!heighttexture) createHeights(INITIALLAYERS);
+    std::vector<int> layers, missing;
+    if(assignLayers(layers, missing) > 0) {
+        GLint maxlayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxlayers);
+        if(heightlayers < maxlayers) {
+            createHeights(std::min(2*heightlayers, (int)maxlayers));
+            assignLayers(layers, missing);
+        }
+    }
+    generateHeights(layers, missing);
+
+    // Sort the instances into the five draw calls: whole nodes, then
+    // the nodes that draw quadrant 0, 1, 2 and 3. Nodes that found no
+    // layer are left out.
+    const std::vector<CDLODNode> &nodes = tree.nodes();
+    instances.clear();
+    for(int group=0; group<5; group++) {
+        groupstart[group] = (int)instances.size() / 5;
+        for(size_t i=0; i<nodes.size(); i++) {
+            bool whole = (nodes[i].quadrants == 15);
+            if(group == 0 ? !whole : (whole || !(nodes[i].quadrants & (1 << (group-1))))) continue;
+            if(layers[i] < 0) continue;
+            instances.push_back(nodes[i].x);
+            instances.push_back(nodes[i].z);
+            instances.push_back(nodes[i].size);
+            instances.push_back((float)nodes[i].lod);
+            instances.push_back((float)layers[i]);
+        }
+    }
+    groupstart[5] = (int)instances.size() / 5;
+    return triangles;
+}
+
+
+void CDLODTerrain::render() {
+
+    if(!vao) createBuffers();
+    if(instances.empty()) return;
+    uploadInstances();
+
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    setUniforms(program);
+
+    glBindVertexArray(vao);
+    for(int group=0; group<5; group++) {
+        int count = groupstart[group+1] - groupstart[group];
+        if(count == 0) continue;
+        setInstanceGroup(group);
+        int first = (group == 0) ? 0 : (group-1)*quadrantindices;
+        int nindices = (group == 0) ? 4*quadrantindices : quadrantindices;
+        glDrawElementsInstanced(GL_TRIANGLES, nindices, GL_UNSIGNED_SHORT,
+            (void*)(first*sizeof(GLushort)), count);
+    }
+    glBindVertexArray(0);
+}
+
+
+void CDLODTerrain::submit(RenderQueue &queue, GLuint program, const char *name) {
+
+    if(!vao) createBuffers();
+    if(instances.empty()) return;
+    uploadInstances();
+
+    for(int group=0; group<5; group++) {
+        DrawPacket packet;
+        packet.program = program;
+        packet.vao = vao;
+        packet.firstindex = (group == 0) ? 0 : (group-1)*quadrantindices;
+        packet.count = (group == 0) ? 4*quadrantindices : quadrantindices;
+        packet.indextype = GL_UNSIGNED_SHORT;
+        packet.instances = groupstart[group+1] - groupstart[group];
+        packet.name = name;
+        packet.prepare = prepareGroup;
+        packet.owner = this;
+        packet.item = group;
+        queue.submit(packet); // Groups without instances are dropped
+    }
+}
+
+
+const CDLODQuadtree &CDLODTerrain::quadtree() const {
+    return tree;
+}
+
+
+/*
+ * private
+ * createBuffers() - the grid patch and the VAO. The patch triangles
+ * are grouped by quadrant, in the bit order of CDLODNode::quadrants, so
+ * one quadrant is a contiguous range and the whole patch is all four.
+ */
+void CDLODTerrain::createBuffers() {
+
+    int n = tree.gridDim(), half = n / 2, stride = n + 1;
+
+    std::vector<GLfloat> vertices;
+    for(int j=0; j<=n; j++) {
+        for(int i=0; i<=n; i++) {
+            vertices.push_back((float)i / n);
+            vertices.push_back((float)j / n);
+        }
+    }
+
+    std::vector<GLushort> indices;
+    for(int q=0; q<4; q++) {
+        int i0 = (q & 1) ? half : 0, j0 = (q & 2) ? half : 0;
+        for(int j=j0; j<j0+half; j++) {
+            for(int i=i0; i<i0+half; i++) {
+                GLushort a = j*stride + i, b = a + 1, c = a + stride, d = c + 1;
+                indices.push_back(a); indices.push_back(c); indices.push_back(b);
+                indices.push_back(b); indices.push_back(c); indices.push_back(d);
+            }
+        }
+    }
+    quadrantindices = (int)indices.size() / 4;
+
+    // Generate one vertex array object (VAO) and bind it
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vertexbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0); // Patch position in [0,1]
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2*sizeof(GLfloat), (void*)0);
+
+    glGenBuffers(1, &instancebuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+    glEnableVertexAttribArray(3); // Node x, z, size and level, one per instance
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 5*sizeof(GLfloat), (void*)0);
+    glVertexAttribDivisor(3, 1);
+    glEnableVertexAttribArray(4); // Height layer of the node
+    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, 5*sizeof(GLfloat), (void*)(4*sizeof(GLfloat)));
+    glVertexAttribDivisor(4, 1);
+
+    glGenBuffers(1, &indexbuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+
+    // Do NOT unbind the index buffer while the VAO is still bound
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+
+/*
+ * private
+ * createHeights() - an empty height texture of 'layers' layers of
+ * (griddim+1)^2 texels. Any heights in the old texture are forgotten.
+ */
+void CDLODTerrain::createHeights(int layers) {
+
+    int stride = tree.gridDim() + 1;
+    if(heighttexture) glDeleteTextures(1, &heighttexture);
+    glGenTextures(1, &heighttexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heighttexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB32F, stride, stride, layers, 0, GL_RGB, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    heightlayers = layers;
+    layerof.clear();
+    layerkey.assign(layers, 0);
+    layerframe.assign(layers, -1);
+}
+
+
+/*
+ * private
+ * assignLayers() - the height layer of each selected node, or -1.
+ * Nodes that are new get the least recently selected layer, and are
+ * listed in 'missing' to have their heights computed. Layers selected
+ * this frame are never taken. Returns the number of nodes left without.
+ */
+int CDLODTerrain::assignLayers(std::vector<int> &layers, std::vector<int> &missing) {
+
+    const std::vector<CDLODNode> &nodes = tree.nodes();
+    layers.assign(nodes.size(), -1);
+    missing.clear();
+    int without = 0;
+    for(size_t i=0; i<nodes.size(); i++) {
+        unsigned long long key = nodeKey(nodes[i]);
+        std::unordered_map<unsigned long long, int>::iterator found = layerof.find(key);
+        if(found != layerof.end()) {
+            layers[i] = found->second;
+            layerframe[found->second] = frame;
+            continue;
+        }
+        int oldest = 0;
+        for(int l=1; l<heightlayers; l++)
+            if(layerframe[l] < layerframe[oldest]) oldest = l;
+        if(layerframe[oldest] == frame) {
+            without++;
+            continue;
+        }
+        if(layerframe[oldest] >= 0) layerof.erase(layerkey[oldest]);
+        layerof[key] = oldest;
+        layerkey[oldest] = key;
+        layerframe[oldest] = frame;
+        layers[i] = oldest;
+        missing.push_back((int)i);
+    }
+    return without;
+}
+
+
+/*
+ * private
+ * generateHeights() - compute the heights and slopes at the patch
+ * vertices of the 'missing' nodes on all workers, then upload them to
+ * the nodes' layers. The vertices are placed as in the vertex shader.
+ */
+void CDLODTerrain::generateHeights(const std::vector<int> &layers, const std::vector<int> &missing) {
+
+    if(missing.empty()) return;
+    const std::vector<CDLODNode> &nodes = tree.nodes();
+    int n = tree.gridDim(), stride = n + 1, texels = stride * stride;
+    std::vector<GLfloat> heights(missing.size() * texels * 3);
+    Noise::getKernel(); // Pick the kernel before the workers need it
+    ThreadPool::global().parallelFor((int)missing.size(), [&](int m) {
+        const CDLODNode &node = nodes[missing[m]];
+        std::vector<float> x(texels), z(texels), h(texels), dhdx(texels), dhdz(texels);
+        for(int j=0; j<stride; j++) {
+            for(int i=0; i<stride; i++) {
+                x[j*stride + i] = node.x + (float)i / n * node.size;
+                z[j*stride + i] = node.z + (float)j / n * node.size;
+            }
+        }
+        Terrain::heights(&x[0], &z[0], &h[0], &dhdx[0], &dhdz[0], texels);
+        GLfloat *texel = &heights[(size_t)m * texels * 3];
+        for(int t=0; t<texels; t++) {
+            texel[3*t] = h[t];
+            texel[3*t+1] = dhdx[t];
+            texel[3*t+2] = dhdz[t];
+        }
+    });
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heighttexture);
+    for(size_t m=0; m<missing.size(); m++) {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layers[missing[m]], stride, stride, 1,
+            GL_RGB, GL_FLOAT, &heights[m * texels * 3]);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+
+/*
+ * private
+ * uploadInstances() - stream this frame's instances. Orphaning the old
+ * storage first means the driver never has to wait for the previous frame.
+ */
+void CDLODTerrain::uploadInstances() {
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size()*sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size()*sizeof(GLfloat), &instances[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/*
+ * private
+ * setUniforms() - morph constants: level 'lod' morphs from morphStart()
+ * to range(), as k = clamp(dist * y - x + 1, 0, 1) with y = 1/(end-start),
+ * x = end*y. 'program' must be in use.
+ */
+void CDLODTerrain::setUniforms(GLuint program) {
+    if(program != uniformprogram) {
+        uniformprogram = program;
+        location_morphconsts = glGetUniformLocation(program, "morphConsts");
+        location_griddim = glGetUniformLocation(program, "gridDim");
+        location_camerapos = glGetUniformLocation(program, "cameraPos");
+        location_heights = glGetUniformLocation(program, "nodeHeights");
+    }
+    GLfloat morphconsts[2*CDLODQuadtree::MAXLEVELS];
+    for(int lod=0; lod<tree.levels(); lod++) {
+        float start = tree.morphStart(lod), end = tree.range(lod);
+        morphconsts[2*lod+1] = 1.0f / (end - start);
+        morphconsts[2*lod] = end * morphconsts[2*lod+1];
+    }
+    glUniform2fv(location_morphconsts, tree.levels(), morphconsts);
+    glUniform1f(location_griddim, (float)tree.gridDim());
+    glUniform3fv(location_camerapos, 1, camerapos);
+    glActiveTexture(GL_TEXTURE0 + HEIGHT_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heighttexture);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(location_heights, HEIGHT_UNIT);
+}
+
+
+/*
+ * private
+ * setInstanceGroup() - OpenGL 3.3 has no base instance, so point the
+ * instance attributes of the bound VAO at the group instead.
+ */
+void CDLODTerrain::setInstanceGroup(int group) {
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 5*sizeof(GLfloat),
+        (void*)(groupstart[group]*5*sizeof(GLfloat)));
+    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, 5*sizeof(GLfloat),
+        (void*)((groupstart[group]*5 + 4)*sizeof(GLfloat)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/* private: DrawPacket::prepare for submit() */
+void CDLODTerrain::prepareGroup(void *owner, int item, GLuint program) {
+    CDLODTerrain *terrain = (CDLODTerrain*)owner;
+    terrain->setUniforms(program);
+    terrain->setInstanceGroup(item);
+}
@@ -0,0 +1,105 @@
+/* CDLODTerrain.hpp */
+/*
+ * Draws the terrain of TerrainHeight.hpp with continuous level of
+ * detail. The nodes picked by CDLODQuadtree are drawn as instances of
+ * one shared grid patch, with one glDrawElementsInstanced() call for
+ * the whole nodes and one for each quadrant. The vertex shader
+ * (cdlodTerrainVert.glsl) places and morphs the patch vertices and
+ * filters their heights and slopes from a per-node height texture.
+ * A node's layer of that texture is computed once on the ThreadPool
+ * with Terrain::heights(), when the node is first selected, and kept
+ * until the layer is needed for another node. Most frames select the
+ * same nodes as the last one, so the noise is hardly ever evaluated.
+ */
+/* Usage: call update() once per frame with the view-projection matrix
+ * and the camera position, then render() with the CDLOD shader in use,
+ * or submit() the draws to a RenderQueue. update() makes the height
+ * texture, so the OpenGL context must be current. */
+
+#ifndef CDLODTERRAIN_HPP // Avoid including this header twice
+#define CDLODTERRAIN_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <vector>
+#include <unordered_map>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "CDLODQuadtree.hpp"
+#include "RenderQueue.hpp"
+
+class CDLODTerrain {
+
+public:
+
+/* The texture unit of the node heights while drawing */
+static const int HEIGHT_UNIT = 12;
+
+/* Constructor: see CDLODQuadtree. No OpenGL calls are made here. */
+CDLODTerrain(float leafsize = 2.0f, int levels = 8, int griddim = 32);
+
+/* Destructor: delete the OpenGL objects */
+~CDLODTerrain();
+
+/* Level 0 range and triangle budget, see CDLODQuadtree */
+void setDetail(float range0);
+void setTriangleBudget(int triangles);
+
+/*
+ * Select the nodes for this frame and compute the heights of the nodes
+ * that are not in the height texture yet. Returns the number of triangles.
+ */
+int update(const float *viewproj, const float *campos);
+
+/* Draw the selected nodes */
+void render();
+
+/* Submit the five draws of the selected nodes as opaque packets */
+void submit(RenderQueue &queue, GLuint program, const char *name = NULL);
+
+/* The selection, for statistics */
+const CDLODQuadtree &quadtree() const;
+
+private:
+
+CDLODQuadtree tree;
+
+GLuint vao;
+GLuint vertexbuffer;   // Patch vertices, (griddim+1)^2 vec2 in [0,1]
+GLuint indexbuffer;    // Patch triangles, grouped by quadrant
+GLuint instancebuffer; // Per node and draw: x, z, size, lod and height layer
+int quadrantindices;   // Indices per quadrant
+
+GLuint heighttexture;  // Height, dh/dx and dh/dz at the patch vertices, one layer per node
+int heightlayers;      // Layers in heighttexture
+std::unordered_map<unsigned long long, int> layerof; // Node key -> layer
+std::vector<unsigned long long> layerkey;           // Node key of each layer
+std::vector<int> layerframe;                        // Frame each layer was last selected, -1 if unused
+int frame;
+
+std::vector<GLfloat> instances; // Whole nodes first, then the nodes of each quadrant
+int groupstart[6];              // Instance ranges of the five draw calls
+
+GLuint uniformprogram; // Program the uniform locations below belong to
+GLint location_morphconsts, location_griddim, location_camerapos, location_heights;
+float camerapos[3];
+
+void createBuffers();
+void createHeights(int layers);
+int assignLayers(std::vector<int> &layers, std::vector<int> &missing);
+void generateHeights(const std::vector<int> &layers, const std::vector<int> &missing);
+void uploadInstances();
+void setUniforms(GLuint program);
+void setInstanceGroup(int group);
+static void prepareGroup(void *owner, int item, GLuint program);
+
+CDLODTerrain(const CDLODTerrain&);            // Not copyable
+CDLODTerrain &operator=(const CDLODTerrain&);
+
+};
+
+#endif // CDLODTERRAIN_HPP
@@ -0,0 +1,119 @@
+#include "CloudLayer.hpp"
+
+#include "glm/gtc/type_ptr.hpp"
+
+namespace {
+
+/* The pixel of each 2x2 block sampled into each layer, the diagonal
+ * first so that two frames already cover the block evenly. The same
+ * table is in shaders/cloudCompositeFrag.glsl. */
+const int SAMPLES[CloudLayer::FRAMES][2] = { {0, 0}, {1, 1}, {1, 0}, {0, 1} };
+
+}
+
+
+CloudLayer::CloudLayer() {
+    frame = 0;
+    framewidth = frameheight = 0;
+    viewprojection = glm::mat4(1.0f);
+    for(int l=0; l<FRAMES; l++) {
+        layerviewprojection[l] = glm::mat4(1.0f);
+        layervalid[l] = 0.0f;
+    }
+    uniformprogram = 0;
+    location_samples = location_matrices = location_valid = location_frame = -1;
+    meshprepare = NULL;
+    meshowner = NULL;
+}
+
+
+void CloudLayer::beginFrame(int width, int height, const glm::mat4 &viewProjection) {
+    framewidth = width;
+    frameheight = height;
+    viewprojection = viewProjection;
+    frame++;
+    if(samples.resize((width + 1) / 2, (height + 1) / 2, GL_RGBA8, FRAMES)) {
+        for(int l=0; l<FRAMES; l++) layervalid[l] = 0.0f;
+    }
+}
+
+
+/*
+ * jitter() - in pixels, sample i of a row lands on screen pixel 2i + s.
+ * In normalized device coordinates that is a scale of w / 2sw, which is
+ * 1 unless the width w is odd (sw is the sample width), and a shift.
+ */
+glm::mat4 CloudLayer::jitter() const {
+    int sx = SAMPLES[layer()][0], sy = SAMPLES[layer()][1];
+    int sw = samples.width(), sh = samples.height();
+    float ax = (float)framewidth / (2 * sw), ay = (float)frameheight / (2 * sh);
+    glm::mat4 m(1.0f);
+    m[0][0] = ax;
+    m[1][1] = ay;
+    m[3][0] = ax - 1.0f + (0.5f - sx) / sw;
+    m[3][1] = ay - 1.0f + (0.5f - sy) / sh;
+    return m;
+}
+
+
+void CloudLayer::render(DrawPacket clouds, FrameUniforms &uniforms) {
+
+    // Keep the state of the caller
+    GLint oldframebuffer = 0, viewport[4];
+    GLfloat clearcolor[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oldframebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearcolor);
+
+    // The samples replace the pixels: the blending is left to the composite
+    clouds.blend = false;
+    clouds.depthwrite = true;
+    samples.bind(layer());
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    queue.submit(clouds);
+    queue.flush(uniforms);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, oldframebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clearcolor[0], clearcolor[1], clearcolor[2], clearcolor[3]);
+
+    layerviewprojection[layer()] = viewprojection;
+    layervalid[layer()] = 1.0f;
+}
+
+
+void CloudLayer::attach(DrawPacket &packet) {
+    if(packet.count == 0) return; // No mesh
+    meshprepare = packet.prepare;
+    meshowner = packet.owner;
+    packet.prepare = prepareComposite;
+    packet.owner = this;
+}
+
+
+/* private: this frame's layer */
+int CloudLayer::layer() const {
+    return frame % FRAMES;
+}
+
+
+/* private: DrawPacket::prepare for attach() */
+void CloudLayer::prepareComposite(void *owner, int item, GLuint program) {
+    CloudLayer *clouds = (CloudLayer*)owner;
+    if(program != clouds->uniformprogram) {
+        clouds->uniformprogram = program;
+        clouds->location_samples = glGetUniformLocation(program, "cloudSamples");
+        clouds->location_matrices = glGetUniformLocation(program, "cloudViewProjections");
+        clouds->location_valid = glGetUniformLocation(program, "cloudValid");
+        clouds->location_frame = glGetUniformLocation(program, "cloudFrame");
+    }
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, clouds->samples.colorTexture());
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(clouds->location_samples, TEXTURE_UNIT);
+    glUniformMatrix4fv(clouds->location_matrices, FRAMES, GL_FALSE, glm::value_ptr(clouds->layerviewprojection[0]));
+    glUniform4fv(clouds->location_valid, 1, clouds->layervalid);
+    glUniform3f(clouds->location_frame, (float)clouds->framewidth, (float)clouds->frameheight, (float)clouds->layer());
+    if(clouds->meshprepare) clouds->meshprepare(clouds->meshowner, item, program);
+}
@@ -0,0 +1,105 @@
+/* CloudLayer.hpp */
+/*
+ * The cloud sphere at a quarter of the pixels. The clouds surround the
+ * whole scene and are blended over it, so every pixel paid for their
+ * fragment shader. Here they are drawn at half the width and height:
+ * one sample per 2x2 block of screen pixels, and by a jitter of the
+ * projection a different pixel of the block each frame, so the last
+ * four frames together sample every pixel once. Each frame goes to its
+ * own layer of a texture array, with the view-projection it was drawn
+ * with.
+ * The composite draws the cloud mesh at full resolution, blended as
+ * before. Each pixel takes the sample of its own place in the 2x2
+ * block from the frame that drew that place, at the point of the cloud
+ * sphere it sees, reprojected into that frame. A still camera gets
+ * every pixel exact; a moving one, samples from up to three frames
+ * back at the right place on the sphere. Pixels that were off screen
+ * then are interpolated from this frame's samples.
+ * Nothing needs clamping or rejecting as in the usual temporal
+ * reprojection: the clouds are drawn into the layers without the scene
+ * and seen from inside, so no part of them hides another, and they
+ * change far too slowly to show their age. The composite is depth
+ * tested against the scene at full resolution, so the clouds stop
+ * exactly at its edges, which the samples know nothing of.
+ */
+/* Usage, each frame with the cloud shaders ready: beginFrame() with the
+ * frame size and view-projection, add an Object entry with jitter()
+ * times the clouds' MVP, render() a cloud packet that uses it, then
+ * attach() a packet of the cloud mesh drawn with cloudShaderVert.glsl
+ * (CLOUD_COMPOSITE defined) and cloudCompositeFrag.glsl and submit it
+ * where the clouds were. */
+
+#ifndef CLOUDLAYER_HPP // Avoid including this header twice
+#define CLOUDLAYER_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "FrameUniforms.hpp"
+#include "RenderQueue.hpp"
+#include "RenderTarget.hpp"
+#include "glm/glm.hpp"
+
+class CloudLayer {
+
+public:
+
+/* The texture unit of the samples while compositing */
+static const int TEXTURE_UNIT = 11;
+
+/* Frames, and layers, to sample every pixel */
+static const int FRAMES = 4;
+
+/* Constructor: no samples yet. No OpenGL calls are made here. */
+CloudLayer();
+
+/*
+ * beginFrame() - size the samples for a width x height frame, which
+ * drops the old ones if it changed, and pick this frame's pixel of
+ * each 2x2 block. 'viewProjection' is the camera's, without the jitter.
+ */
+void beginFrame(int width, int height, const glm::mat4 &viewProjection);
+
+/* The matrix that moves the clouds' MVP onto this frame's samples */
+glm::mat4 jitter() const;
+
+/*
+ * render() - draw 'clouds' into this frame's layer, unblended. Keeps
+ * the framebuffer, viewport and clear colour of the caller.
+ */
+void render(DrawPacket clouds, FrameUniforms &uniforms);
+
+/*
+ * attach() - bind the samples and set the uniforms of the composite
+ * before 'packet' is drawn, then call the packet's own prepare().
+ */
+void attach(DrawPacket &packet);
+
+private:
+
+RenderTarget samples;
+int frame;                      // Counts beginFrame(); the layer is frame % FRAMES
+int framewidth, frameheight;
+glm::mat4 viewprojection;       // This frame's
+glm::mat4 layerviewprojection[FRAMES];
+float layervalid[FRAMES];       // 1 once drawn at the current size
+RenderQueue queue;
+
+GLuint uniformprogram;          // Program the uniform locations below belong to
+GLint location_samples, location_matrices, location_valid, location_frame;
+void (*meshprepare)(void *owner, int item, GLuint program); // The composite packet's own
+void *meshowner;
+
+int layer() const;
+static void prepareComposite(void *owner, int item, GLuint program);
+
+CloudLayer(const CloudLayer&);            // Not copyable
+CloudLayer &operator=(const CloudLayer&);
+
+};
+
+#endif // CLOUDLAYER_HPP
@@ -0,0 +1,193 @@
+#include "CloudVolume.hpp"
+#include "SimplexNoise.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+/* [-1, 1] to an unsigned byte */
+GLubyte toByte(float v) {
+    return (GLubyte)floorf(127.5f * std::min(1.0f, std::max(-1.0f, v)) + 128.0f);
+}
+
+/* The weight of the far copy in a cross-fade over [0, 1], flat at both ends */
+float fade(float s) {
+    return s * s * (3.0f - 2.0f * s);
+}
+
+}
+
+
+CloudVolume::CloudVolume(int size, float period) {
+    this->size = std::max(4, size);
+    this->period = period > 0.0f ? period : 8.0f;
+    texture = 0;
+    gradientscale = 1.0f;
+    milliseconds = 0.0;
+    uniformprogram = 0;
+    location_volume = location_params = -1;
+    meshprepare = NULL;
+    meshowner = NULL;
+}
+
+
+CloudVolume::~CloudVolume() {
+    if(texture) glDeleteTextures(1, &texture);
+}
+
+
+void CloudVolume::generate() {
+
+    double start = glfwGetTime();
+    size_t slice = (size_t)size * size;
+    std::vector<float> values(slice * size);
+    Noise::getKernel(); // Pick the kernel before the workers need it
+    ThreadPool::global().parallelFor(size, [&](int k) {
+        computeSlice(k, &values[k * slice]);
+    });
+
+    // The gradients once to find the steepest, and again to store them
+    // in 8 bits scaled to fit: cheap to filter and small
+    std::vector<float> steepest(size, 0.0f);
+    ThreadPool::global().parallelFor(size, [&](int k) {
+        float grad[3];
+        for(int j=0; j<size; j++) {
+            for(int i=0; i<size; i++) {
+                gradient(&values[0], i, j, k, grad);
+                steepest[k] = std::max(steepest[k], std::max(fabsf(grad[0]), std::max(fabsf(grad[1]), fabsf(grad[2]))));
+            }
+        }
+    });
+    float largest = *std::max_element(steepest.begin(), steepest.end());
+    gradientscale = (largest > 0.0f) ? largest : 1.0f;
+    std::vector<GLubyte> bytes(values.size() * 4);
+    ThreadPool::global().parallelFor(size, [&](int k) {
+        float grad[3];
+        for(int j=0; j<size; j++) {
+            for(int i=0; i<size; i++) {
+                size_t t = (k * slice + j * size + i) * 4;
+                gradient(&values[0], i, j, k, grad);
+                bytes[t] = toByte(grad[0] / gradientscale);
+                bytes[t+1] = toByte(grad[1] / gradientscale);
+                bytes[t+2] = toByte(grad[2] / gradientscale);
+                bytes[t+3] = toByte(values[t / 4]);
+            }
+        }
+    });
+    milliseconds = 1000.0 * (glfwGetTime() - start);
+
+    if(!texture) glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, size, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, &bytes[0]);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    printf("Cloud volume: %dx%dx%d computed in %.1f ms on %d workers, %.1f MB\n",
+        size, size, size, milliseconds, ThreadPool::global().size(), textureBytes() / 1048576.0);
+}
+
+
+bool CloudVolume::ready() const {
+    return texture != 0;
+}
+
+
+void CloudVolume::attach(DrawPacket &packet) {
+    if(packet.count == 0) return; // No mesh
+    meshprepare = packet.prepare;
+    meshowner = packet.owner;
+    packet.prepare = prepareClouds;
+    packet.owner = this;
+}
+
+
+double CloudVolume::generateTime() const {
+    return milliseconds;
+}
+
+
+/* The volume at 4 bytes per texel */
+long CloudVolume::textureBytes() const {
+    return (long)size * size * size * 4;
+}
+
+
+/*
+ * private
+ * computeSlice() - the noise at every texel of slice k, as a blend of
+ * the eight copies of the noise one period apart. Runs on a worker.
+ */
+void CloudVolume::computeSlice(int slice, float *values) const {
+
+    int n = size * size;
+    float texel = period / size;
+    float wz = fade((float)slice / size);
+    std::vector<float> x(n), y(n), z(n), noise(n), weight2(n, 0.0f);
+    std::fill(values, values + n, 0.0f);
+
+    for(int copy=0; copy<8; copy++) {
+        int a = copy & 1, b = (copy >> 1) & 1, c = (copy >> 2) & 1;
+        for(int j=0; j<size; j++) {
+            for(int i=0; i<size; i++) {
+                x[j*size + i] = i * texel - a * period;
+                y[j*size + i] = j * texel - b * period;
+                z[j*size + i] = slice * texel - c * period;
+            }
+        }
+        Noise::snoiseBatch(&x[0], &y[0], &z[0], &noise[0], n);
+        float weightz = c ? wz : 1.0f - wz;
+        for(int j=0; j<size; j++) {
+            float wy = fade((float)j / size);
+            wy = b ? wy : 1.0f - wy;
+            for(int i=0; i<size; i++) {
+                float wx = fade((float)i / size);
+                wx = a ? wx : 1.0f - wx;
+                float w = wx * wy * weightz;
+                values[j*size + i] += w * noise[j*size + i];
+                weight2[j*size + i] += w * w;
+            }
+        }
+    }
+
+    // Copies of the noise are about independent, so the blend has the
+    // variance of one times the sum of the squared weights
+    for(int t=0; t<n; t++) values[t] /= sqrtf(weight2[t]);
+}
+
+
+/* private: the gradient at texel (i, j, k) by central differences that wrap around */
+void CloudVolume::gradient(const float *values, int i, int j, int k, float *grad) const {
+    size_t slice = (size_t)size * size;
+    float scale = size / (2.0f * period);
+    int i0 = (i + size - 1) % size, i1 = (i + 1) % size;
+    int j0 = (j + size - 1) % size, j1 = (j + 1) % size;
+    int k0 = (k + size - 1) % size, k1 = (k + 1) % size;
+    const float *row = values + k * slice + (size_t)j * size;
+    grad[0] = (row[i1] - row[i0]) * scale;
+    grad[1] = (values[k * slice + (size_t)j1 * size + i] - values[k * slice + (size_t)j0 * size + i]) * scale;
+    grad[2] = (values[k1 * slice + (size_t)j * size + i] - values[k0 * slice + (size_t)j * size + i]) * scale;
+}
+
+
+/* private: DrawPacket::prepare for attach() */
+void CloudVolume::prepareClouds(void *owner, int item, GLuint program) {
+    CloudVolume *volume = (CloudVolume*)owner;
+    if(program != volume->uniformprogram) {
+        volume->uniformprogram = program;
+        volume->location_volume = glGetUniformLocation(program, "cloudVolume");
+        volume->location_params = glGetUniformLocation(program, "cloudParams");
+    }
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_3D, volume->texture);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(volume->location_volume, TEXTURE_UNIT);
+    glUniform2f(volume->location_params, volume->period, volume->gradientscale);
+    if(volume->meshprepare) volume->meshprepare(volume->meshowner, item, program);
+}
@@ -0,0 +1,94 @@
+/* CloudVolume.hpp */
+/*
+ * Precomputed noise for the cloud layer, to replace the gradient noise
+ * that cloudShaderFrag.glsl evaluates per fragment. The clouds are a
+ * sphere around the whole scene, blended over everything, so that
+ * noise was paid for on every pixel of every frame.
+ * The simplex noise is computed once on the CPU, over a cube of
+ * 'period' noise units, as a 3-D texture of size^3 texels: the gradient
+ * in red, green and blue, divided by the steepest one, and the value
+ * in alpha, all in 8 bits. The shader needs the gradient, so RGBA it
+ * is rather than a single channel that it would have to difference.
+ * The volume tiles in all three directions, by the cross-fade of
+ * WaterNormals.hpp: each point blends the noise there and one period
+ * away along x, y and z, and the gradient is the central difference of
+ * the blend, wrapping around. The shader scrolls its coordinates
+ * through the volume over time.
+ * The slices are computed on the ThreadPool workers with the batch
+ * noise of SimplexNoise.hpp. The texture repeats, with no mipmaps: the
+ * cloud sphere is far larger than the volume, which is magnified all
+ * over it.
+ */
+/* Usage: generate() at startup, then attach() the packet of the cloud
+ * mesh, drawn with the cloud shader compiled with CLOUD_VOLUME defined
+ * (see cloudShaderFrag.glsl). */
+
+#ifndef CLOUDVOLUME_HPP // Avoid including this header twice
+#define CLOUDVOLUME_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <vector>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "RenderQueue.hpp"
+
+class CloudVolume {
+
+public:
+
+/* The texture unit of the volume while drawing */
+static const int TEXTURE_UNIT = 10;
+
+/*
+ * Constructor: size^3 texels covering 'period' units of noise space
+ * along each axis. No OpenGL calls are made here.
+ */
+CloudVolume(int size = 128, float period = 8.0f);
+
+/* Destructor: delete the texture */
+~CloudVolume();
+
+/* Compute the volume on all workers and upload it. Prints the time taken. */
+void generate();
+
+/* True once generate() has made the texture */
+bool ready() const;
+
+/*
+ * attach() - bind the volume and set its uniforms before 'packet' is
+ * drawn, then call the packet's own prepare().
+ */
+void attach(DrawPacket &packet);
+
+/* Milliseconds the computation took, and the texture memory in bytes */
+double generateTime() const;
+long textureBytes() const;
+
+private:
+
+int size;
+float period;
+GLuint texture;
+float gradientscale;  // The steepest gradient component, 1 in the texture
+double milliseconds;
+
+GLuint uniformprogram; // Program the uniform locations below belong to
+GLint location_volume, location_params;
+void (*meshprepare)(void *owner, int item, GLuint program); // The cloud packet's own
+void *meshowner;
+
+void computeSlice(int slice, float *values) const;
+void gradient(const float *values, int i, int j, int k, float *grad) const;
+static void prepareClouds(void *owner, int item, GLuint program);
+
+CloudVolume(const CloudVolume&);            // Not copyable
+CloudVolume &operator=(const CloudVolume&);
+
+};
+
+#endif // CLOUDVOLUME_HPP
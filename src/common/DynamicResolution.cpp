@@ -0,0 +1,162 @@
+#include "DynamicResolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+/* PID gains on the relative error of the GPU time, per update of the area */
+const float KP = 0.1f, KI = 0.15f, KD = 0.02f;
+
+/* Weight of a new GPU time in the smoothed one */
+const float SMOOTHING = 0.5f;
+
+/* Relative errors smaller than this count as none */
+const float DEADBAND = 0.05f;
+
+/* Steps of the scale before it is changed: down, and up */
+const float STEPDOWN = 0.02f, STEPUP = 0.05f;
+
+}
+
+
+DynamicResolution::DynamicResolution(float budget, float minScale) {
+    for(int i=0; i<LATENCY; i++) {
+        queries[i][0] = queries[i][1] = 0;
+        issued[i] = false;
+    }
+    frame = 0;
+    framewidth = frameheight = 0;
+    oldframebuffer = 0;
+    budgetms = budget > 0.0f ? budget : 16.7f;
+    minscale = std::min(1.0f, std::max(0.1f, minScale));
+    area = 1.0f;
+    currentscale = 1.0f;
+    smoothed = -1.0f;
+    error1 = error2 = 0.0f;
+    lastgpu = -1.0f;
+    scalesum = gpusum = 0.0;
+    frames = measured = changes = 0;
+}
+
+
+DynamicResolution::~DynamicResolution() {
+    if(queries[0][0]) glDeleteQueries(2 * LATENCY, &queries[0][0]);
+}
+
+
+void DynamicResolution::beginFrame(int width, int height) {
+
+    if(!queries[0][0]) glGenQueries(2 * LATENCY, &queries[0][0]);
+
+    // The oldest frame's times, if the GPU is done with them
+    int slot = frame % LATENCY;
+    if(issued[slot]) {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(queries[slot][0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(queries[slot][1], GL_QUERY_RESULT, &end);
+            control((float)((end - start) / 1.0e6));
+        }
+        issued[slot] = false; // Late: skipped rather than waited for
+    }
+
+    framewidth = std::max(1, width);
+    frameheight = std::max(1, height);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oldframebuffer);
+    target.resize(framewidth, frameheight);
+    target.bind();
+    glViewport(0, 0, renderWidth(), renderHeight());
+    glQueryCounter(queries[slot][0], GL_TIMESTAMP);
+}
+
+
+void DynamicResolution::endFrame() {
+
+    int slot = frame % LATENCY;
+    glQueryCounter(queries[slot][1], GL_TIMESTAMP);
+    issued[slot] = true;
+    frame++;
+    frames++;
+    scalesum += currentscale;
+
+    // Bilinear, from this frame's corner of the target to the whole window
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebufferObject());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oldframebuffer);
+    glBlitFramebuffer(0, 0, renderWidth(), renderHeight(), 0, 0, framewidth, frameheight,
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, oldframebuffer);
+    glViewport(0, 0, framewidth, frameheight);
+}
+
+
+int DynamicResolution::renderWidth() const {
+    return std::max(1, (int)(framewidth * currentscale + 0.5f));
+}
+
+
+int DynamicResolution::renderHeight() const {
+    return std::max(1, (int)(frameheight * currentscale + 0.5f));
+}
+
+
+float DynamicResolution::scale() const {
+    return currentscale;
+}
+
+
+void DynamicResolution::setBudget(float milliseconds) {
+    if(milliseconds > 0.0f) budgetms = milliseconds;
+}
+
+
+float DynamicResolution::budget() const {
+    return budgetms;
+}
+
+
+float DynamicResolution::gpuTime() const {
+    return lastgpu;
+}
+
+
+void DynamicResolution::printStats() const {
+    if(frames == 0) return;
+    printf("Dynamic resolution: scale %.2f on average over %d frames, changed %d times\n",
+        scalesum / frames, frames, changes);
+    if(measured > 0) printf("  GPU time %.2f ms on average for a budget of %.2f ms, %d frames measured\n",
+        gpusum / measured, budgetms, measured);
+}
+
+
+/*
+ * private
+ * control() - one step of the controller with the GPU time of a frame.
+ * The incremental form adds to the area the change of the proportional
+ * term, the integral term's error and the change of the derivative
+ * term; clamping the area is then all the anti-windup it needs.
+ */
+void DynamicResolution::control(float milliseconds) {
+
+    lastgpu = milliseconds;
+    gpusum += milliseconds;
+    measured++;
+    smoothed = (smoothed < 0.0f) ? milliseconds : smoothed + SMOOTHING * (milliseconds - smoothed);
+
+    float error = (budgetms - smoothed) / budgetms;
+    if(fabsf(error) < DEADBAND) error = 0.0f;
+    area += KP * (error - error1) + KI * error + KD * (error - 2.0f * error1 + error2);
+    area = std::min(1.0f, std::max(minscale * minscale, area));
+    error2 = error1;
+    error1 = error;
+
+    float wanted = (area <= minscale * minscale) ? minscale : sqrtf(area);
+    bool limit = (wanted == 1.0f || wanted == minscale) && wanted != currentscale;
+    if(limit || wanted < currentscale - STEPDOWN || wanted > currentscale + STEPUP) {
+        currentscale = wanted;
+        changes++;
+    }
+}
@@ -0,0 +1,101 @@
+/* DynamicResolution.hpp */
+/*
+ * Dynamic resolution: the frame is drawn into an offscreen target at a
+ * fraction of the window's width and height, chosen to keep the GPU
+ * time of the frame at a budget, and scaled up to the window at the
+ * end. The terrain, water and cloud shaders cost about in proportion
+ * to the pixels, so the pixels are what is controlled: a PID controller
+ * in incremental form moves the area fraction by the relative error of
+ * the GPU time, smoothed over a few frames, which saturates cleanly at
+ * its limits without winding up.
+ * The GPU time comes from a pair of GL_TIMESTAMP queries around the
+ * frame (the Profiler owns GL_TIME_ELAPSED, which cannot nest), read
+ * back a few frames later once they are available, never waiting.
+ * The target has the window's size and the frame a corner of it, so a
+ * new scale costs nothing; still, errors within a dead band are
+ * ignored, and the scale only goes up by a larger step than it goes
+ * down, so it does not flicker between two sizes. The scale never goes
+ * below a minimum, and never above 1.
+ */
+/* Usage, each frame: beginFrame() with the window size instead of
+ * setting the viewport, draw with renderWidth() x renderHeight() as the
+ * frame size, then endFrame() before swapping the buffers. */
+
+#ifndef DYNAMICRESOLUTION_HPP // Avoid including this header twice
+#define DYNAMICRESOLUTION_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "RenderTarget.hpp"
+
+class DynamicResolution {
+
+public:
+
+/* Frames of queries in flight: a result is looked for this many frames later */
+static const int LATENCY = 3;
+
+/*
+ * Constructor: aim at 'budget' milliseconds of GPU time per frame, with
+ * the scale between 'minScale' and 1. No OpenGL calls are made here.
+ */
+DynamicResolution(float budget = 16.7f, float minScale = 0.5f);
+
+/* Destructor: delete the queries */
+~DynamicResolution();
+
+/*
+ * beginFrame() - size the target for a width x height window, update
+ * the scale from the queries that are done, then bind the target with
+ * the viewport set to this frame's corner of it. The framebuffer bound
+ * before is the one endFrame() draws to.
+ */
+void beginFrame(int width, int height);
+
+/* Scale this frame up into the framebuffer of beginFrame(), and bind it again */
+void endFrame();
+
+/* This frame's size, and the scale of it to the window */
+int renderWidth() const;
+int renderHeight() const;
+float scale() const;
+
+/* Aim at 'milliseconds' of GPU time per frame from now on */
+void setBudget(float milliseconds);
+
+/* The budget, and the last GPU time measured in milliseconds, -1 for none yet */
+float budget() const;
+float gpuTime() const;
+
+/* Print the average scale and GPU time, and how often the scale changed */
+void printStats() const;
+
+private:
+
+RenderTarget target;
+GLuint queries[LATENCY][2];      // Timestamps at the start and end of a frame
+bool issued[LATENCY];
+int frame;
+int framewidth, frameheight;     // The window's
+GLint oldframebuffer;
+float budgetms, minscale;
+float area;                      // What the controller asks for, the scale squared
+float currentscale;              // What is drawn, which lags the area by the hysteresis
+float smoothed, error1, error2;  // The smoothed time and the errors of the last two updates
+float lastgpu;
+double scalesum, gpusum;
+int frames, measured, changes;
+
+void control(float milliseconds);
+
+DynamicResolution(const DynamicResolution&);            // Not copyable
+DynamicResolution &operator=(const DynamicResolution&);
+
+};
+
+#endif // DYNAMICRESOLUTION_HPP
@@ -0,0 +1,242 @@
+#include "FFT.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FFT_SSE 1
+#endif
+
+namespace {
+
+/*
+ * The arithmetic of the kernel on four neighbouring columns at once,
+ * in an SSE register or a plain array where there is no SSE, or on a
+ * single float for the columns left over. The butterflies below are
+ * written once for all of them.
+ */
+struct Four {};
+struct One {};
+
+template<class T> struct Ops;
+
+#ifdef FFT_SSE
+template<> struct Ops<Four> {
+    typedef __m128 V;
+    static V ld(const float *p) { return _mm_loadu_ps(p); }
+    static void st(float *p, V a) { _mm_storeu_ps(p, a); }
+    static V sp(float f) { return _mm_set1_ps(f); }
+    static V ad(V a, V b) { return _mm_add_ps(a, b); }
+    static V sb(V a, V b) { return _mm_sub_ps(a, b); }
+    static V ml(V a, V b) { return _mm_mul_ps(a, b); }
+    static V ng(V a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+};
+#else
+struct Lane { float f[4]; };
+
+template<> struct Ops<Four> {
+    typedef Lane V;
+    static V ld(const float *p) { V a; for(int i=0; i<4; i++) a.f[i] = p[i]; return a; }
+    static void st(float *p, V a) { for(int i=0; i<4; i++) p[i] = a.f[i]; }
+    static V sp(float f) { V a; for(int i=0; i<4; i++) a.f[i] = f; return a; }
+    static V ad(V a, V b) { for(int i=0; i<4; i++) a.f[i] += b.f[i]; return a; }
+    static V sb(V a, V b) { for(int i=0; i<4; i++) a.f[i] -= b.f[i]; return a; }
+    static V ml(V a, V b) { for(int i=0; i<4; i++) a.f[i] *= b.f[i]; return a; }
+    static V ng(V a) { for(int i=0; i<4; i++) a.f[i] = -a.f[i]; return a; }
+};
+#endif
+
+template<> struct Ops<One> {
+    typedef float V;
+    static V ld(const float *p) { return *p; }
+    static void st(float *p, V a) { *p = a; }
+    static V sp(float f) { return f; }
+    static V ad(V a, V b) { return a + b; }
+    static V sb(V a, V b) { return a - b; }
+    static V ml(V a, V b) { return a * b; }
+    static V ng(V a) { return -a; }
+};
+
+/*
+ * The kernel, on 'width' columns, Four or One at a time. Rows are
+ * swapped into bit reversed order, then the first two stages are a
+ * radix-4 butterfly on each group of four rows, where the twiddles are
+ * 1 and -i (forward) or +i (inverse). The other stages are radix-2.
+ */
+template<class T>
+void columns(float *re, float *im, int stride, int width, int n, const int *reversed,
+             const float *twiddlere, const float *twiddleim, bool inverse) {
+
+    typedef Ops<T> O;
+    typedef typename O::V V;
+    const int step = sizeof(V) / sizeof(float);
+
+    // Bit reversal of the rows
+    for(int i=0; i<n; i++) {
+        int j = reversed[i];
+        if(j <= i) continue;
+        float *ra = re + i*stride, *rb = re + j*stride, *ia = im + i*stride, *ib = im + j*stride;
+        for(int c=0; c<width; c+=step) {
+            V t = O::ld(ra + c); O::st(ra + c, O::ld(rb + c)); O::st(rb + c, t);
+            t = O::ld(ia + c); O::st(ia + c, O::ld(ib + c)); O::st(ib + c, t);
+        }
+    }
+
+    // Radix-4: two stages, no multiplications
+    for(int g=0; g<n; g+=4) {
+        for(int c=0; c<width; c+=step) {
+            float *r = re + g*stride + c, *m = im + g*stride + c;
+            V x0r = O::ld(r), x1r = O::ld(r + stride), x2r = O::ld(r + 2*stride), x3r = O::ld(r + 3*stride);
+            V x0i = O::ld(m), x1i = O::ld(m + stride), x2i = O::ld(m + 2*stride), x3i = O::ld(m + 3*stride);
+            V a0r = O::ad(x0r, x1r), a0i = O::ad(x0i, x1i);
+            V a1r = O::sb(x0r, x1r), a1i = O::sb(x0i, x1i);
+            V a2r = O::ad(x2r, x3r), a2i = O::ad(x2i, x3i);
+            V a3r = O::sb(x2r, x3r), a3i = O::sb(x2i, x3i);
+            // a3 times -i forward, +i inverse
+            V br, bi;
+            if(inverse) { br = O::ng(a3i); bi = a3r; }
+            else { br = a3i; bi = O::ng(a3r); }
+            O::st(r, O::ad(a0r, a2r));              O::st(m, O::ad(a0i, a2i));
+            O::st(r + 2*stride, O::sb(a0r, a2r));   O::st(m + 2*stride, O::sb(a0i, a2i));
+            O::st(r + stride, O::ad(a1r, br));      O::st(m + stride, O::ad(a1i, bi));
+            O::st(r + 3*stride, O::sb(a1r, br));    O::st(m + 3*stride, O::sb(a1i, bi));
+        }
+    }
+
+    // Radix-2 for the rest
+    float sign = inverse ? -1.0f : 1.0f;
+    for(int h=4; h<n; h*=2) {
+        for(int j=0; j<h; j++) {
+            V wr = O::sp(twiddlere[h + j]), wi = O::sp(sign * twiddleim[h + j]);
+            for(int start=0; start<n; start+=2*h) {
+                float *ra = re + (start + j)*stride, *ia = im + (start + j)*stride;
+                float *rb = ra + h*stride, *ib = ia + h*stride;
+                for(int c=0; c<width; c+=step) {
+                    V xr = O::ld(rb + c), xi = O::ld(ib + c);
+                    V tr = O::sb(O::ml(wr, xr), O::ml(wi, xi));
+                    V ti = O::ad(O::ml(wr, xi), O::ml(wi, xr));
+                    V ar = O::ld(ra + c), ai = O::ld(ia + c);
+                    O::st(rb + c, O::sb(ar, tr)); O::st(ib + c, O::sb(ai, ti));
+                    O::st(ra + c, O::ad(ar, tr)); O::st(ia + c, O::ad(ai, ti));
+                }
+            }
+        }
+    }
+}
+
+}
+
+
+FFT::FFT(int n) {
+    this->n = 4;
+    logn = 2;
+    while(this->n < n) {
+        this->n *= 2;
+        logn++;
+    }
+    n = this->n;
+
+    reversed.resize(n);
+    for(int i=0; i<n; i++) {
+        int r = 0;
+        for(int b=0; b<logn; b++) r |= ((i >> b) & 1) << (logn - 1 - b);
+        reversed[i] = r;
+    }
+
+    // Index h + j holds exp(-i pi j / h): the twiddles of the stage of half size h
+    twiddlere.assign(n, 1.0f);
+    twiddleim.assign(n, 0.0f);
+    for(int h=1; h<n; h*=2) {
+        for(int j=0; j<h; j++) {
+            double angle = -M_PI * j / h;
+            twiddlere[h + j] = (float)cos(angle);
+            twiddleim[h + j] = (float)sin(angle);
+        }
+    }
+}
+
+
+int FFT::size() const {
+    return n;
+}
+
+
+/*
+ * transformColumns() - blocks of BLOCK columns are copied to a buffer of
+ * their own first: at a stride of a power of two, the rows of a column
+ * would all fall in the same few cache sets. Fewer than WIDTH columns
+ * are transformed where they are, one at a time.
+ */
+void FFT::transformColumns(float *re, float *im, int stride, int columns, bool inverse) const {
+    if(columns < WIDTH) {
+        ::columns<One>(re, im, stride, columns, n, &reversed[0], &twiddlere[0], &twiddleim[0], inverse);
+        return;
+    }
+    std::vector<float> block(2 * n * BLOCK, 0.0f);
+    float *bre = &block[0], *bim = &block[n * BLOCK];
+    for(int c0=0; c0<columns; c0+=BLOCK) {
+        int width = std::min(BLOCK, columns - c0);
+        for(int r=0; r<n; r++) {
+            for(int c=0; c<width; c++) {
+                bre[r*BLOCK + c] = re[r*stride + c0 + c];
+                bim[r*BLOCK + c] = im[r*stride + c0 + c];
+            }
+        }
+        ::columns<Four>(bre, bim, BLOCK, BLOCK, n, &reversed[0], &twiddlere[0], &twiddleim[0], inverse);
+        for(int r=0; r<n; r++) {
+            for(int c=0; c<width; c++) {
+                re[r*stride + c0 + c] = bre[r*BLOCK + c];
+                im[r*stride + c0 + c] = bim[r*BLOCK + c];
+            }
+        }
+    }
+}
+
+
+void FFT::transform(float *re, float *im, bool inverse) const {
+    transformColumns(re, im, 1, 1, inverse);
+}
+
+
+/*
+ * transform2D() - the columns in blocks of BLOCK on the workers, then the
+ * rows the same way: a block of rows is copied in transposed, so its
+ * rows are the columns of the buffer, and copied back the same way.
+ * With n = 256 a block is 32 KB, which stays in cache for all stages.
+ */
+void FFT::transform2D(float *re, float *im, bool inverse, ThreadPool *pool) const {
+    ThreadPool &workers = pool ? *pool : ThreadPool::global();
+    int blocks = (n + BLOCK - 1) / BLOCK;
+    workers.parallelFor(blocks, [&](int b) {
+        transformColumns(re + b*BLOCK, im + b*BLOCK, n, std::min(BLOCK, n - b*BLOCK), inverse);
+    });
+    workers.parallelFor(blocks, [&](int b) {
+        std::vector<float> block(2 * n * BLOCK, 0.0f);
+        float *bre = &block[0], *bim = &block[n * BLOCK];
+        int r0 = b * BLOCK, rows = std::min(BLOCK, n - r0);
+        for(int r=0; r<rows; r++) {
+            for(int c=0; c<n; c++) {
+                bre[c*BLOCK + r] = re[(r0 + r)*n + c];
+                bim[c*BLOCK + r] = im[(r0 + r)*n + c];
+            }
+        }
+        ::columns<Four>(bre, bim, BLOCK, BLOCK, n, &reversed[0], &twiddlere[0], &twiddleim[0], inverse);
+        for(int r=0; r<rows; r++) {
+            for(int c=0; c<n; c++) {
+                re[(r0 + r)*n + c] = bre[c*BLOCK + r];
+                im[(r0 + r)*n + c] = bim[c*BLOCK + r];
+            }
+        }
+    });
+}
+
+
+bool FFT::simd() {
+#ifdef FFT_SSE
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,65 @@
+/* FFT.hpp */
+/*
+ * Complex fast Fourier transforms of power of two sizes, in one and two
+ * dimensions, on split arrays (real and imaginary parts apart).
+ * The kernel transforms down the columns of a row-major array, so one
+ * butterfly works on neighbouring columns at once: four columns per SSE
+ * register, in every stage, with no shuffles. After the bit reversal of
+ * the rows, the first two stages are one radix-4 pass that needs no
+ * multiplications. The rest are radix-2 passes with tabled twiddles.
+ * Blocks of columns are copied to a small buffer that stays in cache
+ * for all the stages. A 2-D transform does the columns, then the rows
+ * as the columns of transposed copies, with the blocks spread over the
+ * workers of a ThreadPool. A 1-D transform is a single column.
+ * The forward transform uses exp(-2 pi i jk / n), the inverse the
+ * conjugate. Neither divides by n.
+ */
+/* Usage: FFT fft(256); fft.transform2D(re, im, true) on 256 x 256
+ * arrays, or fft.transformColumns() on a block of columns. */
+
+#ifndef FFT_HPP // Avoid including this header twice
+#define FFT_HPP
+
+#include <vector>
+
+class ThreadPool;
+
+class FFT {
+
+public:
+
+/* Columns per SIMD register, and per block of a 2-D transform on one worker */
+static const int WIDTH = 4;
+static const int BLOCK = 16;
+
+/* Constructor: transforms of n points, a power of two of at least 4 */
+FFT(int n = 256);
+
+int size() const;
+
+/*
+ * transformColumns() - transform 'columns' columns of n rows, starting
+ * at re and im, with 'stride' floats from one row to the next. Any
+ * number of columns; multiples of WIDTH go fastest.
+ */
+void transformColumns(float *re, float *im, int stride, int columns, bool inverse) const;
+
+/* One transform of n points in place */
+void transform(float *re, float *im, bool inverse) const;
+
+/* An n x n row-major array in place, on the workers of 'pool' (NULL for the global one) */
+void transform2D(float *re, float *im, bool inverse, ThreadPool *pool = 0) const;
+
+/* True if the kernel uses SSE, false for the plain C++ fallback */
+static bool simd();
+
+private:
+
+int n, logn;
+std::vector<int> reversed;      // Bit reversed row index
+std::vector<float> twiddlere;   // exp(-i pi j / h) at index h + j, for each stage h
+std::vector<float> twiddleim;
+
+};
+
+#endif // FFT_HPP
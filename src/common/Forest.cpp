@@ -0,0 +1,345 @@
+#include "Forest.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+/* Trees are left out where the slope, dh/dx and dh/dz together, is steeper than this */
+const float MAXSLOPE = 0.8f;
+
+/* Size range of the trees, as a scale of the mesh */
+const float MINSCALE = 0.3f, MAXSCALE = 0.6f;
+
+/* Instances per square unit of Scatter with spacing 1 on open ground, measured */
+const float PACKING = 0.47f;
+
+/* A cell and its distance to the camera cell, for the order of the buffer */
+struct Cell {
+    int ix, iz, distance2;
+    float nearest;     // From the nearest point of the camera cell
+    bool operator<(const Cell &other) const {
+        return nearest < other.nearest || (nearest == other.nearest && distance2 < other.distance2);
+    }
+};
+
+/* Far outside any forest, for fadeDistance when there are no impostors */
+const float NOFADE = 1e30f;
+
+/* The cells within 'radius' cells of (cx, cz), nearest first, see Cell */
+std::vector<Cell> cellsInRange(int cx, int cz, int radius, float cellsize) {
+    std::vector<Cell> inrange;
+    for(int iz=cz-radius; iz<=cz+radius; iz++) {
+        for(int ix=cx-radius; ix<=cx+radius; ix++) {
+            int d2 = (ix-cx)*(ix-cx) + (iz-cz)*(iz-cz);
+            if(d2 > radius*radius) continue;
+            float dx = (float)std::max(0, abs(ix-cx) - 1), dz = (float)std::max(0, abs(iz-cz) - 1);
+            Cell cell = { ix, iz, d2, cellsize * sqrtf(dx*dx + dz*dz) };
+            inrange.push_back(cell);
+        }
+    }
+    std::sort(inrange.begin(), inrange.end());
+    return inrange;
+}
+
+}
+
+
+const float Forest::WATERLEVEL = -0.6f;
+
+
+Forest::Forest(float cellsize, int radius) : scatter(cellsize) {
+    this->cellsize = cellsize;
+    this->radius = std::max(1, radius);
+    density = 0.0f;
+    centerx = centerz = 0;
+    built = false;
+    synchronous = false;
+    buffer = texture = 0;
+    count = builds = 0;
+    meshcount = impostorfirst = 0;
+    fadestart = 12.0f;
+    fadeend = 16.0f;
+    for(int i=0; i<2; i++) {
+        locations[i].program = 0;
+        locations[i].instances = locations[i].fadedistance = locations[i].firstinstance = -1;
+    }
+    meshprepare = NULL;
+    meshowner = NULL;
+    impostor = NULL;
+    // Sparse on the shore, thinning out towards the tree line
+    scatter.setWaterLevel(WATERLEVEL);
+    scatter.setMaxSlope(MAXSLOPE);
+    scatter.addBand(WATERLEVEL, -0.4f, 0, 0.3f);
+    scatter.addBand(-0.4f, 1.2f, 0);
+    scatter.addBand(1.2f, 1e30f, 0, 0.4f);
+}
+
+
+Forest::~Forest() {
+    if(texture) glDeleteTextures(1, &texture);
+    if(buffer) glDeleteBuffers(1, &buffer);
+}
+
+
+void Forest::setCount(int trees) {
+    float area = (float)M_PI * (radius * cellsize) * (radius * cellsize);
+    float wanted = std::max(0, trees) / area;
+    if(wanted != density) {
+        density = wanted;
+        if(density > 0.0f) scatter.setSpacing(sqrtf(PACKING / density));
+        cells.clear(); // Placed with the old density
+        job.reset();   // And so are the trees of a worker still placing them
+        built = false;
+    }
+}
+
+
+void Forest::setImpostorDistance(float fadestart, float fadeend) {
+    this->fadestart = std::max(0.0f, fadestart);
+    this->fadeend = std::max(this->fadestart + 0.01f, fadeend);
+}
+
+
+void Forest::setSynchronous(bool synchronous) {
+    this->synchronous = synchronous;
+}
+
+
+/*
+ * update() - one placement at a time: if the camera moves on while the
+ * worker is busy, the next one starts after its buffer is built.
+ */
+void Forest::update(float x, float z) {
+    if(job && job->done.load()) rebuild();
+    int cx = (int)floorf(x / cellsize), cz = (int)floorf(z / cellsize);
+    if(job || (built && cx == centerx && cz == centerz)) return;
+    start(cx, cz);
+    if(job->done.load()) rebuild();
+}
+
+
+/*
+ * submit() - with impostors, the mesh draws the cells that may be nearer
+ * than the end of the fade, and the impostor the cells that may be
+ * farther than its start. The shaders leave out the trees of those
+ * cells that are not theirs.
+ */
+void Forest::submit(RenderQueue &queue, TriangleSoup &tree, GLuint program, const char *name,
+                    Impostor *impostor, GLuint impostorprogram) {
+
+    this->impostor = (impostor && impostor->baked() && impostorprogram) ? impostor : NULL;
+    meshcount = count;
+    impostorfirst = count;
+    if(count == 0) return;
+    if(this->impostor) {
+        meshcount = impostorfirst = 0;
+        for(size_t i=0; i<ranges.size(); i++) {
+            if(ranges[i].nearest < fadeend) meshcount = ranges[i].end;
+        }
+        for(size_t i=0; i<ranges.size() && ranges[i].farthest <= fadestart; i++) {
+            impostorfirst = ranges[i].end;
+        }
+    }
+
+    DrawPacket packet = tree.packet(program, -1);
+    if(packet.count > 0 && meshcount > 0) {
+        // Bind the instances, then let the mesh set its own uniforms
+        meshprepare = packet.prepare;
+        meshowner = packet.owner;
+        packet.prepare = prepareForest;
+        packet.owner = this;
+        packet.item = 0;
+        packet.instances = meshcount;
+        packet.depth = 0.0f; // The forest is all around, draw it early
+        packet.name = name;
+        queue.submit(packet);
+    }
+    else meshcount = 0;
+
+    if(this->impostor && impostorfirst < count) {
+        DrawPacket quads;
+        quads.program = impostorprogram;
+        quads.vao = this->impostor->vao();
+        quads.count = Impostor::INDICES;
+        quads.indextype = GL_UNSIGNED_SHORT;
+        quads.instances = count - impostorfirst;
+        quads.depth = fadestart; // After the near trees, which hide some of them
+        quads.prepare = prepareForest;
+        quads.owner = this;
+        quads.item = 1;
+        quads.name = name ? "impostors" : NULL;
+        queue.submit(quads);
+    }
+    else impostorfirst = count;
+}
+
+
+int Forest::instances() const {
+    return count;
+}
+
+
+int Forest::rebuilds() const {
+    return builds;
+}
+
+
+int Forest::meshInstances() const {
+    return meshcount;
+}
+
+
+int Forest::impostorInstances() const {
+    return count - impostorfirst;
+}
+
+
+/*
+ * private
+ * start() - place the trees of the cells in range of (cx, cz) that are
+ * not placed yet, on a worker, or right away when synchronous or when
+ * there is nothing to place.
+ */
+void Forest::start(int cx, int cz) {
+
+    job = std::make_shared<Job>(scatter);
+    job->cx = cx;
+    job->cz = cz;
+    if(density > 0.0f) {
+        std::vector<Cell> inrange = cellsInRange(cx, cz, radius, cellsize);
+        for(size_t i=0; i<inrange.size(); i++) {
+            if(cells.count(key(inrange[i].ix, inrange[i].iz))) continue;
+            job->ix.push_back(inrange[i].ix);
+            job->iz.push_back(inrange[i].iz);
+        }
+    }
+
+    if(synchronous || job->ix.empty()) {
+        placeCells(*job);
+        job->done = true;
+        return;
+    }
+    std::shared_ptr<Job> state = job;
+    ThreadPool::global().submit([state]() {
+        placeCells(*state);
+        state->done = true;
+    });
+}
+
+
+/*
+ * private
+ * rebuild() - gather the trees of the cells in range of the finished
+ * job's camera cell, nearest cells first, by the distance from the
+ * nearest point of the camera cell. The job's cells join the placed
+ * ones, cells that left the range are forgotten.
+ */
+void Forest::rebuild() {
+
+    int cx = job->cx, cz = job->cz;
+    std::vector<Cell> inrange = cellsInRange(cx, cz, radius, cellsize);
+
+    std::unordered_map<uint64_t, std::vector<Tree> > kept;
+    for(size_t i=0; i<inrange.size(); i++) {
+        uint64_t k = key(inrange[i].ix, inrange[i].iz);
+        std::unordered_map<uint64_t, std::vector<Tree> >::iterator it = cells.find(k);
+        if(it != cells.end()) kept[k].swap(it->second);
+    }
+    for(size_t i=0; i<job->ix.size(); i++) kept[key(job->ix[i], job->iz[i])].swap(job->placed[i]);
+    cells.swap(kept);
+    job.reset();
+
+    std::vector<Tree> all;
+    ranges.resize(inrange.size());
+    for(size_t i=0; i<inrange.size(); i++) {
+        const std::vector<Tree> &trees = cells[key(inrange[i].ix, inrange[i].iz)];
+        all.insert(all.end(), trees.begin(), trees.end());
+        float dx = (float)(abs(inrange[i].ix-cx) + 1), dz = (float)(abs(inrange[i].iz-cz) + 1);
+        ranges[i].nearest = inrange[i].nearest;
+        ranges[i].farthest = cellsize * sqrtf(dx*dx + dz*dz);
+        ranges[i].end = (int)all.size();
+    }
+
+    if(!buffer) {
+        glGenBuffers(1, &buffer);
+        glGenTextures(1, &texture);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, all.size()*sizeof(Tree), all.empty() ? NULL : &all[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    count = (int)all.size();
+    centerx = cx;
+    centerz = cz;
+    built = true;
+    builds++;
+}
+
+
+/*
+ * private, static
+ * placeCells() - the trees of the job's cells, on all workers. Runs on
+ * a worker thread, so it only touches the job.
+ */
+void Forest::placeCells(Job &job) {
+    job.placed.resize(job.ix.size());
+    if(job.ix.empty()) return;
+    std::vector<std::vector<Scatter::Instance> > instances(job.ix.size());
+    job.scatter.scatterTiles(&job.ix[0], &job.iz[0], (int)job.ix.size(), &instances[0]);
+    for(size_t i=0; i<job.ix.size(); i++) place(instances[i], job.placed[i]);
+}
+
+
+/*
+ * private, static
+ * place() - trees from the instances of one cell. Scatter has left out
+ * the water and the slopes and spaced the rest as blue noise.
+ */
+void Forest::place(const std::vector<Scatter::Instance> &instances, std::vector<Tree> &trees) {
+    trees.reserve(instances.size());
+    for(size_t i=0; i<instances.size(); i++) {
+        const Scatter::Instance &instance = instances[i];
+        float scale = MINSCALE + (MAXSCALE - MINSCALE) * instance.scale * (1.0f / 255.0f);
+        float yaw = 2.0f * (float)M_PI * instance.yaw * (1.0f / 256.0f);
+        // Sink the trunk a little, so it does not float on a slope
+        Tree tree = { instance.x, instance.y - 0.1f*scale, instance.z, scale, cosf(yaw), sinf(yaw), 0.0f, 0.0f };
+        trees.push_back(tree);
+    }
+}
+
+
+uint64_t Forest::key(int ix, int iz) {
+    return ((uint64_t)(uint32_t)ix << 32) | (uint32_t)iz;
+}
+
+
+/* private: DrawPacket::prepare for submit(), item 0 for the mesh and 1 for the impostor */
+void Forest::prepareForest(void *owner, int item, GLuint program) {
+    Forest *forest = (Forest*)owner;
+    Locations &locations = forest->locations[item];
+    if(program != locations.program) {
+        locations.program = program;
+        locations.instances = glGetUniformLocation(program, "instances");
+        locations.fadedistance = glGetUniformLocation(program, "fadeDistance");
+        locations.firstinstance = glGetUniformLocation(program, "firstInstance");
+    }
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, forest->texture);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(locations.instances, TEXTURE_UNIT);
+    if(forest->impostor) glUniform2f(locations.fadedistance, forest->fadestart, forest->fadeend);
+    else glUniform2f(locations.fadedistance, NOFADE, 2.0f * NOFADE);
+    if(item == 1) {
+        glUniform1i(locations.firstinstance, forest->impostorfirst);
+        forest->impostor->bind(program);
+    }
+    else if(forest->meshprepare) forest->meshprepare(forest->meshowner, item, program);
+}
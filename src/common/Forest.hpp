@@ -0,0 +1,176 @@
+/* Forest.hpp */
+/*
+ * Many copies of one tree mesh scattered over the terrain of
+ * TerrainHeight.hpp, drawn with a single instanced draw call.
+ * The ground is divided into square cells. The trees of a cell are
+ * placed procedurally as blue noise by Scatter, so a cell always gets
+ * the same trees and cells meet without seams. They stand on the
+ * terrain, but not under water or on steep slopes, sparser on the shore
+ * and near the tree line, and each has its own yaw and size.
+ * The trees of all cells within the radius around the camera are kept
+ * in one buffer, read by the vertex shader as a samplerBuffer, two
+ * texels per tree (see treeShaderVert.glsl with INSTANCED defined).
+ * Nearer cells come first, so near trees are drawn first. The buffer is
+ * rebuilt only when the camera moves into another cell, and the trees
+ * of cells that stay in range are kept on the CPU, not placed again.
+ * The cells new in range are placed by a ThreadPool worker, while the
+ * old buffer is still drawn. The next update() after the worker is done
+ * builds the new buffer, so crossing a cell never stalls a frame.
+ */
+/* Far trees can be drawn as impostors, quads textured with views of the
+ * mesh (see Impostor.hpp). Cells are then ordered by their nearest
+ * possible distance to the camera, so the trees that may need the mesh
+ * are a prefix of the buffer and the ones that may need an impostor a
+ * suffix. Each is drawn with one instanced call, and the shaders sort
+ * out the trees in between with a dithered cross-fade.
+ * Usage: setCount() the trees wanted in range, call update() with the
+ * camera position once per frame, then submit() the tree mesh with the
+ * instanced tree shader, and the impostor with its shader. */
+
+#ifndef FOREST_HPP // Avoid including this header twice
+#define FOREST_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "TriangleSoup.hpp"
+#include "RenderQueue.hpp"
+#include "Scatter.hpp"
+#include "Impostor.hpp"
+
+class Forest {
+
+public:
+
+/* The texture unit of the instance buffer while drawing */
+static const int TEXTURE_UNIT = 4;
+
+/* No trees below this height, the water level of the scene */
+static const float WATERLEVEL;
+
+/*
+ * Constructor: cells of cellsize x cellsize world units, out to
+ * 'radius' cells from the camera. No OpenGL calls are made here.
+ */
+Forest(float cellsize = 8.0f, int radius = 5);
+
+/* Destructor: delete the buffer and the texture */
+~Forest();
+
+/* About this many trees in range, before the ones on water and slopes are left out */
+void setCount(int trees);
+
+/* Trees cross-fade from mesh to impostor between these distances from the camera */
+void setImpostorDistance(float fadestart, float fadeend);
+
+/*
+ * setSynchronous() - if true, update() places the trees of a new cell
+ * at once (on all workers, waiting for them) and builds the buffer in
+ * the same frame. Every frame then draws the same trees for the same
+ * camera position, as the benchmark mode needs.
+ */
+void setSynchronous(bool synchronous);
+
+/*
+ * update() - if the camera has moved into another cell of (x, z), start
+ * placing the trees around it. Builds the buffer from a placement that
+ * has finished. Call once per frame from the OpenGL thread.
+ */
+void update(float x, float z);
+
+/*
+ * submit() - an opaque packet that draws the trees in range as
+ * instances of 'tree', with 'program' (the INSTANCED tree shader). With
+ * a baked 'impostor' and its 'impostorprogram', only the near trees get
+ * the mesh and a second packet draws the far ones as impostors.
+ */
+void submit(RenderQueue &queue, TriangleSoup &tree, GLuint program, const char *name = NULL,
+            Impostor *impostor = NULL, GLuint impostorprogram = 0);
+
+/* Trees in the buffer, and the number of times it was built */
+int instances() const;
+int rebuilds() const;
+
+/* Instances drawn by the last submit() with the mesh, and with the impostor */
+int meshInstances() const;
+int impostorInstances() const;
+
+private:
+
+/* The trees of a cell in the buffer, and their distance from the camera cell */
+struct Range {
+    float nearest, farthest; // Horizontal, from any point of the camera cell
+    int end;                 // One past the cell's last tree
+};
+
+/* Two texels of the instance buffer */
+struct Tree {
+    float x, y, z, scale;
+    float cosyaw, sinyaw, unused0, unused1;
+};
+
+/*
+ * The trees of the cells new in range of the camera cell (cx, cz),
+ * placed by a worker. Shared with the worker, so it outlives the Forest
+ * or a change of the density while the worker is still busy.
+ */
+struct Job {
+    int cx, cz;
+    Scatter scatter;                        // A copy, which setCount() cannot change
+    std::vector<int> ix, iz;                // The cells to place
+    std::vector<std::vector<Tree> > placed; // Their trees, per cell
+    std::atomic<bool> done;
+    Job(const Scatter &scatter) : scatter(scatter), done(false) {}
+};
+
+float cellsize;
+int radius;
+float density;        // Trees per square world unit
+Scatter scatter;      // Spaced for the density
+int centerx, centerz; // The cell of the camera when the buffer was built
+float fadestart, fadeend;
+bool built;           // The buffer matches centerx, centerz and the density
+bool synchronous;     // See setSynchronous()
+std::shared_ptr<Job> job; // The placement in progress, or none
+
+std::unordered_map<uint64_t, std::vector<Tree> > cells; // Placed trees in range
+
+std::vector<Range> ranges; // Per cell in buffer order
+
+GLuint buffer, texture;
+int count, builds;
+int meshcount, impostorfirst; // Of the last submit()
+
+/* The uniforms of the mesh (item 0) and impostor (item 1) packets */
+struct Locations {
+    GLuint program;        // Program the locations belong to
+    GLint instances, fadedistance, firstinstance;
+};
+Locations locations[2];
+void (*meshprepare)(void *owner, int item, GLuint program); // The tree packet's own
+void *meshowner;
+Impostor *impostor;     // Of the last submit(), NULL for none
+
+void start(int cx, int cz);
+void rebuild();
+static void placeCells(Job &job);
+static void place(const std::vector<Scatter::Instance> &instances, std::vector<Tree> &trees);
+static uint64_t key(int ix, int iz);
+static void prepareForest(void *owner, int item, GLuint program);
+
+Forest(const Forest&);            // Not copyable
+Forest &operator=(const Forest&);
+
+};
+
+#endif // FOREST_HPP
@@ -0,0 +1,128 @@
+#include "FrameUniforms.hpp"
+
+#include <cstring>
+
+namespace {
+
+/* Round up to a multiple of 'alignment' */
+GLsizeiptr alignUp(GLsizeiptr size, GLsizeiptr alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+}
+
+
+FrameUniforms::FrameUniforms(int maxobjects) {
+
+    this->maxobjects = (maxobjects < 1) ? 1 : maxobjects;
+    framedata.view = framedata.projection = glm::mat4(1.0f);
+    framedata.viewProjection = framedata.rotMat = glm::mat4(1.0f);
+    framedata.eyePosition = framedata.lightPos = glm::vec3(0.0f);
+    framedata.time = framedata.padding = 0.0f;
+    objects.reserve(this->maxobjects);
+
+    buffer = 0;
+    objectoffset = objectstride = sectionsize = 0;
+    section = 0;
+    for(int s=0; s<SECTIONS; s++) fences[s] = 0;
+    warnedfull = false;
+}
+
+
+FrameUniforms::~FrameUniforms() {
+    for(int s=0; s<SECTIONS; s++) {
+        if(fences[s]) glDeleteSync(fences[s]);
+    }
+    if(buffer) glDeleteBuffers(1, &buffer);
+}
+
+
+void FrameUniforms::bindBlocks(GLuint program) {
+    GLuint block = glGetUniformBlockIndex(program, "Frame");
+    if(block != GL_INVALID_INDEX) glUniformBlockBinding(program, block, FRAME_BINDING);
+    block = glGetUniformBlockIndex(program, "Object");
+    if(block != GL_INVALID_INDEX) glUniformBlockBinding(program, block, OBJECT_BINDING);
+}
+
+
+FrameBlock &FrameUniforms::frame() {
+    return framedata;
+}
+
+
+int FrameUniforms::addObject(const glm::mat4 &mvp, const glm::mat4 &model) {
+    if((int)objects.size() == maxobjects) {
+        if(!warnedfull) Utilities::printError("FrameUniforms", "too many objects in one frame");
+        warnedfull = true;
+        return -1;
+    }
+    ObjectBlock object = { mvp, model };
+    objects.push_back(object);
+    return (int)objects.size() - 1;
+}
+
+
+void FrameUniforms::upload() {
+
+    if(!buffer) createBuffer();
+
+    // The GPU normally finished this section two frames ago, so this rarely waits
+    if(fences[section]) {
+        glClientWaitSync(fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(fences[section]);
+        fences[section] = 0;
+    }
+
+    // No synchronisation by the driver is needed, the fence above did that
+    GLintptr base = section * sectionsize;
+    GLsizeiptr used = objectoffset + objects.size() * objectstride;
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    char *data = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, base, used,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if(data) {
+        memcpy(data, &framedata, sizeof(FrameBlock));
+        for(size_t i=0; i<objects.size(); i++) {
+            memcpy(data + objectoffset + i*objectstride, &objects[i], sizeof(ObjectBlock));
+        }
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING, buffer, base, sizeof(FrameBlock));
+}
+
+
+void FrameUniforms::bindObject(int index) {
+    if(index < 0 || index >= (int)objects.size()) return;
+    glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BINDING, buffer,
+        section * sectionsize + objectoffset + index * objectstride, sizeof(ObjectBlock));
+}
+
+
+void FrameUniforms::endFrame() {
+    if(buffer) fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    section = (section + 1) % SECTIONS;
+    objects.clear();
+}
+
+
+/*
+ * private
+ * createBuffer() - the ring. Each section is the Frame block followed by
+ * the Object entries, all at offsets the driver accepts for binding.
+ */
+void FrameUniforms::createBuffer() {
+
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if(alignment < 1) alignment = 256;
+
+    objectoffset = alignUp(sizeof(FrameBlock), alignment);
+    objectstride = alignUp(sizeof(ObjectBlock), alignment);
+    sectionsize = alignUp(objectoffset + maxobjects * objectstride, alignment);
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, SECTIONS * sectionsize, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
@@ -0,0 +1,117 @@
+/* FrameUniforms.hpp */
+/*
+ * Uniform buffers shared by all shader programs. Everything that is the
+ * same for a whole frame (camera, light, time, sky rotation) is in the
+ * std140 block "Frame", and the matrices of each drawn object are in the
+ * block "Object", one entry per draw:
+ *
+ *   layout(std140) uniform Frame {
+ *       mat4 view; mat4 projection; mat4 viewProjection;
+ *       mat4 rotMat;                       // Sky rotation
+ *       vec3 eyePosition; float time;
+ *       vec3 lightPos;
+ *   };
+ *   layout(std140) uniform Object {
+ *       mat4 MVP; mat4 model;
+ *   };
+ *
+ * All of it is written with one buffer mapping per frame, into one of
+ * three sections of a ring, so the CPU writes one section while the GPU
+ * may still read the two before. A fence per section makes sure the
+ * CPU never overwrites data that is still in use.
+ */
+/* Usage, once per frame: fill in frame(), call addObject() for every
+ * object to be drawn, then upload(). Before each draw, bindObject()
+ * with the index from addObject(). Call endFrame() after the last draw.
+ * Shader binds the blocks of every program it links with bindBlocks().
+ * Shaders declare the blocks with #include "frame.glsl" and "object.glsl". */
+
+#ifndef FRAMEUNIFORMS_HPP // Avoid including this header twice
+#define FRAMEUNIFORMS_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <vector>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "glm/glm.hpp"
+
+/* CPU side of the Frame block, laid out as std140 */
+struct FrameBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 rotMat;
+    glm::vec3 eyePosition;
+    float time;
+    glm::vec3 lightPos;
+    float padding;
+};
+
+/* CPU side of the Object block, laid out as std140 */
+struct ObjectBlock {
+    glm::mat4 MVP;
+    glm::mat4 model;
+};
+
+class FrameUniforms {
+
+public:
+
+/* Uniform buffer binding points of the two blocks */
+static const GLuint FRAME_BINDING = 0;
+static const GLuint OBJECT_BINDING = 1;
+
+/* Ring sections, the frames the CPU may be ahead of the GPU */
+static const int SECTIONS = 3;
+
+/* Constructor: room for 'maxobjects' draws per frame. No OpenGL calls are made here. */
+FrameUniforms(int maxobjects = 64);
+
+/* Destructor: delete the buffer and fences */
+~FrameUniforms();
+
+/* Connect the Frame and Object blocks of a linked program to their binding points */
+static void bindBlocks(GLuint program);
+
+/* This frame's Frame block, to fill in before upload() */
+FrameBlock &frame();
+
+/* Add one draw's matrices. Returns the index for bindObject(), -1 if full. */
+int addObject(const glm::mat4 &mvp, const glm::mat4 &model);
+
+/* Write the frame and its objects to the buffer and bind the Frame block */
+void upload();
+
+/* Bind the Object block to one draw's entry */
+void bindObject(int index);
+
+/* Fence this frame's section and move on to the next one */
+void endFrame();
+
+private:
+
+int maxobjects;
+FrameBlock framedata;
+std::vector<ObjectBlock> objects;
+
+GLuint buffer;
+GLsizeiptr objectoffset;   // Offset of the first object in a section
+GLsizeiptr objectstride;   // Object entries, padded to the offset alignment
+GLsizeiptr sectionsize;
+int section;               // The section of this frame
+GLsync fences[SECTIONS];
+bool warnedfull;
+
+void createBuffer();
+
+FrameUniforms(const FrameUniforms&);            // Not copyable
+FrameUniforms &operator=(const FrameUniforms&);
+
+};
+
+#endif // FRAMEUNIFORMS_HPP
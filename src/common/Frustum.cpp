@@ -0,0 +1,40 @@
+#include "Frustum.hpp"
+
+#include <cmath>
+
+
+Frustum::Frustum() {
+    for(int p=0; p<6; p++) {
+        for(int col=0; col<4; col++) planes[p][col] = 0.0f;
+    }
+}
+
+
+/* set() - element (row, col) of the matrix is viewproj[4*col + row] */
+void Frustum::set(const float *viewproj) {
+    for(int p=0; p<6; p++) {
+        int row = p / 2;
+        float sign = (p & 1) ? -1.0f : 1.0f;
+        float len = 0.0f;
+        for(int col=0; col<4; col++) {
+            planes[p][col] = viewproj[4*col + 3] + sign * viewproj[4*col + row];
+            if(col < 3) len += planes[p][col] * planes[p][col];
+        }
+        len = sqrtf(len);
+        if(len > 0.0f) {
+            for(int col=0; col<4; col++) planes[p][col] /= len;
+        }
+    }
+}
+
+
+bool Frustum::boxVisible(const float min[3], const float max[3]) const {
+    for(int p=0; p<6; p++) {
+        // The box corner furthest along the plane normal
+        float px = (planes[p][0] >= 0.0f) ? max[0] : min[0];
+        float py = (planes[p][1] >= 0.0f) ? max[1] : min[1];
+        float pz = (planes[p][2] >= 0.0f) ? max[2] : min[2];
+        if(planes[p][0]*px + planes[p][1]*py + planes[p][2]*pz + planes[p][3] < 0.0f) return false;
+    }
+    return true;
+}
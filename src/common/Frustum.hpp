@@ -0,0 +1,37 @@
+/* Frustum.hpp */
+/*
+ * The six planes of a view frustum, taken from the rows of the
+ * view-projection matrix (Gribb and Hartmann), for culling boxes on the
+ * CPU. Used by CDLODQuadtree for its nodes and by TileManager for its
+ * tiles. No OpenGL calls.
+ */
+/* Usage: set() the frustum from a column-major 4x4 view-projection
+ * matrix (as in OpenGL and glm) once per frame, then ask boxVisible()
+ * for each axis-aligned box in world coordinates. */
+
+#ifndef FRUSTUM_HPP // Avoid including this header twice
+#define FRUSTUM_HPP
+
+class Frustum {
+
+public:
+
+/* Constructor: a frustum that contains everything */
+Frustum();
+
+/* Take the planes from 'viewproj' */
+void set(const float *viewproj);
+
+/*
+ * boxVisible() - conservative test of the box from 'min' to 'max',
+ * false only if it is entirely outside one of the planes.
+ */
+bool boxVisible(const float min[3], const float max[3]) const;
+
+private:
+
+float planes[6][4]; // a*x + b*y + c*z + d >= 0 inside
+
+};
+
+#endif // FRUSTUM_HPP
@@ -0,0 +1,199 @@
+#include "Impostor.hpp"
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/*
+ * The view direction of point e in [-1, 1]^2 of the hemi-octahedral
+ * square, towards the viewer. The inverse is hemiOctEncode() in
+ * shaders/impostorVert.glsl.
+ */
+glm::vec3 hemiOctDecode(float ex, float ey) {
+    float px = 0.5f * (ex + ey), pz = 0.5f * (ex - ey);
+    return glm::normalize(glm::vec3(px, 1.0f - fabsf(px) - fabsf(pz), pz));
+}
+
+}
+
+
+Impostor::Impostor(int frames, int framesize) {
+    this->frames = std::max(2, frames);
+    this->framesize = std::max(8, framesize);
+    albedo = normals = 0;
+    quadvao = quadindices = 0;
+    center[0] = center[1] = center[2] = 0.0f;
+    radius = 1.0f;
+    done = false;
+    milliseconds = 0.0;
+    uniformprogram = 0;
+    location_albedo = location_normals = location_frames = location_center = location_radius = -1;
+}
+
+
+Impostor::~Impostor() {
+    if(albedo) glDeleteTextures(1, &albedo);
+    if(normals) glDeleteTextures(1, &normals);
+    if(quadindices) glDeleteBuffers(1, &quadindices);
+    if(quadvao) glDeleteVertexArrays(1, &quadvao);
+}
+
+
+/*
+ * bake() - one orthographic view of the bounding sphere per frame, the
+ * camera on the sphere looking at its centre. The background is cleared
+ * to zero, so the mipmaps hold colour and normal times coverage, and
+ * the shader divides by the coverage.
+ */
+void Impostor::bake(TriangleSoup &mesh, GLuint program) {
+
+    float min[3], max[3];
+    if(!program || !mesh.bounds(min, max)) return;
+    double start = glfwGetTime();
+    for(int k=0; k<3; k++) center[k] = 0.5f * (min[k] + max[k]);
+    radius = 0.5f * sqrtf((max[0]-min[0])*(max[0]-min[0]) + (max[1]-min[1])*(max[1]-min[1])
+        + (max[2]-min[2])*(max[2]-min[2]));
+    if(radius <= 0.0f) return;
+
+    // The atlas, colour and normals at the same size
+    int size = frames * framesize;
+    GLuint *textures[2] = { &albedo, &normals };
+    for(int t=0; t<2; t++) {
+        if(!*textures[t]) glGenTextures(1, textures[t]);
+        glBindTexture(GL_TEXTURE_2D, *textures[t]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLuint depthbuffer, framebuffer;
+    glGenRenderbuffers(1, &depthbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    // Keep the state of the caller
+    GLint oldframebuffer = 0, viewport[4];
+    GLfloat clearcolor[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oldframebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearcolor);
+    GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST), blend = glIsEnabled(GL_BLEND);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normals, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+    GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, buffers);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        Utilities::printError("Impostor", "atlas framebuffer is incomplete");
+    }
+    else {
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glViewport(0, 0, size, size);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glUseProgram(program);
+        GLint location_mvp = glGetUniformLocation(program, "bakeMVP");
+        glm::vec3 c(center[0], center[1], center[2]);
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+        for(int j=0; j<frames; j++) {
+            for(int i=0; i<frames; i++) {
+                // The same basis as the quads in shaders/impostorVert.glsl
+                glm::vec3 d = hemiOctDecode(2.0f * i / (frames - 1) - 1.0f, 2.0f * j / (frames - 1) - 1.0f);
+                glm::vec3 up = (fabsf(d.y) > 0.999f) ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                glm::mat4 mvp = projection * glm::lookAt(c + radius * d, c, up);
+                glUniformMatrix4fv(location_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+                glViewport(i * framesize, j * framesize, framesize, framesize);
+                mesh.render();
+            }
+        }
+        glUseProgram(0);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, oldframebuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &depthbuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clearcolor[0], clearcolor[1], clearcolor[2], clearcolor[3]);
+    if(!depthtest) glDisable(GL_DEPTH_TEST);
+    if(blend) glEnable(GL_BLEND);
+
+    for(int t=0; t<2; t++) {
+        glBindTexture(GL_TEXTURE_2D, *textures[t]);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if(!quadvao) createQuad();
+
+    glFinish();
+    milliseconds = 1000.0 * (glfwGetTime() - start);
+    done = true;
+}
+
+
+bool Impostor::baked() const {
+    return done;
+}
+
+
+GLuint Impostor::vao() const {
+    return quadvao;
+}
+
+
+void Impostor::bind(GLuint program) {
+
+    if(program != uniformprogram) {
+        uniformprogram = program;
+        location_albedo = glGetUniformLocation(program, "impostorAlbedo");
+        location_normals = glGetUniformLocation(program, "impostorNormals");
+        location_frames = glGetUniformLocation(program, "impostorFrames");
+        location_center = glGetUniformLocation(program, "impostorCenter");
+        location_radius = glGetUniformLocation(program, "impostorRadius");
+    }
+    glActiveTexture(GL_TEXTURE0 + ALBEDO_UNIT);
+    glBindTexture(GL_TEXTURE_2D, albedo);
+    glActiveTexture(GL_TEXTURE0 + NORMAL_UNIT);
+    glBindTexture(GL_TEXTURE_2D, normals);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(location_albedo, ALBEDO_UNIT);
+    glUniform1i(location_normals, NORMAL_UNIT);
+    glUniform1i(location_frames, frames);
+    glUniform3fv(location_center, 1, center);
+    glUniform1f(location_radius, radius);
+}
+
+
+double Impostor::bakeTime() const {
+    return milliseconds;
+}
+
+
+/*
+ * private
+ * createQuad() - a VAO with no attributes, only the indices of two
+ * triangles. The vertex shader makes the corners from gl_VertexID.
+ */
+void Impostor::createQuad() {
+    const GLushort indices[INDICES] = { 0, 1, 2, 0, 2, 3 };
+    glGenVertexArrays(1, &quadvao);
+    glBindVertexArray(quadvao);
+    glGenBuffers(1, &quadindices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadindices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
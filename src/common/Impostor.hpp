@@ -0,0 +1,93 @@
+/* Impostor.hpp */
+/*
+ * A mesh seen from many directions, rendered once into a texture atlas,
+ * to draw far copies of it as single camera-facing quads.
+ * The atlas is a grid of frames x frames views. The view direction of
+ * each frame comes from its place in the grid by a hemi-octahedral
+ * mapping: the upper half of the unit sphere, folded flat onto a
+ * square. Views from below are not stored; trees are seen from the
+ * side or from above. Each view is an orthographic image of the mesh's
+ * bounding sphere, with the material colour and coverage in one texture
+ * and the object space normal in another, so the quads are lit like the
+ * mesh under any light. Both are mipmapped.
+ * A quad blends the three frames around its view direction (see
+ * shaders/impostorVert.glsl), so the image changes smoothly as the
+ * camera moves around.
+ */
+/* Usage: bake() the mesh once at load time with the tree shader compiled
+ * with IMPOSTOR_BAKE defined. The quads are drawn with the VAO and the
+ * six indices of vao(), instanced, with bind() setting the textures and
+ * uniforms of shaders/impostorVert.glsl and impostorFrag.glsl.
+ * Forest::submit() does this for the far trees. */
+
+#ifndef IMPOSTOR_HPP // Avoid including this header twice
+#define IMPOSTOR_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "TriangleSoup.hpp"
+
+class Impostor {
+
+public:
+
+/* The texture units of the atlas while drawing, after Forest's instance buffer */
+static const int ALBEDO_UNIT = 5;
+static const int NORMAL_UNIT = 6;
+
+/*
+ * Constructor: frames x frames views of framesize x framesize pixels.
+ * No OpenGL calls are made here.
+ */
+Impostor(int frames = 8, int framesize = 128);
+
+/* Destructor: delete the textures and the quad */
+~Impostor();
+
+/*
+ * bake() - render 'mesh' into the atlas with 'program', which takes the
+ * matrix "bakeMVP" and writes colour and coverage to output 0 and the
+ * normal to output 1. The framebuffer, viewport and clear colour are
+ * restored afterwards. Does nothing for an empty mesh.
+ */
+void bake(TriangleSoup &mesh, GLuint program);
+
+/* True once bake() has filled the atlas */
+bool baked() const;
+
+/* The quad: four corners by gl_VertexID, six GL_UNSIGNED_SHORT indices */
+GLuint vao() const;
+static const int INDICES = 6;
+
+/* Bind the atlas and set the impostor uniforms of 'program', which is in use */
+void bind(GLuint program);
+
+/* Milliseconds the last bake() took, measured on the CPU after a glFinish() */
+double bakeTime() const;
+
+private:
+
+int frames, framesize;
+GLuint albedo, normals;  // The atlas textures
+GLuint quadvao, quadindices;
+float center[3];         // The mesh's bounding sphere
+float radius;
+bool done;
+double milliseconds;
+
+GLuint uniformprogram;   // Program the uniform locations below belong to
+GLint location_albedo, location_normals, location_frames, location_center, location_radius;
+
+void createQuad();
+
+Impostor(const Impostor&);            // Not copyable
+Impostor &operator=(const Impostor&);
+
+};
+
+#endif // IMPOSTOR_HPP
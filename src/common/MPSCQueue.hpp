@@ -0,0 +1,95 @@
+/* MPSCQueue.hpp */
+/*
+ * A lock-free, bounded queue for many producer threads and a single
+ * consumer thread (Dmitry Vyukov's bounded queue, a ring of cells with
+ * sequence numbers). All cells are allocated by the constructor, so
+ * push() never allocates memory or takes a lock, and worker threads can
+ * hand results to the OpenGL thread without ever making it wait. A
+ * producer only retries when another producer took the same cell first.
+ */
+/* Usage: make the queue with room for as many values as can ever be
+ * waiting at once. Any thread calls push(value), which returns false if
+ * the queue is full. Only one thread calls pop(value), which returns
+ * false if the queue is empty. A push() that is in progress may stay
+ * invisible to pop() for a moment; the value then shows up on a later
+ * pop(). */
+
+#ifndef MPSCQUEUE_HPP // Avoid including this header twice
+#define MPSCQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+
+template<class T>
+class MPSCQueue {
+
+public:
+
+/* Constructor: an empty queue with room for 'capacity' values, rounded up to a power of two */
+explicit MPSCQueue(int capacity) {
+    size = 1;
+    while((int)size < capacity) size *= 2;
+    cells = new Cell[size];
+    for(size_t i=0; i<size; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    tail = 0;
+}
+
+/* Destructor: drop anything still queued. No other thread may use the queue. */
+~MPSCQueue() {
+    delete[] cells;
+}
+
+/* Add a value at the end. Safe to call from any number of threads. False if the queue is full. */
+bool push(const T &value) {
+    size_t position = head.load(std::memory_order_relaxed);
+    for(;;) {
+        Cell &cell = cells[position & (size - 1)];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)position;
+        if(difference == 0) {
+            // The cell is free: claim it, unless another producer was faster
+            if(head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.value = value;
+                cell.sequence.store(position + 1, std::memory_order_release); // Hands the cell to the consumer
+                return true;
+            }
+        }
+        else if(difference < 0) {
+            return false; // The consumer has not taken this cell's last value yet
+        }
+        else {
+            position = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/* Take the first value. Only one thread at a time may call this. */
+bool pop(T &value) {
+    Cell &cell = cells[tail & (size - 1)];
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if(sequence != tail + 1) return false;
+    value = cell.value;
+    cell.sequence.store(tail + size, std::memory_order_release); // Free for the push one lap later
+    tail++;
+    return true;
+}
+
+private:
+
+struct Cell {
+    std::atomic<size_t> sequence; // == position: free, == position + 1: holds a value
+    T value;
+};
+
+Cell *cells;
+size_t size;               // Number of cells, a power of two
+std::atomic<size_t> head;  // Next position to push, shared by the producers
+size_t tail;               // Next position to pop, owned by the consumer
+
+MPSCQueue(const MPSCQueue&);            // Not copyable
+MPSCQueue &operator=(const MPSCQueue&);
+
+};
+
+#endif // MPSCQUEUE_HPP
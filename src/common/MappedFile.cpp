@@ -0,0 +1,111 @@
+#include "MappedFile.hpp"
+
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define HAVE_MMAP 0
+#endif
+
+/* Constructor: an empty, closed file */
+MappedFile::MappedFile() {
+    contents = NULL;
+    length = 0;
+    mapped = false;
+}
+
+
+/* Destructor: release the mapping */
+MappedFile::~MappedFile() {
+    close();
+}
+
+
+bool MappedFile::open(const char *filename) {
+
+    close();
+
+#if HAVE_MMAP
+    int fd = ::open(filename, O_RDONLY);
+    if(fd < 0) {
+        printError("File not found", filename);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        printError("Cannot stat file", filename);
+        ::close(fd);
+        return false;
+    }
+    length = (size_t)st.st_size;
+    if(length == 0) { // mmap() refuses empty files, but they are valid
+        ::close(fd);
+        return true;
+    }
+    void *addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping stays valid after the descriptor is closed
+    if(addr == MAP_FAILED) {
+        printError("Cannot map file", filename);
+        length = 0;
+        return false;
+    }
+    madvise(addr, length, MADV_SEQUENTIAL);
+    contents = (const char *)addr;
+    mapped = true;
+#else
+    FILE *file = fopen(filename, "rb");
+    if(!file) {
+        printError("File not found", filename);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    length = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *buffer = new char[length > 0 ? length : 1];
+    length = fread(buffer, 1, length, file);
+    fclose(file);
+    contents = buffer;
+    mapped = false;
+#endif
+    return true;
+}
+
+
+void MappedFile::close() {
+    if(contents) {
+#if HAVE_MMAP
+        if(mapped) munmap((void *)contents, length);
+        else delete[] contents;
+#else
+        delete[] contents;
+#endif
+    }
+    contents = NULL;
+    length = 0;
+    mapped = false;
+}
+
+
+const char *MappedFile::data() const {
+    return contents;
+}
+
+
+size_t MappedFile::size() const {
+    return length;
+}
+
+
+/*
+ * private
+ * printError() - Signal an error.
+ * Simple printf() to console for portability.
+ */
+void MappedFile::printError(const char *errtype, const char *errmsg) {
+    fprintf(stderr, "%s: %s\n", errtype, errmsg);
+}
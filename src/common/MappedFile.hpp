@@ -0,0 +1,50 @@
+/* MappedFile.hpp */
+/*
+ * Read-only access to the whole contents of a file through a memory
+ * mapping (mmap() on POSIX systems). On platforms without mmap() the
+ * file is read into a heap buffer instead, behind the same interface.
+ */
+/* Usage: call open() with a file name, then use data() and size().
+ * The mapping is released by close() or by the destructor. */
+
+#ifndef MAPPEDFILE_HPP // Avoid including this header twice
+#define MAPPEDFILE_HPP
+
+#include <cstddef> // For size_t
+
+class MappedFile {
+
+public:
+
+/* Constructor: an empty, closed file */
+MappedFile();
+
+/* Destructor: release the mapping */
+~MappedFile();
+
+/* Map the named file. Returns false (and prints an error) on failure. */
+bool open(const char *filename);
+
+/* Release the mapping */
+void close();
+
+/* Start of the file contents, or NULL if nothing is mapped */
+const char *data() const;
+
+/* Size of the file in bytes */
+size_t size() const;
+
+private:
+
+const char *contents;
+size_t length;
+bool mapped; // true if contents came from mmap(), false if from new[]
+
+MappedFile(const MappedFile&);            // Not copyable
+MappedFile &operator=(const MappedFile&);
+
+void printError(const char *errtype, const char *errmsg);
+
+};
+
+#endif // MAPPEDFILE_HPP
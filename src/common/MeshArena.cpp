@@ -0,0 +1,500 @@
+#include "MeshArena.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef GL_DRAW_INDIRECT_BUFFER // OpenGL 4.0, not in every 3.3 header
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+namespace {
+
+#ifdef _WIN32
+typedef void (__stdcall *MultiDrawElementsIndirectProc)(GLenum mode, GLenum type,
+    const void *indirect, GLsizei drawcount, GLsizei stride);
+#else
+typedef void (*MultiDrawElementsIndirectProc)(GLenum mode, GLenum type,
+    const void *indirect, GLsizei drawcount, GLsizei stride);
+#endif
+
+MultiDrawElementsIndirectProc multiDrawElementsIndirect = NULL;
+GLuint indirectbuffer = 0;   // Commands of the last multiDraw()
+long long drawcalls = 0, drawcommands = 0;
+
+/* The arenas made by shared() */
+struct SharedArena {
+    GLsizei stride;
+    void (*setupAttribs)();
+    GLenum indextype;
+    MeshArena *arena;
+};
+std::vector<SharedArena> sharedarenas;
+
+/* Allocations by offset, for defragment() */
+struct ByOffset {
+    const std::vector<int> *offsets;
+    bool operator()(int a, int b) const { return (*offsets)[a] < (*offsets)[b]; }
+};
+
+}
+
+
+MeshArena::MeshArena(GLsizei stride, void (*setupAttribs)(), GLenum indextype,
+                     int initialvertices, int initialindices) {
+    vertexstride = stride;
+    setupattribs = setupAttribs;
+    this->indextype = indextype;
+    indexsize = (indextype == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    this->initialvertices = std::max(1, initialvertices);
+    this->initialindices = std::max(1, initialindices);
+    vertexarray = 0;
+    vertexbuffer = indexbuffer = 0;
+}
+
+
+MeshArena::~MeshArena() {
+    if(vertexarray) glDeleteVertexArrays(1, &vertexarray);
+    if(vertexbuffer) glDeleteBuffers(1, &vertexbuffer);
+    if(indexbuffer) glDeleteBuffers(1, &indexbuffer);
+}
+
+
+MeshArena *MeshArena::shared(GLsizei stride, void (*setupAttribs)(), GLenum indextype) {
+    for(size_t i=0; i<sharedarenas.size(); i++) {
+        if(sharedarenas[i].stride == stride && sharedarenas[i].setupAttribs == setupAttribs
+           && sharedarenas[i].indextype == indextype) return sharedarenas[i].arena;
+    }
+    SharedArena entry = { stride, setupAttribs, indextype, new MeshArena(stride, setupAttribs, indextype) };
+    sharedarenas.push_back(entry);
+    return entry.arena;
+}
+
+
+int MeshArena::allocate(int vertices, int indices) {
+
+    if(vertices < 0 || indices < 0) return -1;
+    if(!vertexarray) createBuffers();
+
+    Allocation a = { 0, vertices, 0, indices, true };
+    if(vertices > 0) {
+        a.vertexoffset = vertexranges.allocate(vertices);
+        if(a.vertexoffset < 0 && growVertices(vertices)) a.vertexoffset = vertexranges.allocate(vertices);
+        if(a.vertexoffset < 0) {
+            Utilities::printError("MeshArena", "no room for the vertices");
+            return -1;
+        }
+    }
+    if(indices > 0) {
+        a.indexoffset = indexranges.allocate(indices);
+        if(a.indexoffset < 0 && growIndices(indices)) a.indexoffset = indexranges.allocate(indices);
+        if(a.indexoffset < 0) {
+            if(vertices > 0) vertexranges.release(a.vertexoffset, vertices);
+            Utilities::printError("MeshArena", "no room for the indices");
+            return -1;
+        }
+    }
+
+    if(!freehandles.empty()) {
+        int handle = freehandles.back();
+        freehandles.pop_back();
+        allocations[handle] = a;
+        return handle;
+    }
+    allocations.push_back(a);
+    return (int)allocations.size() - 1;
+}
+
+
+void MeshArena::release(int allocation) {
+    if(!valid(allocation)) return;
+    Allocation &a = allocations[allocation];
+    if(a.vertices > 0) vertexranges.release(a.vertexoffset, a.vertices);
+    if(a.indices > 0) indexranges.release(a.indexoffset, a.indices);
+    a.live = false;
+    freehandles.push_back(allocation);
+}
+
+
+void MeshArena::writeVertices(int allocation, const void *data) {
+    if(!valid(allocation) || allocations[allocation].vertices == 0) return;
+    const Allocation &a = allocations[allocation];
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)a.vertexoffset * vertexstride,
+        (GLsizeiptr)a.vertices * vertexstride, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void MeshArena::writeIndices(int allocation, const void *data) {
+    if(!valid(allocation) || allocations[allocation].indices == 0) return;
+    const Allocation &a = allocations[allocation];
+    // The element array binding belongs to the VAO, so use another target
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexbuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)a.indexoffset * indexsize,
+        (GLsizeiptr)a.indices * indexsize, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+
+void MeshArena::copyVertices(int allocation, GLuint buffer) {
+    if(!valid(allocation) || allocations[allocation].vertices == 0) return;
+    const Allocation &a = allocations[allocation];
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertexbuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+        (GLintptr)a.vertexoffset * vertexstride, (GLsizeiptr)a.vertices * vertexstride);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+
+GLint MeshArena::baseVertex(int allocation) const {
+    return valid(allocation) ? allocations[allocation].vertexoffset : 0;
+}
+
+
+GLuint MeshArena::firstIndex(int allocation) const {
+    return valid(allocation) ? allocations[allocation].indexoffset : 0;
+}
+
+
+int MeshArena::indexCount(int allocation) const {
+    return valid(allocation) ? allocations[allocation].indices : 0;
+}
+
+
+MeshArena::DrawCommand MeshArena::command(int vertices, int indices, GLuint instances, GLuint baseinstance) const {
+    DrawCommand command;
+    command.count = indexCount(indices);
+    command.instances = instances;
+    command.firstindex = firstIndex(indices);
+    command.basevertex = baseVertex(vertices);
+    command.baseinstance = baseinstance;
+    return command;
+}
+
+
+MeshArena::DrawCommand MeshArena::command(int allocation) const {
+    return command(allocation, allocation);
+}
+
+
+GLuint MeshArena::vao() {
+    if(!vertexarray) createBuffers();
+    return vertexarray;
+}
+
+
+GLsizei MeshArena::stride() const {
+    return vertexstride;
+}
+
+
+GLenum MeshArena::indexType() const {
+    return indextype;
+}
+
+
+void MeshArena::multiDraw(GLenum indextype, const DrawCommand *commands, int count) {
+
+    if(count <= 0) return;
+    drawcommands += count;
+
+    if(multiDrawIndirect()) {
+        if(!indirectbuffer) glGenBuffers(1, &indirectbuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectbuffer);
+        // A new buffer each time, so the driver never waits for the last draw
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, count * sizeof(DrawCommand), commands, GL_STREAM_DRAW);
+        multiDrawElementsIndirect(GL_TRIANGLES, indextype, (const void*)0, count, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        drawcalls++;
+        return;
+    }
+
+    GLsizei indexsize = (indextype == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    for(int i=0; i<count; i++) {
+        const DrawCommand &c = commands[i];
+        if(c.count == 0 || c.instances == 0) continue;
+        const void *offset = (const void*)((size_t)c.firstindex * indexsize);
+        if(c.instances > 1)
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, c.count, indextype, offset, c.instances, c.basevertex);
+        else
+            glDrawElementsBaseVertex(GL_TRIANGLES, c.count, indextype, offset, c.basevertex);
+        drawcalls++;
+    }
+}
+
+
+/*
+ * multiDrawIndirect() - OpenGL 4.3 or GL_ARB_multi_draw_indirect, and
+ * OpenGL 4.2 or GL_ARB_base_instance, without which the baseinstance of
+ * a command is ignored, and the function could be found. Checked once.
+ */
+bool MeshArena::multiDrawIndirect() {
+    static int supported = -1; // Not checked yet
+    if(supported < 0) {
+        supported = 0;
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool multidraw = major > 4 || (major == 4 && minor >= 3);
+        bool baseinstance = major > 4 || (major == 4 && minor >= 2);
+        GLint extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+        for(GLint i=0; i<extensions && !(multidraw && baseinstance); i++) {
+            const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if(!name) continue;
+            if(!strcmp(name, "GL_ARB_multi_draw_indirect")) multidraw = true;
+            if(!strcmp(name, "GL_ARB_base_instance")) baseinstance = true;
+        }
+        if(multidraw && baseinstance) {
+            multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)glfwGetProcAddress("glMultiDrawElementsIndirect");
+            supported = multiDrawElementsIndirect ? 1 : 0;
+        }
+    }
+    return supported == 1;
+}
+
+
+long long MeshArena::drawCalls() {
+    return drawcalls;
+}
+
+
+long long MeshArena::drawCommands() {
+    return drawcommands;
+}
+
+
+long long MeshArena::defragment() {
+
+    if(!vertexarray) return 0;
+
+    std::vector<int> live;
+    for(size_t i=0; i<allocations.size(); i++) {
+        if(allocations[i].live) live.push_back((int)i);
+    }
+    long long copied = 0;
+
+    // Vertices, then indices: copy the ranges in order into a new buffer
+    for(int pass=0; pass<2; pass++) {
+        std::vector<int> offsets(allocations.size(), 0);
+        for(size_t i=0; i<allocations.size(); i++) {
+            offsets[i] = pass == 0 ? allocations[i].vertexoffset : allocations[i].indexoffset;
+        }
+        ByOffset order = { &offsets };
+        std::sort(live.begin(), live.end(), order);
+
+        Ranges &ranges = pass == 0 ? vertexranges : indexranges;
+        GLuint &buffer = pass == 0 ? vertexbuffer : indexbuffer;
+        GLsizeiptr elementsize = pass == 0 ? vertexstride : indexsize;
+
+        GLuint compacted;
+        glGenBuffers(1, &compacted);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, compacted);
+        glBufferData(GL_COPY_WRITE_BUFFER, ranges.capacity() * elementsize, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        int used = 0;
+        for(size_t i=0; i<live.size(); i++) {
+            Allocation &a = allocations[live[i]];
+            int &offset = pass == 0 ? a.vertexoffset : a.indexoffset;
+            int size = pass == 0 ? a.vertices : a.indices;
+            if(size == 0) continue;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                offset * elementsize, used * elementsize, size * elementsize);
+            copied += size * elementsize;
+            offset = used;
+            used += size;
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = compacted;
+        ranges.reset(ranges.capacity(), used);
+    }
+
+    attachBuffers();
+    return copied;
+}
+
+
+float MeshArena::fragmentation() const {
+    float worst = 0.0f;
+    const Ranges *ranges[2] = { &vertexranges, &indexranges };
+    for(int i=0; i<2; i++) {
+        if(ranges[i]->freeSpace() > 0) {
+            worst = std::max(worst, 1.0f - (float)ranges[i]->largest() / ranges[i]->freeSpace());
+        }
+    }
+    return worst;
+}
+
+
+void MeshArena::printStats(const char *name) const {
+    int live = 0;
+    for(size_t i=0; i<allocations.size(); i++) if(allocations[i].live) live++;
+    printf("%s: %d meshes, vertices %d of %d used (%d free ranges), indices %d of %d used (%d free ranges)\n",
+        name, live,
+        vertexranges.capacity() - vertexranges.freeSpace(), vertexranges.capacity(), vertexranges.count(),
+        indexranges.capacity() - indexranges.freeSpace(), indexranges.capacity(), indexranges.count());
+}
+
+
+/*
+ * private
+ * createBuffers() - the VAO and the buffers at the size given to the constructor
+ */
+void MeshArena::createBuffers() {
+    glGenVertexArrays(1, &vertexarray);
+    glGenBuffers(1, &vertexbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)initialvertices * vertexstride, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glGenBuffers(1, &indexbuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexbuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)initialindices * indexsize, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    vertexranges.reset(initialvertices, 0);
+    indexranges.reset(initialindices, 0);
+    attachBuffers();
+}
+
+
+/* private: double the vertex buffer until 'needed' more vertices fit */
+bool MeshArena::growVertices(int needed) {
+    int capacity = vertexranges.capacity();
+    int grown = capacity;
+    while(grown - capacity < needed && grown < (1 << 30)) grown *= 2;
+    if(grown - capacity < needed) return false;
+    vertexbuffer = resizeBuffer(vertexbuffer,
+        (GLsizeiptr)capacity * vertexstride, (GLsizeiptr)grown * vertexstride);
+    vertexranges.grow(grown);
+    attachBuffers();
+    return true;
+}
+
+
+/* private: double the index buffer until 'needed' more indices fit */
+bool MeshArena::growIndices(int needed) {
+    int capacity = indexranges.capacity();
+    int grown = capacity;
+    while(grown - capacity < needed && grown < (1 << 30)) grown *= 2;
+    if(grown - capacity < needed) return false;
+    indexbuffer = resizeBuffer(indexbuffer,
+        (GLsizeiptr)capacity * indexsize, (GLsizeiptr)grown * indexsize);
+    indexranges.grow(grown);
+    attachBuffers();
+    return true;
+}
+
+
+/*
+ * private
+ * attachBuffers() - point the VAO at the current buffers. Other state of
+ * the VAO, like attributes that users of the arena added, is kept.
+ */
+void MeshArena::attachBuffers() {
+    glBindVertexArray(vertexarray);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    setupattribs();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
+    // Do NOT unbind the index buffer while the VAO is still bound
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+
+/* private */
+bool MeshArena::valid(int allocation) const {
+    return allocation >= 0 && allocation < (int)allocations.size() && allocations[allocation].live;
+}
+
+
+/* private: a bigger buffer with the contents of the old one, which is deleted */
+GLuint MeshArena::resizeBuffer(GLuint buffer, GLsizeiptr oldsize, GLsizeiptr newsize) {
+    GLuint resized;
+    glGenBuffers(1, &resized);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+    glBufferData(GL_COPY_WRITE_BUFFER, newsize, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldsize);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    return resized;
+}
+
+
+MeshArena::Ranges::Ranges() {
+    total = 0;
+}
+
+
+void MeshArena::Ranges::reset(int capacity, int used) {
+    free.clear();
+    total = capacity;
+    if(used < capacity) free[used] = capacity - used;
+}
+
+
+/* First fit, from the lowest offset, so the start of the buffer fills up first */
+int MeshArena::Ranges::allocate(int size) {
+    for(std::map<int, int>::iterator it = free.begin(); it != free.end(); ++it) {
+        if(it->second < size) continue;
+        int offset = it->first, left = it->second - size;
+        free.erase(it);
+        if(left > 0) free[offset + size] = left;
+        return offset;
+    }
+    return -1;
+}
+
+
+/* Merge with the free ranges right before and after */
+void MeshArena::Ranges::release(int offset, int size) {
+    std::map<int, int>::iterator next = free.lower_bound(offset);
+    if(next != free.end() && offset + size == next->first) {
+        size += next->second;
+        next = free.erase(next);
+    }
+    if(next != free.begin()) {
+        std::map<int, int>::iterator previous = next;
+        --previous;
+        if(previous->first + previous->second == offset) {
+            previous->second += size;
+            return;
+        }
+    }
+    free[offset] = size;
+}
+
+
+void MeshArena::Ranges::grow(int capacity) {
+    if(capacity > total) release(total, capacity - total);
+    total = capacity;
+}
+
+
+int MeshArena::Ranges::capacity() const {
+    return total;
+}
+
+
+int MeshArena::Ranges::freeSpace() const {
+    int sum = 0;
+    for(std::map<int, int>::const_iterator it = free.begin(); it != free.end(); ++it) sum += it->second;
+    return sum;
+}
+
+
+int MeshArena::Ranges::largest() const {
+    int size = 0;
+    for(std::map<int, int>::const_iterator it = free.begin(); it != free.end(); ++it) size = std::max(size, it->second);
+    return size;
+}
+
+
+int MeshArena::Ranges::count() const {
+    return (int)free.size();
+}
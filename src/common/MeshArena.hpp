@@ -0,0 +1,184 @@
+/* MeshArena.hpp */
+/*
+ * One large vertex buffer and one index buffer for many meshes that
+ * share a vertex layout and an index type, with a single VAO. Meshes
+ * are ranges of the buffers, handed out by a first-fit allocator that
+ * merges neighbouring free ranges when a mesh is released. A mesh is
+ * drawn with its first index and base vertex, so its indices stay
+ * local and 16-bit indices still work for meshes of up to 65536
+ * vertices. Since all meshes use the same VAO, drawing one after the
+ * other needs no VAO switch.
+ * When a buffer is full it grows to twice its size. The data is copied
+ * on the GPU and the VAO is pointed at the new buffer. defragment()
+ * moves all meshes to the start of the buffers, leaving one free range
+ * at the end.
+ * multiDraw() draws a list of DrawCommands, built on the CPU, with one
+ * glMultiDrawElementsIndirect() call where the driver has OpenGL 4.3, or
+ * GL_ARB_multi_draw_indirect and GL_ARB_base_instance. Other drivers get
+ * one draw per command.
+ */
+/* Usage: shared() returns the arena for a layout, which lives until
+ * the program exits (TriangleSoup uses these), or construct one of your
+ * own (TileManager does). allocate() room for a mesh, write its vertices
+ * and indices, and draw it with command() and multiDraw(), with vao()
+ * bound. Offsets change when a buffer grows or is defragmented, so ask
+ * for them again each frame instead of keeping them. */
+
+#ifndef MESHARENA_HPP // Avoid including this header twice
+#define MESHARENA_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <map>
+#include <vector>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+
+class MeshArena {
+
+public:
+
+/* The layout of DrawElementsIndirectCommand, the command of an indirect draw */
+struct DrawCommand {
+    GLuint count;         // Indices to draw
+    GLuint instances;
+    GLuint firstindex;
+    GLint basevertex;
+    GLuint baseinstance;  // Only used with multiDrawIndirect()
+};
+
+/* Room for this many vertices and indices when the buffers are created, unless the constructor is told otherwise */
+static const int INITIALVERTICES = 1 << 16;
+static const int INITIALINDICES = 1 << 18;
+
+/*
+ * Constructor: an empty arena for vertices of 'stride' bytes, whose
+ * attributes are set up by 'setupAttribs' (see VertexLayout.hpp), and
+ * indices of 'indextype'. The buffers start with room for
+ * 'initialvertices' and 'initialindices'. No OpenGL calls are made here.
+ */
+MeshArena(GLsizei stride, void (*setupAttribs)(), GLenum indextype,
+          int initialvertices = INITIALVERTICES, int initialindices = INITIALINDICES);
+
+/* Destructor: delete the buffers and the VAO */
+~MeshArena();
+
+/* The shared arena for a layout and index type, made on first use */
+static MeshArena *shared(GLsizei stride, void (*setupAttribs)(), GLenum indextype);
+
+/*
+ * allocate() - room for a mesh. Either count may be zero, e.g. for
+ * meshes that share the indices of another allocation. Returns the
+ * handle of the allocation, or -1 (and prints why) on failure.
+ */
+int allocate(int vertices, int indices);
+
+/* Give the ranges of an allocation back to the arena */
+void release(int allocation);
+
+/* Fill in the vertices or the indices of an allocation */
+void writeVertices(int allocation, const void *data);
+void writeIndices(int allocation, const void *data);
+
+/* Copy the vertices of an allocation from the start of another buffer */
+void copyVertices(int allocation, GLuint buffer);
+
+/* Where an allocation is now */
+GLint baseVertex(int allocation) const;
+GLuint firstIndex(int allocation) const;
+int indexCount(int allocation) const;
+
+/*
+ * command() - draw the indices of 'indices' with the vertices of
+ * 'vertices', which may be the same allocation.
+ */
+DrawCommand command(int vertices, int indices, GLuint instances = 1, GLuint baseinstance = 0) const;
+DrawCommand command(int allocation) const;
+
+/* The VAO of all meshes in the arena. Creates the buffers on first use. */
+GLuint vao();
+
+GLsizei stride() const;
+GLenum indexType() const;
+
+/*
+ * multiDraw() - draw 'count' commands as GL_TRIANGLES with the VAO of
+ * an arena bound. One call with an indirect buffer if the driver can,
+ * otherwise one call per command.
+ */
+static void multiDraw(GLenum indextype, const DrawCommand *commands, int count);
+
+/* True if multiDraw() makes a single indirect draw call, and honours baseinstance */
+static bool multiDrawIndirect();
+
+/* Draw calls made and commands drawn by multiDraw(), in total */
+static long long drawCalls();
+static long long drawCommands();
+
+/*
+ * defragment() - move all meshes to the start of the buffers, in the
+ * order they are in now. Returns the bytes copied. Not while a frame
+ * that uses the old offsets is being recorded.
+ */
+long long defragment();
+
+/* 1 - largest free range / all free space, for vertices or indices, whichever is worse. 0 is no fragmentation. */
+float fragmentation() const;
+
+/* Print the used and free space and the number of free ranges */
+void printStats(const char *name) const;
+
+private:
+
+/* Free ranges of a buffer, in elements, by offset */
+class Ranges {
+public:
+    Ranges();
+    void reset(int capacity, int used);
+    int allocate(int size);           // Offset, or -1 if no range is big enough
+    void release(int offset, int size);
+    void grow(int capacity);
+    int capacity() const;
+    int freeSpace() const;
+    int largest() const;
+    int count() const;
+private:
+    std::map<int, int> free;          // Offset -> size
+    int total;
+};
+
+struct Allocation {
+    int vertexoffset, vertices;
+    int indexoffset, indices;
+    bool live;
+};
+
+GLsizei vertexstride;
+void (*setupattribs)();
+GLenum indextype;
+int indexsize;
+int initialvertices, initialindices;
+
+GLuint vertexarray;
+GLuint vertexbuffer, indexbuffer;
+Ranges vertexranges, indexranges;
+std::vector<Allocation> allocations;
+std::vector<int> freehandles;
+
+void createBuffers();
+bool growVertices(int needed);
+bool growIndices(int needed);
+void attachBuffers();
+bool valid(int allocation) const;
+static GLuint resizeBuffer(GLuint buffer, GLsizeiptr oldsize, GLsizeiptr newsize);
+
+MeshArena(const MeshArena&);            // Not copyable
+MeshArena &operator=(const MeshArena&);
+
+};
+
+#endif // MESHARENA_HPP
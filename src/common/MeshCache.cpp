@@ -0,0 +1,263 @@
+#include "MeshCache.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace {
+
+/* Modification time and size of a file. Returns false if it does not exist. */
+bool fileKey(const char *filename, int64_t &mtime, uint64_t &size) {
+    struct stat st;
+    if(stat(filename, &st) != 0) return false;
+    mtime = (int64_t)st.st_mtime;
+    size = (uint64_t)st.st_size;
+    return true;
+}
+
+uint64_t alignUp(uint64_t x) {
+    return (x + MESHFILE_ALIGN - 1) & ~(uint64_t)(MESHFILE_ALIGN - 1);
+}
+
+/* A blob of 'bytes' at 'offset' lies within a file of 'size' bytes, without overflowing */
+bool inside(uint64_t offset, uint64_t bytes, uint64_t size) {
+    return offset <= size && bytes <= size - offset;
+}
+
+/* Whole triangles, and every index refers to one of the 'nverts' vertices */
+template<class Index>
+bool indicesValid(const Index *indices, uint64_t nindices, uint64_t nverts) {
+    if(nindices % 3 != 0) return false;
+    for(uint64_t i=0; i<nindices; i++) {
+        if(indices[i] >= nverts) return false;
+    }
+    return true;
+}
+
+}
+
+
+/* Constructor: nothing mapped */
+MeshCache::MeshCache() {
+    head = NULL;
+}
+
+
+/* Destructor: unmap */
+MeshCache::~MeshCache() {
+    close();
+}
+
+
+void MeshCache::cacheName(const char *sourcefile, char *cachefile, int size) {
+    snprintf(cachefile, size, "%s.mesh", sourcefile);
+}
+
+
+bool MeshCache::open(const char *cachefile, const char *sourcefile) {
+
+    close();
+
+    int64_t mtime;
+    uint64_t size;
+    if(!fileKey(sourcefile, mtime, size)) return false;
+
+    FILE *probe = fopen(cachefile, "rb"); // Keep quiet if there is no cache yet
+    if(!probe) return false;
+    fclose(probe);
+    if(!file.open(cachefile)) return false;
+
+    const MeshFileHeader *h = (const MeshFileHeader *)file.data();
+    bool valid = file.size() >= sizeof(MeshFileHeader)
+        && h->magic == MESHFILE_MAGIC
+        && h->version == MESHFILE_VERSION
+        && h->headersize == sizeof(MeshFileHeader)
+        && h->byteorder == 0x01020304u
+        && strncmp(h->sourcepath, sourcefile, MESHFILE_MAXPATH) == 0
+        && h->nattribs <= MESHFILE_MAXATTRIBS
+        && (h->indexsize == 2 || h->indexsize == 4)
+        && h->nindices % 3 == 0
+        && inside(h->vertexoffset, h->vertexbytes, file.size())
+        && inside(h->indexoffset, h->indexbytes, file.size())
+        && h->vertexbytes == (uint64_t)h->nverts * h->vertexstride
+        && h->indexbytes == (uint64_t)h->nindices * h->indexsize;
+    if(valid) { // One pass over the indices, so a draw never reads past the vertices
+        const void *indexdata = file.data() + h->indexoffset;
+        valid = (h->indexsize == 2) ? indicesValid((const uint16_t *)indexdata, h->nindices, h->nverts)
+            : indicesValid((const uint32_t *)indexdata, h->nindices, h->nverts);
+    }
+    if(!valid) {
+        printError("Ignoring outdated or damaged mesh cache", cachefile);
+        close();
+        return false;
+    }
+
+    // Same time stamp and size: trust it. Otherwise compare the contents,
+    // since a checkout or a copy changes the time but not the data.
+    if(h->sourcemtime != mtime || h->sourcesize != size) {
+        MappedFile source;
+        if(!source.open(sourcefile) || hash(source.data(), source.size()) != h->sourcehash) {
+            close();
+            return false;
+        }
+        // Same contents: store the new key, so the next open() need not hash again
+        updateKey(cachefile, mtime, size);
+    }
+
+    head = h;
+    return true;
+}
+
+
+void MeshCache::close() {
+    file.close();
+    head = NULL;
+}
+
+
+const MeshFileHeader *MeshCache::header() const {
+    return head;
+}
+
+
+const void *MeshCache::vertices() const {
+    return head ? file.data() + head->vertexoffset : NULL;
+}
+
+
+const void *MeshCache::indices() const {
+    return head ? file.data() + head->indexoffset : NULL;
+}
+
+
+bool MeshCache::write(const char *cachefile, const char *sourcefile,
+                      const void *vertexdata, int nverts, int vertexstride,
+                      const MeshFileAttrib *attribs, int nattribs,
+                      const void *indexdata, int nindices, int indexsize,
+                      const float *boundsmin, const float *boundsmax) {
+
+    MeshFileHeader h;
+    memset(&h, 0, sizeof(h));
+
+    if(nattribs > MESHFILE_MAXATTRIBS || strlen(sourcefile) >= MESHFILE_MAXPATH) return false;
+    bool valid = (indexsize == 2) ? indicesValid((const uint16_t *)indexdata, nindices, nverts)
+        : (indexsize == 4) && indicesValid((const uint32_t *)indexdata, nindices, nverts);
+    if(nverts < 0 || nindices < 0 || !valid) {
+        printError("Not caching a damaged mesh", sourcefile);
+        return false;
+    }
+    if(!fileKey(sourcefile, h.sourcemtime, h.sourcesize)) return false;
+    {
+        MappedFile source;
+        if(!source.open(sourcefile)) return false;
+        h.sourcehash = hash(source.data(), source.size());
+    }
+
+    h.magic = MESHFILE_MAGIC;
+    h.version = MESHFILE_VERSION;
+    h.headersize = sizeof(MeshFileHeader);
+    h.byteorder = 0x01020304u;
+    strncpy(h.sourcepath, sourcefile, MESHFILE_MAXPATH - 1);
+    memcpy(h.boundsmin, boundsmin, 3*sizeof(float));
+    memcpy(h.boundsmax, boundsmax, 3*sizeof(float));
+    h.nverts = nverts;
+    h.nindices = nindices;
+    h.vertexstride = vertexstride;
+    h.indexsize = indexsize;
+    h.nattribs = nattribs;
+    memcpy(h.attribs, attribs, nattribs*sizeof(MeshFileAttrib));
+    h.vertexoffset = alignUp(sizeof(MeshFileHeader));
+    h.vertexbytes = (uint64_t)nverts * vertexstride;
+    h.indexoffset = alignUp(h.vertexoffset + h.vertexbytes);
+    h.indexbytes = (uint64_t)nindices * indexsize;
+
+    char tmpname[MESHFILE_MAXPATH + 16];
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", cachefile);
+    FILE *out = fopen(tmpname, "wb");
+    if(!out) {
+        printError("Cannot write mesh cache", tmpname);
+        return false;
+    }
+
+    static const char zeros[MESHFILE_ALIGN] = {0};
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1;
+    ok = ok && fwrite(zeros, 1, h.vertexoffset - sizeof(h), out) == h.vertexoffset - sizeof(h);
+    ok = ok && fwrite(vertexdata, 1, h.vertexbytes, out) == h.vertexbytes;
+    uint64_t pad = h.indexoffset - (h.vertexoffset + h.vertexbytes);
+    ok = ok && fwrite(zeros, 1, pad, out) == pad;
+    ok = ok && fwrite(indexdata, 1, h.indexbytes, out) == h.indexbytes;
+    ok = (fclose(out) == 0) && ok;
+
+    remove(cachefile); // rename() does not replace existing files on Windows
+    if(!ok || rename(tmpname, cachefile) != 0) {
+        remove(tmpname);
+        printError("Cannot write mesh cache", cachefile);
+        return false;
+    }
+    return true;
+}
+
+
+/* The attributes of TriangleSoup's interleaved float layout */
+static const MeshFileAttrib interleavedAttribs[3] = {
+    { 0, 3, MESHFILE_FLOAT, MESHFILE_FALSE, 0 },                 // xyz coordinates
+    { 1, 3, MESHFILE_FLOAT, MESHFILE_FALSE, 3*sizeof(float) },   // normals
+    { 2, 2, MESHFILE_FLOAT, MESHFILE_FALSE, 6*sizeof(float) }    // texcoords
+};
+
+
+bool MeshCache::writeInterleaved(const char *cachefile, const char *sourcefile,
+                                 const float *vertexarray, int nverts,
+                                 const unsigned int *indexarray, int nindices) {
+
+    float boundsmin[3] = { 0.0f, 0.0f, 0.0f };
+    float boundsmax[3] = { 0.0f, 0.0f, 0.0f };
+    for(int i=0; i<nverts; i++) {
+        for(int k=0; k<3; k++) {
+            float x = vertexarray[8*i+k];
+            if(i == 0 || x < boundsmin[k]) boundsmin[k] = x;
+            if(i == 0 || x > boundsmax[k]) boundsmax[k] = x;
+        }
+    }
+    return write(cachefile, sourcefile, vertexarray, nverts, 8*sizeof(float),
+                 interleavedAttribs, 3, indexarray, nindices, sizeof(unsigned int),
+                 boundsmin, boundsmax);
+}
+
+
+uint64_t MeshCache::hash(const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = 14695981039346656037ull;
+    for(size_t i=0; i<size; i++) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+
+/*
+ * private
+ * updateKey() - write a new modification time and size into the header
+ * of a cache file. The mapping is read-only, so this goes through a
+ * file handle. Failing is harmless, the contents are hashed again next time.
+ */
+void MeshCache::updateKey(const char *cachefile, int64_t mtime, uint64_t size) {
+    FILE *out = fopen(cachefile, "r+b");
+    if(!out) return;
+    if(fseek(out, (long)offsetof(MeshFileHeader, sourcemtime), SEEK_SET) == 0
+       && fwrite(&mtime, sizeof(mtime), 1, out) == 1) {
+        fwrite(&size, sizeof(size), 1, out); // sourcesize follows sourcemtime
+    }
+    fclose(out);
+}
+
+
+/*
+ * private
+ * printError() - Signal an error.
+ * Simple printf() to console for portability.
+ */
+void MeshCache::printError(const char *errtype, const char *errmsg) {
+    fprintf(stderr, "%s: %s\n", errtype, errmsg);
+}
@@ -0,0 +1,141 @@
+/* MeshCache.hpp */
+/*
+ * A versioned binary mesh format that can be memory mapped and handed
+ * straight to glBufferData(), used as a cache for parsed OBJ files in
+ * the vertex format they are drawn in (see TriangleSoup::readOBJ()).
+ * Layout of a file:
+ *   MeshFileHeader (magic, version, source key, bounds, vertex layout)
+ *   vertex blob, aligned to MESHFILE_ALIGN bytes
+ *   index blob, aligned to MESHFILE_ALIGN bytes
+ * The cache file for "objects/Tree.obj" is "objects/Tree.obj.mesh".
+ * It is valid if its version matches and it was written from a source
+ * file with the same path and either the same modification time and size,
+ * or the same contents (FNV-1a hash), e.g. after a fresh checkout. In
+ * the latter case the new time and size are written to the header.
+ * Both write() and open() refuse meshes with an index outside the
+ * vertices. open() also checks that the header is consistent with the
+ * file size, so a damaged file is never drawn.
+ */
+/* Usage: MeshCache::write() stores a mesh. open() maps a cache file and
+ * checks it against its source. After a successful open(), vertices()
+ * and indices() point into the mapping, valid until close(). */
+
+#ifndef MESHCACHE_HPP // Avoid including this header twice
+#define MESHCACHE_HPP
+
+#include "MappedFile.hpp"
+
+#include <stdint.h>
+
+#define MESHFILE_MAGIC   0x4853454du // "MESH" read as a little endian word
+#define MESHFILE_VERSION 1
+#define MESHFILE_ALIGN   64
+#define MESHFILE_MAXATTRIBS 8
+#define MESHFILE_MAXPATH 256
+
+// OpenGL enums used in attribute descriptions. Defined here so that tools
+// can write mesh files without including any OpenGL headers.
+#define MESHFILE_FLOAT 0x1406 // GL_FLOAT
+#define MESHFILE_FALSE 0      // GL_FALSE
+
+/* One vertex attribute, on the form glVertexAttribPointer() wants it */
+struct MeshFileAttrib {
+    uint32_t location;   // Attribute location in the shader
+    uint32_t components; // 1 to 4
+    uint32_t type;       // GL_FLOAT, GL_HALF_FLOAT, GL_SHORT...
+    uint32_t normalized; // GL_TRUE or GL_FALSE
+    uint32_t offset;     // Byte offset within a vertex
+};
+
+struct MeshFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headersize;  // sizeof(MeshFileHeader), a sanity check
+    uint32_t byteorder;   // 0x01020304 as written by the creating machine
+
+    // Cache key: where the mesh came from
+    char sourcepath[MESHFILE_MAXPATH];
+    int64_t sourcemtime;
+    uint64_t sourcesize;
+    uint64_t sourcehash;
+
+    float boundsmin[3];
+    float boundsmax[3];
+
+    uint32_t nverts;
+    uint32_t nindices;
+    uint32_t vertexstride; // Bytes per vertex
+    uint32_t indexsize;    // Bytes per index, 2 or 4
+    uint32_t nattribs;
+    MeshFileAttrib attribs[MESHFILE_MAXATTRIBS];
+
+    uint64_t vertexoffset; // Byte offset of the vertex blob from the file start
+    uint64_t vertexbytes;
+    uint64_t indexoffset;
+    uint64_t indexbytes;
+};
+
+class MeshCache {
+
+public:
+
+/* Constructor: nothing mapped */
+MeshCache();
+
+/* Destructor: unmap */
+~MeshCache();
+
+/* Name of the cache file that belongs to a source file */
+static void cacheName(const char *sourcefile, char *cachefile, int size);
+
+/*
+ * open() - map a cache file and check that it is current for the given
+ * source file. Returns false if it is missing, stale or damaged.
+ */
+bool open(const char *cachefile, const char *sourcefile);
+
+/* Unmap the file */
+void close();
+
+/* The header, or NULL if nothing is open */
+const MeshFileHeader *header() const;
+
+/* Vertex and index data inside the mapping */
+const void *vertices() const;
+const void *indices() const;
+
+/*
+ * write() - store a mesh with the given vertex layout, keyed on the
+ * source file's path, modification time, size and contents.
+ * The file is written under a temporary name and then renamed, so a
+ * crash never leaves a half-written cache behind.
+ */
+static bool write(const char *cachefile, const char *sourcefile,
+                  const void *vertexdata, int nverts, int vertexstride,
+                  const MeshFileAttrib *attribs, int nattribs,
+                  const void *indexdata, int nindices, int indexsize,
+                  const float *boundsmin, const float *boundsmax);
+
+/*
+ * writeInterleaved() - write() for TriangleSoup's float layout:
+ * 8 floats per vertex (x y z nx ny nz s t) and 32-bit indices.
+ * The bounds are computed from the positions.
+ */
+static bool writeInterleaved(const char *cachefile, const char *sourcefile,
+                             const float *vertexarray, int nverts,
+                             const unsigned int *indexarray, int nindices);
+
+/* 64-bit FNV-1a hash of a block of memory */
+static uint64_t hash(const void *data, size_t size);
+
+private:
+
+MappedFile file;
+const MeshFileHeader *head;
+
+static void updateKey(const char *cachefile, int64_t mtime, uint64_t size);
+static void printError(const char *errtype, const char *errmsg);
+
+};
+
+#endif // MESHCACHE_HPP
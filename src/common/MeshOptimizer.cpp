@@ -0,0 +1,239 @@
+#include "MeshOptimizer.hpp"
+
+#include <cmath>   // For pow()
+#include <cstring> // For memcpy(), memcmp()
+#include <vector>
+
+namespace {
+
+/* Hash of one vertex, with -0.0 folded onto +0.0 */
+unsigned int hashVertex(const float *v, int stride) {
+    unsigned int h = 2166136261u; // FNV-1a over the 32-bit words
+    for(int i=0; i<stride; i++) {
+        float f = (v[i] == 0.0f) ? 0.0f : v[i];
+        unsigned int bits;
+        memcpy(&bits, &f, sizeof(bits));
+        h = (h ^ bits) * 16777619u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+bool sameVertex(const float *a, const float *b, int stride) {
+    for(int i=0; i<stride; i++) {
+        if(a[i] == 0.0f && b[i] == 0.0f) continue; // +0.0 == -0.0
+        if(memcmp(&a[i], &b[i], sizeof(float)) != 0) return false;
+    }
+    return true;
+}
+
+/* Forsyth's vertex score: recently used and low-valence vertices score high */
+const float CacheDecayPower = 1.5f;
+const float LastTriScore = 0.75f;
+const float ValenceBoostScale = 2.0f;
+const float ValenceBoostPower = 0.5f;
+
+float vertexScore(int cacheposition, int valence) {
+    if(valence == 0) return -1.0f; // No triangles left, never pick it
+    float score = 0.0f;
+    if(cacheposition >= 0) {
+        if(cacheposition < 3) {
+            // The vertices of the last triangle get a fixed score, so there
+            // is no strong preference for strips in one direction.
+            score = LastTriScore;
+        } else {
+            float scaler = 1.0f / (MeshOptimizer::CACHESIZE - 3);
+            score = 1.0f - (cacheposition - 3) * scaler;
+            score = powf(score, CacheDecayPower);
+        }
+    }
+    score += ValenceBoostScale * powf((float)valence, -ValenceBoostPower);
+    return score;
+}
+
+}
+
+
+int MeshOptimizer::weldVertices(float *vertexarray, int nverts, int stride,
+                                unsigned int *indexarray, int nindices) {
+
+    // Open addressing hash table, at most half full
+    int tablesize = 1;
+    while(tablesize < 2*nverts) tablesize <<= 1;
+    std::vector<int> table(tablesize, -1);
+    std::vector<unsigned int> remap(nverts);
+    int unique = 0;
+
+    for(int i=0; i<nverts; i++) {
+        const float *v = &vertexarray[(size_t)stride*i];
+        unsigned int slot = hashVertex(v, stride) & (tablesize - 1);
+        for(;;) {
+            int j = table[slot];
+            if(j < 0) { // New vertex: move it down to the end of the unique ones
+                if(unique != i) {
+                    memcpy(&vertexarray[(size_t)stride*unique], v, stride*sizeof(float));
+                }
+                table[slot] = unique;
+                remap[i] = unique++;
+                break;
+            }
+            if(sameVertex(&vertexarray[(size_t)stride*j], v, stride)) {
+                remap[i] = j;
+                break;
+            }
+            slot = (slot + 1) & (tablesize - 1);
+        }
+    }
+
+    for(int i=0; i<nindices; i++) {
+        indexarray[i] = remap[indexarray[i]];
+    }
+    return unique;
+}
+
+
+void MeshOptimizer::optimizeVertexCache(unsigned int *indexarray, int nindices, int nverts) {
+
+    const int ntris = nindices / 3;
+    if(ntris == 0) return;
+
+    // Vertex to triangle adjacency (compressed rows). The first
+    // 'valence[v]' entries of each row are the triangles not yet emitted.
+    std::vector<int> valence(nverts, 0);
+    std::vector<int> offset(nverts + 1, 0);
+    for(int i=0; i<3*ntris; i++) valence[indexarray[i]]++;
+    for(int v=0; v<nverts; v++) offset[v+1] = offset[v] + valence[v];
+    std::vector<int> adjacency(offset[nverts]);
+    std::vector<int> fill(offset.begin(), offset.end() - 1);
+    for(int t=0; t<ntris; t++) {
+        for(int k=0; k<3; k++) adjacency[fill[indexarray[3*t+k]]++] = t;
+    }
+
+    std::vector<int> cacheposition(nverts, -1);
+    std::vector<float> score(nverts);
+    for(int v=0; v<nverts; v++) score[v] = vertexScore(-1, valence[v]);
+
+    std::vector<float> triscore(ntris);
+    std::vector<char> emitted(ntris, 0);
+    int best = 0;
+    for(int t=0; t<ntris; t++) {
+        triscore[t] = score[indexarray[3*t]] + score[indexarray[3*t+1]] + score[indexarray[3*t+2]];
+        if(triscore[t] > triscore[best]) best = t;
+    }
+
+    std::vector<unsigned int> output(3*ntris);
+    std::vector<int> cache, newcache;
+    cache.reserve(CACHESIZE + 3);
+    newcache.reserve(CACHESIZE + 3);
+    int scanposition = 0;
+
+    for(int n=0; n<ntris; n++) {
+
+        if(best < 0) {
+            // Nothing useful in the cache: continue with the next unused triangle
+            while(emitted[scanposition]) scanposition++;
+            best = scanposition;
+        }
+
+        const unsigned int *tri = &indexarray[3*best];
+        memcpy(&output[3*n], tri, 3*sizeof(unsigned int));
+        emitted[best] = 1;
+
+        // Remove the triangle from its vertices' adjacency lists
+        for(int k=0; k<3; k++) {
+            int v = tri[k];
+            int *row = &adjacency[offset[v]];
+            for(int i=0; i<valence[v]; i++) {
+                if(row[i] == best) {
+                    row[i] = row[valence[v] - 1];
+                    valence[v]--;
+                    break;
+                }
+            }
+        }
+
+        // New cache: this triangle's vertices first, then the old entries
+        newcache.clear();
+        for(int k=0; k<3; k++) newcache.push_back(tri[k]);
+        for(size_t i=0; i<cache.size(); i++) {
+            int v = cache[i];
+            if(v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2]) newcache.push_back(v);
+        }
+        for(size_t i=0; i<newcache.size(); i++) {
+            cacheposition[newcache[i]] = (i < (size_t)CACHESIZE) ? (int)i : -1;
+        }
+        if(newcache.size() > (size_t)CACHESIZE) newcache.resize(CACHESIZE);
+        cache.swap(newcache);
+
+        // Rescore the vertices that moved, and their remaining triangles.
+        // 'newcache' now holds the old cache, so vertices that were pushed
+        // out (cacheposition -1) are rescored as well.
+        for(int pass=0; pass<2; pass++) {
+            const std::vector<int> &list = (pass == 0) ? newcache : cache;
+            for(size_t i=0; i<list.size(); i++) {
+                int v = list[i];
+                float s = vertexScore(cacheposition[v], valence[v]);
+                float delta = s - score[v];
+                score[v] = s;
+                for(int j=0; j<valence[v]; j++) triscore[adjacency[offset[v] + j]] += delta;
+            }
+        }
+
+        // The next triangle is the best one touching the cache
+        best = -1;
+        float bestscore = -1.0f;
+        for(size_t i=0; i<cache.size(); i++) {
+            int v = cache[i];
+            for(int j=0; j<valence[v]; j++) {
+                int t = adjacency[offset[v] + j];
+                if(triscore[t] > bestscore) {
+                    bestscore = triscore[t];
+                    best = t;
+                }
+            }
+        }
+    }
+
+    memcpy(indexarray, &output[0], 3*ntris*sizeof(unsigned int));
+}
+
+
+int MeshOptimizer::optimizeVertexFetch(float *vertexarray, int nverts, int stride,
+                                       unsigned int *indexarray, int nindices) {
+
+    std::vector<int> remap(nverts, -1);
+    int next = 0;
+    for(int i=0; i<nindices; i++) {
+        unsigned int v = indexarray[i];
+        if(remap[v] < 0) remap[v] = next++;
+        indexarray[i] = remap[v];
+    }
+
+    std::vector<float> copy(vertexarray, vertexarray + (size_t)stride*nverts);
+    for(int v=0; v<nverts; v++) {
+        if(remap[v] >= 0) {
+            memcpy(&vertexarray[(size_t)stride*remap[v]], &copy[(size_t)stride*v], stride*sizeof(float));
+        }
+    }
+    return next;
+}
+
+
+float MeshOptimizer::computeACMR(const unsigned int *indexarray, int nindices, int nverts,
+                                 int cachesize) {
+
+    if(nindices < 3) return 0.0f;
+
+    // FIFO cache: a vertex is a hit if it was loaded fewer than
+    // 'cachesize' misses ago.
+    std::vector<int> loadtime(nverts, -cachesize - 1);
+    int misses = 0;
+    for(int i=0; i<nindices; i++) {
+        unsigned int v = indexarray[i];
+        if(misses - loadtime[v] > cachesize) {
+            loadtime[v] = misses;
+            misses++;
+        }
+    }
+    return (float)misses / (nindices / 3);
+}
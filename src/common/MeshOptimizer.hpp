@@ -0,0 +1,56 @@
+/* MeshOptimizer.hpp */
+/*
+ * Functions to make indexed triangle meshes cheaper to draw:
+ * welding of duplicate vertices, reordering of triangles for the
+ * post-transform vertex cache (Tom Forsyth's "Linear-Speed Vertex Cache
+ * Optimisation") and reordering of vertices for fetch locality.
+ * All functions work in place on the interleaved vertex arrays used by
+ * TriangleSoup, with 'stride' floats per vertex.
+ */
+/* Usage: weldVertices(), then optimizeVertexCache(), then
+ * optimizeVertexFetch(). computeACMR() measures the result as the
+ * average number of vertex shader runs per triangle (3.0 is the worst,
+ * about 0.5-0.7 is typical for an optimised regular grid). */
+
+#ifndef MESHOPTIMIZER_HPP // Avoid including this header twice
+#define MESHOPTIMIZER_HPP
+
+namespace MeshOptimizer {
+
+/* Cache size used for both optimisation and ACMR reports */
+const int CACHESIZE = 32;
+
+/*
+ * weldVertices() - merge vertices whose attributes are bitwise identical
+ * (+0.0 and -0.0 are treated as equal). The unique vertices are moved to
+ * the front of the vertex array and the indices are rewritten.
+ * Returns the new number of vertices.
+ */
+int weldVertices(float *vertexarray, int nverts, int stride,
+                 unsigned int *indexarray, int nindices);
+
+/*
+ * optimizeVertexCache() - reorder the triangles (not the vertices)
+ * for a post-transform cache of CACHESIZE entries.
+ */
+void optimizeVertexCache(unsigned int *indexarray, int nindices, int nverts);
+
+/*
+ * optimizeVertexFetch() - reorder vertices in the order they are first
+ * used by the index array, so that vertex fetches walk the buffer
+ * forwards. Unreferenced vertices are dropped.
+ * Returns the new number of vertices.
+ */
+int optimizeVertexFetch(float *vertexarray, int nverts, int stride,
+                        unsigned int *indexarray, int nindices);
+
+/*
+ * computeACMR() - average cache miss ratio: the number of vertex shader
+ * invocations per triangle for a FIFO cache of the given size.
+ */
+float computeACMR(const unsigned int *indexarray, int nindices, int nverts,
+                  int cachesize = CACHESIZE);
+
+}
+
+#endif // MESHOPTIMIZER_HPP
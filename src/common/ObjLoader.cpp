@@ -0,0 +1,478 @@
+#include "ObjLoader.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+#include <cmath>   // For sqrtf(), pow()
+#include <cstdio>
+#include <cstring> // For memcpy()
+#include <vector>
+
+namespace {
+
+/* Corner flags: which indices are present, and which are relative */
+enum {
+    HAS_T = 1,
+    HAS_N = 2,
+    REL_V = 4,
+    REL_T = 8,
+    REL_N = 16
+};
+
+/* One face corner. Indices are 0-based, either absolute or (if the
+ * REL flag is set) relative to the start of the chunk they came from. */
+struct Corner {
+    int v, t, n;
+    unsigned char flags;
+};
+
+/* Everything parsed from one line-aligned piece of the file */
+struct Chunk {
+    const char *begin;
+    const char *end;
+    std::vector<float> v, vt, vn;
+    std::vector<Corner> corners;
+    std::vector<int> facesizes;
+    int ntris;
+    const char *error;    // Error message, or NULL
+    const char *errorpos; // Where in the file the error occurred
+    // Offsets of this chunk's data in the merged arrays
+    int voffset, vtoffset, vnoffset, trioffset;
+};
+
+inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char *skipBlanks(const char *p, const char *end) {
+    while(p < end && isBlank(*p)) p++;
+    return p;
+}
+
+inline const char *skipLine(const char *p, const char *end) {
+    while(p < end && *p != '\n') p++;
+    return p < end ? p + 1 : end;
+}
+
+/*
+ * parseFloat() - read a decimal floating point number, independent
+ * of the C locale. Accepts an optional sign, digits with an optional
+ * fraction and an optional exponent. Returns the position after the
+ * number, or NULL if there was no number.
+ */
+const char *parseFloat(const char *p, const char *end, float &result) {
+
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    p = skipBlanks(p, end);
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int ndigits = 0;
+    bool anydigits = false;
+
+    while(p < end && isDigit(*p)) {
+        if(ndigits < 19) { mantissa = mantissa*10 + (*p - '0'); if(mantissa) ndigits++; }
+        else exponent++; // Digits beyond what fits are only a scale factor
+        anydigits = true;
+        p++;
+    }
+    if(p < end && *p == '.') {
+        p++;
+        while(p < end && isDigit(*p)) {
+            if(ndigits < 19) { mantissa = mantissa*10 + (*p - '0'); if(mantissa) ndigits++; exponent--; }
+            anydigits = true;
+            p++;
+        }
+    }
+    if(!anydigits) return NULL;
+
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool expnegative = false;
+        if(q < end && (*q == '-' || *q == '+')) {
+            expnegative = (*q == '-');
+            q++;
+        }
+        if(q < end && isDigit(*q)) {
+            int e = 0;
+            while(q < end && isDigit(*q)) {
+                if(e < 10000) e = e*10 + (*q - '0');
+                q++;
+            }
+            exponent += expnegative ? -e : e;
+            p = q;
+        }
+    }
+
+    double value = (double)mantissa;
+    if(exponent < 0) {
+        value = (exponent >= -22) ? value / pow10[-exponent] : value * pow(10.0, exponent);
+    } else if(exponent > 0) {
+        value = (exponent <= 22) ? value * pow10[exponent] : value * pow(10.0, exponent);
+    }
+    result = (float)(negative ? -value : value);
+    return p;
+}
+
+/* parseInt() - read a signed decimal integer. Returns NULL if there was none. */
+inline const char *parseInt(const char *p, const char *end, int &result) {
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if(p >= end || !isDigit(*p)) return NULL;
+    int value = 0;
+    while(p < end && isDigit(*p)) {
+        value = value*10 + (*p - '0');
+        p++;
+    }
+    result = negative ? -value : value;
+    return p;
+}
+
+/* Read n floats into out, with missing trailing values set to zero
+ * (vt lines may have one, two or three components). At least
+ * 'required' values must be present. */
+const char *parseFloats(const char *p, const char *end, float *out, int n, int required) {
+    for(int i=0; i<n; i++) {
+        const char *q = parseFloat(p, end, out[i]);
+        if(!q) {
+            if(i < required) return NULL;
+            for(; i<n; i++) out[i] = 0.0f;
+            return p;
+        }
+        p = q;
+    }
+    return p;
+}
+
+/*
+ * Convert a 1-based OBJ index to 0-based. Negative indices count back
+ * from the most recent element, which may lie in an earlier chunk,
+ * so they are stored relative to the chunk start and fixed up later.
+ */
+inline void convertIndex(int raw, int countsofar, int &index, unsigned char &flags, unsigned char relflag) {
+    if(raw < 0) {
+        index = countsofar + raw;
+        flags |= relflag;
+    } else {
+        index = raw - 1;
+    }
+}
+
+/* parseChunk() - parse all lines in [chunk.begin, chunk.end) */
+void parseChunk(Chunk &chunk) {
+
+    const char *p = chunk.begin;
+    const char *end = chunk.end;
+    float f[3];
+
+    chunk.ntris = 0;
+    chunk.error = NULL;
+
+    while(p < end) {
+        const char *line = p;
+        p = skipBlanks(p, end);
+        if(p >= end) break;
+
+        if(p[0] == 'v' && p+1 < end && isBlank(p[1])) {
+            p = parseFloats(p+2, end, f, 3, 3);
+            if(!p) { chunk.error = "Malformed vertex data"; chunk.errorpos = line; return; }
+            chunk.v.insert(chunk.v.end(), f, f+3);
+        }
+        else if(p[0] == 'v' && p+2 < end && p[1] == 'n' && isBlank(p[2])) {
+            p = parseFloats(p+3, end, f, 3, 3);
+            if(!p) { chunk.error = "Malformed normal data"; chunk.errorpos = line; return; }
+            chunk.vn.insert(chunk.vn.end(), f, f+3);
+        }
+        else if(p[0] == 'v' && p+2 < end && p[1] == 't' && isBlank(p[2])) {
+            p = parseFloats(p+3, end, f, 2, 1);
+            if(!p) { chunk.error = "Malformed texcoord data"; chunk.errorpos = line; return; }
+            chunk.vt.insert(chunk.vt.end(), f, f+2);
+        }
+        else if(p[0] == 'f' && p+1 < end && isBlank(p[1])) {
+            int nv = (int)chunk.v.size() / 3;
+            int nt = (int)chunk.vt.size() / 2;
+            int nn = (int)chunk.vn.size() / 3;
+            int ncorners = 0;
+            p++;
+            for(;;) {
+                p = skipBlanks(p, end);
+                if(p >= end || *p == '\n' || *p == '#') break;
+                Corner c;
+                int raw;
+                c.flags = 0;
+                c.t = c.n = 0;
+                const char *q = parseInt(p, end, raw);
+                if(!q || raw == 0) { p = NULL; break; }
+                convertIndex(raw, nv, c.v, c.flags, REL_V);
+                p = q;
+                if(p < end && *p == '/') {
+                    p++;
+                    if(p < end && *p != '/') { // v/t or v/t/n
+                        q = parseInt(p, end, raw);
+                        if(!q || raw == 0) { p = NULL; break; }
+                        convertIndex(raw, nt, c.t, c.flags, REL_T);
+                        c.flags |= HAS_T;
+                        p = q;
+                    }
+                    if(p < end && *p == '/') { // v//n or v/t/n
+                        p++;
+                        q = parseInt(p, end, raw);
+                        if(!q || raw == 0) { p = NULL; break; }
+                        convertIndex(raw, nn, c.n, c.flags, REL_N);
+                        c.flags |= HAS_N;
+                        p = q;
+                    }
+                }
+                if(p < end && !isBlank(*p) && *p != '\n') { p = NULL; break; }
+                chunk.corners.push_back(c);
+                ncorners++;
+            }
+            if(!p || ncorners < 3) {
+                chunk.error = "Malformed face data";
+                chunk.errorpos = line;
+                return;
+            }
+            chunk.facesizes.push_back(ncorners);
+            chunk.ntris += ncorners - 2;
+        }
+        // Anything else (comments, groups, materials...) is ignored
+
+        p = skipLine(p, end);
+    }
+}
+
+/* Resolve one corner index against the merged array of 'count' elements */
+inline bool resolve(int index, bool relative, int offset, int count, int &result) {
+    result = relative ? offset + index : index;
+    return result >= 0 && result < count;
+}
+
+}
+
+
+/* Constructor: an empty loader */
+ObjLoader::ObjLoader() {
+    vertexarray = NULL;
+    indexarray = NULL;
+    nverts = 0;
+    ntris = 0;
+    numverts = numnormals = numtexcoords = numfaces = 0;
+}
+
+
+/* Destructor: delete the arrays unless the caller took them */
+ObjLoader::~ObjLoader() {
+    clean();
+}
+
+
+void ObjLoader::clean() {
+    delete[] vertexarray;
+    delete[] indexarray;
+    detach();
+}
+
+
+void ObjLoader::detach() {
+    vertexarray = NULL;
+    indexarray = NULL;
+    nverts = 0;
+    ntris = 0;
+}
+
+
+/*
+ * load() - parse in three steps:
+ * 1. Split the mapped file into line-aligned chunks and parse them in
+ *    parallel into per-chunk arrays of vertices, normals, texcoords
+ *    and face corners.
+ * 2. Compute prefix sums to place each chunk's data in the merged arrays.
+ * 3. In parallel again, triangulate the faces and write the interleaved
+ *    vertex array, each chunk to its own slice of the output.
+ */
+bool ObjLoader::load(const char *filename, ThreadPool *pool) {
+
+    MappedFile file;
+    size_t i;
+
+    clean();
+    numverts = numnormals = numtexcoords = numfaces = 0;
+
+    if(!file.open(filename)) return false;
+    if(!pool) pool = &ThreadPool::global();
+
+    const char *data = file.data();
+    const char *dataend = data + file.size();
+
+    // Aim for a few chunks per thread, but not tiny ones
+    const size_t minchunk = 256*1024;
+    size_t nchunks = file.size() / minchunk;
+    size_t maxchunks = 4 * (size_t)(pool->size() + 1);
+    if(nchunks > maxchunks) nchunks = maxchunks;
+    if(nchunks < 1) nchunks = 1;
+
+    std::vector<Chunk> chunks(nchunks);
+    const char *p = data;
+    for(i=0; i<nchunks; i++) {
+        chunks[i].begin = p;
+        if(i == nchunks-1) {
+            p = dataend;
+        } else {
+            p = data + file.size() * (i+1) / nchunks;
+            if(p < chunks[i].begin) p = chunks[i].begin;
+            p = skipLine(p, dataend); // Move to the start of the next line
+        }
+        chunks[i].end = p;
+    }
+
+    pool->parallelFor((int)nchunks, [&](int c) { parseChunk(chunks[c]); });
+
+    // Report the first error in file order, with its line number
+    for(i=0; i<nchunks; i++) {
+        if(chunks[i].error) {
+            int line = 1;
+            for(const char *q = data; q < chunks[i].errorpos; q++) if(*q == '\n') line++;
+            char message[128];
+            snprintf(message, sizeof(message), "%s at line %d of", chunks[i].error, line);
+            printError(message, filename);
+            return false;
+        }
+    }
+
+    // Prefix sums
+    int totaltris = 0;
+    for(i=0; i<nchunks; i++) {
+        chunks[i].voffset = numverts;
+        chunks[i].vtoffset = numtexcoords;
+        chunks[i].vnoffset = numnormals;
+        chunks[i].trioffset = totaltris;
+        numverts += (int)chunks[i].v.size() / 3;
+        numtexcoords += (int)chunks[i].vt.size() / 2;
+        numnormals += (int)chunks[i].vn.size() / 3;
+        numfaces += (int)chunks[i].facesizes.size();
+        totaltris += chunks[i].ntris;
+    }
+
+    // Merge the attribute arrays
+    std::vector<float> verts(3*(size_t)numverts);
+    std::vector<float> texcoords(2*(size_t)numtexcoords);
+    std::vector<float> normals(3*(size_t)numnormals);
+    pool->parallelFor((int)nchunks, [&](int c) {
+        const Chunk &ch = chunks[c];
+        if(!ch.v.empty()) memcpy(&verts[3*(size_t)ch.voffset], &ch.v[0], ch.v.size()*sizeof(float));
+        if(!ch.vt.empty()) memcpy(&texcoords[2*(size_t)ch.vtoffset], &ch.vt[0], ch.vt.size()*sizeof(float));
+        if(!ch.vn.empty()) memcpy(&normals[3*(size_t)ch.vnoffset], &ch.vn[0], ch.vn.size()*sizeof(float));
+    });
+
+    ntris = totaltris;
+    nverts = 3*ntris;
+    vertexarray = new float[8*(size_t)nverts];
+    indexarray = new unsigned int[3*(size_t)ntris];
+
+    // Triangulate and write the interleaved vertices
+    std::vector<int> badchunk(nchunks, 0);
+    pool->parallelFor((int)nchunks, [&](int c) {
+        const Chunk &ch = chunks[c];
+        size_t corner = 0;
+        size_t tri = ch.trioffset;
+        for(size_t f=0; f<ch.facesizes.size(); f++) {
+            int n = ch.facesizes[f];
+            const Corner *fc = &ch.corners[corner];
+            corner += n;
+            for(int k=1; k<n-1; k++) { // Fan triangulation around corner 0
+                const Corner *tc[3] = { &fc[0], &fc[k], &fc[k+1] };
+                float *out = &vertexarray[24*tri];
+                bool hasnormals = true;
+                for(int j=0; j<3; j++) {
+                    const Corner &cn = *tc[j];
+                    float *vtx = out + 8*j;
+                    int iv, it, in;
+                    if(!resolve(cn.v, (cn.flags & REL_V) != 0, ch.voffset, numverts, iv)) {
+                        badchunk[c] = 1;
+                        return;
+                    }
+                    vtx[0] = verts[3*(size_t)iv];
+                    vtx[1] = verts[3*(size_t)iv+1];
+                    vtx[2] = verts[3*(size_t)iv+2];
+                    // Texture coordinates beyond the end of the list are read as
+                    // missing, since exporters sometimes reference a vt that was
+                    // never written (plane2.obj does this).
+                    if((cn.flags & HAS_T) &&
+                       resolve(cn.t, (cn.flags & REL_T) != 0, ch.vtoffset, numtexcoords, it)) {
+                        vtx[6] = texcoords[2*(size_t)it];
+                        vtx[7] = texcoords[2*(size_t)it+1];
+                    } else {
+                        vtx[6] = vtx[7] = 0.0f;
+                    }
+                    if(cn.flags & HAS_N) {
+                        if(!resolve(cn.n, (cn.flags & REL_N) != 0, ch.vnoffset, numnormals, in)) {
+                            badchunk[c] = 1;
+                            return;
+                        }
+                        vtx[3] = normals[3*(size_t)in];
+                        vtx[4] = normals[3*(size_t)in+1];
+                        vtx[5] = normals[3*(size_t)in+2];
+                    } else {
+                        hasnormals = false;
+                    }
+                }
+                if(!hasnormals) { // Flat face normal for all three corners
+                    float e1[3], e2[3], nrm[3];
+                    for(int j=0; j<3; j++) {
+                        e1[j] = out[8+j] - out[j];
+                        e2[j] = out[16+j] - out[j];
+                    }
+                    nrm[0] = e1[1]*e2[2] - e1[2]*e2[1];
+                    nrm[1] = e1[2]*e2[0] - e1[0]*e2[2];
+                    nrm[2] = e1[0]*e2[1] - e1[1]*e2[0];
+                    float len = sqrtf(nrm[0]*nrm[0] + nrm[1]*nrm[1] + nrm[2]*nrm[2]);
+                    if(len > 0.0f) { nrm[0] /= len; nrm[1] /= len; nrm[2] /= len; }
+                    for(int j=0; j<3; j++) {
+                        out[8*j+3] = nrm[0];
+                        out[8*j+4] = nrm[1];
+                        out[8*j+5] = nrm[2];
+                    }
+                }
+                indexarray[3*tri] = (unsigned int)(3*tri);
+                indexarray[3*tri+1] = (unsigned int)(3*tri+1);
+                indexarray[3*tri+2] = (unsigned int)(3*tri+2);
+                tri++;
+            }
+        }
+    });
+
+    for(i=0; i<nchunks; i++) {
+        if(badchunk[i]) {
+            printError("Face index out of range in", filename);
+            clean();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * private
+ * printError() - Signal an error.
+ * Simple printf() to console for portability.
+ */
+void ObjLoader::printError(const char *errtype, const char *errmsg) {
+    fprintf(stderr, "%s: %s\n", errtype, errmsg);
+}
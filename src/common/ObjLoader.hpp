@@ -0,0 +1,67 @@
+/* ObjLoader.hpp */
+/*
+ * A fast, multi-threaded loader for Wavefront OBJ geometry.
+ * The file is memory mapped, split into line-aligned chunks and the
+ * chunks are parsed in parallel on the ThreadPool. Numbers are parsed
+ * by hand, so the result does not depend on the C locale.
+ * Faces may be triangles, quads or general polygons (triangulated as
+ * fans) with corners on any of the forms v, v/t, v//n and v/t/n.
+ * Negative (relative) indices are supported.
+ * Material information, groups and everything else is ignored.
+ */
+/* Usage: call load() with a file name. On success, vertexarray holds
+ * nverts vertices on the same interleaved format as TriangleSoup
+ * (x y z nx ny nz s t), three per triangle, and indexarray holds
+ * 3*ntris indices. Call detach() to take over ownership of the arrays,
+ * which are allocated with new[]. Faces without normals get the flat
+ * face normal, and missing texture coordinates are set to zero. */
+
+#ifndef OBJLOADER_HPP // Avoid including this header twice
+#define OBJLOADER_HPP
+
+class ThreadPool;
+
+class ObjLoader {
+
+public:
+
+float *vertexarray;        // Interleaved vertex array, 8 floats per vertex
+unsigned int *indexarray;  // Element index array, 3 per triangle
+int nverts;  // Number of vertices in vertexarray
+int ntris;   // Number of triangles in indexarray
+
+// Statistics from the file itself
+int numverts;
+int numnormals;
+int numtexcoords;
+int numfaces;
+
+/* Constructor: an empty loader */
+ObjLoader();
+
+/* Destructor: deletes the arrays unless they have been detached */
+~ObjLoader();
+
+/*
+ * load() - read and triangulate an OBJ file. Uses ThreadPool::global()
+ * unless another pool is given. Returns false and prints an error
+ * message if the file is missing or malformed.
+ */
+bool load(const char *filename, ThreadPool *pool = 0);
+
+/* Give up ownership of vertexarray and indexarray to the caller */
+void detach();
+
+/* Delete any loaded data */
+void clean();
+
+private:
+
+ObjLoader(const ObjLoader&);            // Not copyable
+ObjLoader &operator=(const ObjLoader&);
+
+void printError(const char *errtype, const char *errmsg);
+
+};
+
+#endif // OBJLOADER_HPP
@@ -0,0 +1,211 @@
+#include "Ocean.hpp"
+#include "ThreadPool.hpp"
+#include "VertexLayout.hpp" // For floatToHalf()
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+const int ROWS = 16; // Grid rows per task when halving a step
+
+}
+
+
+Ocean::Ocean(int n, float patch, float wind, float rmsheight)
+    : simulation(n, patch, wind, rmsheight) {
+    this->n = simulation.size();
+    textures[0] = textures[1] = 0;
+    for(int b=0; b<RING; b++) {
+        buffers[b] = 0;
+        fences[b] = 0;
+    }
+    current = 0;
+    mapped = NULL;
+    running = false;
+    finished = false;
+    lastms = totalms = 0.0;
+    stepcount = skipcount = 0;
+    uniformprogram = 0;
+    location_displacement = location_slopes = location_patch = -1;
+    meshprepare = NULL;
+    meshowner = NULL;
+}
+
+
+Ocean::~Ocean() {
+    // The worker writes to the mapped buffer and to this object
+    while(running && !finished.load(std::memory_order_acquire)) std::this_thread::yield();
+    for(int b=0; b<RING; b++) {
+        if(fences[b]) glDeleteSync(fences[b]);
+    }
+    if(buffers[0]) glDeleteBuffers(RING, buffers); // Unmaps a mapped one
+    if(textures[0]) glDeleteTextures(2, textures);
+}
+
+
+void Ocean::update(float time) {
+
+    if(!textures[0]) create();
+
+    if(running) {
+        if(!finished.load(std::memory_order_acquire)) {
+            skipcount++;
+            return;
+        }
+        upload();
+    }
+
+    // The next buffer, if the GPU is done with the last upload from it
+    int next = current;
+    if(fences[next]) {
+        GLenum status = glClientWaitSync(fences[next], 0, 0);
+        if(status == GL_TIMEOUT_EXPIRED) {
+            skipcount++;
+            return;
+        }
+        glDeleteSync(fences[next]);
+        fences[next] = 0;
+    }
+    run(time);
+}
+
+
+void Ocean::attach(DrawPacket &packet) {
+    if(packet.count == 0) return; // No mesh
+    meshprepare = packet.prepare;
+    meshowner = packet.owner;
+    packet.prepare = prepareWater;
+    packet.owner = this;
+}
+
+
+int Ocean::steps() const {
+    return stepcount;
+}
+
+
+int Ocean::skipped() const {
+    return skipcount;
+}
+
+
+double Ocean::stepTime() const {
+    return stepcount ? totalms / stepcount : 0.0;
+}
+
+
+/*
+ * private
+ * create() - the textures, flat until the first step arrives, and the
+ * ring of pixel buffers, 6 half floats per grid point each.
+ */
+void Ocean::create() {
+
+    glGenTextures(2, textures);
+    std::vector<GLushort> zero((size_t)n * n * 4, 0);
+    GLenum internal[2] = { GL_RGBA16F, GL_RG16F }, format[2] = { GL_RGBA, GL_RG };
+    for(int t=0; t<2; t++) {
+        glBindTexture(GL_TEXTURE_2D, textures[t]);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal[t], n, n, 0, format[t], GL_HALF_FLOAT, &zero[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenBuffers(RING, buffers);
+    for(int b=0; b<RING; b++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[b]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)n * n * 6 * sizeof(GLushort), NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
+/*
+ * private
+ * upload() - copy the finished step from its buffer to the textures.
+ * The copy runs on the GPU, after the draws queued so far; the fence
+ * tells when it has, and the buffer can be written again.
+ */
+void Ocean::upload() {
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[current]);
+    if(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, n, n, GL_RGBA, GL_HALF_FLOAT, (void*)0);
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, n, n, GL_RG, GL_HALF_FLOAT,
+            (void*)((size_t)n * n * 4 * sizeof(GLushort)));
+        glBindTexture(GL_TEXTURE_2D, 0);
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        stepcount++;
+        totalms += lastms;
+    }
+    // else the buffer was lost, as for a mode change: skip this step
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    mapped = NULL;
+    running = false;
+    current = (current + 1) % RING;
+}
+
+
+/*
+ * private
+ * run() - map the current buffer and hand it to a worker. The map is
+ * unsynchronized: the fence has shown that the GPU no longer reads it.
+ */
+void Ocean::run(float time) {
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[current]);
+    mapped = (GLushort*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)n * n * 6 * sizeof(GLushort),
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if(!mapped) return;
+
+    if(displacement.empty()) {
+        displacement.resize((size_t)n * n * 4);
+        slopes.resize((size_t)n * n * 2);
+    }
+    running = true;
+    finished.store(false, std::memory_order_relaxed);
+    GLushort *out = mapped, *outslopes = mapped + (size_t)n * n * 4;
+    ThreadPool::global().submit([this, time, out, outslopes]() {
+        double start = glfwGetTime();
+        simulation.step(time, &displacement[0], &slopes[0]);
+        ThreadPool::global().parallelFor((n + ROWS - 1) / ROWS, [&](int task) {
+            size_t end = (size_t)std::min(n, (task + 1) * ROWS) * n;
+            for(size_t k=(size_t)task * ROWS * n; k<end; k++) {
+                for(int c=0; c<4; c++) out[4*k + c] = floatToHalf(displacement[4*k + c]);
+                outslopes[2*k] = floatToHalf(slopes[2*k]);
+                outslopes[2*k + 1] = floatToHalf(slopes[2*k + 1]);
+            }
+        });
+        lastms = 1000.0 * (glfwGetTime() - start);
+        finished.store(true, std::memory_order_release);
+    });
+}
+
+
+/* private: DrawPacket::prepare for attach() */
+void Ocean::prepareWater(void *owner, int item, GLuint program) {
+    Ocean *ocean = (Ocean*)owner;
+    if(program != ocean->uniformprogram) {
+        ocean->uniformprogram = program;
+        ocean->location_displacement = glGetUniformLocation(program, "oceanDisplacement");
+        ocean->location_slopes = glGetUniformLocation(program, "oceanSlopes");
+        ocean->location_patch = glGetUniformLocation(program, "oceanPatch");
+    }
+    glActiveTexture(GL_TEXTURE0 + DISPLACEMENT_UNIT);
+    glBindTexture(GL_TEXTURE_2D, ocean->textures[0]);
+    glActiveTexture(GL_TEXTURE0 + SLOPE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, ocean->textures[1]);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(ocean->location_displacement, DISPLACEMENT_UNIT);
+    glUniform1i(ocean->location_slopes, SLOPE_UNIT);
+    glUniform1f(ocean->location_patch, ocean->simulation.patchSize());
+    if(ocean->meshprepare) ocean->meshprepare(ocean->meshowner, item, program);
+}
@@ -0,0 +1,106 @@
+/* Ocean.hpp */
+/*
+ * The waves of OceanSimulation.hpp on the GPU: one simulation step per
+ * frame on the ThreadPool workers, streamed into two textures that the
+ * water shaders sample (waterShaderVert.glsl and waterShaderFrag.glsl
+ * with OCEAN defined): x, y and z displacement in RGBA16F, and the two
+ * slopes of the height in RG16F, both repeating over the patch.
+ * The render thread never waits for the workers or the GPU. A worker
+ * writes its step, as half floats, straight into a pixel buffer object
+ * that is mapped while it runs; one of a ring of RING buffers, each
+ * with a fence that says when the GPU has finished the upload from it.
+ * update() uploads a finished step and starts the next one, unless the
+ * worker or the buffer it would get is still busy: then the waves just
+ * show the last step one more frame. The surface is one frame behind
+ * the time it was started at.
+ */
+/* Usage: update(time) once per frame on the render thread, then
+ * attach() the water packet before it is submitted. Print the counts
+ * of steps(), skipped() and stepTime() at the end. */
+
+#ifndef OCEAN_HPP // Avoid including this header twice
+#define OCEAN_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <atomic>
+#include <vector>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "OceanSimulation.hpp"
+#include "RenderQueue.hpp"
+
+class Ocean {
+
+public:
+
+/* The texture units of the displacement and the slopes while drawing */
+static const int DISPLACEMENT_UNIT = 8;
+static const int SLOPE_UNIT = 9;
+
+/* Pixel buffers in the ring */
+static const int RING = 3;
+
+/*
+ * Constructor: the waves of OceanSimulation on an n x n grid over
+ * 'patch' world units. No OpenGL calls are made here.
+ */
+Ocean(int n = 256, float patch = 16.0f, float wind = 2.5f, float rmsheight = 0.04f);
+
+/* Destructor: wait for a step in progress, delete the textures and buffers */
+~Ocean();
+
+/*
+ * update() - upload the last step if the worker has finished it, and
+ * start the step for 'time' in the next pixel buffer if it is free.
+ * Creates the textures, flat, on the first call. Never waits.
+ */
+void update(float time);
+
+/*
+ * attach() - bind the textures and set the uniforms of the water shader
+ * before 'packet' is drawn, then call the packet's own prepare().
+ */
+void attach(DrawPacket &packet);
+
+/* Steps uploaded, frames that kept the old step, and the average worker milliseconds per step */
+int steps() const;
+int skipped() const;
+double stepTime() const;
+
+private:
+
+OceanSimulation simulation;
+int n;
+std::vector<float> displacement, slopes; // The worker's step, before it is halved
+
+GLuint textures[2];     // Displacement and slopes
+GLuint buffers[RING];
+GLsync fences[RING];    // Set when the upload from the buffer is queued
+int current;            // The ring buffer the step in progress writes to
+GLushort *mapped;       // Its memory, while mapped
+bool running;
+std::atomic<bool> finished;
+double lastms, totalms;
+int stepcount, skipcount;
+
+GLuint uniformprogram;  // Program the uniform locations below belong to
+GLint location_displacement, location_slopes, location_patch;
+void (*meshprepare)(void *owner, int item, GLuint program); // The water packet's own
+void *meshowner;
+
+void create();
+void upload();
+void run(float time);
+static void prepareWater(void *owner, int item, GLuint program);
+
+Ocean(const Ocean&);            // Not copyable
+Ocean &operator=(const Ocean&);
+
+};
+
+#endif // OCEAN_HPP
@@ -0,0 +1,163 @@
+#include "OceanSimulation.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float GRAVITY = 9.81f;
+const float WIND_X = 0.8f, WIND_Z = 0.6f; // Wind direction, unit length
+const float REPEAT = 100.0f;              // Seconds before the waves repeat
+const int ROWS = 16;                      // Grid rows per task
+
+/* Deterministic normally distributed numbers: xorshift and Box-Muller */
+struct Gaussian {
+    unsigned long long state;
+    explicit Gaussian(unsigned int seed) : state(0x9E3779B97F4A7C15ull ^ seed) {}
+    float uniform() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return ((state * 0x2545F4914F6CDD1Dull) >> 40) * (1.0f / 16777216.0f);
+    }
+    float next() {
+        float u = std::max(uniform(), 1e-7f), v = uniform();
+        return sqrtf(-2.0f * logf(u)) * cosf(2.0f * (float)M_PI * v);
+    }
+};
+
+/*
+ * The Phillips spectrum: waves of length L = V^2/g are the largest a
+ * wind of speed V raises. Waves across the wind are suppressed, and so
+ * are waves much shorter than the grid can show.
+ */
+float phillips(float kx, float kz, float largest, float smallest) {
+    float k2 = kx * kx + kz * kz;
+    if(k2 == 0.0f) return 0.0f;
+    float along = (kx * WIND_X + kz * WIND_Z);
+    return expf(-1.0f / (k2 * largest * largest)) / (k2 * k2) * (along * along / k2)
+        * expf(-k2 * smallest * smallest);
+}
+
+}
+
+
+OceanSimulation::OceanSimulation(int n, float patch, float wind, float rmsheight,
+                                 float choppiness, unsigned int seed) : fft(n) {
+
+    this->n = fft.size();
+    n = this->n;
+    this->patch = (patch > 0.0f) ? patch : 16.0f;
+    this->choppiness = choppiness;
+    repeat = REPEAT;
+    int count = n * n;
+    h0re.resize(count); h0im.resize(count);
+    h0cre.resize(count); h0cim.resize(count);
+    omega.resize(count); kx.resize(count); kz.resize(count);
+    for(int t=0; t<3; t++) {
+        re[t].resize(count);
+        im[t].resize(count);
+    }
+
+    // Grid index i is wave number i, or i - n in the upper half
+    float largest = std::max(wind, 0.01f) * std::max(wind, 0.01f) / GRAVITY;
+    float smallest = this->patch / n;
+    float basic = 2.0f * (float)M_PI / repeat;
+    Gaussian random(seed);
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            int k = j*n + i;
+            kx[k] = 2.0f * (float)M_PI * (i < n/2 ? i : i - n) / this->patch;
+            kz[k] = 2.0f * (float)M_PI * (j < n/2 ? j : j - n) / this->patch;
+            float amplitude = sqrtf(0.5f * phillips(kx[k], kz[k], largest, smallest));
+            h0re[k] = random.next() * amplitude;
+            h0im[k] = random.next() * amplitude;
+            float w = sqrtf(GRAVITY * sqrtf(kx[k]*kx[k] + kz[k]*kz[k]));
+            omega[k] = floorf(w / basic) * basic;
+        }
+    }
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            int k = j*n + i, minus = ((n - j) % n)*n + (n - i) % n;
+            h0cre[k] = h0re[minus];
+            h0cim[k] = -h0im[minus];
+        }
+    }
+
+    // Scale to the height asked for. The mean square of the height is
+    // the sum of the squared amplitudes at time 0 (Parseval).
+    double sum = 0.0;
+    for(int k=0; k<count; k++) {
+        double r = h0re[k] + h0cre[k], m = h0im[k] + h0cim[k];
+        sum += r*r + m*m;
+    }
+    float scale = (sum > 0.0) ? rmsheight / (float)sqrt(sum) : 0.0f;
+    for(int k=0; k<count; k++) {
+        h0re[k] *= scale; h0im[k] *= scale;
+        h0cre[k] *= scale; h0cim[k] *= scale;
+    }
+}
+
+
+int OceanSimulation::size() const {
+    return n;
+}
+
+
+float OceanSimulation::patchSize() const {
+    return patch;
+}
+
+
+float OceanSimulation::repeatTime() const {
+    return repeat;
+}
+
+
+/*
+ * step() - the amplitudes at the time, h = h0 e^(iwt) + conj(h0(-k))
+ * e^(-iwt), give the spectra of the height h, the displacement -i k/|k| h
+ * and the slopes i k h, which are packed in pairs as a + ib:
+ * (height, x displacement), (z displacement, x slope), (z slope, 0).
+ */
+void OceanSimulation::step(float time, float *displacement, float *slopes, ThreadPool *pool) {
+
+    ThreadPool &workers = pool ? *pool : ThreadPool::global();
+    float t = fmodf(time, repeat);
+    int tasks = (n + ROWS - 1) / ROWS;
+
+    workers.parallelFor(tasks, [&](int task) {
+        int end = std::min(n, (task + 1) * ROWS) * n;
+        for(int k=task*ROWS*n; k<end; k++) {
+            float c = cosf(omega[k] * t), s = sinf(omega[k] * t);
+            float hr = (h0re[k] + h0cre[k]) * c - (h0im[k] - h0cim[k]) * s;
+            float hi = (h0re[k] - h0cre[k]) * s + (h0im[k] + h0cim[k]) * c;
+            float length = sqrtf(kx[k]*kx[k] + kz[k]*kz[k]);
+            float ux = (length > 0.0f) ? choppiness * kx[k] / length : 0.0f;
+            float uz = (length > 0.0f) ? choppiness * kz[k] / length : 0.0f;
+            // -i u h = u (hi - i hr), i k h = k (-hi + i hr)
+            float dxr = ux * hi, dxi = -ux * hr;
+            float dzr = uz * hi, dzi = -uz * hr;
+            float sxr = -kx[k] * hi, sxi = kx[k] * hr;
+            float szr = -kz[k] * hi, szi = kz[k] * hr;
+            re[0][k] = hr - dxi;  im[0][k] = hi + dxr;
+            re[1][k] = dzr - sxi; im[1][k] = dzi + sxr;
+            re[2][k] = szr;       im[2][k] = szi;
+        }
+    });
+
+    for(int f=0; f<3; f++) fft.transform2D(&re[f][0], &im[f][0], true, &workers);
+
+    workers.parallelFor(tasks, [&](int task) {
+        int end = std::min(n, (task + 1) * ROWS) * n;
+        for(int k=task*ROWS*n; k<end; k++) {
+            displacement[4*k] = im[0][k];
+            displacement[4*k + 1] = re[0][k];
+            displacement[4*k + 2] = re[1][k];
+            displacement[4*k + 3] = 0.0f;
+            slopes[2*k] = im[1][k];
+            slopes[2*k + 1] = re[2][k];
+        }
+    });
+}
@@ -0,0 +1,68 @@
+/* OceanSimulation.hpp */
+/*
+ * Deep water waves by Tessendorf's method ("Simulating Ocean Water"):
+ * a random field of wave amplitudes with the Phillips spectrum for a
+ * wind, each wave moving at its own speed, summed by inverse FFTs.
+ * One step gives, on a square patch that tiles, the vertical height,
+ * the horizontal (choppy) displacement that sharpens the crests, and
+ * the two slopes of the height, on an n x n grid.
+ * The five fields are real, so two of them go in one complex transform
+ * as its real and imaginary parts: three 2-D transforms per step.
+ * Everything runs on the workers of a ThreadPool, with the FFTs of
+ * FFT.hpp. Frequencies are rounded to multiples of one over a repeat
+ * time, so the motion loops and the time never grows large.
+ * No OpenGL is used here; Ocean.hpp streams the results to the GPU.
+ */
+/* Usage: OceanSimulation sim(256, 16.0f, 2.5f, 0.04f); then
+ * sim.step(time, displacement, slopes) once per frame. */
+
+#ifndef OCEANSIMULATION_HPP // Avoid including this header twice
+#define OCEANSIMULATION_HPP
+
+#include <vector>
+
+#include "FFT.hpp"
+
+class ThreadPool;
+
+class OceanSimulation {
+
+public:
+
+/*
+ * Constructor: an n x n grid (a power of two) over 'patch' world units,
+ * waves raised by a wind of 'wind' units per second, scaled to a root
+ * mean square height of 'rmsheight'. 'choppiness' scales the horizontal
+ * displacement, 0 for none.
+ */
+OceanSimulation(int n = 256, float patch = 16.0f, float wind = 2.5f, float rmsheight = 0.04f,
+                float choppiness = 0.8f, unsigned int seed = 1);
+
+int size() const;
+float patchSize() const;
+
+/* Seconds after which the waves repeat */
+float repeatTime() const;
+
+/*
+ * step() - the surface at 'time' seconds. 'displacement' gets x, y and z
+ * offsets and a zero per grid point, 'slopes' dh/dx and dh/dz, both in
+ * rows along x, from z = 0. Runs on the workers of 'pool' (NULL for the
+ * global one) and returns when done; one step at a time.
+ */
+void step(float time, float *displacement, float *slopes, ThreadPool *pool = 0);
+
+private:
+
+int n;
+float patch, choppiness, repeat;
+FFT fft;
+std::vector<float> h0re, h0im;   // The amplitudes at time 0 ...
+std::vector<float> h0cre, h0cim; // ... and the conjugates of those at -k
+std::vector<float> omega;        // Angular frequency
+std::vector<float> kx, kz;       // Wave vector
+std::vector<float> re[3], im[3]; // The three packed transforms
+
+};
+
+#endif // OCEANSIMULATION_HPP
@@ -0,0 +1,78 @@
+#include "OverdrawView.hpp"
+
+namespace {
+
+/* The colours of 1 to LEVELS fragments */
+const GLfloat RAMP[OverdrawView::LEVELS][3] = {
+    { 0.0f, 0.1f, 0.5f }, { 0.0f, 0.6f, 0.2f }, { 0.6f, 0.8f, 0.0f }, { 1.0f, 0.8f, 0.0f },
+    { 1.0f, 0.4f, 0.0f }, { 0.9f, 0.0f, 0.0f }, { 0.9f, 0.0f, 0.7f }, { 1.0f, 1.0f, 1.0f }
+};
+
+}
+
+
+OverdrawView::OverdrawView() {
+    vao = 0;
+    location_color = -1;
+    uniformprogram = 0;
+    sum = 0.0;
+    count = 0;
+}
+
+
+OverdrawView::~OverdrawView() {
+    if(vao) glDeleteVertexArrays(1, &vao);
+}
+
+
+void OverdrawView::draw(GLuint program, int width, int height) {
+
+    if(width < 1 || height < 1) return;
+
+    // The average before the counts are painted over
+    counts.resize((size_t)width * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, &counts[0]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    long long fragments = 0;
+    for(size_t i=0; i<counts.size(); i++) fragments += counts[i];
+    sum += (double)fragments / counts.size();
+    count++;
+
+    if(!vao) glGenVertexArrays(1, &vao);
+    if(program != uniformprogram) {
+        uniformprogram = program;
+        location_color = glGetUniformLocation(program, "overdrawColor");
+    }
+    glUseProgram(program);
+    glBindVertexArray(vao);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_STENCIL_TEST);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+    // Black where nothing was drawn, then each level where it applies
+    glStencilFunc(GL_EQUAL, 0, 0xFF);
+    glUniform3f(location_color, 0.0f, 0.0f, 0.0f);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    for(int level=1; level<=LEVELS; level++) {
+        // The reference is compared to the count: the last level takes all above it
+        glStencilFunc(level < LEVELS ? GL_EQUAL : GL_LEQUAL, level, 0xFF);
+        glUniform3fv(location_color, 1, RAMP[level-1]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glDisable(GL_STENCIL_TEST);
+    glEnable(GL_DEPTH_TEST);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+
+double OverdrawView::average() const {
+    return count ? sum / count : 0.0;
+}
+
+
+int OverdrawView::frames() const {
+    return count;
+}
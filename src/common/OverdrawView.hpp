@@ -0,0 +1,67 @@
+/* OverdrawView.hpp */
+/*
+ * A debug view of overdraw: how many fragments each pixel was shaded
+ * with. RenderQueue::setOverdrawCount() counts them in the stencil
+ * buffer as it draws; draw() then paints over the image, one stencil
+ * tested full-screen triangle per level, from dark blue for one
+ * fragment through green, yellow and red to white for LEVELS or more.
+ * Pixels nothing was drawn into stay black. It also reads the stencil
+ * buffer back to average the fragments per pixel, which stalls the
+ * pipeline but is only done while the view is on.
+ */
+/* Usage, each frame: clear the stencil buffer with the others, flush()
+ * the queue with the count on, then draw() with a program made of
+ * shaders/overdrawVert.glsl and shaders/overdrawFrag.glsl. */
+
+#ifndef OVERDRAWVIEW_HPP // Avoid including this header twice
+#define OVERDRAWVIEW_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <vector>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+
+class OverdrawView {
+
+public:
+
+/* Levels of the colour ramp, the last one for that many or more */
+static const int LEVELS = 8;
+
+/* Constructor: nothing measured yet. No OpenGL calls are made here. */
+OverdrawView();
+
+/* Destructor: delete the vertex array object */
+~OverdrawView();
+
+/*
+ * draw() - measure the counts in the stencil buffer of the bound
+ * framebuffer, width x height pixels, then paint them over the image
+ * with 'program'. Leaves the stencil test off and the depth test on.
+ */
+void draw(GLuint program, int width, int height);
+
+/* Average fragments per pixel over the frames drawn, and their number */
+double average() const;
+int frames() const;
+
+private:
+
+GLuint vao;                     // Empty: the triangle needs no attributes
+GLint location_color;
+GLuint uniformprogram;          // Program location_color belongs to
+std::vector<GLubyte> counts;
+double sum;
+int count;
+
+OverdrawView(const OverdrawView&);            // Not copyable
+OverdrawView &operator=(const OverdrawView&);
+
+};
+
+#endif // OVERDRAWVIEW_HPP
@@ -0,0 +1,312 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Nearest-rank percentile of sorted values, p in (0,1] */
+double percentile(const std::vector<double> &sorted, double p) {
+    if(sorted.empty()) return 0.0;
+    int rank = (int)ceil(p * sorted.size()) - 1;
+    if(rank < 0) rank = 0;
+    return sorted[rank];
+}
+
+void printPercentiles(std::vector<double> &values) {
+    if(values.empty()) {
+        printf("%27s", "-");
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    printf(" %8.3f %8.3f %8.3f", percentile(values, 0.50) / 1000.0,
+        percentile(values, 0.95) / 1000.0, percentile(values, 0.99) / 1000.0);
+}
+
+}
+
+
+Profiler::Profiler(int frames) {
+
+    numframes = (frames < 4) ? 4 : frames; // Room for the two frames of queries in flight
+    framecount = 0;
+    framestart = new double[numframes];
+    frameduration = new double[numframes];
+    samples = new PassSample[numframes * MAXPASSES];
+    for(int i=0; i<numframes; i++) framestart[i] = frameduration[i] = -1.0;
+    for(int i=0; i<numframes*MAXPASSES; i++) {
+        samples[i].cpustart = samples[i].gpuduration = -1.0;
+        samples[i].cpuduration = 0.0;
+    }
+
+    numpasses = 0;
+    for(int p=0; p<MAXPASSES; p++) {
+        names[p] = NULL;
+        openstart[p] = 0.0;
+    }
+    for(int r=0; r<MAXRUNS; r++) {
+        queries[0][r] = queries[1][r] = 0;
+        runpass[0][r] = runpass[1][r] = -1;
+    }
+    runs[0] = runs[1] = 0;
+    issuedframe[0] = issuedframe[1] = -1;
+    lateframes = 0;
+    origin = seconds();
+    depth = 0;
+    gpupass = -1;
+    inframe = false;
+}
+
+
+Profiler::~Profiler() {
+    if(queries[0][0]) glDeleteQueries(2*MAXRUNS, &queries[0][0]);
+    delete[] framestart;
+    delete[] frameduration;
+    delete[] samples;
+}
+
+
+void Profiler::beginFrame() {
+
+    if(inframe) endFrame();
+    if(!queries[0][0]) glGenQueries(2*MAXRUNS, &queries[0][0]);
+
+    // This frame reuses the queries of two frames ago, so read those first
+    int parity = framecount & 1;
+    collect(parity);
+    issuedframe[parity] = framecount;
+
+    int slot = framecount % numframes;
+    for(int p=0; p<MAXPASSES; p++) {
+        PassSample &s = samples[slot*MAXPASSES + p];
+        s.cpustart = s.gpuduration = -1.0;
+        s.cpuduration = 0.0;
+    }
+    frameduration[slot] = -1.0;
+    framestart[slot] = now();
+    depth = 0;
+    inframe = true;
+}
+
+
+void Profiler::endFrame() {
+    if(!inframe) return;
+    if(gpupass >= 0) {
+        glEndQuery(GL_TIME_ELAPSED);
+        gpupass = -1;
+    }
+    int slot = framecount % numframes;
+    frameduration[slot] = now() - framestart[slot];
+    framecount++;
+    inframe = false;
+}
+
+
+int Profiler::beginPass(const char *name) {
+
+    if(!inframe) return -1;
+
+    int pass = 0;
+    while(pass < numpasses && names[pass] != name && strcmp(names[pass], name)) pass++;
+    if(pass == numpasses) {
+        if(numpasses == MAXPASSES) return -1; // Out of room, not timed
+        names[numpasses++] = name;
+    }
+
+    depth++;
+    int parity = framecount & 1;
+    if(depth == 1 && gpupass < 0 && runs[parity] < MAXRUNS) {
+        glBeginQuery(GL_TIME_ELAPSED, queries[parity][runs[parity]]);
+        runpass[parity][runs[parity]++] = pass;
+        gpupass = pass;
+    }
+
+    double t = now();
+    PassSample &s = sample(framecount, pass);
+    if(s.cpustart < 0.0) s.cpustart = t;
+    openstart[pass] = t;
+    return pass;
+}
+
+
+void Profiler::endPass(int pass) {
+
+    if(pass < 0 || !inframe) return;
+    sample(framecount, pass).cpuduration += now() - openstart[pass];
+    depth--;
+    if(gpupass == pass) {
+        glEndQuery(GL_TIME_ELAPSED);
+        gpupass = -1;
+    }
+}
+
+
+void Profiler::printReport() const {
+
+    int first, last;
+    if(!storedFrames(first, last)) {
+        printf("Profiler: no frames recorded\n");
+        return;
+    }
+
+    printf("Profile of the last %d frames\n", last - first + 1);
+    printf("%-24s %8s %8s %8s %8s %8s %8s\n", "(ms)", "CPU p50", "p95", "p99", "GPU p50", "p95", "p99");
+    std::vector<double> cpu, gpu;
+    for(int f=first; f<=last; f++) cpu.push_back(frameduration[f % numframes]);
+    printf("%-24s", "frame");
+    printPercentiles(cpu);
+    printf("\n");
+
+    for(int p=0; p<numpasses; p++) {
+        passTimes(p, cpu, gpu);
+        printf("%-24s", names[p]);
+        printPercentiles(cpu);
+        printPercentiles(gpu);
+        printf("\n");
+    }
+    if(lateframes > 0) printf("GPU times of %d frames were not ready in time and were skipped\n", lateframes);
+}
+
+
+void Profiler::writeSummary(FILE *file) const {
+
+    fprintf(file, "{");
+    std::vector<double> times[2];
+    for(int p=0; p<numpasses; p++) {
+        passTimes(p, times[0], times[1]);
+        fprintf(file, "%s\n    \"%s\": {", p ? "," : "", names[p]);
+        for(int k=0; k<2; k++) {
+            std::sort(times[k].begin(), times[k].end());
+            fprintf(file, "%s\"%s\": ", k ? ", " : "", k ? "gpu" : "cpu");
+            if(times[k].empty()) fprintf(file, "null");
+            else fprintf(file, "{\"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f}",
+                percentile(times[k], 0.50) / 1000.0, percentile(times[k], 0.95) / 1000.0,
+                percentile(times[k], 0.99) / 1000.0);
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  }");
+}
+
+
+/*
+ * writeTrace() - one "complete" event per frame and pass. CPU times are
+ * on thread 1. GPU times are on thread 2, placed at the CPU start of
+ * their pass since elapsed-time queries have no start time of their own.
+ */
+bool Profiler::writeTrace(const char *filename) const {
+
+    FILE *file = fopen(filename, "w");
+    if(!file) {
+        Utilities::printError("Profiler: cannot write trace", filename);
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+
+    int first, last;
+    storedFrames(first, last);
+    for(int f=first; f<=last; f++) {
+        int slot = f % numframes;
+        fprintf(file, ",\n{\"name\":\"frame %d\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+            f, framestart[slot], frameduration[slot]);
+        for(int p=0; p<numpasses; p++) {
+            const PassSample &s = sample(f, p);
+            if(s.cpustart < 0.0) continue;
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                names[p], s.cpustart, s.cpuduration);
+            if(s.gpuduration >= 0.0) {
+                fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f}",
+                    names[p], s.cpustart, s.gpuduration);
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = !ferror(file);
+    fclose(file);
+    if(ok) printf("Wrote profiler trace of %d frames to %s\n", last - first + 1, filename);
+    return ok;
+}
+
+
+Profiler &Profiler::global() {
+    static Profiler profiler;
+    return profiler;
+}
+
+
+/* private: microseconds since the profiler was created */
+double Profiler::now() const {
+    return 1.0e6 * (seconds() - origin);
+}
+
+
+/* private */
+Profiler::PassSample &Profiler::sample(int frame, int pass) const {
+    return samples[(frame % numframes)*MAXPASSES + pass];
+}
+
+
+/*
+ * private
+ * storedFrames() - the frames that are complete and still in the ring.
+ * Returns false if there are none.
+ */
+bool Profiler::storedFrames(int &first, int &last) const {
+    last = framecount - 1;
+    first = framecount - numframes + (inframe ? 1 : 0); // The current frame has taken a slot
+    if(first < 0) first = 0;
+    return last >= first;
+}
+
+
+/* private: the CPU and GPU times of one pass in the stored frames it ran in */
+void Profiler::passTimes(int pass, std::vector<double> &cpu, std::vector<double> &gpu) const {
+    cpu.clear();
+    gpu.clear();
+    int first, last;
+    if(!storedFrames(first, last)) return;
+    for(int f=first; f<=last; f++) {
+        const PassSample &s = sample(f, pass);
+        if(s.cpustart < 0.0) continue; // Not run in that frame
+        cpu.push_back(s.cpuduration);
+        if(s.gpuduration >= 0.0) gpu.push_back(s.gpuduration);
+    }
+}
+
+
+/*
+ * private
+ * collect() - read back the queries issued with this parity, two frames
+ * ago, and sum the runs of each pass. They are normally done by now; if
+ * the last one is not (queries finish in order), the frame is skipped.
+ */
+void Profiler::collect(int parity) {
+    int frame = issuedframe[parity];
+    int count = runs[parity];
+    runs[parity] = 0;
+    if(frame < 0 || count == 0) return;
+
+    GLint available = 0;
+    glGetQueryObjectiv(queries[parity][count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available) {
+        lateframes++; // Late: skipped rather than waited for
+        return;
+    }
+    for(int r=0; r<count; r++) {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(queries[parity][r], GL_QUERY_RESULT, &nanoseconds);
+        PassSample &s = sample(frame, runpass[parity][r]);
+        if(s.gpuduration < 0.0) s.gpuduration = 0.0;
+        s.gpuduration += nanoseconds / 1000.0;
+    }
+}
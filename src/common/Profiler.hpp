@@ -0,0 +1,147 @@
+/* Profiler.hpp */
+/*
+ * Per-pass frame profiler. Every named pass gets a CPU time and, at the
+ * outermost level, a GPU time from a GL_TIME_ELAPSED query, one query
+ * per run of the pass. The queries are double buffered: each frame takes
+ * its queries from one of two pools, alternating, and they are read back
+ * two frames after they were issued, when the GPU has normally finished
+ * them. If it has not, the GPU times of that frame are skipped rather
+ * than waited for, so reading them never stalls the pipeline.
+ * The last 'frames' frames are kept in a ring buffer, for percentiles
+ * (printReport()) and a Chrome trace (writeTrace(), open it in
+ * chrome://tracing or https://ui.perfetto.dev).
+ */
+/* Usage: the PROFILE_ macros below are empty unless the program is
+ * built with -DPROFILER ("make profile"), so they cost nothing otherwise.
+ *   PROFILE_BEGIN_FRAME();          at the start of the frame
+ *   { PROFILE_SCOPE("water"); ... } around each pass, nesting is allowed
+ *   PROFILE_END_FRAME();            after glfwSwapBuffers()
+ *   PROFILE_REPORT();               p50/p95/p99 per pass to the console
+ *   PROFILE_WRITE_TRACE("trace.json");
+ * Pass names must be string literals (or otherwise outlive the profiler).
+ * GL_TIME_ELAPSED queries cannot overlap, so nested passes get CPU times
+ * only. A pass that runs several times in a frame is summed. */
+
+#ifndef PROFILER_HPP // Avoid including this header twice
+#define PROFILER_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <cstdio>
+#include <vector>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+
+class Profiler {
+
+public:
+
+/* Most distinct pass names */
+static const int MAXPASSES = 32;
+
+/* Most GPU timed runs of passes per frame */
+static const int MAXRUNS = 128;
+
+/* Constructor: keep the last 'frames' frames. No OpenGL calls are made here. */
+Profiler(int frames = 512);
+
+/* Destructor: delete the query objects */
+~Profiler();
+
+/* Frame boundaries. beginFrame() also collects the queries of two frames ago. */
+void beginFrame();
+void endFrame();
+
+/* Pass boundaries, normally through ProfileScope. beginPass() returns the pass index. */
+int beginPass(const char *name);
+void endPass(int pass);
+
+/* Print p50/p95/p99 of the CPU and GPU time per pass over the stored frames */
+void printReport() const;
+
+/* Write the stored frames as Chrome trace_event JSON. Returns false on failure. */
+bool writeTrace(const char *filename) const;
+
+/*
+ * writeSummary() - the numbers of printReport() as a JSON object,
+ * {"pass": {"cpu": {"p50": ms, "p95": ms, "p99": ms}, "gpu": {...}}, ...}
+ */
+void writeSummary(FILE *file) const;
+
+/* A process-wide profiler, created on first use */
+static Profiler &global();
+
+private:
+
+struct PassSample {
+    double cpustart;    // Microseconds since the profiler was created, -1 if not run
+    double cpuduration; // Microseconds
+    double gpuduration; // Microseconds, -1 if not measured (yet)
+};
+
+int numframes;
+int framecount;            // Frames finished so far, also the current frame
+double *framestart;        // Per ring slot, microseconds
+double *frameduration;
+PassSample *samples;       // numframes x MAXPASSES
+
+const char *names[MAXPASSES];
+double openstart[MAXPASSES]; // Start of the pass' current run
+int numpasses;
+double origin;             // Time of creation, in seconds
+
+GLuint queries[2][MAXRUNS];   // Double buffered, per frame parity
+int runpass[2][MAXRUNS];      // The pass each query timed
+int runs[2];                  // Queries issued with each parity
+int issuedframe[2];           // The frame each set of queries belongs to
+int lateframes;               // Frames whose GPU times were skipped
+int depth;                    // Current pass nesting
+int gpupass;                  // Pass with an open GPU query, -1 if none
+bool inframe;
+
+double now() const;
+PassSample &sample(int frame, int pass) const;
+bool storedFrames(int &first, int &last) const;
+void passTimes(int pass, std::vector<double> &cpu, std::vector<double> &gpu) const;
+void collect(int parity);
+
+Profiler(const Profiler&);            // Not copyable
+Profiler &operator=(const Profiler&);
+
+};
+
+/* Times the enclosing scope as one pass */
+class ProfileScope {
+public:
+    ProfileScope(Profiler &profiler, const char *name)
+        : profiler(profiler), pass(profiler.beginPass(name)) {}
+    ~ProfileScope() { profiler.endPass(pass); }
+private:
+    Profiler &profiler;
+    int pass;
+    ProfileScope(const ProfileScope&);
+    ProfileScope &operator=(const ProfileScope&);
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+#ifdef PROFILER
+#define PROFILE_BEGIN_FRAME() Profiler::global().beginFrame()
+#define PROFILE_END_FRAME() Profiler::global().endFrame()
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(Profiler::global(), name)
+#define PROFILE_REPORT() Profiler::global().printReport()
+#define PROFILE_WRITE_TRACE(filename) Profiler::global().writeTrace(filename)
+#else
+#define PROFILE_BEGIN_FRAME() ((void)0)
+#define PROFILE_END_FRAME() ((void)0)
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_REPORT() ((void)0)
+#define PROFILE_WRITE_TRACE(filename) ((void)0)
+#endif
+
+#endif // PROFILER_HPP
@@ -0,0 +1,323 @@
+#include "RenderQueue.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+/* The bits of a non-negative float, which sort like the float itself */
+uint32_t depthBits(float depth) {
+    if(!(depth > 0.0f)) return 0; // Also NaN
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    return bits;
+}
+
+void printCount(const char *name, long long made, long long avoided, int frames) {
+    printf("  %-22s %8.1f   %8.1f avoided\n", name, (double)made / frames, (double)avoided / frames);
+}
+
+}
+
+
+DrawPacket::DrawPacket() {
+    program = 0;
+    vao = 0;
+    object = -1;
+    blend = false;
+    depthwrite = true;
+    depth = 0.0f;
+    count = 0;
+    indextype = GL_UNSIGNED_INT;
+    firstindex = 0;
+    basevertex = 0;
+    instances = 1;
+    commands = NULL;
+    commandcount = 0;
+    name = NULL;
+    prepare = NULL;
+    owner = NULL;
+    item = 0;
+}
+
+
+RenderQueue::RenderQueue() {
+    memset(&last, 0, sizeof(last));
+    memset(&sum, 0, sizeof(sum));
+    frames = 0;
+    warnedfull = false;
+    depthprepass = overdrawcount = false;
+}
+
+
+void RenderQueue::submit(const DrawPacket &packet) {
+    if(packet.commands ? packet.commandcount <= 0 : (packet.count <= 0 || packet.instances <= 0)) return;
+    if((int)packets.size() == MAXPACKETS) {
+        if(!warnedfull) Utilities::printError("RenderQueue", "too many packets in one frame");
+        warnedfull = true;
+        return;
+    }
+    keys.push_back(sortKey(packet, (int)packets.size()));
+    packets.push_back(packet);
+}
+
+
+void RenderQueue::flush(FrameUniforms &uniforms) {
+
+    memset(&last, 0, sizeof(last));
+    last.packets = (long long)keys.size();
+    std::sort(keys.begin(), keys.end());
+    if(overdrawcount) {
+        // Every fragment that passes the depth test adds one
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+    }
+
+    // Nothing is known about the state left by other code
+    DrawState state;
+    state.first = true;
+    state.program = state.vao = 0;
+    state.object = -1;
+    state.blend = false;
+    state.depthwrite = true;
+    state.cullface = GL_NONE;
+    state.passname = NULL;
+    state.pass = -1;
+
+    if(!depthprepass) {
+        if(overdrawcount) glEnable(GL_STENCIL_TEST);
+        for(size_t i=0; i<keys.size(); i++) {
+            const DrawPacket &packet = packets[keys[i] & (MAXPACKETS - 1)];
+            draw(packet, packet.program, packet.name, packet.depthwrite, state, uniforms);
+        }
+    }
+    else {
+        // The depth of the opaque packets that have a depth program,
+        // still front to back
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for(size_t i=0; i<keys.size(); i++) {
+            const DrawPacket &packet = packets[keys[i] & (MAXPACKETS - 1)];
+            GLuint depthprogram = programState(packet.program).depthprogram;
+            if(!packet.blend && depthprogram) draw(packet, depthprogram, "depth prepass", true, state, uniforms);
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        if(overdrawcount) glEnable(GL_STENCIL_TEST);
+
+        // The other opaque packets, which may hide some of the above
+        for(size_t i=0; i<keys.size(); i++) {
+            const DrawPacket &packet = packets[keys[i] & (MAXPACKETS - 1)];
+            if(!packet.blend && !programState(packet.program).depthprogram)
+                draw(packet, packet.program, packet.name, packet.depthwrite, state, uniforms);
+        }
+
+        // The colour of the first ones, where their depth is still the nearest
+        glDepthFunc(GL_EQUAL);
+        for(size_t i=0; i<keys.size(); i++) {
+            const DrawPacket &packet = packets[keys[i] & (MAXPACKETS - 1)];
+            if(!packet.blend && programState(packet.program).depthprogram)
+                draw(packet, packet.program, packet.name, false, state, uniforms);
+        }
+        glDepthFunc(GL_LESS);
+
+        for(size_t i=0; i<keys.size(); i++) {
+            const DrawPacket &packet = packets[keys[i] & (MAXPACKETS - 1)];
+            if(packet.blend) draw(packet, packet.program, packet.name, false, state, uniforms);
+        }
+    }
+
+#ifdef PROFILER
+    if(state.pass >= 0) Profiler::global().endPass(state.pass);
+#endif
+
+    // Leave the state as the rest of the program expects it
+    if(!state.first) {
+        glBindVertexArray(0);
+        glUseProgram(0);
+        if(state.blend) glDisable(GL_BLEND);
+        if(!state.depthwrite) glDepthMask(GL_TRUE);
+        if(state.cullface != GL_NONE) glDisable(GL_CULL_FACE);
+    }
+    if(overdrawcount) glDisable(GL_STENCIL_TEST);
+
+    packets.clear();
+    keys.clear();
+
+    frames++;
+    sum.packets += last.packets;
+    sum.programbinds += last.programbinds;
+    sum.programbindsavoided += last.programbindsavoided;
+    sum.vaobinds += last.vaobinds;
+    sum.vaobindsavoided += last.vaobindsavoided;
+    sum.objectbinds += last.objectbinds;
+    sum.objectbindsavoided += last.objectbindsavoided;
+    sum.statechanges += last.statechanges;
+    sum.statechangesavoided += last.statechangesavoided;
+    sum.multidrawcommands += last.multidrawcommands;
+}
+
+
+void RenderQueue::setDepthPrepass(bool enabled) {
+    depthprepass = enabled;
+}
+
+
+void RenderQueue::setDepthProgram(GLuint program, GLuint depthProgram) {
+    ProgramState state = programState(program);
+    state.depthprogram = depthProgram;
+    programstates[program] = state;
+}
+
+
+void RenderQueue::setCullFace(GLuint program, GLenum face) {
+    ProgramState state = programState(program);
+    state.cullface = face;
+    programstates[program] = state;
+}
+
+
+void RenderQueue::setOverdrawCount(bool enabled) {
+    overdrawcount = enabled;
+}
+
+
+const RenderQueueStats &RenderQueue::lastFrame() const {
+    return last;
+}
+
+
+const RenderQueueStats &RenderQueue::total() const {
+    return sum;
+}
+
+
+void RenderQueue::printStats() const {
+    if(frames == 0) return;
+    printf("Render queue, per frame over %d frames:\n", frames);
+    printf("  %-22s %8.1f\n", "packets", (double)sum.packets / frames);
+    printCount("program binds", sum.programbinds, sum.programbindsavoided, frames);
+    printCount("VAO binds", sum.vaobinds, sum.vaobindsavoided, frames);
+    printCount("Object block binds", sum.objectbinds, sum.objectbindsavoided, frames);
+    printCount("blend/depth/cull changes", sum.statechanges, sum.statechangesavoided, frames);
+    if(sum.multidrawcommands > 0) {
+        printf("  %-22s %8.1f   in %s\n", "multi-draw commands", (double)sum.multidrawcommands / frames,
+            MeshArena::multiDrawIndirect() ? "one indirect draw per packet" : "one draw each (no indirect draws)");
+    }
+}
+
+
+/* private: how the packets of 'program' are drawn, the default if it was never set */
+RenderQueue::ProgramState RenderQueue::programState(GLuint program) const {
+    std::unordered_map<GLuint, ProgramState>::const_iterator found = programstates.find(program);
+    if(found != programstates.end()) return found->second;
+    ProgramState state;
+    state.depthprogram = 0;
+    state.cullface = GL_NONE;
+    return state;
+}
+
+
+/*
+ * private
+ * draw() - draw 'packet' with 'program', which is the packet's own or
+ * its depth program, setting only the state that changed. 'writes' is
+ * whether an opaque packet writes depth.
+ */
+void RenderQueue::draw(const DrawPacket &packet, GLuint program, const char *name, bool writes,
+                       DrawState &state, FrameUniforms &uniforms) {
+
+#ifdef PROFILER
+    // Consecutive packets with the same name are one profiler pass
+    if(state.first || name != state.passname) {
+        if(state.pass >= 0) Profiler::global().endPass(state.pass);
+        state.passname = name;
+        state.pass = name ? Profiler::global().beginPass(name) : -1;
+    }
+#else
+    (void)name;
+#endif
+
+    if(state.first || program != state.program) {
+        glUseProgram(program);
+        state.program = program;
+        last.programbinds++;
+    }
+    else last.programbindsavoided++;
+
+    if(state.first || packet.vao != state.vao) {
+        glBindVertexArray(packet.vao);
+        state.vao = packet.vao;
+        last.vaobinds++;
+    }
+    else last.vaobindsavoided++;
+
+    if(packet.object >= 0) {
+        if(packet.object != state.object) {
+            uniforms.bindObject(packet.object);
+            state.object = packet.object;
+            last.objectbinds++;
+        }
+        else last.objectbindsavoided++;
+    }
+
+    if(state.first || packet.blend != state.blend) {
+        if(packet.blend) glEnable(GL_BLEND);
+        else glDisable(GL_BLEND);
+        state.blend = packet.blend;
+        last.statechanges++;
+    }
+    else last.statechangesavoided++;
+
+    writes = writes && !packet.blend;
+    if(state.first || writes != state.depthwrite) {
+        glDepthMask(writes ? GL_TRUE : GL_FALSE);
+        state.depthwrite = writes;
+        last.statechanges++;
+    }
+    else last.statechangesavoided++;
+
+    // Culling follows the packet's own program, also in the pre-pass
+    GLenum cullface = programState(packet.program).cullface;
+    if(state.first || cullface != state.cullface) {
+        if(cullface == GL_NONE) glDisable(GL_CULL_FACE);
+        else {
+            if(state.first || state.cullface == GL_NONE) glEnable(GL_CULL_FACE);
+            glCullFace(cullface);
+        }
+        state.cullface = cullface;
+        last.statechanges++;
+    }
+    else last.statechangesavoided++;
+    state.first = false;
+
+    if(packet.prepare) packet.prepare(packet.owner, packet.item, program);
+    if(packet.commands) {
+        MeshArena::multiDraw(packet.indextype, packet.commands, packet.commandcount);
+        last.multidrawcommands += packet.commandcount;
+        return;
+    }
+    GLsizei indexsize = (packet.indextype == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    const void *offset = (const void*)((size_t)packet.firstindex * indexsize);
+    if(packet.instances > 1)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, packet.count, packet.indextype, offset,
+            packet.instances, packet.basevertex);
+    else
+        glDrawElementsBaseVertex(GL_TRIANGLES, packet.count, packet.indextype, offset, packet.basevertex);
+}
+
+
+/*
+ * private
+ * sortKey() - see the layout in RenderQueue.hpp. The depth bucket is the
+ * exponent and top 3 mantissa bits of the depth, about 9% steps, so
+ * packets at about the same distance group by state.
+ */
+uint64_t RenderQueue::sortKey(const DrawPacket &packet, int order) {
+    uint64_t depth = depthBits(packet.depth);
+    if(packet.blend) {
+        return (1ULL << 63) | ((uint64_t)(~depth & 0x7FFFFFFFu) << 32)
+            | ((uint64_t)(packet.program & 0xFFFu) << 20) | (uint64_t)order;
+    }
+    return ((depth >> 20) << 52) | ((uint64_t)(packet.program & 0xFFFFu) << 36)
+        | ((uint64_t)(packet.vao & 0xFFFFu) << 20) | (uint64_t)order;
+}
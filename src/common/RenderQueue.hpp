@@ -0,0 +1,172 @@
+/* RenderQueue.hpp */
+/*
+ * Draw calls are collected as packets during the frame and drawn all at
+ * once by flush(), sorted by a 64-bit key:
+ *
+ *   opaque:      0 | depth bucket (11) | program (16) | VAO (16) | order (20)
+ *   transparent: 1 | inverted depth (31)       | program (12) | order (20)
+ *
+ * Opaque packets come first, roughly front to back so that the depth
+ * test rejects hidden fragments early; packets at about the same depth
+ * are grouped by program and VAO. Transparent packets follow, back to
+ * front, without writing depth. The order of submission breaks ties, so
+ * the result is the same every frame.
+ * The queue remembers the bound program, VAO, Object block entry (see
+ * FrameUniforms.hpp), blending, depth writes and face culling, and only
+ * calls OpenGL when they change. It counts the calls it made and the
+ * ones it avoided.
+ * With the depth pre-pass on, the opaque packets whose program has a
+ * position-only depth program are drawn twice: first all of them with
+ * that program and no colour writes, then, after the other opaque
+ * packets, in colour with GL_EQUAL depth testing and no depth writes.
+ * Hidden fragments of their expensive shaders are then never run, in
+ * any order. Packets whose shaders discard fragments must be left
+ * without a depth program: they are drawn in between, as before.
+ */
+/* Usage, once per frame: submit() packets, then flush() after
+ * FrameUniforms::upload(). TriangleSoup::packet() fills in a packet
+ * for a mesh; TileManager and CDLODTerrain submit their own. */
+
+#ifndef RENDERQUEUE_HPP // Avoid including this header twice
+#define RENDERQUEUE_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "FrameUniforms.hpp"
+#include "MeshArena.hpp"
+
+/* One draw call and the state it needs */
+struct DrawPacket {
+    GLuint program;
+    GLuint vao;
+    int object;           // Object block entry to bind, -1 for none
+    bool blend;           // Transparent: alpha blended, drawn back to front
+    bool depthwrite;      // Ignored for transparent packets, which never write depth
+    float depth;          // Distance from the camera, for the sort
+    GLsizei count;        // Indices to draw as GL_TRIANGLES
+    GLenum indextype;     // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    GLsizei firstindex;
+    GLint basevertex;     // Added to every index, for meshes in a MeshArena
+    GLsizei instances;    // More than 1 for an instanced draw
+
+    /* Optional: draw these commands with MeshArena::multiDraw() instead.
+     * They must stay valid until flush(). */
+    const MeshArena::DrawCommand *commands;
+    int commandcount;
+    const char *name;     // Pass name for the profiler, may be NULL
+
+    /* Optional: called with the program and VAO bound, right before the
+     * draw, to set uniforms or vertex attributes of this draw only */
+    void (*prepare)(void *owner, int item, GLuint program);
+    void *owner;
+    int item;
+
+    /* Defaults: nothing to draw, opaque, depth written */
+    DrawPacket();
+};
+
+/* What flush() did, per frame or in total */
+struct RenderQueueStats {
+    long long packets;
+    long long programbinds, programbindsavoided;
+    long long vaobinds, vaobindsavoided;
+    long long objectbinds, objectbindsavoided;
+    long long statechanges, statechangesavoided; // Blending, depth writes and culling
+    long long multidrawcommands;                 // Draws in the packets with commands
+};
+
+class RenderQueue {
+
+public:
+
+/* Largest number of packets per flush(), set by the bits of the key */
+static const int MAXPACKETS = 1 << 20;
+
+/* Constructor: an empty queue. No OpenGL calls are made here. */
+RenderQueue();
+
+/* Add a packet to this frame's draws */
+void submit(const DrawPacket &packet);
+
+/*
+ * flush() - sort and draw the packets, then empty the queue. Leaves no
+ * program or VAO bound, blending and culling off, depth writes on and
+ * the depth test GL_LESS.
+ */
+void flush(FrameUniforms &uniforms);
+
+/* Turn the depth pre-pass on or off, off at first */
+void setDepthPrepass(bool enabled);
+
+/*
+ * setDepthProgram() - the program for the pre-pass of the packets of
+ * 'program': the same vertex shader, which must declare gl_Position
+ * invariant for GL_EQUAL to work, and an empty fragment shader.
+ * 0 for none.
+ */
+void setDepthProgram(GLuint program, GLuint depthProgram);
+
+/* Cull the GL_BACK or GL_FRONT faces of the packets of 'program', or GL_NONE */
+void setCullFace(GLuint program, GLenum face);
+
+/*
+ * setOverdrawCount() - with 'enabled', count in the stencil buffer the
+ * fragments each pixel gets in colour, after any depth pre-pass. The
+ * stencil buffer must have been cleared. See OverdrawView.hpp.
+ */
+void setOverdrawCount(bool enabled);
+
+/* Counters of the last flush() and of all of them */
+const RenderQueueStats &lastFrame() const;
+const RenderQueueStats &total() const;
+
+/* Print the average calls per frame, and how many were avoided */
+void printStats() const;
+
+private:
+
+/* How the packets of one program are drawn, if not the default */
+struct ProgramState {
+    GLuint depthprogram;
+    GLenum cullface;
+};
+
+/* The state flush() last set, to skip setting it again */
+struct DrawState {
+    bool first;
+    GLuint program, vao;
+    int object;
+    bool blend, depthwrite;
+    GLenum cullface;
+    const char *passname;
+    int pass;
+};
+
+std::vector<DrawPacket> packets;
+std::vector<uint64_t> keys;
+RenderQueueStats last, sum;
+int frames;
+bool warnedfull;
+bool depthprepass, overdrawcount;
+std::unordered_map<GLuint, ProgramState> programstates; // Programs that are not drawn the default way
+
+ProgramState programState(GLuint program) const;
+void draw(const DrawPacket &packet, GLuint program, const char *name, bool writes,
+          DrawState &state, FrameUniforms &uniforms);
+static uint64_t sortKey(const DrawPacket &packet, int order);
+
+RenderQueue(const RenderQueue&);            // Not copyable
+RenderQueue &operator=(const RenderQueue&);
+
+};
+
+#endif // RENDERQUEUE_HPP
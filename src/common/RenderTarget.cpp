@@ -0,0 +1,101 @@
+#include "RenderTarget.hpp"
+
+
+RenderTarget::RenderTarget() {
+    framebuffer = texture = depthbuffer = 0;
+    targetwidth = targetheight = 0;
+    targetlayers = 1;
+    targetformat = GL_RGBA8;
+}
+
+
+RenderTarget::~RenderTarget() {
+    release();
+}
+
+
+bool RenderTarget::resize(int width, int height, GLenum format, int layers) {
+
+    if(width < 1) width = 1;
+    if(height < 1) height = 1;
+    if(layers < 1) layers = 1;
+    if(framebuffer && width == targetwidth && height == targetheight
+        && format == targetformat && layers == targetlayers) return false;
+    release();
+    targetwidth = width;
+    targetheight = height;
+    targetformat = format;
+    targetlayers = layers;
+
+    // The pixel format only matters for the initial contents, which are none
+    GLenum kind = (layers > 1) ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+    glGenTextures(1, &texture);
+    glBindTexture(kind, texture);
+    if(layers > 1) glTexImage3D(kind, 0, format, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    else glTexImage2D(kind, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(kind, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(kind, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(kind, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(kind, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(kind, 0);
+
+    glGenRenderbuffers(1, &depthbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    // Keep the framebuffer of the caller
+    GLint oldframebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oldframebuffer);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if(layers > 1) glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, 0);
+    else glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        Utilities::printError("RenderTarget", "framebuffer is incomplete");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, oldframebuffer);
+    return true;
+}
+
+
+void RenderTarget::bind(int layer) const {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if(targetlayers > 1) glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, layer);
+    glViewport(0, 0, targetwidth, targetheight);
+}
+
+
+GLuint RenderTarget::colorTexture() const {
+    return texture;
+}
+
+
+GLuint RenderTarget::framebufferObject() const {
+    return framebuffer;
+}
+
+
+int RenderTarget::width() const {
+    return targetwidth;
+}
+
+
+int RenderTarget::height() const {
+    return targetheight;
+}
+
+
+int RenderTarget::layers() const {
+    return targetlayers;
+}
+
+
+/* private: delete the objects, if any */
+void RenderTarget::release() {
+    if(framebuffer) glDeleteFramebuffers(1, &framebuffer);
+    if(texture) glDeleteTextures(1, &texture);
+    if(depthbuffer) glDeleteRenderbuffers(1, &depthbuffer);
+    framebuffer = texture = depthbuffer = 0;
+}
@@ -0,0 +1,67 @@
+/* RenderTarget.hpp */
+/*
+ * An offscreen framebuffer: one colour texture, to be sampled by later
+ * passes, and a depth and stencil buffer of the same size. With more
+ * than one layer the texture is a 2-D array and bind() draws into one
+ * layer at a time, all of them sharing the depth buffer. The texture
+ * clamps at its edges and filters linearly, with no mipmaps.
+ * resize() (re)creates the objects only when the size or the format
+ * changes, so it can be called every frame with the window size.
+ */
+/* Usage: resize(w, h) each frame, bind() to draw into it, then bind the
+ * previous framebuffer again and sample colorTexture(). */
+
+#ifndef RENDERTARGET_HPP // Avoid including this header twice
+#define RENDERTARGET_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+
+class RenderTarget {
+
+public:
+
+/* Constructor: no size yet. No OpenGL calls are made here. */
+RenderTarget();
+
+/* Destructor: delete the framebuffer, texture and depth buffer */
+~RenderTarget();
+
+/*
+ * resize() - make the target width x height, with a colour texture of
+ * 'format' (GL_RGBA8, GL_RGBA16F...) and 'layers' layers. Returns true
+ * if the objects were made anew, which leaves their contents undefined.
+ */
+bool resize(int width, int height, GLenum format = GL_RGBA8, int layers = 1);
+
+/* Bind the framebuffer, drawing into 'layer', and set the viewport to all of it */
+void bind(int layer = 0) const;
+
+/* GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY with more than one layer */
+GLuint colorTexture() const;
+
+/* The framebuffer object, to read from with glBlitFramebuffer() */
+GLuint framebufferObject() const;
+int width() const;
+int height() const;
+int layers() const;
+
+private:
+
+GLuint framebuffer, texture, depthbuffer;
+int targetwidth, targetheight, targetlayers;
+GLenum targetformat;
+
+void release();
+
+RenderTarget(const RenderTarget&);            // Not copyable
+RenderTarget &operator=(const RenderTarget&);
+
+};
+
+#endif // RENDERTARGET_HPP
@@ -0,0 +1,222 @@
+#include "Scatter.hpp"
+#include "TerrainHeight.hpp"
+#include "ThreadPool.hpp"
+
+#include <cmath>
+#include <cfloat>
+
+namespace {
+
+/* Cells around a cell that can hold an instance within the spacing (2 * cellsize > spacing) */
+const int REACH = 2;
+
+/* Which hash of a candidate, see Scatter::hash() */
+enum { HASH_X, HASH_Z, HASH_PRIORITY, HASH_KEEP, HASH_LOOKS };
+
+/* A cell of the sampled region */
+struct Cell {
+    bool taken;            // Holds an instance from an earlier phase
+    int candidate;         // Index into the candidates of this phase, -1 for none
+    Scatter::Instance instance;
+};
+
+struct Candidate {
+    int cell;
+    float x, z;
+    uint32_t priority;
+    bool valid;            // Passed the terrain filters
+};
+
+}
+
+
+Scatter::Scatter(float tilesize, float spacing, uint32_t seed) {
+    this->tilesize = tilesize;
+    this->seed = seed;
+    waterlevel = -FLT_MAX;
+    maxslope = FLT_MAX;
+    heights = Terrain::heights;
+    setSpacing(spacing);
+}
+
+
+void Scatter::setSpacing(float spacing) {
+    radius = spacing > 0.0f ? spacing : 1.0f;
+    cellsize = radius / sqrtf(2.0f);
+}
+
+
+float Scatter::spacing() const {
+    return radius;
+}
+
+
+void Scatter::setWaterLevel(float height) {
+    waterlevel = height;
+}
+
+
+void Scatter::setMaxSlope(float slope) {
+    maxslope = slope;
+}
+
+
+void Scatter::addBand(float minheight, float maxheight, unsigned char kind, float keep) {
+    Band band = { minheight, maxheight, kind, keep };
+    bands.push_back(band);
+}
+
+
+void Scatter::setHeightFunction(HeightFunction heights) {
+    this->heights = heights;
+}
+
+
+/*
+ * scatterTile() - sample the cells of the tile and a margin around it.
+ * Errors at the edge of the region, where neighbours are missing, move
+ * REACH cells inwards per phase, so a margin of PHASES * REACH cells
+ * (and one for rounding) keeps them out of the tile.
+ */
+void Scatter::scatterTile(int ix, int iz, std::vector<Instance> &instances) const {
+
+    const int margin = PHASES * REACH + 1;
+    int gx0 = (int)floorf(ix * tilesize / cellsize) - margin;
+    int gz0 = (int)floorf(iz * tilesize / cellsize) - margin;
+    int gx1 = (int)floorf((ix + 1) * tilesize / cellsize) + margin;
+    int gz1 = (int)floorf((iz + 1) * tilesize / cellsize) + margin;
+    int width = gx1 - gx0 + 1, depth = gz1 - gz0 + 1;
+    float radius2 = radius * radius;
+
+    std::vector<Cell> cells(width * depth);
+    for(size_t i=0; i<cells.size(); i++) {
+        cells[i].taken = false;
+        cells[i].candidate = -1;
+    }
+    std::vector<Candidate> candidates;
+    std::vector<float> x, z, h, dhdx, dhdz;
+    candidates.reserve(cells.size());
+
+    for(int phase=0; phase<PHASES; phase++) {
+
+        // A candidate in every empty cell
+        candidates.clear();
+        x.clear();
+        z.clear();
+        for(int j=0; j<depth; j++) {
+            for(int i=0; i<width; i++) {
+                Cell &cell = cells[j*width + i];
+                cell.candidate = -1;
+                if(cell.taken) continue;
+                int gx = gx0 + i, gz = gz0 + j;
+                Candidate c;
+                c.cell = j*width + i;
+                c.x = (gx + hash(gx, gz, phase, HASH_X) * (1.0f / 4294967296.0f)) * cellsize;
+                c.z = (gz + hash(gx, gz, phase, HASH_Z) * (1.0f / 4294967296.0f)) * cellsize;
+                c.priority = hash(gx, gz, phase, HASH_PRIORITY);
+                c.valid = true;
+                cell.candidate = (int)candidates.size();
+                candidates.push_back(c);
+                x.push_back(c.x);
+                z.push_back(c.z);
+            }
+        }
+        if(candidates.empty()) break;
+
+        // Terrain filters, with all heights of the phase in one batch
+        int n = (int)candidates.size();
+        h.resize(n);
+        dhdx.resize(n);
+        dhdz.resize(n);
+        heights(&x[0], &z[0], &h[0], &dhdx[0], &dhdz[0], n);
+        for(int k=0; k<n; k++) {
+            Candidate &c = candidates[k];
+            Cell &cell = cells[c.cell];
+            int gx = gx0 + c.cell % width, gz = gz0 + c.cell / width;
+            if(h[k] < waterlevel || dhdx[k]*dhdx[k] + dhdz[k]*dhdz[k] > maxslope*maxslope) {
+                c.valid = false;
+                continue;
+            }
+            unsigned char kind = 0;
+            if(!bands.empty()) {
+                size_t b = 0;
+                while(b < bands.size() && !(h[k] >= bands[b].minheight && h[k] < bands[b].maxheight)) b++;
+                if(b == bands.size()
+                   || hash(gx, gz, phase, HASH_KEEP) * (1.0f / 4294967296.0f) >= bands[b].keep) {
+                    c.valid = false;
+                    continue;
+                }
+                kind = bands[b].kind;
+            }
+            uint32_t looks = hash(gx, gz, phase, HASH_LOOKS);
+            cell.instance.x = c.x;
+            cell.instance.y = h[k];
+            cell.instance.z = c.z;
+            cell.instance.kind = kind;
+            cell.instance.scale = (unsigned char)(looks & 0xFF);
+            cell.instance.yaw = (unsigned char)((looks >> 8) & 0xFF);
+            cell.instance.unused = 0;
+        }
+
+        // Keep the candidates with no instance and no stronger candidate near.
+        // Ties in priority go to the later cell, the same in every tile.
+        std::vector<int> kept;
+        for(int k=0; k<n; k++) {
+            const Candidate &c = candidates[k];
+            if(!c.valid) continue;
+            int ci = c.cell % width, cj = c.cell / width;
+            bool keep = true;
+            for(int j=cj-REACH; j<=cj+REACH && keep; j++) {
+                if(j < 0 || j >= depth) continue;
+                for(int i=ci-REACH; i<=ci+REACH && keep; i++) {
+                    if(i < 0 || i >= width) continue;
+                    int other = j*width + i;
+                    if(other == c.cell) continue;
+                    const Cell &cell = cells[other];
+                    if(cell.taken) {
+                        float dx = cell.instance.x - c.x, dz = cell.instance.z - c.z;
+                        if(dx*dx + dz*dz < radius2) keep = false;
+                    }
+                    else if(cell.candidate >= 0 && candidates[cell.candidate].valid) {
+                        const Candidate &o = candidates[cell.candidate];
+                        float dx = o.x - c.x, dz = o.z - c.z;
+                        if(dx*dx + dz*dz < radius2
+                           && (o.priority > c.priority || (o.priority == c.priority && other > c.cell))) keep = false;
+                    }
+                }
+            }
+            if(keep) kept.push_back(c.cell);
+        }
+        for(size_t k=0; k<kept.size(); k++) cells[kept[k]].taken = true;
+    }
+
+    // The instances inside the tile, each tile owns the positions in [ix, ix+1) * tilesize
+    float x0 = ix * tilesize, x1 = (ix + 1) * tilesize;
+    float z0 = iz * tilesize, z1 = (iz + 1) * tilesize;
+    for(size_t i=0; i<cells.size(); i++) {
+        const Instance &instance = cells[i].instance;
+        if(cells[i].taken && instance.x >= x0 && instance.x < x1 && instance.z >= z0 && instance.z < z1) {
+            instances.push_back(instance);
+        }
+    }
+}
+
+
+void Scatter::scatterTiles(const int *ix, const int *iz, int n, std::vector<Instance> *instances) const {
+    ThreadPool::global().parallelFor(n, [&](int i) {
+        scatterTile(ix[i], iz[i], instances[i]);
+    });
+}
+
+
+/* private: a well mixed 32-bit hash of a candidate (MurmurHash3's finalizer) */
+uint32_t Scatter::hash(int gx, int gz, int phase, int which) const {
+    uint64_t k = ((uint64_t)(uint32_t)gx << 32) | (uint32_t)gz;
+    k ^= (uint64_t)(seed * 0x9E3779B9u + (uint32_t)(phase * 8 + which)) * 0x9E3779B97F4A7C15ULL;
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDULL;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ULL;
+    k ^= k >> 33;
+    return (uint32_t)k;
+}
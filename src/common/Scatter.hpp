@@ -0,0 +1,102 @@
+/* Scatter.hpp */
+/*
+ * Blue-noise (Poisson disc) placement of vegetation on the terrain,
+ * tile by tile, with no seams between tiles. No two instances are
+ * closer than the spacing, also across tile borders.
+ * The plane is covered by a grid of cells of spacing / sqrt(2), so a
+ * cell holds at most one instance. In each of a few phases, every
+ * empty cell throws one candidate at a position given by a hash of the
+ * cell and the seed. A candidate is kept if no instance from an earlier
+ * phase and no candidate of higher priority (also a hash) of the same
+ * phase lies within the spacing. Since a decision only depends on the
+ * cells around it, a tile is sampled on its own, with a margin that
+ * covers everything the decisions inside the tile depend on, and the
+ * result is the same as for the whole plane: seamless, deterministic,
+ * and free to run on any thread.
+ * Candidates are filtered before they compete, by the terrain height
+ * (water level and altitude bands) and slope. An altitude band sets the
+ * kind of the instances in it and the fraction that is kept.
+ */
+/* Usage: set the water level, slope and bands, then scatterTile() for
+ * one tile or scatterTiles() for many, on the ThreadPool workers. The
+ * heights are those of TerrainHeight.hpp, unless setHeightFunction()
+ * says otherwise. */
+
+#ifndef SCATTER_HPP // Avoid including this header twice
+#define SCATTER_HPP
+
+#include <vector>
+#include <stdint.h>
+
+class Scatter {
+
+public:
+
+/* One placed instance, 16 bytes */
+struct Instance {
+    float x, y, z;        // World position, on the terrain
+    unsigned char kind;   // From the altitude band
+    unsigned char scale;  // 0-255, for a size range of the user's choice
+    unsigned char yaw;    // 0-255 for a full turn
+    unsigned char unused;
+};
+
+/* Heights and slopes at n points, like Terrain::heights() */
+typedef void (*HeightFunction)(const float *x, const float *z, float *h, float *dhdx, float *dhdz, int n);
+
+/* Candidates thrown per cell, at most. More phases fill the gaps better. */
+static const int PHASES = 4;
+
+/*
+ * Constructor: tiles of tilesize x tilesize world units, instances at
+ * least 'spacing' apart, and a seed for the hashes. No water level or
+ * slope limit and no bands: every candidate is kept, of kind 0.
+ */
+Scatter(float tilesize = 8.0f, float spacing = 1.0f, uint32_t seed = 1);
+
+void setSpacing(float spacing);
+float spacing() const;
+
+/* No instances below this height */
+void setWaterLevel(float height);
+
+/* No instances where the slope, length of (dh/dx, dh/dz), is steeper than this */
+void setMaxSlope(float slope);
+
+/*
+ * addBand() - instances between 'minheight' and 'maxheight' are of
+ * 'kind', and only the fraction 'keep' of the candidates there is used.
+ * Once a band is added, heights outside all bands get no instances.
+ */
+void addBand(float minheight, float maxheight, unsigned char kind, float keep = 1.0f);
+
+void setHeightFunction(HeightFunction heights);
+
+/* The instances in tile (ix, iz), added to 'instances' */
+void scatterTile(int ix, int iz, std::vector<Instance> &instances) const;
+
+/* n tiles at once on the ThreadPool workers, tile i into instances[i] */
+void scatterTiles(const int *ix, const int *iz, int n, std::vector<Instance> *instances) const;
+
+private:
+
+struct Band {
+    float minheight, maxheight;
+    unsigned char kind;
+    float keep;
+};
+
+float tilesize;
+float radius;       // The spacing
+float cellsize;     // radius / sqrt(2)
+uint32_t seed;
+float waterlevel;
+float maxslope;
+std::vector<Band> bands;
+HeightFunction heights;
+
+uint32_t hash(int gx, int gz, int phase, int which) const;
+
+};
+
+#endif // SCATTER_HPP
@@ -1,5 +1,41 @@
 #include "Shader.hpp"
+#include "FrameUniforms.hpp"
 #include <iostream>
+#include <cstring>
+#include <sys/stat.h> // For mkdir()
+#ifdef _WIN32
+#include <direct.h>   // For _mkdir()
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR // From GL_KHR_parallel_shader_compile
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace {
+
+#ifdef _WIN32
+typedef void (__stdcall *MaxCompilerThreadsProc)(GLuint count);
+#else
+typedef void (*MaxCompilerThreadsProc)(GLuint count);
+#endif
+
+/* Start of every cache file, followed by the key, the format and the size */
+const char CACHE_MAGIC[8] = { 'G', 'L', 'P', 'R', 'O', 'G', '0', '1' };
+
+/* 64-bit FNV-1a hash of a string, continuing from 'hash' */
+unsigned long long hashString(unsigned long long hash, const char *str) {
+    for(const unsigned char *c = (const unsigned char*)str; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= 0xff; // Separate the strings, so "ab"+"c" differs from "a"+"bc"
+    return hash * 1099511628211ULL;
+}
+
+}
+
+const char *Shader::cachedirectory = "shadercache";
+int Shader::cachehits = 0;
 
 /*
  * Constructor without arguments.
@@ -7,6 +43,9 @@
  */
 Shader::Shader() {
     this->programID = 0;
+    this->vertexshader = this->fragmentshader = 0;
+    this->programkey = 0;
+    this->pending = this->linked = false;
 }
 
 
@@ -16,8 +55,12 @@ Shader::Shader() {
  * Loads the named files, compiles the shaders and
  * assembles the shader program.
  */
-Shader::Shader(const char *vertexshaderfile, const char *fragmentshaderfile) {
-    this->createShader(vertexshaderfile, fragmentshaderfile);
+Shader::Shader(const char *vertexshaderfile, const char *fragmentshaderfile, const char *defines) {
+    this->programID = 0;
+    this->vertexshader = this->fragmentshader = 0;
+    this->programkey = 0;
+    this->pending = this->linked = false;
+    this->createShader(vertexshaderfile, fragmentshaderfile, defines);
 }
 
 
@@ -26,88 +69,365 @@ Shader::Shader(const char *vertexshaderfile, const char *fragmentshaderfile) {
  * Cleans up by deleting the program if it was compiled.
  */
 Shader::~Shader() {
-    if(programID != 0)
-        glDeleteProgram(programID);
+    release();
 }
 
 
 /*
  * createShader() - create, load, compile and link the GLSL Shader objects.
  */
-void Shader::createShader(const char *vertexshaderfile, const char *fragmentshaderfile) {
+void Shader::createShader(const char *vertexshaderfile, const char *fragmentshaderfile, const char *defines) {
+    submitShader(vertexshaderfile, fragmentshaderfile, defines);
+    finish();
+}
+
+
+/*
+ * createFeedbackShader() - create, load, compile and link a vertex shader
+ * for transform feedback. The outputs must be declared before linking.
+ */
+void Shader::createFeedbackShader(const char *vertexshaderfile, const char **varyings, int nvaryings,
+    const char *defines) {
+    submitFeedbackShader(vertexshaderfile, varyings, nvaryings, defines);
+    finish();
+}
+
+
+/*
+ * submitShader() - start compiling and linking the program, without
+ * asking for the result. Status queries would wait for the compiler.
+ */
+void Shader::submitShader(const char *vertexshaderfile, const char *fragmentshaderfile, const char *defines) {
 
     GLuint programObject;
-    GLuint vertexShader;
-    GLuint fragmentShader;
-    const char *vertexShaderStrings[1];
-    const char *fragmentShaderStrings[1];
 	unsigned char *vertexShaderAssembly;
 	unsigned char *fragmentShaderAssembly;
-    
+
+    release();
+
+    vertexShaderAssembly = loadShaderSource(vertexshaderfile, defines, vertexfiles);
+    fragmentShaderAssembly = loadShaderSource(fragmentshaderfile, defines, fragmentfiles);
+
+    // Use the program from the last run if the sources are unchanged
+    programkey = 0;
+    if(vertexShaderAssembly && fragmentShaderAssembly) {
+        const char *sources[2] = { (char*)vertexShaderAssembly, (char*)fragmentShaderAssembly };
+        programkey = cacheKey(sources, 2, NULL, 0);
+        programObject = loadBinary(programkey);
+        if(programObject) {
+            delete[] vertexShaderAssembly;
+            delete[] fragmentShaderAssembly;
+            FrameUniforms::bindBlocks(programObject); // Block bindings are not in the binary
+            programID = programObject;
+            linked = true;
+            return;
+        }
+    }
+
+    // Compile the two shaders, create a program object and attach them.
+    vertexshader = compileShader(GL_VERTEX_SHADER, vertexShaderAssembly);
+    fragmentshader = compileShader(GL_FRAGMENT_SHADER, fragmentShaderAssembly);
+    programObject = glCreateProgram();
+    glAttachShader(programObject, vertexshader);
+    glAttachShader(programObject, fragmentshader);
+    if(programkey && binariesSupported())
+        glProgramParameteri(programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    // Link the program object. finish() checks the result.
+    glLinkProgram(programObject);
+    programID = programObject; // Save this value in the class variable
+    pending = true;
+}
+
+
+/*
+ * submitFeedbackShader() - start compiling and linking a vertex shader
+ * for transform feedback, like submitShader().
+ */
+void Shader::submitFeedbackShader(const char *vertexshaderfile, const char **varyings, int nvaryings,
+    const char *defines) {
+
+    GLuint programObject;
+    unsigned char *vertexShaderAssembly;
+
+    release();
+
+    vertexShaderAssembly = loadShaderSource(vertexshaderfile, defines, vertexfiles);
+
+    // Use the program from the last run if the source and outputs are unchanged
+    programkey = 0;
+    if(vertexShaderAssembly) {
+        const char *sources[1] = { (char*)vertexShaderAssembly };
+        programkey = cacheKey(sources, 1, varyings, nvaryings);
+        programObject = loadBinary(programkey);
+        if(programObject) {
+            delete[] vertexShaderAssembly;
+            FrameUniforms::bindBlocks(programObject); // Block bindings are not in the binary
+            programID = programObject;
+            linked = true;
+            return;
+        }
+    }
+
+    // Create a program object with the vertex shader and name the captured outputs.
+    vertexshader = compileShader(GL_VERTEX_SHADER, vertexShaderAssembly);
+    programObject = glCreateProgram();
+    glAttachShader(programObject, vertexshader);
+    glTransformFeedbackVaryings(programObject, nvaryings, varyings, GL_INTERLEAVED_ATTRIBS);
+    if(programkey && binariesSupported())
+        glProgramParameteri(programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    // Link the program object. finish() checks the result.
+    glLinkProgram(programObject);
+    programID = programObject; // Save this value in the class variable
+    pending = true;
+}
+
+
+/*
+ * ready() - with parallel compilation the driver can tell whether it is
+ * done without waiting. Otherwise this waits for the program.
+ */
+bool Shader::ready() {
+    if(pending && parallelCompile()) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(programID, GL_COMPLETION_STATUS_KHR, &done);
+        if(done == GL_FALSE) return false;
+    }
+    finish();
+    return linked;
+}
+
+
+/*
+ * finish() - wait for the submitted program, print the compiler and
+ * linker errors, if any, and store it in the cache.
+ */
+void Shader::finish() {
+
     GLint vertexCompiled;
     GLint fragmentCompiled;
     GLint shadersLinked;
     char str[4096]; // For error messages from the GLSL compiler and linker
 
-    // If a program is already stored in this object, delete it
-    if(programID != 0)
-        glDeleteProgram(programID);
+    if(!pending) return;
+    pending = false;
 
-    // Create the vertex shader.
-    vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glGetShaderiv(vertexshader, GL_COMPILE_STATUS, &vertexCompiled);
+    if(vertexCompiled == GL_FALSE)
+    {
+        glGetShaderInfoLog(vertexshader, sizeof(str), NULL, str);
+        printError("Vertex shader compile error", str);
+        printError("Vertex shader files", vertexfiles.c_str());
+    }
 
-    vertexShaderAssembly = readShaderFile(vertexshaderfile);
-    if(vertexShaderAssembly) { // Don't try to use a NULL pointer
-        vertexShaderStrings[0] = (char*)vertexShaderAssembly;
-        glShaderSource(vertexShader, 1, vertexShaderStrings, NULL);
-        glCompileShader(vertexShader);
-        delete[] vertexShaderAssembly;
+    if(fragmentshader) { // Feedback programs have none
+        glGetShaderiv(fragmentshader, GL_COMPILE_STATUS, &fragmentCompiled);
+        if(fragmentCompiled == GL_FALSE)
+        {
+            glGetShaderInfoLog(fragmentshader, sizeof(str), NULL, str);
+            printError("Fragment shader compile error ", str);
+            printError("Fragment shader files", fragmentfiles.c_str());
+        }
     }
 
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS,
-                               &vertexCompiled);
-    if(vertexCompiled  == GL_FALSE)
-  	{
-        glGetShaderInfoLog(vertexShader, sizeof(str), NULL, str);
-        printError("Vertex shader compile error", str);
-  	}
+    glGetProgramiv(programID, GL_LINK_STATUS, &shadersLinked);
+    if(shadersLinked == GL_FALSE)
+    {
+        glGetProgramInfoLog(programID, sizeof(str), NULL, str);
+        printError("Program object linking error", str);
+    }
+    else if(programkey) saveBinary(programID, programkey);
+    linked = (shadersLinked == GL_TRUE);
 
-  	// Create the fragment shader.
-    fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glDeleteShader(vertexshader);   // After linking,
+    glDeleteShader(fragmentshader); // these are no longer needed
+    vertexshader = fragmentshader = 0;
 
-    fragmentShaderAssembly = readShaderFile(fragmentshaderfile);
-    if(fragmentShaderAssembly) { // Don't try to use a NULL pointer
-    	fragmentShaderStrings[0] = (char*)fragmentShaderAssembly;
-        glShaderSource(fragmentShader, 1, fragmentShaderStrings, NULL);
-        glCompileShader(fragmentShader);
-        delete[] fragmentShaderAssembly;
+    FrameUniforms::bindBlocks(programID); // The shared uniform buffers
+}
+
+
+void Shader::setCacheDirectory(const char *directory) {
+    cachedirectory = directory;
+}
+
+
+int Shader::cacheHits() {
+    return cachehits;
+}
+
+
+/* private */
+unsigned long long Shader::cacheKey(const char **sources, int nsources,
+    const char **varyings, int nvaryings) {
+
+    unsigned long long hash = 14695981039346656037ULL;
+    const GLubyte *renderer = glGetString(GL_RENDERER);
+    const GLubyte *version = glGetString(GL_VERSION);
+    hash = hashString(hash, renderer ? (const char*)renderer : "");
+    hash = hashString(hash, version ? (const char*)version : "");
+    for(int i=0; i<nsources; i++) hash = hashString(hash, sources[i]);
+    for(int i=0; i<nvaryings; i++) hash = hashString(hash, varyings[i]);
+    return hash;
+}
+
+
+/*
+ * private
+ * loadBinary() - the cache file is named after the key, and repeats it
+ * in its header in case of a collision of file names.
+ */
+GLuint Shader::loadBinary(unsigned long long key) {
+
+    if(!cachedirectory || !binariesSupported()) return 0;
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s/%016llx.bin", cachedirectory, key);
+    FILE *file = fopen(filename, "rb");
+    if(!file) return 0; // Not cached yet
+
+    char magic[8];
+    unsigned long long filekey = 0;
+    GLenum format = 0;
+    GLint length = 0;
+    bool ok = fread(magic, 1, 8, file) == 8 && !memcmp(magic, CACHE_MAGIC, 8)
+        && fread(&filekey, sizeof(filekey), 1, file) == 1 && filekey == key
+        && fread(&format, sizeof(format), 1, file) == 1
+        && fread(&length, sizeof(length), 1, file) == 1 && length > 0;
+    char *binary = NULL;
+    if(ok) {
+        binary = new char[length];
+        ok = fread(binary, 1, length, file) == (size_t)length;
     }
+    fclose(file);
 
-    glGetProgramiv(fragmentShader, GL_COMPILE_STATUS, &fragmentCompiled);
-    if(fragmentCompiled == GL_FALSE)
-   	{
-        glGetShaderInfoLog(fragmentShader, sizeof(str), NULL, str);
-        printError("Fragment shader compile error ", str);
+    GLuint program = 0;
+    if(ok) {
+        program = glCreateProgram();
+        glProgramBinary(program, format, binary, length);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if(linked == GL_FALSE) { // Rejected, e.g. by a new driver: compile instead
+            glDeleteProgram(program);
+            program = 0;
+        }
     }
+    delete[] binary;
+    if(program) cachehits++;
+    return program;
+}
 
-    // Create a program object and attach the two compiled shaders.
-    programObject = glCreateProgram();
-    glAttachShader(programObject, vertexShader);
-    glAttachShader(programObject, fragmentShader);
 
-    // Link the program object and print out the info log.
-    glLinkProgram(programObject);
-    glGetProgramiv(programObject, GL_LINK_STATUS, &shadersLinked);
+/* private */
+void Shader::saveBinary(GLuint program, unsigned long long key) {
 
-    if(shadersLinked == GL_FALSE)
-	{
-		glGetProgramInfoLog( programObject, sizeof(str), NULL, str );
-		printError("Program object linking error", str);
-	}
-	glDeleteShader(vertexShader);   // After successful linking,
-	glDeleteShader(fragmentShader); // these are no longer needed
+    if(!cachedirectory || !binariesSupported()) return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0) return;
+    char *binary = new char[length];
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary);
+
+#ifdef _WIN32
+    _mkdir(cachedirectory);
+#else
+    mkdir(cachedirectory, 0755);
+#endif
+    // Write to a temporary file and rename it, so that a crash or a second
+    // instance of the program never leaves a partial cache file behind
+    char filename[1024], tmpname[1040];
+    snprintf(filename, sizeof(filename), "%s/%016llx.bin", cachedirectory, key);
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+    FILE *file = fopen(tmpname, "wb");
+    if(file) {
+        bool ok = fwrite(CACHE_MAGIC, 1, 8, file) == 8
+            && fwrite(&key, sizeof(key), 1, file) == 1
+            && fwrite(&format, sizeof(format), 1, file) == 1
+            && fwrite(&length, sizeof(length), 1, file) == 1
+            && fwrite(binary, 1, length, file) == (size_t)length;
+        ok = (fclose(file) == 0) && ok;
+        remove(filename); // rename() does not replace existing files on Windows
+        if(!ok || rename(tmpname, filename) != 0) {
+            remove(tmpname);
+            printError("Cannot write shader cache file", filename);
+        }
+    }
+    else printError("Cannot write shader cache file", tmpname);
+    delete[] binary;
+}
+
+
+/*
+ * private
+ * parallelCompile() - with GL_KHR_parallel_shader_compile (or the ARB
+ * version) the driver compiles on threads of its own, and programs can
+ * be polled with GL_COMPLETION_STATUS_KHR. Checked once; the driver is
+ * asked to use as many threads as it likes.
+ */
+bool Shader::parallelCompile() {
+    static int supported = -1; // Not checked yet
+    if(supported < 0) {
+        supported = 0;
+        GLint extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+        for(GLint i=0; i<extensions && !supported; i++) {
+            const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if(!name) continue;
+            const char *function = NULL;
+            if(!strcmp(name, "GL_KHR_parallel_shader_compile")) function = "glMaxShaderCompilerThreadsKHR";
+            if(!strcmp(name, "GL_ARB_parallel_shader_compile")) function = "glMaxShaderCompilerThreadsARB";
+            if(!function) continue;
+            supported = 1;
+            MaxCompilerThreadsProc maxThreads = (MaxCompilerThreadsProc)glfwGetProcAddress(function);
+            if(maxThreads) maxThreads(0xFFFFFFFF); // As many as the driver wants
+        }
+    }
+    return supported == 1;
+}
+
+
+/* private: create a shader object and start compiling it */
+GLuint Shader::compileShader(GLenum type, unsigned char *source) {
+    GLuint shader = glCreateShader(type);
+    if(source) { // Don't try to use a NULL pointer
+        const char *strings[1] = { (char*)source };
+        glShaderSource(shader, 1, strings, NULL);
+        glCompileShader(shader);
+        delete[] source;
+    }
+    return shader;
+}
 
-	programID = programObject; // Save this value in the class variable
+
+/* private: delete the program and any shaders still waiting to be linked */
+void Shader::release() {
+    if(vertexshader) glDeleteShader(vertexshader);
+    if(fragmentshader) glDeleteShader(fragmentshader);
+    if(programID != 0)
+        glDeleteProgram(programID);
+    programID = vertexshader = fragmentshader = 0;
+    pending = linked = false;
+}
+
+
+/*
+ * private
+ * binariesSupported() - program binaries are core in OpenGL 4.1 and
+ * otherwise need ARB_get_program_binary. Drivers can also support them
+ * with no formats at all, which means that nothing can be saved.
+ */
+bool Shader::binariesSupported() {
+    static int supported = -1; // Not checked yet
+    if(supported < 0) {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        glGetError(); // GL_INVALID_ENUM if the driver does not know program binaries
+        supported = (formats > 0) ? 1 : 0;
+    }
+    return supported == 1;
 }
 
 
@@ -147,7 +467,7 @@ unsigned char* Shader::readShaderFile(const char *filename) {
     FILE *file = fopen(filename, "r");
     if(file == NULL)
     {
-        printError("ERROR", "Cannot open shader file!");
+        printError("Cannot open shader file", filename);
   		  return 0;
     }
     int bytesinfile = filelength(file);
@@ -158,3 +478,103 @@ unsigned char* Shader::readShaderFile(const char *filename) {
 
     return buffer;
 }
+
+
+/*
+ * private
+ * loadShaderSource() - the result is in new[] memory, like that of
+ * readShaderFile(), and is NULL if the main file cannot be read.
+ */
+unsigned char* Shader::loadShaderSource(const char *filename, const char *defines, std::string &files) {
+
+    std::string source;
+    std::vector<std::string> included;
+    if(!expandIncludes(filename, defines, source, included, 0)) return 0;
+
+    files.clear();
+    for(size_t i=0; i<included.size(); i++) {
+        char number[16];
+        snprintf(number, sizeof(number), "%s%d ", i ? ", " : "", (int)i);
+        files += number + included[i];
+    }
+
+    unsigned char *buffer = new unsigned char[source.size()+1];
+    memcpy(buffer, source.c_str(), source.size()+1);
+    return buffer;
+}
+
+
+/*
+ * private
+ * expandIncludes() - copy the file line by line, replacing #include lines
+ * with the named files. #line directives keep the line numbers of the
+ * compiler's messages right, with the file's number in 'included' as the
+ * GLSL source string number. The defines go after the main file's
+ * #version line, which must stay first.
+ */
+bool Shader::expandIncludes(const char *filename, const char *defines, std::string &source,
+    std::vector<std::string> &included, int depth) {
+
+    unsigned char *text = readShaderFile(filename);
+    if(!text) return false;
+
+    int fileindex = (int)included.size();
+    included.push_back(filename);
+    std::string directory(filename);
+    size_t slash = directory.find_last_of("/\\");
+    directory = (slash == std::string::npos) ? "" : directory.substr(0, slash+1);
+
+    char linemark[64];
+    if(depth > 0) {
+        snprintf(linemark, sizeof(linemark), "#line 1 %d\n", fileindex);
+        source += linemark;
+    }
+    bool hasversion = false;
+    int linenumber = 0;
+    const char *line = (const char*)text;
+    while(*line) {
+        const char *end = strchr(line, '\n');
+        std::string current = end ? std::string(line, end - line + 1) : std::string(line) + "\n";
+        line = end ? end + 1 : line + strlen(line);
+        linenumber++;
+
+        size_t first = current.find_first_not_of(" \t");
+        if(first != std::string::npos && current.compare(first, 8, "#include") == 0) {
+            size_t open = current.find('"', first + 8);
+            size_t close = (open == std::string::npos) ? open : current.find('"', open + 1);
+            if(close == std::string::npos) {
+                printError("Bad #include in shader file", filename);
+                continue;
+            }
+            std::string name = directory + current.substr(open + 1, close - open - 1);
+            bool seen = false;
+            for(size_t i=0; i<included.size(); i++) seen = seen || included[i] == name;
+            if(!seen) {
+                if(depth >= 16) printError("Shader #includes nested too deep in", filename);
+                else if(!expandIncludes(name.c_str(), NULL, source, included, depth + 1))
+                    printError("Cannot include shader file", name.c_str());
+            }
+            snprintf(linemark, sizeof(linemark), "#line %d %d\n", linenumber + 1, fileindex);
+            source += linemark;
+            continue;
+        }
+
+        source += current;
+        if(depth == 0 && !hasversion && first != std::string::npos
+            && current.compare(first, 8, "#version") == 0) {
+            hasversion = true;
+            if(defines) {
+                source += defines;
+                if(*defines && defines[strlen(defines)-1] != '\n') source += "\n";
+                snprintf(linemark, sizeof(linemark), "#line %d %d\n", linenumber + 1, fileindex);
+                source += linemark;
+            }
+        }
+    }
+    delete[] text;
+    if(depth == 0 && defines && !hasversion) {
+        snprintf(linemark, sizeof(linemark), "\n#line 1 %d\n", fileindex);
+        source = defines + (linemark + source);
+    }
+    return true;
+}
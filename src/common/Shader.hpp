@@ -2,7 +2,24 @@
 /* A class to load and compile GLSL shaders from files. */
 /* Usage: call createShader() to load and compile a program object,
  * or use the constructor with two file name arguments.
- * Call glUseProgram() with the public member programID as argument. */
+ * createFeedbackShader() makes a vertex shader only program that
+ * writes its outputs to a buffer with transform feedback.
+ * Call glUseProgram() with the public member programID as argument.
+ * Shader files may #include "file.glsl" other files, relative to their
+ * own directory; each file is included only once. 'defines' is GLSL text
+ * put right after the #version line, e.g. "#define NOISE_OCTAVES 1\n",
+ * to compile specialized variants of one source. Errors refer to the
+ * files by number (0 is the main file); the numbers are listed after the
+ * compiler's log.
+ * To compile several programs at once, call submitShader() for each of
+ * them, and ready() before each use: it is false until the program is
+ * done, so that pass can be skipped instead of waiting for the compiler.
+ * Drivers with GL_KHR_parallel_shader_compile compile them on threads
+ * of their own meanwhile. finish() waits for one program.
+ * Linked programs are kept in an on-disk cache (see setCacheDirectory())
+ * and loaded from there with glProgramBinary() on the next start, if the
+ * driver supports program binaries. A binary that the driver rejects,
+ * e.g. after a driver update, is silently replaced by a compiled one. */
 /* Stefan Gustavson (stefan.gustavson@liu.se) 2014-03-27 */
 
 #ifndef SHADER_HPP // Avoid including this header twice
@@ -15,6 +32,8 @@
 #include <GLFW/glfw3.h>
 #include "Utilities.hpp" // For OpenGL extensions
 #include <cstdio>
+#include <string>
+#include <vector>
 
 class Shader {
 
@@ -26,7 +45,7 @@ GLuint programID;
 Shader();
 
 /* Constructor to create, load and compile a Shader program in one blow. */
-Shader(const char *vertexshaderfile, const char *fragmentshaderfile);
+Shader(const char *vertexshaderfile, const char *fragmentshaderfile, const char *defines = NULL);
 
 /* Destructor */
 ~Shader();
@@ -34,10 +53,77 @@ Shader(const char *vertexshaderfile, const char *fragmentshaderfile);
 /*
  * createShader() - create, load, compile and link the GLSL shader objects.
  */
-void createShader(const char *vertexshaderfile, const char *fragmentshaderfile);
+void createShader(const char *vertexshaderfile, const char *fragmentshaderfile, const char *defines = NULL);
+
+/*
+ * createFeedbackShader() - create a program with only a vertex shader,
+ * whose outputs 'varyings' are captured interleaved, in that order,
+ * by transform feedback. Draw with GL_RASTERIZER_DISCARD enabled.
+ */
+void createFeedbackShader(const char *vertexshaderfile, const char **varyings, int nvaryings,
+    const char *defines = NULL);
+
+/*
+ * submitShader(), submitFeedbackShader() - like createShader() and
+ * createFeedbackShader(), but return without waiting for the compiler.
+ */
+void submitShader(const char *vertexshaderfile, const char *fragmentshaderfile, const char *defines = NULL);
+void submitFeedbackShader(const char *vertexshaderfile, const char **varyings, int nvaryings,
+    const char *defines = NULL);
+
+/* True when the program is linked and can be used. Does not wait if the driver can tell. */
+bool ready();
+
+/* Wait for a submitted program and print its errors, if any */
+void finish();
+
+/*
+ * setCacheDirectory() - where program binaries are stored, "shadercache"
+ * by default. NULL turns the cache off. Created when first written to.
+ */
+static void setCacheDirectory(const char *directory);
+
+/* Number of programs loaded from the cache so far, rather than compiled */
+static int cacheHits();
 
 private:
 
+static const char *cachedirectory;
+static int cachehits;
+
+GLuint vertexshader, fragmentshader; // Until the program is linked
+unsigned long long programkey;       // Cache key, 0 if not to be cached
+std::string vertexfiles, fragmentfiles;
+bool pending;                        // Submitted and not finished
+bool linked;
+
+/* Create a shader object and start compiling 'source', which is deleted */
+GLuint compileShader(GLenum type, unsigned char *source);
+
+/* Delete the program and its shaders */
+void release();
+
+/* True if the driver compiles on threads of its own */
+static bool parallelCompile();
+
+/*
+ * cacheKey() - a hash of the expanded shader sources (so every variant
+ * and every change to an included file has its own entry), the transform
+ * feedback varyings, and of the GL_RENDERER and GL_VERSION strings, since binaries
+ * are only valid for the driver that made them.
+ */
+static unsigned long long cacheKey(const char **sources, int nsources,
+    const char **varyings, int nvaryings);
+
+/* Load a linked program from the cache. Returns 0 if none is usable. */
+GLuint loadBinary(unsigned long long key);
+
+/* Store a linked program in the cache */
+void saveBinary(GLuint program, unsigned long long key);
+
+/* True if the driver can save and load program binaries */
+static bool binariesSupported();
+
 /*
  * Override the Win32 filelength() function with
  * a version that takes a Unix-style file handle as
@@ -51,6 +137,16 @@ long filelength(FILE *file);
  */
 unsigned char* readShaderFile(const char *filename);
 
+/*
+ * loadShaderSource() - read a shader file with its #includes expanded
+ * and 'defines' inserted. 'files' gets the list of files by number.
+ */
+unsigned char* loadShaderSource(const char *filename, const char *defines, std::string &files);
+
+/* Append 'filename' with its includes to 'source'. Returns false if it cannot be read. */
+bool expandIncludes(const char *filename, const char *defines, std::string &source,
+    std::vector<std::string> &included, int depth);
+
 void printError(const char *errtype, const char *errmsg);
 
 };
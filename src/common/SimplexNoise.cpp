@@ -0,0 +1,295 @@
+/*
+ * CPU version of the 3-D simplex noise from the GLSL shaders.
+ * The scalar snoise() functions are a direct transcription of the
+ * GLSL code and serve as the reference. The batch functions dispatch
+ * to the fastest kernel the CPU supports. The scalar batch kernel is
+ * built from the same source as the SIMD kernels (SimplexNoiseKernel.inl).
+ *
+ * GLSL original: Ian McEwan, Ashima Arts and Stefan Gustavson, LiU.
+ * This code is in the public domain.
+ */
+
+#include "SimplexNoise.hpp"
+
+#include <cmath>   // For floorf(), fabsf()
+#include <cstring> // For memcpy()
+
+/*
+ * The reference implementation, kept as close to the GLSL source as
+ * possible. Vector expressions are written out component by component,
+ * and dot() products are summed left to right.
+ */
+namespace {
+
+inline float mod289(float x) {
+    return x - floorf(x * (1.0f / 289.0f)) * 289.0f;
+}
+
+inline float permute(float x) {
+    return mod289(((x*34.0f)+1.0f)*x);
+}
+
+inline float taylorInvSqrt(float r) {
+    return 1.79284291400159f - 0.85373472095314f * r;
+}
+
+inline float step(float edge, float x) {
+    return x < edge ? 0.0f : 1.0f;
+}
+
+// Same NaN behaviour as the SSE min/max instructions
+inline float fmin2(float a, float b) { return a < b ? a : b; }
+inline float fmax2(float a, float b) { return a > b ? a : b; }
+
+inline float dot3(const float *a, const float *b) {
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+/*
+ * Everything up to the final mix, shared by both snoise() versions.
+ * Fills in the corner offsets x[4][3] and the gradients p[4][3].
+ */
+void simplexSetup(float vx, float vy, float vz, float x[4][3], float p[4][3]) {
+
+    const float C[2] = { 1.0f/6.0f, 1.0f/3.0f };
+    const float D[4] = { 0.0f, 0.5f, 1.0f, 2.0f };
+    int k;
+
+    // First corner
+    float s = vx*C[1] + vy*C[1] + vz*C[1];
+    float i[3] = { floorf(vx + s), floorf(vy + s), floorf(vz + s) };
+    float t = i[0]*C[0] + i[1]*C[0] + i[2]*C[0];
+    x[0][0] = vx - i[0] + t;
+    x[0][1] = vy - i[1] + t;
+    x[0][2] = vz - i[2] + t;
+
+    // Other corners
+    float g[3] = { step(x[0][1], x[0][0]), step(x[0][2], x[0][1]), step(x[0][0], x[0][2]) };
+    float l[3] = { 1.0f - g[0], 1.0f - g[1], 1.0f - g[2] };
+    float i1[3] = { fmin2(g[0], l[2]), fmin2(g[1], l[0]), fmin2(g[2], l[1]) };
+    float i2[3] = { fmax2(g[0], l[2]), fmax2(g[1], l[0]), fmax2(g[2], l[1]) };
+
+    for(k=0; k<3; k++) {
+        x[1][k] = x[0][k] - i1[k] + C[0];
+        x[2][k] = x[0][k] - i2[k] + C[1]; // 2.0*C.x = 1/3 = C.y
+        x[3][k] = x[0][k] - D[1];         // -1.0+3.0*C.x = -0.5 = -D.y
+    }
+
+    // Permutations
+    for(k=0; k<3; k++) i[k] = mod289(i[k]);
+    float ox[4] = { 0.0f, i1[0], i2[0], 1.0f };
+    float oy[4] = { 0.0f, i1[1], i2[1], 1.0f };
+    float oz[4] = { 0.0f, i1[2], i2[2], 1.0f };
+
+    // Gradients: 7x7 points over a square, mapped onto an octahedron.
+    // The ring size 17*17 = 289 is close to a multiple of 49 (49*6 = 294)
+    float n_ = 0.142857142857f; // 1.0/7.0
+    float ns[3] = { n_*D[3] - D[0], n_*D[1] - D[2], n_*D[2] - D[0] };
+
+    for(k=0; k<4; k++) {
+        float pk = permute(permute(permute(i[2] + oz[k]) + i[1] + oy[k]) + i[0] + ox[k]);
+
+        float j = pk - 49.0f * floorf(pk * ns[2] * ns[2]);  //  mod(p,7*7)
+        float x_ = floorf(j * ns[2]);
+        float y_ = floorf(j - 7.0f * x_);    // mod(j,N)
+        float gx = x_ *ns[0] + ns[1];
+        float gy = y_ *ns[0] + ns[1];
+        float h = 1.0f - fabsf(gx) - fabsf(gy);
+
+        float sx = floorf(gx)*2.0f + 1.0f;
+        float sy = floorf(gy)*2.0f + 1.0f;
+        float sh = -step(h, 0.0f);
+
+        p[k][0] = gx + sx*sh;
+        p[k][1] = gy + sy*sh;
+        p[k][2] = h;
+
+        // Normalise gradients
+        float norm = taylorInvSqrt(dot3(p[k], p[k]));
+        p[k][0] *= norm;
+        p[k][1] *= norm;
+        p[k][2] *= norm;
+    }
+}
+
+}
+
+
+/* 3-D simplex noise */
+float Noise::snoise(float vx, float vy, float vz) {
+
+    float x[4][3], p[4][3], m[4], pdotx[4];
+
+    simplexSetup(vx, vy, vz, x, p);
+
+    // Mix final noise value
+    for(int k=0; k<4; k++) {
+        m[k] = fmax2(0.6f - dot3(x[k], x[k]), 0.0f);
+        m[k] = m[k] * m[k];
+        m[k] = m[k] * m[k];
+        pdotx[k] = dot3(p[k], x[k]);
+    }
+    return 42.0f * (m[0]*pdotx[0] + m[1]*pdotx[1] + m[2]*pdotx[2] + m[3]*pdotx[3]);
+}
+
+
+/* 3-D simplex noise with gradient (analytical partial derivatives in x,y,z) */
+float Noise::snoise(float vx, float vy, float vz, float *grad) {
+
+    float x[4][3], p[4][3], m[4], m4[4], pdotx[4], temp[4];
+
+    simplexSetup(vx, vy, vz, x, p);
+
+    // Mix final noise value
+    for(int k=0; k<4; k++) {
+        m[k] = fmax2(0.6f - dot3(x[k], x[k]), 0.0f);
+        float m2 = m[k] * m[k];
+        m4[k] = m2 * m2;
+        pdotx[k] = dot3(p[k], x[k]);
+        temp[k] = m2 * m[k] * pdotx[k];
+    }
+
+    // Determine noise gradient
+    for(int c=0; c<3; c++) {
+        grad[c] = -8.0f * (temp[0]*x[0][c] + temp[1]*x[1][c] + temp[2]*x[2][c] + temp[3]*x[3][c]);
+        grad[c] += m4[0]*p[0][c] + m4[1]*p[1][c] + m4[2]*p[2][c] + m4[3]*p[3][c];
+        grad[c] *= 42.0f;
+    }
+
+    return 42.0f * (m4[0]*pdotx[0] + m4[1]*pdotx[1] + m4[2]*pdotx[2] + m4[3]*pdotx[3]);
+}
+
+
+/*
+ * Kernel dispatch
+ */
+namespace {
+
+typedef void (*BlockFunc)(const float*, const float*, const float*, float*);
+typedef void (*GradBlockFunc)(const float*, const float*, const float*,
+                              float*, float*, float*, float*);
+
+struct Dispatch {
+    Noise::Kernel kernel;
+    BlockFunc block;
+    GradBlockFunc gradBlock;
+
+    Dispatch() {
+        if(Noise::kernelSupported(Noise::KERNEL_AVX2))
+            select(Noise::KERNEL_AVX2);
+        else if(Noise::kernelSupported(Noise::KERNEL_SSE41))
+            select(Noise::KERNEL_SSE41);
+        else
+            select(Noise::KERNEL_SCALAR);
+    }
+
+    void select(Noise::Kernel k) {
+        switch(k) {
+#if NOISE_X86
+        case Noise::KERNEL_AVX2:
+            block = Noise::snoiseBlockAVX2;
+            gradBlock = Noise::snoiseGradBlockAVX2;
+            break;
+        case Noise::KERNEL_SSE41:
+            block = Noise::snoiseBlockSSE41;
+            gradBlock = Noise::snoiseGradBlockSSE41;
+            break;
+#endif
+        default:
+            block = Noise::snoiseBlockScalar;
+            gradBlock = Noise::snoiseGradBlockScalar;
+            break;
+        }
+        kernel = k;
+    }
+};
+
+Dispatch &dispatch() {
+    static Dispatch d; // Initialised on first use (thread safe in C++11)
+    return d;
+}
+
+}
+
+bool Noise::kernelSupported(Kernel kernel) {
+    switch(kernel) {
+    case KERNEL_SCALAR:
+        return true;
+#if NOISE_X86 && defined(__GNUC__)
+    case KERNEL_SSE41:
+        return __builtin_cpu_supports("sse4.1");
+    case KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+bool Noise::setKernel(Kernel kernel) {
+    if(!kernelSupported(kernel)) return false;
+    dispatch().select(kernel);
+    return true;
+}
+
+Noise::Kernel Noise::getKernel() {
+    return dispatch().kernel;
+}
+
+const char *Noise::kernelName(Kernel kernel) {
+    switch(kernel) {
+    case KERNEL_SSE41: return "SSE4.1";
+    case KERNEL_AVX2:  return "AVX2";
+    default:           return "scalar";
+    }
+}
+
+
+void Noise::snoiseBatch(const float *x, const float *y, const float *z,
+                        float *result, int n) {
+
+    BlockFunc block = dispatch().block;
+    int i = 0;
+
+    for(; i+BLOCKSIZE <= n; i+=BLOCKSIZE) {
+        block(x+i, y+i, z+i, result+i);
+    }
+
+    // Pad the last partial block with zeros
+    if(i < n) {
+        float tx[BLOCKSIZE] = {0}, ty[BLOCKSIZE] = {0}, tz[BLOCKSIZE] = {0};
+        float tr[BLOCKSIZE];
+        int rest = n - i;
+        memcpy(tx, x+i, rest*sizeof(float));
+        memcpy(ty, y+i, rest*sizeof(float));
+        memcpy(tz, z+i, rest*sizeof(float));
+        block(tx, ty, tz, tr);
+        memcpy(result+i, tr, rest*sizeof(float));
+    }
+}
+
+
+void Noise::snoiseBatch(const float *x, const float *y, const float *z,
+                        float *result, float *gx, float *gy, float *gz, int n) {
+
+    GradBlockFunc gradBlock = dispatch().gradBlock;
+    int i = 0;
+
+    for(; i+BLOCKSIZE <= n; i+=BLOCKSIZE) {
+        gradBlock(x+i, y+i, z+i, result+i, gx+i, gy+i, gz+i);
+    }
+
+    if(i < n) {
+        float tx[BLOCKSIZE] = {0}, ty[BLOCKSIZE] = {0}, tz[BLOCKSIZE] = {0};
+        float tr[BLOCKSIZE], tgx[BLOCKSIZE], tgy[BLOCKSIZE], tgz[BLOCKSIZE];
+        int rest = n - i;
+        memcpy(tx, x+i, rest*sizeof(float));
+        memcpy(ty, y+i, rest*sizeof(float));
+        memcpy(tz, z+i, rest*sizeof(float));
+        gradBlock(tx, ty, tz, tr, tgx, tgy, tgz);
+        memcpy(result+i, tr, rest*sizeof(float));
+        memcpy(gx+i, tgx, rest*sizeof(float));
+        memcpy(gy+i, tgy, rest*sizeof(float));
+        memcpy(gz+i, tgz, rest*sizeof(float));
+    }
+}
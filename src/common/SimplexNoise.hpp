@@ -0,0 +1,92 @@
+/* SimplexNoise.hpp */
+/*
+ * A CPU port of the 3-D simplex noise used by the GLSL shaders
+ * (planeShaderVert.glsl, waterShaderFrag.glsl, cloudShaderFrag.glsl).
+ * Both snoise(vec3) and snoise(vec3, out vec3 gradient) are provided,
+ * as a plain scalar reference and as batch functions that evaluate
+ * many points at once with SSE4.1 or AVX2 kernels (8 points per call).
+ * The batch kernels follow the exact expression order of the reference,
+ * without fused multiply-add, so all kernels agree bit for bit.
+ */
+/* Usage: call Noise::snoise(x, y, z) for single points, or
+ * Noise::snoiseBatch() on arrays of coordinates (structure of arrays).
+ * The fastest kernel supported by the CPU is picked on first use.
+ * Call Noise::setKernel() to force a specific one (for benchmarks). */
+/* GLSL original: Ian McEwan, Ashima Arts and Stefan Gustavson, LiU.
+ * This code is in the public domain.
+ */
+
+#ifndef SIMPLEXNOISE_HPP // Avoid including this header twice
+#define SIMPLEXNOISE_HPP
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define NOISE_X86 1
+#else
+#define NOISE_X86 0
+#endif
+
+namespace Noise {
+
+enum Kernel {
+    KERNEL_SCALAR = 0,
+    KERNEL_SSE41  = 1,
+    KERNEL_AVX2   = 2
+};
+
+/* Number of points processed by one call to a SIMD kernel */
+const int BLOCKSIZE = 8;
+
+/*
+ * snoise() - scalar reference, a line-by-line port of the GLSL code.
+ * The second version also returns the analytic gradient in grad[3].
+ */
+float snoise(float x, float y, float z);
+float snoise(float x, float y, float z, float *grad);
+
+/*
+ * snoiseBatch() - evaluate snoise() for n points given as
+ * separate x, y and z arrays. Any n is allowed, the arrays
+ * need no particular alignment.
+ */
+void snoiseBatch(const float *x, const float *y, const float *z,
+                 float *result, int n);
+
+/*
+ * snoiseBatch() with gradient - as above, but also writes the
+ * gradient components to gx, gy and gz.
+ */
+void snoiseBatch(const float *x, const float *y, const float *z,
+                 float *result, float *gx, float *gy, float *gz, int n);
+
+/* Return the kernel used by the batch functions */
+Kernel getKernel();
+
+/* Force a kernel. Returns false (and changes nothing) if the CPU lacks support. */
+bool setKernel(Kernel kernel);
+
+/* True if the CPU can run the given kernel */
+bool kernelSupported(Kernel kernel);
+
+/* Human readable kernel name, for log messages */
+const char *kernelName(Kernel kernel);
+
+/*
+ * Kernel entry points, one set per instruction set. Each call
+ * processes exactly BLOCKSIZE points. Exposed here only so the
+ * dispatcher can reach them from their separate translation units.
+ */
+void snoiseBlockScalar(const float *x, const float *y, const float *z, float *result);
+void snoiseGradBlockScalar(const float *x, const float *y, const float *z,
+                           float *result, float *gx, float *gy, float *gz);
+#if NOISE_X86
+void snoiseBlockSSE41(const float *x, const float *y, const float *z, float *result);
+void snoiseGradBlockSSE41(const float *x, const float *y, const float *z,
+                          float *result, float *gx, float *gy, float *gz);
+void snoiseBlockAVX2(const float *x, const float *y, const float *z, float *result);
+void snoiseGradBlockAVX2(const float *x, const float *y, const float *z,
+                         float *result, float *gx, float *gy, float *gz);
+#endif
+
+}
+
+#endif // SIMPLEXNOISE_HPP
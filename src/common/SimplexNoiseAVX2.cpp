@@ -0,0 +1,44 @@
+/*
+ * AVX2 kernel for the batch simplex noise in SimplexNoise.hpp.
+ * Eight points per register, one register per block.
+ * FMA is deliberately not enabled, so the results stay identical
+ * to the scalar and SSE4.1 versions.
+ */
+
+#include "SimplexNoise.hpp"
+
+#if NOISE_X86
+
+#include <immintrin.h>
+
+#define NOISE_TARGET __attribute__((target("avx2")))
+#define NOISE_BLOCK snoiseBlockAVX2
+#define NOISE_GRAD_BLOCK snoiseGradBlockAVX2
+
+namespace {
+
+typedef __m256 vfloat;
+const int VWIDTH = 8;
+
+NOISE_TARGET static inline vfloat vset1(float a) { return _mm256_set1_ps(a); }
+NOISE_TARGET static inline vfloat vload(const float *p) { return _mm256_loadu_ps(p); }
+NOISE_TARGET static inline void vstore(float *p, vfloat a) { _mm256_storeu_ps(p, a); }
+NOISE_TARGET static inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+NOISE_TARGET static inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+NOISE_TARGET static inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+NOISE_TARGET static inline vfloat vfloor(vfloat a) { return _mm256_floor_ps(a); }
+NOISE_TARGET static inline vfloat vneg(vfloat a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+NOISE_TARGET static inline vfloat vabs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+NOISE_TARGET static inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+NOISE_TARGET static inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+
+// GLSL step(edge, x): 0.0 if x < edge, else 1.0
+NOISE_TARGET static inline vfloat vstep(vfloat edge, vfloat x) {
+    return _mm256_and_ps(_mm256_cmp_ps(x, edge, _CMP_GE_OQ), _mm256_set1_ps(1.0f));
+}
+
+}
+
+#include "SimplexNoiseKernel.inl"
+
+#endif // NOISE_X86
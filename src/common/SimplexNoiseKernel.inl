@@ -0,0 +1,198 @@
+/* SimplexNoiseKernel.inl */
+/*
+ * Width-agnostic body of the simplex noise batch kernels.
+ * This file is included once per instruction set, after the includer
+ * has defined, in an anonymous namespace:
+ *   vfloat          - the SIMD register type
+ *   VWIDTH          - number of floats in a vfloat
+ *   vset1, vload, vstore, vadd, vsub, vmul, vmin, vmax,
+ *   vfloor, vabs, vneg, vstep  - the arithmetic primitives
+ * and the macros
+ *   NOISE_TARGET          - function attribute selecting the instruction set
+ *   NOISE_BLOCK           - name of the plain noise entry point
+ *   NOISE_GRAD_BLOCK      - name of the noise + gradient entry point
+ * The expression order is the same as in Noise::snoise() (and the GLSL
+ * original), which is what makes all kernels agree bit for bit.
+ */
+
+namespace {
+
+NOISE_TARGET static inline vfloat mod289(vfloat x) {
+    return vsub(x, vmul(vfloor(vmul(x, vset1(1.0f / 289.0f))), vset1(289.0f)));
+}
+
+NOISE_TARGET static inline vfloat permute(vfloat x) {
+    return mod289(vmul(vadd(vmul(x, vset1(34.0f)), vset1(1.0f)), x));
+}
+
+/* Offsets to the four simplex corners and their (normalised) gradients */
+struct SimplexCorners {
+    vfloat x[4], y[4], z[4];
+    vfloat px[4], py[4], pz[4];
+};
+
+NOISE_TARGET static inline void simplexCorners(vfloat vx, vfloat vy, vfloat vz,
+                                               SimplexCorners &c) {
+
+    const vfloat Cx = vset1(1.0f / 6.0f);
+    const vfloat Cy = vset1(1.0f / 3.0f);
+    const vfloat one = vset1(1.0f);
+    const float n_ = 0.142857142857f; // 1.0/7.0
+    const vfloat nsx = vset1(n_ * 2.0f - 0.0f);
+    const vfloat nsy = vset1(n_ * 0.5f - 1.0f);
+    const vfloat nsz = vset1(n_ * 1.0f - 0.0f);
+
+    // First corner
+    vfloat s = vadd(vadd(vmul(vx, Cy), vmul(vy, Cy)), vmul(vz, Cy));
+    vfloat ix = vfloor(vadd(vx, s));
+    vfloat iy = vfloor(vadd(vy, s));
+    vfloat iz = vfloor(vadd(vz, s));
+    vfloat t = vadd(vadd(vmul(ix, Cx), vmul(iy, Cx)), vmul(iz, Cx));
+    c.x[0] = vadd(vsub(vx, ix), t);
+    c.y[0] = vadd(vsub(vy, iy), t);
+    c.z[0] = vadd(vsub(vz, iz), t);
+
+    // Other corners
+    vfloat gx = vstep(c.y[0], c.x[0]);
+    vfloat gy = vstep(c.z[0], c.y[0]);
+    vfloat gz = vstep(c.x[0], c.z[0]);
+    vfloat lx = vsub(one, gx);
+    vfloat ly = vsub(one, gy);
+    vfloat lz = vsub(one, gz);
+    vfloat i1x = vmin(gx, lz), i1y = vmin(gy, lx), i1z = vmin(gz, ly);
+    vfloat i2x = vmax(gx, lz), i2y = vmax(gy, lx), i2z = vmax(gz, ly);
+
+    c.x[1] = vadd(vsub(c.x[0], i1x), Cx);
+    c.y[1] = vadd(vsub(c.y[0], i1y), Cx);
+    c.z[1] = vadd(vsub(c.z[0], i1z), Cx);
+    c.x[2] = vadd(vsub(c.x[0], i2x), Cy);
+    c.y[2] = vadd(vsub(c.y[0], i2y), Cy);
+    c.z[2] = vadd(vsub(c.z[0], i2z), Cy);
+    c.x[3] = vsub(c.x[0], vset1(0.5f));
+    c.y[3] = vsub(c.y[0], vset1(0.5f));
+    c.z[3] = vsub(c.z[0], vset1(0.5f));
+
+    // Permutations
+    ix = mod289(ix);
+    iy = mod289(iy);
+    iz = mod289(iz);
+    const vfloat zero = vset1(0.0f);
+    const vfloat ox[4] = { zero, i1x, i2x, one };
+    const vfloat oy[4] = { zero, i1y, i2y, one };
+    const vfloat oz[4] = { zero, i1z, i2z, one };
+
+    for(int k=0; k<4; k++) {
+        vfloat p = permute(vadd(iz, oz[k]));
+        p = permute(vadd(vadd(p, iy), oy[k]));
+        p = permute(vadd(vadd(p, ix), ox[k]));
+
+        // Gradients: 7x7 points over a square, mapped onto an octahedron.
+        vfloat j = vsub(p, vmul(vset1(49.0f), vfloor(vmul(vmul(p, nsz), nsz))));
+        vfloat x_ = vfloor(vmul(j, nsz));
+        vfloat y_ = vfloor(vsub(j, vmul(vset1(7.0f), x_)));
+        vfloat x = vadd(vmul(x_, nsx), nsy);
+        vfloat y = vadd(vmul(y_, nsx), nsy);
+        vfloat h = vsub(vsub(one, vabs(x)), vabs(y));
+
+        vfloat sx = vadd(vmul(vfloor(x), vset1(2.0f)), one);
+        vfloat sy = vadd(vmul(vfloor(y), vset1(2.0f)), one);
+        vfloat sh = vneg(vstep(h, zero));
+
+        vfloat px = vadd(x, vmul(sx, sh));
+        vfloat py = vadd(y, vmul(sy, sh));
+        vfloat pz = h;
+
+        // Normalise gradients
+        vfloat r = vadd(vadd(vmul(px, px), vmul(py, py)), vmul(pz, pz));
+        vfloat norm = vsub(vset1(1.79284291400159f), vmul(vset1(0.85373472095314f), r));
+        c.px[k] = vmul(px, norm);
+        c.py[k] = vmul(py, norm);
+        c.pz[k] = vmul(pz, norm);
+    }
+}
+
+/* m = max(0.6 - dot(x,x), 0.0) and dot(p,x) for corner k */
+NOISE_TARGET static inline void cornerWeights(const SimplexCorners &c, int k,
+                                              vfloat &m, vfloat &pdotx) {
+    vfloat d = vadd(vadd(vmul(c.x[k], c.x[k]), vmul(c.y[k], c.y[k])), vmul(c.z[k], c.z[k]));
+    m = vmax(vsub(vset1(0.6f), d), vset1(0.0f));
+    pdotx = vadd(vadd(vmul(c.px[k], c.x[k]), vmul(c.py[k], c.y[k])), vmul(c.pz[k], c.z[k]));
+}
+
+NOISE_TARGET static void noiseBlock(const float *x, const float *y, const float *z,
+                                    float *result) {
+
+    for(int i=0; i<Noise::BLOCKSIZE; i+=VWIDTH) {
+        SimplexCorners c;
+        simplexCorners(vload(x+i), vload(y+i), vload(z+i), c);
+
+        vfloat m[4], pdotx[4], m4[4];
+        for(int k=0; k<4; k++) {
+            cornerWeights(c, k, m[k], pdotx[k]);
+            vfloat m2 = vmul(m[k], m[k]);
+            m4[k] = vmul(m2, m2);
+        }
+        vfloat n = vadd(vadd(vadd(vmul(m4[0], pdotx[0]), vmul(m4[1], pdotx[1])),
+                             vmul(m4[2], pdotx[2])), vmul(m4[3], pdotx[3]));
+        vstore(result+i, vmul(vset1(42.0f), n));
+    }
+}
+
+NOISE_TARGET static void noiseGradBlock(const float *x, const float *y, const float *z,
+                                        float *result, float *gx, float *gy, float *gz) {
+
+    const vfloat c42 = vset1(42.0f);
+    const vfloat cm8 = vset1(-8.0f);
+
+    for(int i=0; i<Noise::BLOCKSIZE; i+=VWIDTH) {
+        SimplexCorners c;
+        simplexCorners(vload(x+i), vload(y+i), vload(z+i), c);
+
+        vfloat m[4], pdotx[4], m4[4], temp[4];
+        for(int k=0; k<4; k++) {
+            cornerWeights(c, k, m[k], pdotx[k]);
+            vfloat m2 = vmul(m[k], m[k]);
+            m4[k] = vmul(m2, m2);
+            temp[k] = vmul(vmul(m2, m[k]), pdotx[k]);
+        }
+
+        // Determine noise gradient
+        vfloat dx = vadd(vadd(vadd(vmul(temp[0], c.x[0]), vmul(temp[1], c.x[1])),
+                              vmul(temp[2], c.x[2])), vmul(temp[3], c.x[3]));
+        vfloat dy = vadd(vadd(vadd(vmul(temp[0], c.y[0]), vmul(temp[1], c.y[1])),
+                              vmul(temp[2], c.y[2])), vmul(temp[3], c.y[3]));
+        vfloat dz = vadd(vadd(vadd(vmul(temp[0], c.z[0]), vmul(temp[1], c.z[1])),
+                              vmul(temp[2], c.z[2])), vmul(temp[3], c.z[3]));
+        dx = vmul(cm8, dx);
+        dy = vmul(cm8, dy);
+        dz = vmul(cm8, dz);
+        dx = vadd(dx, vadd(vadd(vadd(vmul(m4[0], c.px[0]), vmul(m4[1], c.px[1])),
+                                vmul(m4[2], c.px[2])), vmul(m4[3], c.px[3])));
+        dy = vadd(dy, vadd(vadd(vadd(vmul(m4[0], c.py[0]), vmul(m4[1], c.py[1])),
+                                vmul(m4[2], c.py[2])), vmul(m4[3], c.py[3])));
+        dz = vadd(dz, vadd(vadd(vadd(vmul(m4[0], c.pz[0]), vmul(m4[1], c.pz[1])),
+                                vmul(m4[2], c.pz[2])), vmul(m4[3], c.pz[3])));
+        vstore(gx+i, vmul(dx, c42));
+        vstore(gy+i, vmul(dy, c42));
+        vstore(gz+i, vmul(dz, c42));
+
+        vfloat n = vadd(vadd(vadd(vmul(m4[0], pdotx[0]), vmul(m4[1], pdotx[1])),
+                             vmul(m4[2], pdotx[2])), vmul(m4[3], pdotx[3]));
+        vstore(result+i, vmul(c42, n));
+    }
+}
+
+}
+
+/*
+ * The public entry points carry no target attribute themselves,
+ * so they can be declared in SimplexNoise.hpp like any other function.
+ */
+void Noise::NOISE_BLOCK(const float *x, const float *y, const float *z, float *result) {
+    noiseBlock(x, y, z, result);
+}
+
+void Noise::NOISE_GRAD_BLOCK(const float *x, const float *y, const float *z,
+                             float *result, float *gx, float *gy, float *gz) {
+    noiseGradBlock(x, y, z, result, gx, gy, gz);
+}
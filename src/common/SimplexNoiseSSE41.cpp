@@ -0,0 +1,47 @@
+/*
+ * SSE4.1 kernel for the batch simplex noise in SimplexNoise.hpp.
+ * Four points per register, two registers per block of eight.
+ * The function attributes let this file build without any special
+ * compiler flags. The kernel is only called if the CPU supports it.
+ */
+
+#include "SimplexNoise.hpp"
+
+#if NOISE_X86
+
+#include <smmintrin.h> // SSE4.1 for _mm_floor_ps
+
+#define NOISE_TARGET __attribute__((target("sse4.1")))
+#define NOISE_BLOCK snoiseBlockSSE41
+#define NOISE_GRAD_BLOCK snoiseGradBlockSSE41
+
+namespace {
+
+typedef __m128 vfloat;
+const int VWIDTH = 4;
+
+NOISE_TARGET static inline vfloat vset1(float a) { return _mm_set1_ps(a); }
+NOISE_TARGET static inline vfloat vload(const float *p) { return _mm_loadu_ps(p); }
+NOISE_TARGET static inline void vstore(float *p, vfloat a) { _mm_storeu_ps(p, a); }
+NOISE_TARGET static inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+NOISE_TARGET static inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+NOISE_TARGET static inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+NOISE_TARGET static inline vfloat vfloor(vfloat a) { return _mm_floor_ps(a); }
+NOISE_TARGET static inline vfloat vneg(vfloat a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+NOISE_TARGET static inline vfloat vabs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+
+// GLSL min()/max() return the second argument if either is NaN,
+// and so do minps/maxps. Keep the argument order as in the shader.
+NOISE_TARGET static inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+NOISE_TARGET static inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+
+// GLSL step(edge, x): 0.0 if x < edge, else 1.0
+NOISE_TARGET static inline vfloat vstep(vfloat edge, vfloat x) {
+    return _mm_and_ps(_mm_cmpge_ps(x, edge), _mm_set1_ps(1.0f));
+}
+
+}
+
+#include "SimplexNoiseKernel.inl"
+
+#endif // NOISE_X86
@@ -0,0 +1,39 @@
+/*
+ * Portable kernel for the batch simplex noise in SimplexNoise.hpp.
+ * This is the same code as the SIMD kernels, instantiated for plain
+ * floats, and is used on CPUs without SSE4.1.
+ */
+
+#include "SimplexNoise.hpp"
+
+#include <cmath> // For floorf(), fabsf()
+
+#define NOISE_TARGET
+#define NOISE_BLOCK snoiseBlockScalar
+#define NOISE_GRAD_BLOCK snoiseGradBlockScalar
+
+namespace {
+
+typedef float vfloat;
+const int VWIDTH = 1;
+
+inline vfloat vset1(float a) { return a; }
+inline vfloat vload(const float *p) { return *p; }
+inline void vstore(float *p, vfloat a) { *p = a; }
+inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+inline vfloat vsub(vfloat a, vfloat b) { return a - b; }
+inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+inline vfloat vfloor(vfloat a) { return floorf(a); }
+inline vfloat vneg(vfloat a) { return -a; }
+inline vfloat vabs(vfloat a) { return fabsf(a); }
+
+// Same NaN behaviour as the SSE min/max instructions
+inline vfloat vmin(vfloat a, vfloat b) { return a < b ? a : b; }
+inline vfloat vmax(vfloat a, vfloat b) { return a > b ? a : b; }
+
+// GLSL step(edge, x): 0.0 if x < edge, else 1.0
+inline vfloat vstep(vfloat edge, vfloat x) { return x < edge ? 0.0f : 1.0f; }
+
+}
+
+#include "SimplexNoiseKernel.inl"
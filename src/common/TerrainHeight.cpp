@@ -0,0 +1,50 @@
+#include "TerrainHeight.hpp"
+#include "SimplexNoise.hpp"
+
+#include <vector>
+
+namespace {
+
+const int OCTAVES = 4;
+const float BASEFREQUENCY = 0.04f;
+const float BASEAMPLITUDE = 1.6f; // 1.6 * (1 + 1/2 + 1/4 + 1/8) < MAXAMPLITUDE
+
+}
+
+
+void Terrain::heights(const float *x, const float *z, float *h, float *dhdx, float *dhdz, int n) {
+
+    std::vector<float> sx(n), sy(n), sz(n), noise(n), gx(n), gy(n), gz(n);
+
+    for(int i=0; i<n; i++) {
+        h[i] = BASEHEIGHT;
+        if(dhdx) dhdx[i] = 0.0f;
+        if(dhdz) dhdz[i] = 0.0f;
+    }
+
+    float frequency = BASEFREQUENCY, amplitude = BASEAMPLITUDE;
+    for(int octave=0; octave<OCTAVES; octave++) {
+        // A different y slice of the 3-D noise for each octave, so that
+        // the octaves do not line up at the origin
+        for(int i=0; i<n; i++) {
+            sx[i] = frequency * x[i];
+            sy[i] = 7.31f * octave;
+            sz[i] = frequency * z[i];
+        }
+        Noise::snoiseBatch(&sx[0], &sy[0], &sz[0], &noise[0], &gx[0], &gy[0], &gz[0], n);
+        for(int i=0; i<n; i++) {
+            h[i] += amplitude * noise[i];
+            if(dhdx) dhdx[i] += amplitude * frequency * gx[i];
+            if(dhdz) dhdz[i] += amplitude * frequency * gz[i];
+        }
+        frequency *= 2.0f;
+        amplitude *= 0.5f;
+    }
+}
+
+
+float Terrain::height(float x, float z) {
+    float h;
+    heights(&x, &z, &h, 0, 0, 1);
+    return h;
+}
@@ -0,0 +1,31 @@
+/* TerrainHeight.hpp */
+/*
+ * The height function of the streamed terrain: a few octaves of the
+ * simplex noise from SimplexNoise.hpp over the xz plane, with the
+ * analytic slope for normals. Evaluated on the CPU by the tile workers,
+ * in batches so that the SIMD noise kernels are used.
+ */
+/* Usage: Terrain::heights() for many points at once,
+ * Terrain::height() for a single point (e.g. to place objects). */
+
+#ifndef TERRAINHEIGHT_HPP // Avoid including this header twice
+#define TERRAINHEIGHT_HPP
+
+namespace Terrain {
+
+/* Heights lie within BASEHEIGHT +/- MAXAMPLITUDE */
+const float BASEHEIGHT = -1.0f;
+const float MAXAMPLITUDE = 3.0f;
+
+/*
+ * heights() - terrain height h and its slopes dh/dx and dh/dz at the
+ * n points (x[i], z[i]). dhdx and dhdz may be NULL if not needed.
+ */
+void heights(const float *x, const float *z, float *h, float *dhdx, float *dhdz, int n);
+
+/* Height at one point */
+float height(float x, float z);
+
+}
+
+#endif // TERRAINHEIGHT_HPP
@@ -0,0 +1,117 @@
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <memory>
+
+/* Constructor: start the worker threads */
+ThreadPool::ThreadPool(int numthreads) {
+    stopping = false;
+    if(numthreads <= 0) numthreads = (int)std::thread::hardware_concurrency();
+    if(numthreads <= 0) numthreads = 1;
+    for(int i=0; i<numthreads; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+
+/* Destructor: let the workers drain the queue, then join them */
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for(size_t i=0; i<workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+
+void ThreadPool::submit(const std::function<void()> &task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(task);
+    }
+    wakeup.notify_one();
+}
+
+
+/*
+ * parallelFor() - each worker (and the caller) grabs indices from a
+ * shared counter until none are left. Once the caller finds none, every
+ * index is done or running on a thread that will finish it, so the
+ * caller only waits for those: it never picks up other queued tasks,
+ * which could keep the render thread busy for a whole ocean step or
+ * terrain tile. A parallelFor() issued from inside a task cannot
+ * deadlock the pool either, for the same reason. The shared counters
+ * live on the heap, since a helper task may be dequeued after the loop
+ * has returned.
+ */
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &func) {
+
+    if(count <= 0) return;
+    if(count == 1) {
+        func(0);
+        return;
+    }
+
+    struct Loop {
+        std::atomic<int> next;
+        std::atomic<int> done;
+        int count;
+        const std::function<void(int)> *func;
+    };
+    std::shared_ptr<Loop> loop(new Loop);
+    loop->next = 0;
+    loop->done = 0;
+    loop->count = count;
+    loop->func = &func;
+
+    std::function<void()> work = [loop]() {
+        int i;
+        while((i = loop->next.fetch_add(1)) < loop->count) {
+            (*loop->func)(i);
+            loop->done.fetch_add(1);
+        }
+    };
+
+    int helpers = (int)workers.size();
+    if(helpers > count - 1) helpers = count - 1;
+    for(int i=0; i<helpers; i++) {
+        submit(work);
+    }
+
+    work();
+    while(loop->done.load() < count) std::this_thread::yield();
+}
+
+
+int ThreadPool::size() const {
+    return (int)workers.size();
+}
+
+
+ThreadPool &ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+
+/*
+ * private
+ * workerLoop() - wait for tasks and run them until the pool is destroyed.
+ */
+void ThreadPool::workerLoop() {
+    for(;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while(!stopping && tasks.empty()) wakeup.wait(lock);
+            if(tasks.empty()) return; // Stopping, and nothing left to do
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
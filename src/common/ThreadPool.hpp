@@ -0,0 +1,63 @@
+/* ThreadPool.hpp */
+/*
+ * A small pool of worker threads for CPU-side work that can be split
+ * into independent pieces (mesh loading, noise evaluation and the like).
+ */
+/* Usage: call parallelFor(count, func) to run func(0) ... func(count-1)
+ * on the workers and wait until all of them are done. The calling thread
+ * runs calls of its own loop too, so nested or single-threaded use is
+ * safe, but never other queued tasks, which may be long.
+ * Call submit() for fire-and-forget background tasks.
+ * ThreadPool::global() returns a shared pool sized to the machine. */
+
+#ifndef THREADPOOL_HPP // Avoid including this header twice
+#define THREADPOOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+
+public:
+
+/* Constructor: start numthreads workers (0 means one per hardware thread) */
+ThreadPool(int numthreads = 0);
+
+/* Destructor: finish queued tasks and join all workers */
+~ThreadPool();
+
+/* Queue a task to run on a worker thread */
+void submit(const std::function<void()> &task);
+
+/*
+ * parallelFor() - run func(i) for i = 0 ... count-1 and return when
+ * all calls have finished.
+ */
+void parallelFor(int count, const std::function<void(int)> &func);
+
+/* Number of worker threads */
+int size() const;
+
+/* A process-wide pool, created on first use */
+static ThreadPool &global();
+
+private:
+
+void workerLoop();
+
+std::vector<std::thread> workers;
+std::deque<std::function<void()> > tasks;
+std::mutex mutex;
+std::condition_variable wakeup;
+bool stopping;
+
+ThreadPool(const ThreadPool&);            // Not copyable
+ThreadPool &operator=(const ThreadPool&);
+
+};
+
+#endif // THREADPOOL_HPP
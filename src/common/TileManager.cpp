@@ -0,0 +1,486 @@
+#include "TileManager.hpp"
+#include "TerrainHeight.hpp"
+#include "VertexLayout.hpp" // For the float vertex layout
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/* How many frames ahead to prefetch along the camera motion */
+const float PREFETCHFRAMES = 120.0f;
+
+/* Tiles this far outside the drawing radius are kept if resident, but not requested */
+const int KEEPMARGIN = 2;
+
+/* Attribute location of the tile offset, see terrainTileVert.glsl */
+const GLuint TILEOFFSET_LOCATION = 3;
+
+/* Tiles within 'radius' tiles of the one the camera is in */
+int tilesInRange(int radius) {
+    int count = 0;
+    for(int dz=-radius; dz<=radius; dz++) {
+        for(int dx=-radius; dx<=radius; dx++) {
+            if(dx*dx + dz*dz <= radius*radius) count++;
+        }
+    }
+    return count;
+}
+
+/* A tile to request, with its squared distance to the camera */
+struct Wanted {
+    int ix, iz;
+    float distance2;
+    bool operator<(const Wanted &other) const { return distance2 < other.distance2; }
+};
+
+}
+
+
+TileManager::TileManager(float tilesize, int resolution, int radius)
+    : tilesize(tilesize),
+      resolution(std::max(1, std::min(resolution, 255))), // 16-bit indices
+      radius(std::max(1, radius)),
+      // Everything in the keep radius, and as much again for prefetched tiles
+      capacity(2*tilesInRange(this->radius + KEEPMARGIN)),
+      // Room for all of them and the shared indices from the start,
+      // so that streaming never has to grow the buffers
+      arena(VertexLayoutFloat::STRIDE, &VertexLayoutFloat::setupAttribs, GL_UNSIGNED_SHORT,
+            capacity*(this->resolution+1)*(this->resolution+1), 6*this->resolution*this->resolution) {
+
+    maxinflight = 2*ThreadPool::global().size();
+    uploadbudget = 512*1024;
+    uploadedtiles = 0;
+    synchronous = false;
+
+    indices = -1;
+    indextype = GL_UNSIGNED_SHORT;
+    nindices = 0;
+    offsetbuffer = 0;
+
+    shared = std::make_shared<Shared>(maxinflight);
+
+    culling = false;
+    lastx = lastz = 0.0f;
+    velx = velz = 0.0f;
+    moved = false;
+}
+
+
+TileManager::~TileManager() {
+
+    // Wait for the workers, so that no tile data is leaked
+    while(shared->inflight.load() > 0) std::this_thread::yield();
+    TileData *data;
+    while(shared->done.pop(data)) {
+        delete[] data->vertices;
+        delete data;
+    }
+
+    for(std::unordered_map<uint64_t, Tile*>::iterator it = tiles.begin(); it != tiles.end(); ++it) {
+        freetiles.push_back(it->second);
+    }
+    for(size_t i=0; i<freetiles.size(); i++) {
+        delete freetiles[i];
+    }
+    if(offsetbuffer) glDeleteBuffers(1, &offsetbuffer);
+}
+
+
+void TileManager::setUploadBudget(int bytes) {
+    uploadbudget = bytes;
+}
+
+
+void TileManager::setSynchronous(bool synchronous) {
+    this->synchronous = synchronous;
+}
+
+
+void TileManager::update(float x, float z, const float *viewproj) {
+
+    if(indices < 0) createIndices();
+    culling = (viewproj != NULL);
+    if(culling) frustum.set(viewproj);
+
+    // Camera motion, smoothed over a few frames
+    if(moved) {
+        velx = 0.9f*velx + 0.1f*(x - lastx);
+        velz = 0.9f*velz + 0.1f*(z - lastz);
+    }
+    lastx = x;
+    lastz = z;
+    moved = true;
+
+    // Look ahead along the motion, but never further than the drawing radius
+    float aheadx = velx * PREFETCHFRAMES, aheadz = velz * PREFETCHFRAMES;
+    float ahead = sqrtf(aheadx*aheadx + aheadz*aheadz);
+    float maxahead = radius * tilesize;
+    if(ahead > maxahead) {
+        aheadx *= maxahead / ahead;
+        aheadz *= maxahead / ahead;
+    }
+
+    // Tiles in range of the camera, then in range of the point ahead
+    std::vector<Wanted> wanted;
+    std::unordered_set<uint64_t> seen;
+    float range2 = (radius * tilesize) * (radius * tilesize);
+    for(int pass=0; pass<2; pass++) {
+        if(pass == 1 && (synchronous || ahead < 0.5f*tilesize)) break; // Not moving: nothing to prefetch
+        float px = (pass == 0) ? x : x + aheadx;
+        float pz = (pass == 0) ? z : z + aheadz;
+        int cx = (int)floorf(px / tilesize), cz = (int)floorf(pz / tilesize);
+        for(int iz=cz-radius; iz<=cz+radius; iz++) {
+            for(int ix=cx-radius; ix<=cx+radius; ix++) {
+                float dx = (ix + 0.5f)*tilesize - px, dz = (iz + 0.5f)*tilesize - pz;
+                if(dx*dx + dz*dz > range2 || !seen.insert(key(ix, iz)).second) continue;
+                dx = (ix + 0.5f)*tilesize - x;
+                dz = (iz + 0.5f)*tilesize - z;
+                Wanted w = { ix, iz, dx*dx + dz*dz };
+                wanted.push_back(w);
+            }
+        }
+    }
+    std::sort(wanted.begin(), wanted.end()); // Nearest first
+
+    // Mark resident tiles as used, draw those in range, request the others
+    drawlist.clear();
+    std::vector<Wanted> missing;
+    for(size_t i=0; i<wanted.size(); i++) {
+        std::unordered_map<uint64_t, Tile*>::iterator it = tiles.find(key(wanted[i].ix, wanted[i].iz));
+        if(it != tiles.end()) {
+            lrulist.splice(lrulist.begin(), lrulist, it->second->lru);
+            if(wanted[i].distance2 <= range2 && visible(it->second)) drawlist.push_back(it->second);
+        }
+        else if(synchronous) {
+            missing.push_back(wanted[i]);
+        }
+        else {
+            request(wanted[i].ix, wanted[i].iz);
+        }
+    }
+
+    // Synchronous mode: make the missing tiles right now and draw them this frame
+    if(!missing.empty()) {
+        std::vector<TileData*> made(missing.size());
+        float size = tilesize;
+        int res = resolution;
+        ThreadPool::global().parallelFor((int)missing.size(), [&](int i) {
+            made[i] = generate(missing[i].ix, missing[i].iz, size, res);
+        });
+        for(size_t i=0; i<made.size(); i++) {
+            Tile *tile = upload(made[i]);
+            if(tile && visible(tile)) drawlist.push_back(tile);
+            delete[] made[i]->vertices;
+            delete made[i];
+        }
+    }
+
+    // Upload finished tiles until the budget is used up
+    int tilebytes = 8*(resolution+1)*(resolution+1)*sizeof(GLfloat);
+    int uploadedbytes = 0;
+    uploadedtiles = 0;
+    TileData *data;
+    while((uploadedtiles == 0 || uploadedbytes + tilebytes <= uploadbudget)
+          && shared->done.pop(data)) {
+        pending.erase(key(data->ix, data->iz));
+        // Skip tiles that the camera has left behind while they were made
+        float dx = (data->ix + 0.5f)*tilesize - x, dz = (data->iz + 0.5f)*tilesize - z;
+        float keep = (radius + KEEPMARGIN) * tilesize;
+        if(dx*dx + dz*dz <= keep*keep || seen.count(key(data->ix, data->iz))) {
+            upload(data);
+            uploadedbytes += tilebytes;
+            uploadedtiles++;
+        }
+        delete[] data->vertices;
+        delete data;
+    }
+}
+
+
+void TileManager::render() {
+
+    buildCommands();
+    glBindVertexArray(arena.vao());
+    if(MeshArena::multiDrawIndirect()) {
+        MeshArena::multiDraw(indextype, commands.empty() ? NULL : &commands[0], (int)commands.size());
+    }
+    else {
+        for(size_t i=0; i<drawlist.size(); i++) {
+            prepareTile(this, (int)i, 0);
+            MeshArena::multiDraw(indextype, &commands[i], 1);
+        }
+    }
+    glBindVertexArray(0);
+}
+
+
+void TileManager::submit(RenderQueue &queue, GLuint program, const char *name) {
+
+    buildCommands();
+    if(commands.empty()) return;
+
+    DrawPacket packet;
+    packet.program = program;
+    packet.vao = arena.vao();
+    packet.indextype = indextype;
+    packet.name = name;
+    if(MeshArena::multiDrawIndirect()) {
+        // One packet for all tiles. The commands are nearest first already.
+        packet.depth = -1.0f;
+        for(size_t i=0; i<drawlist.size(); i++) {
+            Tile *tile = drawlist[i];
+            float dx = (tile->ix + 0.5f)*tilesize - lastx, dz = (tile->iz + 0.5f)*tilesize - lastz;
+            float distance = sqrtf(dx*dx + dz*dz);
+            if(packet.depth < 0.0f || distance < packet.depth) packet.depth = distance;
+        }
+        packet.commands = &commands[0];
+        packet.commandcount = (int)commands.size();
+        queue.submit(packet);
+        return;
+    }
+
+    for(size_t i=0; i<drawlist.size(); i++) {
+        Tile *tile = drawlist[i];
+        float dx = (tile->ix + 0.5f)*tilesize - lastx, dz = (tile->iz + 0.5f)*tilesize - lastz;
+        packet.depth = sqrtf(dx*dx + dz*dz);
+        packet.count = commands[i].count;
+        packet.firstindex = commands[i].firstindex;
+        packet.basevertex = commands[i].basevertex;
+        packet.prepare = prepareTile;
+        packet.owner = this;
+        packet.item = (int)i;
+        queue.submit(packet);
+    }
+}
+
+
+int TileManager::residentTiles() const {
+    return (int)tiles.size();
+}
+
+
+int TileManager::pendingTiles() const {
+    return (int)pending.size();
+}
+
+
+int TileManager::uploadedLastFrame() const {
+    return uploadedtiles;
+}
+
+
+/*
+ * private
+ * createIndices() - the triangles of one tile, two per grid quad. With
+ * indirect draws, the VAO of the arena also gets the tile offsets, one
+ * per draw command.
+ */
+void TileManager::createIndices() {
+
+    int n = resolution, stride = resolution + 1;
+    std::vector<GLushort> indices;
+    indices.reserve(6*n*n);
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            GLushort a = j*stride + i, b = a + 1, c = a + stride, d = c + 1;
+            indices.push_back(a); indices.push_back(c); indices.push_back(b);
+            indices.push_back(b); indices.push_back(c); indices.push_back(d);
+        }
+    }
+    nindices = (int)indices.size();
+    indextype = GL_UNSIGNED_SHORT;
+
+    this->indices = arena.allocate(0, nindices);
+    arena.writeIndices(this->indices, &indices[0]);
+
+    if(MeshArena::multiDrawIndirect()) {
+        glGenBuffers(1, &offsetbuffer);
+        glBindVertexArray(arena.vao());
+        glBindBuffer(GL_ARRAY_BUFFER, offsetbuffer);
+        glEnableVertexAttribArray(TILEOFFSET_LOCATION);
+        glVertexAttribPointer(TILEOFFSET_LOCATION, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (void*)0);
+        glVertexAttribDivisor(TILEOFFSET_LOCATION, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+
+/*
+ * private
+ * buildCommands() - one draw command per tile in the draw list, in the
+ * same order. For indirect draws, the tile offsets are uploaded too, and
+ * each command's base instance picks its own.
+ */
+void TileManager::buildCommands() {
+
+    commands.clear();
+    if(indices < 0) return;
+    std::vector<GLfloat> offsets;
+    offsets.reserve(3*drawlist.size());
+    for(size_t i=0; i<drawlist.size(); i++) {
+        Tile *tile = drawlist[i];
+        commands.push_back(arena.command(tile->allocation, indices, 1, (GLuint)i));
+        offsets.push_back(tile->ix * tilesize);
+        offsets.push_back(0.0f);
+        offsets.push_back(tile->iz * tilesize);
+    }
+    if(offsetbuffer && !offsets.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, offsetbuffer);
+        glBufferData(GL_ARRAY_BUFFER, offsets.size()*sizeof(GLfloat), &offsets[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+
+/*
+ * private
+ * request() - start generating a tile on a worker thread, unless it is
+ * already on its way or too many tiles are.
+ */
+void TileManager::request(int ix, int iz) {
+
+    uint64_t k = key(ix, iz);
+    if(pending.count(k) || (int)pending.size() >= maxinflight) return;
+    pending.insert(k);
+
+    std::shared_ptr<Shared> state = shared;
+    float size = tilesize;
+    int res = resolution;
+    state->inflight++;
+    ThreadPool::global().submit([state, ix, iz, size, res]() {
+        // The queue has room for every tile in flight, so it is never
+        // full, but wait for the OpenGL thread rather than lose a tile
+        TileData *data = generate(ix, iz, size, res);
+        while(!state->done.push(data)) std::this_thread::yield();
+        state->inflight--;
+    });
+}
+
+
+/*
+ * private
+ * upload() - send a finished tile to OpenGL, in the room of an evicted
+ * tile if there is one, since all tiles are the same size. Returns the
+ * new resident tile, or NULL if the arena had no room for it.
+ */
+TileManager::Tile *TileManager::upload(TileData *data) {
+
+    evict(capacity - 1);
+    int allocation = arena.allocate((resolution+1)*(resolution+1), 0);
+    if(allocation < 0) return NULL;
+    arena.writeVertices(allocation, data->vertices);
+
+    Tile *tile;
+    if(!freetiles.empty()) {
+        tile = freetiles.back();
+        freetiles.pop_back();
+    }
+    else {
+        tile = new Tile;
+    }
+
+    tile->allocation = allocation;
+
+    tile->ix = data->ix;
+    tile->iz = data->iz;
+    tile->minheight = data->minheight;
+    tile->maxheight = data->maxheight;
+    uint64_t k = key(data->ix, data->iz);
+    lrulist.push_front(k);
+    tile->lru = lrulist.begin();
+    tiles[k] = tile;
+    return tile;
+}
+
+
+/*
+ * private
+ * evict() - drop the least recently used tiles while more than 'keep'
+ * are resident. Tiles used this frame are never dropped.
+ */
+void TileManager::evict(int keep) {
+
+    while((int)tiles.size() > keep) {
+        uint64_t k = lrulist.back();
+        Tile *tile = tiles[k];
+        if(std::find(drawlist.begin(), drawlist.end(), tile) != drawlist.end()) break;
+        lrulist.pop_back();
+        tiles.erase(k);
+        arena.release(tile->allocation);
+        freetiles.push_back(tile);
+    }
+}
+
+
+/* private: true if the tile's box is in the frustum of the last update(), or there was none */
+bool TileManager::visible(const Tile *tile) const {
+    if(!culling) return true;
+    float min[3] = { tile->ix * tilesize, tile->minheight, tile->iz * tilesize };
+    float max[3] = { min[0] + tilesize, tile->maxheight, min[2] + tilesize };
+    return frustum.boxVisible(min, max);
+}
+
+
+/*
+ * private
+ * prepareTile() - DrawPacket::prepare for submit() without indirect
+ * draws. The offset attribute has no array, so its current value is
+ * used for the whole draw.
+ */
+void TileManager::prepareTile(void *owner, int item, GLuint program) {
+    (void)program;
+    TileManager *manager = (TileManager*)owner;
+    Tile *tile = manager->drawlist[item];
+    glVertexAttrib3f(TILEOFFSET_LOCATION, tile->ix * manager->tilesize, 0.0f, tile->iz * manager->tilesize);
+}
+
+
+uint64_t TileManager::key(int ix, int iz) {
+    return ((uint64_t)(uint32_t)ix << 32) | (uint32_t)iz;
+}
+
+
+/*
+ * private, static
+ * generate() - make the vertices of a tile. Runs on a worker thread,
+ * so it only touches its own data. Positions are relative to the tile
+ * corner, the normals come from the analytic slope of the height.
+ */
+TileManager::TileData *TileManager::generate(int ix, int iz, float tilesize, int resolution) {
+
+    int stride = resolution + 1;
+    TileData *data = new TileData;
+    data->ix = ix;
+    data->iz = iz;
+    data->vertices = new float[8*stride*stride];
+    data->minheight = Terrain::BASEHEIGHT + Terrain::MAXAMPLITUDE;
+    data->maxheight = Terrain::BASEHEIGHT - Terrain::MAXAMPLITUDE;
+
+    std::vector<float> x(stride), z(stride), h(stride), dhdx(stride), dhdz(stride);
+    float step = tilesize / resolution;
+    for(int j=0; j<stride; j++) {
+        for(int i=0; i<stride; i++) {
+            x[i] = ix*tilesize + i*step;
+            z[i] = iz*tilesize + j*step;
+        }
+        Terrain::heights(&x[0], &z[0], &h[0], &dhdx[0], &dhdz[0], stride);
+        for(int i=0; i<stride; i++) {
+            float *v = &data->vertices[8*(j*stride + i)];
+            float nx = -dhdx[i], ny = 1.0f, nz = -dhdz[i];
+            float len = sqrtf(nx*nx + ny*ny + nz*nz);
+            v[0] = i*step;
+            v[1] = h[i];
+            v[2] = j*step;
+            v[3] = nx / len;
+            v[4] = ny / len;
+            v[5] = nz / len;
+            v[6] = (float)i / resolution;
+            v[7] = (float)j / resolution;
+            data->minheight = std::min(data->minheight, h[i]);
+            data->maxheight = std::max(data->maxheight, h[i]);
+        }
+    }
+    return data;
+}
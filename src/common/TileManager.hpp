@@ -0,0 +1,167 @@
+/* TileManager.hpp */
+/*
+ * Streaming terrain made of square tiles around the camera, so that the
+ * world has no edge. Tiles are generated on the CPU by ThreadPool
+ * workers (heights and normals from TerrainHeight.hpp) and handed to the
+ * OpenGL thread through a lock-free queue (MPSCQueue.hpp). The OpenGL
+ * thread uploads at most a fixed number of bytes per frame, so
+ * streaming never causes a frame time spike.
+ * Resident tiles are kept in a least recently used list. The oldest one
+ * is evicted when a new tile needs its room. The arena is made big
+ * enough for all resident tiles up front, so it never has to grow.
+ * All tiles are ranges of one MeshArena, with one shared index range,
+ * so with OpenGL 4.3 (or GL_ARB_multi_draw_indirect and
+ * GL_ARB_base_instance) all tiles in range are drawn by a single
+ * indirect draw call, nearest first. Each tile's
+ * offset is then an instanced attribute, found with the base instance
+ * of its draw command. Other drivers get one draw call per tile.
+ * Tiles ahead of the camera, in the direction it moves, are requested
+ * before they come into range. Tiles outside the view frustum, by their
+ * box from the lowest to the highest vertex, stay resident but are not
+ * drawn.
+ */
+/* Usage: call update() with the camera position once per frame, then
+ * render() with a shader program in use, or submit() the tiles to a
+ * RenderQueue. The vertex shader gets
+ * tile-local positions and must add the attribute vec3 tileOffset at
+ * location 3 (see terrainTileVert.glsl). */
+
+#ifndef TILEMANAGER_HPP // Avoid including this header twice
+#define TILEMANAGER_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <stdint.h>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "MPSCQueue.hpp"
+#include "ThreadPool.hpp"
+#include "RenderQueue.hpp"
+#include "MeshArena.hpp"
+#include "Frustum.hpp"
+
+class TileManager {
+
+public:
+
+/*
+ * Constructor: tiles of tilesize x tilesize world units with
+ * resolution x resolution quads each (at most 255), drawn out to
+ * 'radius' tiles from the camera. No OpenGL calls are made here.
+ */
+TileManager(float tilesize = 8.0f, int resolution = 64, int radius = 5);
+
+/* Destructor: wait for the workers and delete all OpenGL objects */
+~TileManager();
+
+/* Set the largest number of bytes to upload per frame (at least one tile is always allowed) */
+void setUploadBudget(int bytes);
+
+/*
+ * setSynchronous() - if true, update() makes every missing tile in range
+ * at once (on all workers, waiting for them) and uploads it in the same
+ * frame, with no prefetching. Slower, but every frame then draws the same
+ * tiles for the same camera position, as the benchmark mode needs.
+ */
+void setSynchronous(bool synchronous);
+
+/*
+ * update() - request the tiles around (x, z) and ahead of the camera,
+ * upload finished tiles within the budget and evict old ones. With the
+ * column-major view-projection matrix 'viewproj', only the tiles in
+ * the view frustum are drawn. Call once per frame from the OpenGL thread.
+ */
+void update(float x, float z, const float *viewproj = NULL);
+
+/* Draw the resident tiles in range */
+void render();
+
+/* Submit the resident tiles in range as opaque packets, at their distance from the camera.
+ * With indirect draws, this is one packet at the distance of the nearest tile. */
+void submit(RenderQueue &queue, GLuint program, const char *name = NULL);
+
+/* Statistics */
+int residentTiles() const;
+int pendingTiles() const;
+int uploadedLastFrame() const;
+
+private:
+
+/* A tile on the CPU, made by a worker thread */
+struct TileData {
+    int ix, iz;
+    float *vertices; // 8 floats per vertex, like TriangleSoup
+    float minheight, maxheight;
+};
+
+/* A tile on the GPU */
+struct Tile {
+    int ix, iz;
+    int allocation;   // The vertices in 'arena'
+    float minheight, maxheight;
+    std::list<uint64_t>::iterator lru; // Position in 'lrulist'
+};
+
+/* State shared with the worker threads. It outlives the TileManager if a job is still running. */
+struct Shared {
+    MPSCQueue<TileData*> done;
+    std::atomic<int> inflight;
+    Shared(int capacity) : done(capacity), inflight(0) {}
+};
+
+float tilesize;
+int resolution;
+int radius;
+int capacity;         // Most tiles to keep resident
+int maxinflight;      // Most tiles being generated at once
+int uploadbudget;     // Bytes per frame
+int uploadedtiles;    // Tiles uploaded in the last update()
+bool synchronous;     // See setSynchronous()
+
+MeshArena arena;      // The vertices of all tiles
+int indices;          // Allocation of the indices, shared by all tiles, they have the same topology
+GLenum indextype;
+int nindices;
+GLuint offsetbuffer;  // Tile offsets for indirect draws, one per command
+std::vector<MeshArena::DrawCommand> commands; // Draws of the tiles in range this frame
+
+std::unordered_map<uint64_t, Tile*> tiles; // Resident tiles
+std::list<uint64_t> lrulist;               // Most recently used first
+std::unordered_set<uint64_t> pending;      // Being generated
+std::vector<Tile*> freetiles;              // Evicted, ready for reuse
+std::vector<Tile*> drawlist;               // Resident tiles in range this frame
+std::shared_ptr<Shared> shared;
+
+Frustum frustum;      // Of the last update()
+bool culling;         // The last update() had a frustum
+
+float lastx, lastz;   // Camera position in the last update()
+float velx, velz;     // Smoothed camera motion per frame
+bool moved;           // lastx and lastz are valid
+
+void createIndices();
+void buildCommands();
+void request(int ix, int iz);
+Tile *upload(TileData *data);
+void evict(int keep);
+bool visible(const Tile *tile) const;
+static uint64_t key(int ix, int iz);
+static void prepareTile(void *owner, int item, GLuint program);
+static TileData *generate(int ix, int iz, float tilesize, int resolution);
+
+TileManager(const TileManager&);            // Not copyable
+TileManager &operator=(const TileManager&);
+
+};
+
+#endif // TILEMANAGER_HPP
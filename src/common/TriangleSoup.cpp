@@ -1,14 +1,95 @@
 #include "TriangleSoup.hpp"
 
+#include <unordered_map>
+
+namespace {
+
+/* One of the layouts in VertexLayout.hpp, and how a mesh file describes it */
+struct GpuLayout {
+	int format;               // The TriangleSoup::VertexFormat it belongs to
+	bool repeating;           // Texcoords may be outside [0,1]
+	GLsizei stride;
+	bool octnormals;
+	float decodescale;        // Of the positions, see VertexLayout::pack()
+	void (*setupAttribs)();
+	unsigned char *(*pack)(const float *vertexarray, int nverts, float *posScale, float *posBias);
+	MeshFileAttrib attribs[3];
+};
+
+template<class P, class N, class T>
+GpuLayout describeLayout(int format, bool repeating) {
+	typedef VertexLayout<P, N, T> Layout;
+	GpuLayout layout = { format, repeating, Layout::STRIDE, N::OCTAHEDRAL, P::decodeScale(),
+		&Layout::setupAttribs, &Layout::pack, {
+		{ 0, P::COMPONENTS, P::TYPE, P::NORMALIZED, Layout::POSITIONOFFSET },
+		{ 1, N::COMPONENTS, N::TYPE, N::NORMALIZED, Layout::NORMALOFFSET },
+		{ 2, T::COMPONENTS, T::TYPE, T::NORMALIZED, Layout::TEXCOORDOFFSET } } };
+	return layout;
+}
+
+/* Compact formats have compact normals and texcoords. Texcoords outside [0,1] repeat a texture, keep them as half floats. */
+const int NUMLAYOUTS = 5;
+const GpuLayout *gpuLayouts() {
+	static const GpuLayout layouts[NUMLAYOUTS] = {
+		describeLayout<PositionFloat, NormalFloat, TexCoordFloat>(TriangleSoup::VERTEX_FLOAT, true),
+		describeLayout<PositionHalf, NormalOct16, TexCoordUnorm16>(TriangleSoup::VERTEX_HALF, false),
+		describeLayout<PositionHalf, NormalOct16, TexCoordHalf>(TriangleSoup::VERTEX_HALF, true),
+		describeLayout<PositionShort, NormalOct16, TexCoordUnorm16>(TriangleSoup::VERTEX_SHORT, false),
+		describeLayout<PositionShort, NormalOct16, TexCoordHalf>(TriangleSoup::VERTEX_SHORT, true)
+	};
+	return layouts;
+}
+
+/* The layout for 'format' that fits the texcoords of the vertices */
+const GpuLayout &chooseLayout(int format, const GLfloat *vertexarray, int nverts) {
+	bool repeating = false;
+	for(int i=0; i<nverts && !repeating; i++) {
+		float s = vertexarray[8*i+6], t = vertexarray[8*i+7];
+		repeating = s < 0.0f || s > 1.0f || t < 0.0f || t > 1.0f;
+	}
+	const GpuLayout *layouts = gpuLayouts();
+	for(int i=0; i<NUMLAYOUTS; i++) {
+		if(layouts[i].format == format && (layouts[i].repeating || !repeating)) return layouts[i];
+	}
+	return layouts[0];
+}
+
+/* Where the vertex format uniforms are in a program */
+struct FormatLocations {
+	GLint posscale, posbias, octnormals;
+};
+
+/* The locations for every program any mesh has been drawn with */
+std::unordered_map<GLuint, FormatLocations> formatlocations;
+
+/* The layout of a mesh file, or NULL if upload() never makes it */
+const GpuLayout *findLayout(const MeshFileHeader *header) {
+	const GpuLayout *layouts = gpuLayouts();
+	for(int i=0; i<NUMLAYOUTS; i++) {
+		if(header->vertexstride == (uint32_t)layouts[i].stride && header->nattribs == 3
+		   && memcmp(header->attribs, layouts[i].attribs, sizeof(layouts[i].attribs)) == 0) return &layouts[i];
+	}
+	return NULL;
+}
+
+}
+
+
 /* Constructor: initialize a TriangleSoup object to all zeros */
 TriangleSoup::TriangleSoup() {
-	vao = 0;
-	vertexbuffer = 0;
-	indexbuffer = 0;
+	arena = NULL;
+	allocation = -1;
 	vertexarray = NULL;
 	indexarray = NULL;
+	meshcache = NULL;
 	nverts = 0;
 	ntris = 0;
+	vertexformat = VERTEX_FLOAT;
+	vertexstride = 8*sizeof(GLfloat);
+	indextype = GL_UNSIGNED_INT;
+	posscale[0] = posscale[1] = posscale[2] = 1.0f;
+	posbias[0] = posbias[1] = posbias[2] = 0.0f;
+	octnormals = false;
 }
 
 
@@ -20,21 +101,18 @@ TriangleSoup::~TriangleSoup() {
 
 void TriangleSoup::clean() {
 
-	if(glIsVertexArray(vao)) {
-		glDeleteVertexArrays(1, &vao);
-	}
-	vao = 0;
-
-	if(glIsBuffer(vertexbuffer)) {
-		glDeleteBuffers(1, &vertexbuffer);
+	if(arena) { // The arena itself is shared and stays
+		arena->release(allocation);
+		arena = NULL;
 	}
-	vertexbuffer = 0;
+	allocation = -1;
 
-	if(glIsBuffer(indexbuffer)) {
-		glDeleteBuffers(1, &indexbuffer);
+	if(meshcache) { // The arrays belong to the mapping
+		delete meshcache;
+		meshcache = NULL;
+		vertexarray = NULL;
+		indexarray = NULL;
 	}
-	indexbuffer = 0;
-
 	if(vertexarray) {
 		delete[] vertexarray;
 		vertexarray = NULL;
@@ -48,6 +126,12 @@ void TriangleSoup::clean() {
 }
 
 
+/* The format is kept by clean(), so it can be set before createXXX() */
+void TriangleSoup::setVertexFormat(VertexFormat format) {
+	vertexformat = format;
+}
+
+
 /* Create a demo object with a single triangle */
 void TriangleSoup::createTriangle() {
 
@@ -79,49 +163,8 @@ void TriangleSoup::createTriangle() {
         indexarray[i]=index_array_data[i];
     }
 
-	// Generate one vertex array object (VAO) and bind it
-	glGenVertexArrays(1, &(vao));
-	glBindVertexArray(vao);
-
-	// Generate two buffer IDs
-	glGenBuffers(1, &vertexbuffer);
-	glGenBuffers(1, &indexbuffer);
-
- 	// Activate the vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
- 	// Present our vertex coordinates to OpenGL
-	glBufferData(GL_ARRAY_BUFFER,
-		8*nverts * sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
-	// Specify how many attribute arrays we have in our VAO
-	glEnableVertexAttribArray(0); // Vertex coordinates
-	glEnableVertexAttribArray(1); // Normals
-	glEnableVertexAttribArray(2); // Texture coordinates
-	// Specify how OpenGL should interpret the vertex buffer data:
-	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-	// Type GL_FLOAT
-	// Not normalized (GL_FALSE)
-	// Stride 8 floats (interleaved array with 8 floats per vertex)
-	// Array buffer offset 0, 3 or 6 floats (offset into first vertex)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)0); // xyz coordinates
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
-
- 	// Activate the index buffer
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
- 	// Present our vertex indices to OpenGL
- 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	 	3*ntris*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
-
-	// Deactivate (unbind) the VAO and the buffers again.
-	// Do NOT unbind the index buffer while the VAO is still bound.
-	// The index buffer is an essential part of the VAO state.
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// Send the arrays to OpenGL in the selected vertex format
+	upload();
 };
 
 
@@ -169,49 +212,8 @@ void TriangleSoup::createBox(float xsize, float ysize, float zsize) {
         indexarray[i]=index_array_data[i];
     }
 
-	// Generate one vertex array object (VAO) and bind it
-	glGenVertexArrays(1, &(vao));
-	glBindVertexArray(vao);
-
-	// Generate two buffer IDs
-	glGenBuffers(1, &vertexbuffer);
-	glGenBuffers(1, &indexbuffer);
-
- 	// Activate the vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
- 	// Present our vertex coordinates to OpenGL
-	glBufferData(GL_ARRAY_BUFFER,
-		8*nverts * sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
-	// Specify how many attribute arrays we have in our VAO
-	glEnableVertexAttribArray(0); // Vertex coordinates
-	glEnableVertexAttribArray(1); // Normals
-	glEnableVertexAttribArray(2); // Texture coordinates
-	// Specify how OpenGL should interpret the vertex buffer data:
-	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-	// Type GL_FLOAT
-	// Not normalized (GL_FALSE)
-	// Stride 8 floats (interleaved array with 8 floats per vertex)
-	// Array buffer offset 0, 3 or 6 floats (offset into first vertex)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)0); // xyz coordinates
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
-
- 	// Activate the index buffer
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
- 	// Present our vertex indices to OpenGL
- 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	 	3*ntris*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
-
-	// Deactivate (unbind) the VAO and the buffers again.
-	// Do NOT unbind the index buffer while the VAO is still bound.
-	// The index buffer is an essential part of the VAO state.
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// Send the arrays to OpenGL in the selected vertex format
+	upload();
 };
 
 
@@ -324,49 +326,8 @@ void TriangleSoup::createSphere(float radius, int segments) {
 		indexarray[base+3*i+2] = nverts-3-i;
 	}
 
-	// Generate one vertex array object (VAO) and bind it
-	glGenVertexArrays(1, &(vao));
-	glBindVertexArray(vao);
-
-	// Generate two buffer IDs
-	glGenBuffers(1, &vertexbuffer);
-	glGenBuffers(1, &indexbuffer);
-
- 	// Activate the vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
- 	// Present our vertex coordinates to OpenGL
-	glBufferData(GL_ARRAY_BUFFER,
-		8*nverts * sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
-	// Specify how many attribute arrays we have in our VAO
-	glEnableVertexAttribArray(0); // Vertex coordinates
-	glEnableVertexAttribArray(1); // Normals
-	glEnableVertexAttribArray(2); // Texture coordinates
-	// Specify how OpenGL should interpret the vertex buffer data:
-	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-	// Type GL_FLOAT
-	// Not normalized (GL_FALSE)
-	// Stride 8 (interleaved array with 8 floats per vertex)
-	// Array buffer offset 0, 3, 6 (offset into first vertex)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)0); // xyz coordinates
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
-
- 	// Activate the index buffer
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
- 	// Present our vertex indices to OpenGL
- 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	 	3*ntris*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
-
-	// Deactivate (unbind) the VAO and the buffers again.
-	// Do NOT unbind the buffers while the VAO is still bound.
-	// The index buffer is an essential part of the VAO state.
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// Send the arrays to OpenGL in the selected vertex format
+	upload();
 
 };
 
@@ -378,218 +339,137 @@ void TriangleSoup::createSphere(float radius, int segments) {
  * The vertex array is on interleaved format. For each vertex, there
  * are 8 floats: three for the vertex coordinates (x, y, z), three
  * for the normal vector (n_x, n_y, n_z) and finally two for texture
- * coordinates (s, t). The returned arrays are allocated by malloc()
- * inside the function and should be disposed of using free() when
- * they are no longer needed, e.g. by calling soupDelete().
+ * coordinates (s, t). The parsing is done by ObjLoader, which reads
+ * the file in parallel and also accepts quads, polygons, v//n and v/t
+ * face corners and negative indices.
  *
  * Author: Stefan Gustavson (stegu@itn.liu.se) 2014.
  * This code is in the public domain.
  */
 void TriangleSoup::readOBJ(const char* filename) {
 
-	FILE *objfile;
-
-	int numverts = 0;
-	int numnormals = 0;
-	int numtexcoords = 0;
-	int numfaces = 0;
-	int i_v = 0;
-	int i_n = 0;
-	int i_t = 0;
-	int i_f = 0;
-	float *verts, *normals, *texcoords;
+	ObjLoader loader;
+	char cachefile[MESHFILE_MAXPATH + 16];
 
-	char line[256];
-	char tag[3];
-	int v1, v2, v3, n1, n2, n3, t1, t2, t3;
-	int numargs, readerror, currentv;
-
-	readerror = 0;
-
-	objfile = fopen(filename, "r");
+	// Delete any previous content in the TriangleSoup object
+	clean();
 
-	if(!objfile) {
-        printError("File not found", filename);
-		readerror = 1;
+	// Use the binary cache if it is current. If it is in the vertex
+	// format of this mesh, the buffers are filled straight from the
+	// mapped file, with no parsing or packing at all.
+	MeshCache::cacheName(filename, cachefile, sizeof(cachefile));
+	meshcache = new MeshCache;
+	const GpuLayout *cached = meshcache->open(cachefile, filename) ? findLayout(meshcache->header()) : NULL;
+	if(cached && cached->format == vertexformat
+	   && meshcache->header()->indexsize == (meshcache->header()->nverts <= 65536 ? sizeof(GLushort) : sizeof(GLuint))) {
+		const MeshFileHeader *header = meshcache->header();
+		nverts = header->nverts;
+		ntris = header->nindices / 3;
+		indextype = (header->indexsize == sizeof(GLushort)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		if(vertexformat == VERTEX_FLOAT) {
+			// The mapping is read-only, but these arrays are never written to
+			vertexarray = (GLfloat *)meshcache->vertices();
+			if(indextype == GL_UNSIGNED_INT) indexarray = (GLuint *)meshcache->indices();
+		}
+		// The packing of the positions, from the bounds, as VertexLayout::pack() made it
+		for(int k=0; k<3; k++) {
+			float extent = 0.5f * (header->boundsmax[k] - header->boundsmin[k]);
+			if(extent <= 0.0f) extent = 1.0f;
+			posbias[k] = (vertexformat == VERTEX_FLOAT) ? 0.0f : 0.5f * (header->boundsmin[k] + header->boundsmax[k]);
+			posscale[k] = (vertexformat == VERTEX_FLOAT) ? 1.0f : extent * cached->decodescale;
+		}
+		vertexstride = cached->stride;
+		octnormals = cached->octnormals;
+		printf("readOBJ(\"%s\"): %d vertices, %d triangles from %s\n",
+			filename, nverts, ntris, cachefile);
+		place(cached->setupAttribs, meshcache->vertices(), meshcache->indices());
+		return;
 	}
 
-	// Scan through the file to count the number of data elements
-	while(fgets(line, 256, objfile)) {
-		sscanf(line, "%2s ", tag);
-		if(!strcmp(tag, "v")) numverts++;
-		else if(!strcmp(tag, "vn")) numnormals++;
-		else if(!strcmp(tag, "vt")) numtexcoords++;
-		else if(!strcmp(tag, "f")) numfaces++;
-		//else printf("Ignoring line starting with \"%s\"\n", tag);
+	if(cached && cached->format == VERTEX_FLOAT && meshcache->header()->indexsize == sizeof(GLuint)) {
+		// A float cache, e.g. from tools/meshconvert: take the arrays
+		// and store the mesh again below, in the format it is drawn in
+		nverts = meshcache->header()->nverts;
+		ntris = meshcache->header()->nindices / 3;
+		vertexarray = new GLfloat[8*nverts];
+		indexarray = new GLuint[3*ntris];
+		memcpy(vertexarray, meshcache->vertices(), 8*nverts*sizeof(GLfloat));
+		memcpy(indexarray, meshcache->indices(), 3*ntris*sizeof(GLuint));
+		delete meshcache;
+		meshcache = NULL;
 	}
+	else {
+		delete meshcache;
+		meshcache = NULL;
 
-	printf("loadObj(\"%s\"): found %d vertices, %d normals, %d texcoords, %d faces.\n",
-		filename, numverts, numnormals, numtexcoords, numfaces);
-
-	verts = new float[3*numverts];
-	normals = new float[3*numnormals];
-	texcoords = new float[2*numtexcoords];
-
-	vertexarray = new float[8*3*numfaces];
-	indexarray = new unsigned int[3*numfaces];
-	nverts = 3*numfaces;
-	ntris = numfaces;
-
-	rewind(objfile); // Start from the top again to read data
-
-	while(fgets(line, 256, objfile)) {
-		tag[0] = '\0';
-		sscanf(line, "%2s ", tag);
-		if(!strcmp(tag, "v")) {
-			//printf("Reading vertex %d\n", i_v+1);
-			numargs = sscanf(line, "v %f %f %f",
-				&verts[3*i_v], &verts[3*i_v+1], &verts[3*i_v+2]);
-			if(numargs != 3) {
-				printf("Malformed vertex data found at vertex %d.\n", i_v+1);
-				printf("Aborting.\n");
-				readerror = 1;
-				break;
-			}
-//			printf("Read vertex coord %d: %8.2f %8.2f %8.2f\n",
-//			i_v, verts[3*i_v], verts[3*i_v+1], verts[3*i_v+2]);
-			i_v++;
-		}
-		else if(!strcmp(tag, "vn")) {
-//			printf("Reading normal %d\n", i_n+1);
-			numargs = sscanf(line, "vn %f %f %f",
-				&normals[3*i_n], &normals[3*i_n+1], &normals[3*i_n+2]);
-			if(numargs != 3) {
-				printf("Malformed normal data found at normal %d.\n", i_n+1);
-				printf("Aborting.\n");
-				readerror = 1;
-				break;
-			}
-			i_n++;
+		if(!loader.load(filename)) { // Bail out if a read error occured
+			printError("Mesh read error","No mesh data generated");
+			return;
 		}
-		else if(!strcmp(tag, "vt"))  {
-//          printf("Reading texcoord %d\n", i_t+1);
-			numargs = sscanf(line, "vt %f %f",
-				&texcoords[2*i_t], &texcoords[2*i_t+1]);
-			if(numargs != 2) {
-				printf("Malformed texcoord data found at texcoord %d.\n", i_t+1);
-				printf("Aborting.\n");
-				readerror = 1;
-				break;
-			}
-			i_t++;
-		}
-		else if(!strcmp(tag, "f")) {
-//			printf("Reading face %d\n", i_f+1);
-			
-			numargs = sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
-				&v1, &t1, &n1, &v2, &t2, &n2, &v3, &t3, &n3);
-			if(numargs != 9) {
-				printf("Malformed face data found at face %d.\n", i_f+1);
-				printf("Aborting.\n");
-				readerror = 1;
-				break;
-			}
-//			printf("Read vertex data %d/%d/%d %d/%d/%d %d/%d/%d\n",
-//			v1, t1, n1, v2, t2, n2, v3, t3, n3);
-			v1--; v2--; v3--; n1--; n2--; n3--; t1--; t2--; t3--;
-			currentv = 8*3*i_f;
-			vertexarray[currentv] = verts[3*v1];
-			vertexarray[currentv+1] = verts[3*v1+1];
-			vertexarray[currentv+2] = verts[3*v1+2];
-			vertexarray[currentv+3] = normals[3*n1];
-			vertexarray[currentv+4] = normals[3*n1+1];
-			vertexarray[currentv+5] = normals[3*n1+2];
-			vertexarray[currentv+6] = texcoords[2*t1];
-			vertexarray[currentv+7] = texcoords[2*t1+1];
-			vertexarray[currentv+8] = verts[3*v2];
-			vertexarray[currentv+9] = verts[3*v2+1];
-			vertexarray[currentv+10] = verts[3*v2+2];
-			vertexarray[currentv+11] = normals[3*n2];
-			vertexarray[currentv+12] = normals[3*n2+1];
-			vertexarray[currentv+13] = normals[3*n2+2];
-			vertexarray[currentv+14] = texcoords[2*t2];
-			vertexarray[currentv+15] = texcoords[2*t2+1];
-			vertexarray[currentv+16] = verts[3*v3];
-			vertexarray[currentv+17] = verts[3*v3+1];
-			vertexarray[currentv+18] = verts[3*v3+2];
-			vertexarray[currentv+19] = normals[3*n3];
-			vertexarray[currentv+20] = normals[3*n3+1];
-			vertexarray[currentv+21] = normals[3*n3+2];
-			vertexarray[currentv+22] = texcoords[2*t3];
-			vertexarray[currentv+23] = texcoords[2*t3+1];
-			indexarray[3*i_f] = 3*i_f;
-			indexarray[3*i_f+1] = 3*i_f+1;
-			indexarray[3*i_f+2] = 3*i_f+2;
-			i_f++;
-		
-		};
 
-	}
+		printf("loadObj(\"%s\"): found %d vertices, %d normals, %d texcoords, %d faces.\n",
+			filename, loader.numverts, loader.numnormals, loader.numtexcoords, loader.numfaces);
 
-	// Clean up the temporary arrays we created
-	delete[] verts; verts = NULL;
-	delete[] normals; normals = NULL;
-	delete[] texcoords; texcoords = NULL;
-	fclose(objfile);
+		// Take over the arrays from the loader
+		vertexarray = loader.vertexarray;
+		indexarray = loader.indexarray;
+		nverts = loader.nverts;
+		ntris = loader.ntris;
+		loader.detach();
 
-	if(readerror) { // Delete corrupt data and bail out if a read error occured
-        printError("Mesh read error","No mesh data generated");
-		clean();
-		return;
+		// The loader writes three vertices per triangle. Share them instead.
+		optimize();
 	}
 
-	// Generate one vertex array object (VAO) and bind it
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// Generate two buffer IDs
-	glGenBuffers(1, &vertexbuffer);
-	glGenBuffers(1, &indexbuffer);
-
- 	// Activate the vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
- 	// Present our vertex coordinates to OpenGL
-	glBufferData(GL_ARRAY_BUFFER,
-		8*nverts * sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
-
-	// Specify how many attribute arrays we have in our VAO
-	glEnableVertexAttribArray(0); // Vertex coordinates
-	glEnableVertexAttribArray(1); // Normals
-	glEnableVertexAttribArray(2); // Texture coordinates
-	// Specify how OpenGL should interpret the vertex buffer data:
-	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-	// Type GL_FLOAT
-	// Not normalized (GL_FALSE)
-	// Stride 8 (interleaved array with 8 floats per vertex)
-	// Array buffer offset 0, 3, 6 (offset into first vertex)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)0); // xyz coordinates
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
-
- 	// Activate the index buffer
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
- 	// Present our vertex indices to OpenGL
- 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	 	3*ntris*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
-
-	// Deactivate (unbind) the VAO and the buffers again.
-	// Do NOT unbind the buffers while the VAO is still bound.
-	// The index buffer is an essential part of the VAO state.
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// Send the arrays to OpenGL in the selected vertex format, and
+	// store them in that format for the next run
+	upload(cachefile, filename);
 
 	return;
 };
 
+/*
+ * optimize()
+ *
+ * Weld identical vertices (same position, normal and texcoords),
+ * reorder the triangles for the post-transform vertex cache and then
+ * the vertices for fetch locality. Prints the vertex count and the
+ * ACMR (vertex shader runs per triangle) before and after.
+ * Call this before the data is sent to OpenGL.
+ */
+void TriangleSoup::optimize() {
+
+	if(ntris == 0 || meshcache) return; // A cached mesh is already optimised
+
+	int oldverts = nverts;
+	float oldacmr = MeshOptimizer::computeACMR(indexarray, 3*ntris, nverts);
+
+	nverts = MeshOptimizer::weldVertices(vertexarray, nverts, 8, indexarray, 3*ntris);
+	MeshOptimizer::optimizeVertexCache(indexarray, 3*ntris, nverts);
+	nverts = MeshOptimizer::optimizeVertexFetch(vertexarray, nverts, 8, indexarray, 3*ntris);
+
+	// Shrink the vertex array to the vertices that are left
+	if(nverts < oldverts) {
+		GLfloat *shrunk = new GLfloat[8*nverts];
+		memcpy(shrunk, vertexarray, 8*nverts*sizeof(GLfloat));
+		delete[] vertexarray;
+		vertexarray = shrunk;
+	}
+
+	printf("optimize(): %d -> %d vertices, ACMR %.3f -> %.3f (cache size %d)\n",
+		oldverts, nverts, oldacmr,
+		MeshOptimizer::computeACMR(indexarray, 3*ntris, nverts), MeshOptimizer::CACHESIZE);
+};
+
 /* Print data from a TriangleSoup object, for debugging purposes */
 void TriangleSoup::print() {
      int i;
 
+     if(!vertexarray || !indexarray) { // Mapped from the cache in a compact format
+         printf("TriangleSoup: %d vertices, %d triangles, no float arrays\n", nverts, ntris);
+         return;
+     }
+
      printf("TriangleSoup vertex data:\n\n");
      for(i=0; i<nverts; i++) {
          printf("%d: %8.2f %8.2f %8.2f\n", i,
@@ -610,6 +490,7 @@ void TriangleSoup::printInfo() {
      printf("TriangleSoup information:\n");
      printf("vertices : %d\n", nverts);
      printf("triangles: %d\n", ntris);
+     if(!vertexarray) return; // Mapped from the cache in a compact format
      xmin = xmax = vertexarray[0];
      ymin = ymax = vertexarray[1];
      zmin = zmax = vertexarray[2];
@@ -633,16 +514,276 @@ void TriangleSoup::printInfo() {
      printf("zmax: %8.2f\n", zmax);
 };
 
+/* bounds() - the box around the vertices of the CPU array, or of the mapped cache */
+bool TriangleSoup::bounds(float min[3], float max[3]) const {
+
+	if(!vertexarray && meshcache && nverts > 0) {
+		memcpy(min, meshcache->header()->boundsmin, 3*sizeof(float));
+		memcpy(max, meshcache->header()->boundsmax, 3*sizeof(float));
+		return true;
+	}
+	if(!vertexarray || nverts == 0) return false;
+	for(int k=0; k<3; k++) min[k] = max[k] = vertexarray[k];
+	for(int i=1; i<nverts; i++) {
+		for(int k=0; k<3; k++) {
+			float v = vertexarray[8*i + k];
+			if(v < min[k]) min[k] = v;
+			if(v > max[k]) max[k] = v;
+		}
+	}
+	return true;
+};
+
+/*
+ * upload(const char *cachefile, const char *sourcefile)
+ *
+ * Pack vertexarray into the selected vertex format and send it and the
+ * indices to a range of the arena for the format. The CPU arrays are
+ * left as they are, 8 floats per vertex and 32-bit indices. If
+ * 'cachefile' is given, the packed mesh is also stored there, as the
+ * cache of 'sourcefile', so that readOBJ() can map it as it is.
+ */
+void TriangleSoup::upload(const char *cachefile, const char *sourcefile) {
+
+	const GpuLayout &layout = chooseLayout(vertexformat, vertexarray, nverts);
+	unsigned char *packed = NULL;
+	if(layout.format == VERTEX_FLOAT) { // Use the float array as it is
+		posscale[0] = posscale[1] = posscale[2] = 1.0f;
+		posbias[0] = posbias[1] = posbias[2] = 0.0f;
+	}
+	else {
+		packed = layout.pack(vertexarray, nverts, posscale, posbias);
+	}
+	vertexstride = layout.stride;
+	octnormals = layout.octnormals;
+	const void *vertices = packed ? (const void *)packed : (const void *)vertexarray;
+
+	// 16-bit indices if they fit. Primitive restart is not used, so 65535 is a valid index.
+	indextype = (nverts <= 65536) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	GLushort *shortindices = NULL;
+	if(indextype == GL_UNSIGNED_SHORT) {
+		shortindices = new GLushort[3*ntris];
+		for(int i=0; i<3*ntris; i++) shortindices[i] = (GLushort)indexarray[i];
+	}
+	const void *indices = shortindices ? (const void *)shortindices : (const void *)indexarray;
+
+	place(layout.setupAttribs, vertices, indices);
+
+	if(cachefile) {
+		// Failing to write the cache is not an error, just slower next time
+		float min[3] = { 0.0f, 0.0f, 0.0f }, max[3] = { 0.0f, 0.0f, 0.0f };
+		bounds(min, max);
+		MeshCache::write(cachefile, sourcefile, vertices, nverts, vertexstride,
+			layout.attribs, 3, indices, 3*ntris,
+			(indextype == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint), min, max);
+	}
+
+	delete[] packed;
+	delete[] shortindices;
+};
+
+/*
+ * private
+ * place() - a range of the arena for the current format and index
+ * type, filled with vertices and indices that are already in them.
+ * Meshes of the same format share the arena's VAO, so the attribute
+ * setup is the arena's job.
+ */
+void TriangleSoup::place(void (*setupAttribs)(), const void *vertices, const void *indices) {
+
+	arena = MeshArena::shared(vertexstride, setupAttribs, indextype);
+	allocation = arena->allocate(nverts, 3*ntris);
+	if(allocation < 0) {
+		arena = NULL;
+		return;
+	}
+	arena->writeVertices(allocation, vertices);
+	arena->writeIndices(allocation, indices);
+};
+
+/*
+ * private
+ * writeIndices() - the indices are relative to the mesh's own vertices,
+ * the base vertex of the allocation is added when drawing. Indices
+ * mapped from the cache are in the index type already.
+ */
+void TriangleSoup::writeIndices() {
+
+	if(!indexarray && meshcache) {
+		arena->writeIndices(allocation, meshcache->indices());
+	}
+	else if(indextype == GL_UNSIGNED_SHORT) {
+		GLushort *shortindices = new GLushort[3*ntris];
+		for(int i=0; i<3*ntris; i++) shortindices[i] = (GLushort)indexarray[i];
+		arena->writeIndices(allocation, shortindices);
+		delete[] shortindices;
+	}
+	else {
+		arena->writeIndices(allocation, indexarray);
+	}
+};
+
+/*
+ * printMemory(const char *name)
+ *
+ * Print the size of the vertex and index buffers, and an estimate of the
+ * bytes read per draw call (vertex fetches after the post-transform
+ * cache, plus the indices), compared to 8 floats and 32-bit indices.
+ */
+void TriangleSoup::printMemory(const char *name) {
+
+	if(ntris == 0) return; // Nothing loaded
+
+	int indexsize = (indextype == GL_UNSIGNED_SHORT) ? 2 : 4;
+	int floatstride = 8*sizeof(GLfloat);
+	float acmr;
+	if(indexarray) {
+		acmr = MeshOptimizer::computeACMR(indexarray, 3*ntris, nverts);
+	}
+	else if(indextype == GL_UNSIGNED_INT) { // 32-bit indices mapped from the cache
+		acmr = MeshOptimizer::computeACMR((const GLuint *)meshcache->indices(), 3*ntris, nverts);
+	}
+	else { // 16-bit indices mapped from the cache
+		const GLushort *mapped = (const GLushort *)meshcache->indices();
+		GLuint *widened = new GLuint[3*ntris];
+		for(int i=0; i<3*ntris; i++) widened[i] = mapped[i];
+		acmr = MeshOptimizer::computeACMR(widened, 3*ntris, nverts);
+		delete[] widened;
+	}
+	double bytes = (double)nverts*vertexstride + 3.0*ntris*indexsize;
+	double floatbytes = (double)nverts*floatstride + 3.0*ntris*sizeof(GLuint);
+	double fetched = (double)acmr*ntris*vertexstride + 3.0*ntris*indexsize;
+	double floatfetched = (double)acmr*ntris*floatstride + 3.0*ntris*sizeof(GLuint);
+
+	printf("%s: %d vertices, %d triangles, %d B/vertex, %d B/index\n",
+		name, nverts, ntris, vertexstride, indexsize);
+	printf("%s: memory %.1f kB (float %.1f kB, %.0f%% saved), fetched per draw %.1f kB (float %.1f kB, %.0f%% saved)\n",
+		name, bytes/1024.0, floatbytes/1024.0, 100.0*(1.0 - bytes/floatbytes),
+		fetched/1024.0, floatfetched/1024.0, 100.0*(1.0 - fetched/floatfetched));
+};
+
+/*
+ * bake(GLuint program)
+ *
+ * Replace the vertex buffer with the output of a transform feedback pass.
+ * The program must capture 8 floats per vertex (position, normal,
+ * texcoords), interleaved. Each vertex is drawn once as a point, so
+ * shared vertices are only processed once.
+ */
+void TriangleSoup::bake(GLuint program) {
+
+	if(nverts == 0 || !arena) return;
+
+	GLuint bakedbuffer;
+	glGenBuffers(1, &bakedbuffer);
+	glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, bakedbuffer);
+	glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER,
+		8*nverts*sizeof(GLfloat), NULL, GL_STATIC_COPY);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, bakedbuffer);
+
+	glUseProgram(program);
+	setFormatUniforms(program);
+
+	// Only the captured vertices are wanted, nothing is rasterized
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(arena->vao());
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, arena->baseVertex(allocation), nverts);
+	glEndTransformFeedback();
+	glBindVertexArray(0);
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+	glUseProgram(0);
+
+	// Move the mesh to the arena of plain float vertices
+	MeshArena *floatarena = MeshArena::shared(VertexLayoutFloat::STRIDE, &VertexLayoutFloat::setupAttribs, indextype);
+	int baked = floatarena->allocate(nverts, 3*ntris);
+	if(baked >= 0) {
+		arena->release(allocation);
+		arena = floatarena;
+		allocation = baked;
+		arena->copyVertices(allocation, bakedbuffer);
+		writeIndices();
+	}
+	glDeleteBuffers(1, &bakedbuffer);
+	if(baked < 0) return;
+
+	vertexstride = VertexLayoutFloat::STRIDE;
+	posscale[0] = posscale[1] = posscale[2] = 1.0f;
+	posbias[0] = posbias[1] = posbias[2] = 0.0f;
+	octnormals = false;
+};
+
 /* Render the geometry in a TriangleSoup object */
 void TriangleSoup::render() {
 
-	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, 3 * ntris, GL_UNSIGNED_INT, (void*)0);
-	// (mode, vertex count, type, element array buffer offset)
+	GLint program = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	setFormatUniforms(program);
+
+	if(!arena) return;
+	GLsizei indexsize = (indextype == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+	glBindVertexArray(arena->vao());
+	glDrawElementsBaseVertex(GL_TRIANGLES, 3 * ntris, indextype,
+		(void*)((size_t)arena->firstIndex(allocation) * indexsize), arena->baseVertex(allocation));
+	// (mode, vertex count, type, element array buffer offset, first vertex)
 	glBindVertexArray(0);
 
 };
 
+/*
+ * packet() - the format uniforms are set by prepareDraw(). The VAO is
+ * the arena's, shared by all meshes of the same format, so packets of
+ * different meshes rarely need to switch it.
+ */
+DrawPacket TriangleSoup::packet(GLuint program, int object) {
+
+	DrawPacket packet;
+	packet.program = program;
+	if(!arena) return packet; // Nothing to draw
+	packet.vao = arena->vao();
+	packet.object = object;
+	packet.count = 3 * ntris;
+	packet.indextype = indextype;
+	packet.firstindex = arena->firstIndex(allocation);
+	packet.basevertex = arena->baseVertex(allocation);
+	packet.prepare = prepareDraw;
+	packet.owner = this;
+	return packet;
+};
+
+/*
+ * private
+ * setFormatUniforms() - tell the shader program how to decode the
+ * vertex format. The uniform locations are looked up once per program
+ * and kept for all meshes, so a mesh that is drawn with several
+ * programs, like a colour and a depth pre-pass program, never looks
+ * them up again.
+ */
+void TriangleSoup::setFormatUniforms(GLuint program) {
+
+	std::unordered_map<GLuint, FormatLocations>::iterator it = formatlocations.find(program);
+	if(it == formatlocations.end()) {
+		FormatLocations locations;
+		locations.posscale = glGetUniformLocation(program, "posScale");
+		locations.posbias = glGetUniformLocation(program, "posBias");
+		locations.octnormals = glGetUniformLocation(program, "octNormals");
+		it = formatlocations.insert(std::make_pair(program, locations)).first;
+	}
+	const FormatLocations &locations = it->second;
+	if(locations.posscale >= 0) glUniform3fv(locations.posscale, 1, posscale);
+	if(locations.posbias >= 0) glUniform3fv(locations.posbias, 1, posbias);
+	if(locations.octnormals >= 0) glUniform1i(locations.octnormals, octnormals ? 1 : 0);
+};
+
+/* private */
+void TriangleSoup::prepareDraw(void *owner, int item, GLuint program) {
+	(void)item;
+	((TriangleSoup*)owner)->setFormatUniforms(program);
+};
+
 /*
  * private
  * printError() - Signal an error.
@@ -1,13 +1,22 @@
 /* TriangleSoup.hpp */
 /*
- * A class to manage a basic vertex array and index array
- * in an OpenGL vertex array object. */
+ * A class to manage a basic vertex array and index array.
+ * On the GPU, the mesh is a range of the vertex and index buffers of a
+ * MeshArena shared by all meshes with the same format, so meshes share
+ * one vertex array object. */
 /* Usage: The methods createXXX() create geometry from fixed
  * arrays or procedural descriptions.
- * The method loadOBJ() loads geometry from an OBJ file.
+ * The method readOBJ() loads geometry from an OBJ file.
  * Only the mesh is loaded. Material information is ignored.
- * Only triangles are supported. OBJ files with quads are rejected.
- * Call render() to draw the mesh in OpenGL. */
+ * Quads and larger polygons are split into triangles.
+ * The parsed and optimised mesh is cached next to the OBJ file
+ * (see MeshCache.hpp) in the vertex format it is drawn in, so later
+ * runs map it straight into the GPU buffers instead of parsing.
+ * Call setVertexFormat() before creating the geometry to store it on
+ * the GPU in a compact format (see VertexLayout.hpp). Meshes with at
+ * most 65536 vertices get 16-bit indices.
+ * Call render() to draw the mesh in OpenGL, or submit packet() to a
+ * RenderQueue. */
 /* Author: Stefan Gustavson 2013-2014 (stefan.gustavson@liu.se)
  * This code is in the public domain.
  */
@@ -21,9 +30,9 @@
 
 #include <GLFW/glfw3.h>   // To use OpenGL datatypes
 
-#include <cstdio>  // For C-style file input in readOBJ()
+#include <cstdio>  // For printf()
 #include <cmath>   // For sin() and cos() in soupCreateSphere()
-#include <cstring> // For strcmp() - a leftover from the C version
+#include <cstring> // For memcpy()
 
 // Some <cmath> headers define M_PI, some don't. Make sure we have it.
 #ifndef M_PI
@@ -31,6 +40,12 @@
 #endif // M_PI
 
 #include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "ObjLoader.hpp"  // For readOBJ()
+#include "MeshOptimizer.hpp" // For optimize()
+#include "MeshCache.hpp"  // For the binary cache of readOBJ()
+#include "VertexLayout.hpp" // For the vertex formats used by upload()
+#include "RenderQueue.hpp" // For packet()
+#include "MeshArena.hpp"  // For the GPU buffers
 
 /* A struct to hold geometry data and send it off for rendering */
 class TriangleSoup {
@@ -38,16 +53,32 @@ class TriangleSoup {
 private:
 
     // All data members are private. They are accessed only by methods in the class.
-    GLuint vao;          // Vertex array object, the main handle for geometry
+    MeshArena *arena;    // The buffers and the VAO the mesh is in
+    int allocation;      // The mesh's ranges of the arena, -1 for none
     int nverts; // Number of vertices in the vertex array
     int ntris;  // Number of triangles in the index array (may be zero)
-    GLuint vertexbuffer; // Buffer ID to bind to GL_ARRAY_BUFFER
-    GLuint indexbuffer;  // Buffer ID to bind to GL_ELEMENT_ARRAY_BUFFER
     GLfloat *vertexarray; // Vertex array on interleaved format: x y z nx ny nz s t
     GLuint *indexarray;   // Element index array
+                          // (both NULL if the mesh was mapped from a cache in a compact format)
+    MeshCache *meshcache; // If not NULL, the arrays point into this mapped file
+
+    // The data on the GPU, see upload()
+    int vertexformat;     // VERTEX_FLOAT, VERTEX_HALF or VERTEX_SHORT
+    int vertexstride;     // Bytes per vertex in the vertex buffer
+    GLenum indextype;     // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    GLfloat posscale[3];  // Shader uniforms to decode compact positions
+    GLfloat posbias[3];
+    bool octnormals;      // Normals are octahedral-encoded
 
 public:
 
+/* GPU vertex formats. Normals and texcoords are compact in all but VERTEX_FLOAT. */
+enum VertexFormat {
+    VERTEX_FLOAT, // 32 bytes per vertex: float position, normal, texcoords
+    VERTEX_HALF,  // 16 bytes: half float position, octahedral normal, 16-bit texcoords
+    VERTEX_SHORT  // 16 bytes: 16-bit integer position, octahedral normal, 16-bit texcoords
+};
+
 /* Constructor: initialize a triangleSoup object to all zeros */
 TriangleSoup();
 
@@ -57,6 +88,9 @@ TriangleSoup();
 /* Clean up allocated data in a triangleSoup object */
 void clean();
 
+/* Select the GPU vertex format for the next createXXX() or readOBJ() */
+void setVertexFormat(VertexFormat format);
+
 /* Create a very simple demo mesh with a single triangle */
 void createTriangle();
 
@@ -69,17 +103,56 @@ void createSphere(float radius, int segments);
 /* Load geometry from an OBJ file */
 void readOBJ(const char* filename);
 
+/* Weld duplicate vertices and reorder for the vertex cache (readOBJ() does this) */
+void optimize();
+
 /* Print data from a triangleSoup object, for debugging purposes */
 void print();
 
 /* Print information about a triangleSoup object (stats and extents) */
 void printInfo();
 
+/* The extents of the vertex positions. False, and nothing set, for an empty mesh. */
+bool bounds(float min[3], float max[3]) const;
+
+/* Print the GPU memory used, and an estimate of the bytes fetched per draw, against the float format */
+void printMemory(const char *name);
+
+/*
+ * Run every vertex once through a transform feedback program (see
+ * Shader::createFeedbackShader()) that outputs position, normal and
+ * texcoords, and draw the result from now on instead of the original
+ * vertices. The CPU arrays are not changed.
+ */
+void bake(GLuint program);
+
 /* Render the geometry in a triangleSoup object */
 void render();
 
+/*
+ * A RenderQueue packet that draws the geometry with 'program' and the
+ * FrameUniforms entry 'object'. Set its depth, blending and name before
+ * submitting it.
+ */
+DrawPacket packet(GLuint program, int object);
+
 private:
 
+/* Set the uniforms that decode the vertex format in 'program', which is in use */
+void setFormatUniforms(GLuint program);
+
+/* DrawPacket::prepare for packet() */
+static void prepareDraw(void *owner, int item, GLuint program);
+
+/* Allocate the mesh in an arena and copy vertexarray and indexarray to it, optionally caching it */
+void upload(const char *cachefile = NULL, const char *sourcefile = NULL);
+
+/* Allocate the mesh in the arena for its format and fill it with data in that format */
+void place(void (*setupAttribs)(), const void *vertices, const void *indices);
+
+/* Copy indexarray into the allocation, as 16-bit indices if that is the arena's type */
+void writeIndices();
+
 void printError(const char *errtype, const char *errmsg);
 
 };
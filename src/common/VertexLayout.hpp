@@ -0,0 +1,231 @@
+/* VertexLayout.hpp */
+/*
+ * Compile-time descriptions of interleaved vertex formats for
+ * TriangleSoup. A layout is built from one encoder per attribute:
+ *   location 0: position  (PositionFloat, PositionHalf, PositionShort)
+ *   location 1: normal    (NormalFloat, NormalOct16)
+ *   location 2: texcoords (TexCoordFloat, TexCoordHalf, TexCoordUnorm16)
+ * VertexLayout<P, N, T> knows the stride and offsets, sets up the
+ * attribute pointers of a VAO and packs TriangleSoup's float vertices
+ * (x y z nx ny nz s t) into its own format.
+ *
+ * Compact positions are stored relative to the mesh bounds. The vertex
+ * shader gets them back as Position * posScale + posBias, with the
+ * uniforms set by TriangleSoup::render(). Octahedral normals are plain
+ * 16-bit integers that the shader decodes when octNormals is true.
+ * Integer attributes are not normalized by OpenGL, since the signed
+ * normalization rule changed between OpenGL 3.3 and 4.2. The shader
+ * scales them instead, which is exact in both.
+ */
+/* Usage: VertexLayout<PositionShort, NormalOct16, TexCoordUnorm16>::pack(...)
+ * then ::setupAttribs() with the VAO and the vertex buffer bound. */
+
+#ifndef VERTEXLAYOUT_HPP // Avoid including this header twice
+#define VERTEXLAYOUT_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <cmath>   // For floorf(), fabsf()
+#include <cstring> // For memcpy()
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+
+/* Round a float to the nearest half float (IEEE 754 binary16) */
+inline GLushort floatToHalf(float f) {
+    unsigned int x;
+    memcpy(&x, &f, sizeof(x));
+    GLushort sign = (GLushort)((x >> 16) & 0x8000u);
+    unsigned int absx = x & 0x7fffffffu;
+    if(absx >= 0x7f800000u) { // Inf or NaN
+        return sign | 0x7c00u | (absx > 0x7f800000u ? 0x200u : 0u);
+    }
+    if(absx >= 0x477ff000u) return sign | 0x7c00u; // Too large: Inf
+    if(absx < 0x38800000u) { // Denormal or zero
+        float d;
+        memcpy(&d, &absx, sizeof(d));
+        return sign | (GLushort)(int)floorf(d * 16777216.0f + 0.5f); // d / 2^-24
+    }
+    // Normal: rebias the exponent and round to nearest even
+    unsigned int h = (absx - 0x38000000u) >> 13;
+    unsigned int rest = absx & 0x1fffu;
+    if(rest > 0x1000u || (rest == 0x1000u && (h & 1u))) h++;
+    return sign | (GLushort)h;
+}
+
+/* Clamp and round to a 16-bit integer */
+inline GLshort floatToShort(float f) {
+    if(f > 32767.0f) f = 32767.0f;
+    if(f < -32767.0f) f = -32767.0f;
+    return (GLshort)floorf(f + 0.5f);
+}
+
+/*
+ * Attribute encoders. Each one has COMPONENTS, TYPE and NORMALIZED for
+ * glVertexAttribPointer(), BYTES (padded to a multiple of 4) and an
+ * encode() that writes one attribute from floats.
+ */
+
+/* Positions as three floats */
+struct PositionFloat {
+    enum { COMPONENTS = 3, TYPE = GL_FLOAT, NORMALIZED = GL_FALSE, BYTES = 12 };
+    static const bool COMPACT = false;
+    static float decodeScale() { return 1.0f; }
+    static void encode(const float *p, void *out) { memcpy(out, p, 3*sizeof(float)); }
+};
+
+/* Positions as half floats in [-1, 1] relative to the bounds */
+struct PositionHalf {
+    enum { COMPONENTS = 3, TYPE = GL_HALF_FLOAT, NORMALIZED = GL_FALSE, BYTES = 8 };
+    static const bool COMPACT = true;
+    static float decodeScale() { return 1.0f; }
+    static void encode(const float *p, void *out) {
+        GLushort *h = (GLushort *)out;
+        for(int k=0; k<3; k++) h[k] = floatToHalf(p[k]);
+        h[3] = 0;
+    }
+};
+
+/* Positions as 16-bit integers in [-32767, 32767] relative to the bounds */
+struct PositionShort {
+    enum { COMPONENTS = 3, TYPE = GL_SHORT, NORMALIZED = GL_FALSE, BYTES = 8 };
+    static const bool COMPACT = true;
+    static float decodeScale() { return 1.0f / 32767.0f; }
+    static void encode(const float *p, void *out) {
+        GLshort *s = (GLshort *)out;
+        for(int k=0; k<3; k++) s[k] = floatToShort(p[k] * 32767.0f);
+        s[3] = 0;
+    }
+};
+
+/* Normals as three floats */
+struct NormalFloat {
+    enum { COMPONENTS = 3, TYPE = GL_FLOAT, NORMALIZED = GL_FALSE, BYTES = 12 };
+    static const bool OCTAHEDRAL = false;
+    static void encode(const float *n, void *out) { memcpy(out, n, 3*sizeof(float)); }
+};
+
+/*
+ * Normals folded onto an octahedron and unfolded onto a square,
+ * stored as two 16-bit integers. The error is below 0.05 degrees.
+ */
+struct NormalOct16 {
+    enum { COMPONENTS = 2, TYPE = GL_SHORT, NORMALIZED = GL_FALSE, BYTES = 4 };
+    static const bool OCTAHEDRAL = true;
+    static void encode(const float *n, void *out) {
+        float len = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+        float u = 0.0f, v = 0.0f;
+        if(len > 0.0f) {
+            u = n[0] / len;
+            v = n[1] / len;
+            if(n[2] < 0.0f) { // Fold the lower half over the diagonals
+                float fu = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+                float fv = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+                u = fu;
+                v = fv;
+            }
+        }
+        GLshort *s = (GLshort *)out;
+        s[0] = floatToShort(u * 32767.0f);
+        s[1] = floatToShort(v * 32767.0f);
+    }
+};
+
+/* Texture coordinates as two floats */
+struct TexCoordFloat {
+    enum { COMPONENTS = 2, TYPE = GL_FLOAT, NORMALIZED = GL_FALSE, BYTES = 8 };
+    static void encode(const float *t, void *out) { memcpy(out, t, 2*sizeof(float)); }
+};
+
+/* Texture coordinates as half floats, for repeating textures */
+struct TexCoordHalf {
+    enum { COMPONENTS = 2, TYPE = GL_HALF_FLOAT, NORMALIZED = GL_FALSE, BYTES = 4 };
+    static void encode(const float *t, void *out) {
+        GLushort *h = (GLushort *)out;
+        h[0] = floatToHalf(t[0]);
+        h[1] = floatToHalf(t[1]);
+    }
+};
+
+/* Texture coordinates in [0, 1] as normalized 16-bit unsigned integers */
+struct TexCoordUnorm16 {
+    enum { COMPONENTS = 2, TYPE = GL_UNSIGNED_SHORT, NORMALIZED = GL_TRUE, BYTES = 4 };
+    static void encode(const float *t, void *out) {
+        GLushort *s = (GLushort *)out;
+        for(int k=0; k<2; k++) {
+            float x = t[k] < 0.0f ? 0.0f : (t[k] > 1.0f ? 1.0f : t[k]);
+            s[k] = (GLushort)floorf(x * 65535.0f + 0.5f);
+        }
+    }
+};
+
+template<class P, class N, class T>
+struct VertexLayout {
+
+    enum {
+        POSITIONOFFSET = 0,
+        NORMALOFFSET = P::BYTES,
+        TEXCOORDOFFSET = P::BYTES + N::BYTES,
+        STRIDE = P::BYTES + N::BYTES + T::BYTES
+    };
+
+    /*
+     * pack() - convert 'nverts' vertices on TriangleSoup's float format
+     * to this layout. Compact positions are mapped to [-1, 1] with
+     * p' = (p - bias) / extent. posScale and posBias are set to what
+     * the shader needs to undo it. Returns a new[] array.
+     */
+    static unsigned char *pack(const float *vertexarray, int nverts,
+                               float *posScale, float *posBias) {
+
+        float extent[3] = { 1.0f, 1.0f, 1.0f };
+        for(int k=0; k<3; k++) posBias[k] = 0.0f;
+        if(P::COMPACT && nverts > 0) {
+            for(int k=0; k<3; k++) {
+                float lo = vertexarray[k], hi = vertexarray[k];
+                for(int i=1; i<nverts; i++) {
+                    float x = vertexarray[8*i+k];
+                    if(x < lo) lo = x;
+                    if(x > hi) hi = x;
+                }
+                posBias[k] = 0.5f * (lo + hi);
+                extent[k] = 0.5f * (hi - lo);
+                if(extent[k] <= 0.0f) extent[k] = 1.0f; // Flat in this direction
+            }
+        }
+        for(int k=0; k<3; k++) posScale[k] = extent[k] * P::decodeScale();
+
+        unsigned char *packed = new unsigned char[(size_t)STRIDE * nverts];
+        for(int i=0; i<nverts; i++) {
+            const float *v = &vertexarray[8*i];
+            unsigned char *out = &packed[(size_t)STRIDE * i];
+            float p[3];
+            for(int k=0; k<3; k++) p[k] = (v[k] - posBias[k]) / extent[k];
+            P::encode(p, out + POSITIONOFFSET);
+            N::encode(v + 3, out + NORMALOFFSET);
+            T::encode(v + 6, out + TEXCOORDOFFSET);
+        }
+        return packed;
+    }
+
+    /* Enable and point out attributes 0, 1 and 2 in the bound VAO */
+    static void setupAttribs() {
+        glEnableVertexAttribArray(0); // Vertex coordinates
+        glEnableVertexAttribArray(1); // Normals
+        glEnableVertexAttribArray(2); // Texture coordinates
+        glVertexAttribPointer(0, P::COMPONENTS, P::TYPE, P::NORMALIZED,
+            STRIDE, (void*)POSITIONOFFSET);
+        glVertexAttribPointer(1, N::COMPONENTS, N::TYPE, N::NORMALIZED,
+            STRIDE, (void*)NORMALOFFSET);
+        glVertexAttribPointer(2, T::COMPONENTS, T::TYPE, T::NORMALIZED,
+            STRIDE, (void*)TEXCOORDOFFSET);
+    }
+};
+
+/* The original format: 8 floats, 32 bytes per vertex */
+typedef VertexLayout<PositionFloat, NormalFloat, TexCoordFloat> VertexLayoutFloat;
+
+#endif // VERTEXLAYOUT_HPP
@@ -0,0 +1,191 @@
+#include "WaterNormals.hpp"
+#include "SimplexNoise.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+/* The octaves of waterShaderFrag.glsl: frequency and amplitude. The
+ * shader's slope weights (0.4, 2, 4) are the derivatives of these. */
+const int OCTAVES = 3;
+const float FREQUENCY[OCTAVES] = { 2.0f, 4.0f, 10.0f };
+const float AMPLITUDE[OCTAVES] = { 0.2f, 0.5f, 0.4f };
+
+/* The noise moves through its y axis over time, from the water level */
+const float WATERLEVEL = -0.6f, DRIFT = 0.25f;
+
+/* [-1, 1] to an unsigned byte */
+GLubyte toByte(float v) {
+    return (GLubyte)floorf(127.5f * std::min(1.0f, std::max(-1.0f, v)) + 128.0f);
+}
+
+/* The weight of the far copy in a cross-fade over [0, 1], flat at both ends */
+float fade(float s) {
+    return s * s * (3.0f - 2.0f * s);
+}
+
+}
+
+
+WaterNormals::WaterNormals(int size, int frames, float period, float loop) {
+    this->size = std::max(4, size);
+    this->frames = std::max(2, frames);
+    this->period = period > 0.0f ? period : 4.0f;
+    this->loop = loop > 0.0f ? loop : 8.0f;
+    texture = 0;
+    slopescale = 1.0f;
+    milliseconds = 0.0;
+    uniformprogram = 0;
+    location_maps = location_params = -1;
+    meshprepare = NULL;
+    meshowner = NULL;
+}
+
+
+WaterNormals::~WaterNormals() {
+    if(texture) glDeleteTextures(1, &texture);
+}
+
+
+void WaterNormals::generate() {
+
+    double start = glfwGetTime();
+    std::vector<float> texels((size_t)size * size * 4 * frames);
+    Noise::getKernel(); // Pick the kernel before the workers need it
+    ThreadPool::global().parallelFor(frames, [&](int frame) {
+        computeFrame(frame, &texels[(size_t)frame * size * size * 4]);
+    });
+
+    // To 8 bits, with the slopes scaled to fit: cheap to filter and small
+    float steepest = 0.0f;
+    for(size_t i=0; i<texels.size(); i+=4) {
+        steepest = std::max(steepest, std::max(fabsf(texels[i]), fabsf(texels[i+1])));
+    }
+    slopescale = (steepest > 0.0f) ? steepest : 1.0f;
+    std::vector<GLubyte> bytes(texels.size());
+    for(size_t i=0; i<texels.size(); i+=4) {
+        bytes[i] = toByte(texels[i] / slopescale);
+        bytes[i+1] = toByte(texels[i+1] / slopescale);
+        bytes[i+2] = toByte(texels[i+2]);
+        bytes[i+3] = 255;
+    }
+    milliseconds = 1000.0 * (glfwGetTime() - start);
+
+    if(!texture) glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size, size, frames, 0, GL_RGBA, GL_UNSIGNED_BYTE, &bytes[0]);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    printf("Water normal maps: %d frames of %dx%d computed in %.1f ms on %d workers, %.1f MB\n",
+        frames, size, size, milliseconds, ThreadPool::global().size(), textureBytes() / 1048576.0);
+}
+
+
+bool WaterNormals::ready() const {
+    return texture != 0;
+}
+
+
+void WaterNormals::attach(DrawPacket &packet) {
+    if(packet.count == 0) return; // No mesh
+    meshprepare = packet.prepare;
+    meshowner = packet.owner;
+    packet.prepare = prepareWater;
+    packet.owner = this;
+}
+
+
+double WaterNormals::generateTime() const {
+    return milliseconds;
+}
+
+
+/* The frames and their mipmaps, at 4 bytes per texel */
+long WaterNormals::textureBytes() const {
+    return (long)size * size * frames * 4 * 4 / 3;
+}
+
+
+/*
+ * private
+ * computeFrame() - the height at every texel of one frame, as a blend of
+ * the eight copies of the noise one period (and one loop) apart, then
+ * the slopes from the heights. Runs on a worker thread.
+ */
+void WaterNormals::computeFrame(int frame, float *texels) const {
+
+    int n = size * size;
+    float texel = period / size;
+    float t = frame * loop / frames;
+    float wt = fade((float)frame / frames);
+    std::vector<float> x(n), y(n), z(n), noise(n), height(n, 0.0f), weight2(n, 0.0f);
+
+    for(int copy=0; copy<8; copy++) {
+        int a = copy & 1, b = (copy >> 1) & 1, c = (copy >> 2) & 1;
+        float shifty = WATERLEVEL + DRIFT * (t - c * loop);
+        float timeweight = c ? wt : 1.0f - wt;
+        for(int o=0; o<OCTAVES; o++) {
+            float f = FREQUENCY[o];
+            for(int j=0; j<size; j++) {
+                for(int i=0; i<size; i++) {
+                    x[j*size + i] = f * (i * texel - a * period);
+                    y[j*size + i] = f * shifty;
+                    z[j*size + i] = f * (j * texel - b * period);
+                }
+            }
+            Noise::snoiseBatch(&x[0], &y[0], &z[0], &noise[0], n);
+            for(int j=0; j<size; j++) {
+                float wz = fade((float)j / size);
+                wz = b ? wz : 1.0f - wz;
+                for(int i=0; i<size; i++) {
+                    float wx = fade((float)i / size);
+                    wx = a ? wx : 1.0f - wx;
+                    float w = wx * wz * timeweight;
+                    height[j*size + i] += w * AMPLITUDE[o] * noise[j*size + i];
+                    if(o == 0) weight2[j*size + i] += w * w;
+                }
+            }
+        }
+    }
+
+    // Copies of the noise are about independent, so the blend has the
+    // variance of one times the sum of the squared weights
+    for(int k=0; k<n; k++) height[k] /= sqrtf(weight2[k]);
+
+    for(int j=0; j<size; j++) {
+        int up = ((j + 1) % size) * size, down = ((j + size - 1) % size) * size;
+        for(int i=0; i<size; i++) {
+            int right = (i + 1) % size, left = (i + size - 1) % size;
+            float *texel4 = &texels[4 * (j*size + i)];
+            texel4[0] = (height[j*size + right] - height[j*size + left]) / (2.0f * texel);
+            texel4[1] = (height[up + i] - height[down + i]) / (2.0f * texel);
+            texel4[2] = height[j*size + i];
+            texel4[3] = 0.0f;
+        }
+    }
+}
+
+
+/* private: DrawPacket::prepare for attach() */
+void WaterNormals::prepareWater(void *owner, int item, GLuint program) {
+    WaterNormals *maps = (WaterNormals*)owner;
+    if(program != maps->uniformprogram) {
+        maps->uniformprogram = program;
+        maps->location_maps = glGetUniformLocation(program, "waterMaps");
+        maps->location_params = glGetUniformLocation(program, "waterParams");
+    }
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, maps->texture);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(maps->location_maps, TEXTURE_UNIT);
+    glUniform4f(maps->location_params, (float)maps->frames, maps->period, maps->loop, maps->slopescale);
+    if(maps->meshprepare) maps->meshprepare(maps->meshowner, item, program);
+}
@@ -0,0 +1,91 @@
+/* WaterNormals.hpp */
+/*
+ * Precomputed detail for the water surface, to replace the three
+ * octaves of gradient noise that waterShaderFrag.glsl evaluates per
+ * fragment. The same fractal sum of simplex noise is computed once on
+ * the CPU, on a square of 'period' world units and over 'loop' seconds,
+ * as a few frames of size x size texels in a texture array: the slope
+ * (dh/dx, dh/dz) in the red and green channels and the height in blue,
+ * all in 8 bits, the slopes divided by the steepest one.
+ * The maps tile in both directions and the last frame runs into the
+ * first. Noise has no period, so each point is a cross-fade of the
+ * noise there and one period away, in x, z and time, with weights that
+ * are flat at the ends (no seams in the slopes) and a correction for
+ * the contrast lost in the middle of the fade. The slopes are central
+ * differences that wrap around.
+ * The frames are computed on the ThreadPool workers with the batch
+ * noise of SimplexNoise.hpp. The texture is mipmapped and repeats.
+ */
+/* Usage: generate() at startup, then attach() the packet of the water
+ * mesh, drawn with the water shader compiled with NORMAL_MAPS defined,
+ * which samples two scrolling layers of the maps (see
+ * waterShaderFrag.glsl). */
+
+#ifndef WATERNORMALS_HPP // Avoid including this header twice
+#define WATERNORMALS_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h>   // To use OpenGL datatypes
+
+#include <vector>
+
+#include "Utilities.hpp"  // To be able to use OpenGL extensions
+#include "RenderQueue.hpp"
+
+class WaterNormals {
+
+public:
+
+/* The texture unit of the maps while drawing */
+static const int TEXTURE_UNIT = 7;
+
+/*
+ * Constructor: 'frames' maps of size x size texels, covering 'period'
+ * world units and 'loop' seconds. No OpenGL calls are made here.
+ */
+WaterNormals(int size = 256, int frames = 16, float period = 4.0f, float loop = 8.0f);
+
+/* Destructor: delete the texture */
+~WaterNormals();
+
+/* Compute the maps on all workers and upload them. Prints the time taken. */
+void generate();
+
+/* True once generate() has made the texture */
+bool ready() const;
+
+/*
+ * attach() - bind the maps and set their uniforms before 'packet' is
+ * drawn, then call the packet's own prepare().
+ */
+void attach(DrawPacket &packet);
+
+/* Milliseconds the computation took, and the texture memory in bytes */
+double generateTime() const;
+long textureBytes() const;
+
+private:
+
+int size, frames;
+float period, loop;
+GLuint texture;
+float slopescale;     // The steepest slope, 1 in the texture
+double milliseconds;
+
+GLuint uniformprogram; // Program the uniform locations below belong to
+GLint location_maps, location_params;
+void (*meshprepare)(void *owner, int item, GLuint program); // The water packet's own
+void *meshowner;
+
+void computeFrame(int frame, float *texels) const;
+static void prepareWater(void *owner, int item, GLuint program);
+
+WaterNormals(const WaterNormals&);            // Not copyable
+WaterNormals &operator=(const WaterNormals&);
+
+};
+
+#endif // WATERNORMALS_HPP
@@ -28,6 +28,16 @@ glm::vec3 Camera::getUp() const
 	return upDirection;
 }
 
+void Camera::setPos(glm::vec3 pos)
+{
+	position = pos;
+}
+
+void Camera::setDir(glm::vec3 dir)
+{
+	direction = dir;
+}
+
 glm::mat4 Camera::getViewMatrix() const
 {
 	return glm::lookAt(
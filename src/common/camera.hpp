@@ -16,6 +16,9 @@ public:
 	glm::vec3 getDir() const;
 	glm::vec3 getUp() const;
 
+	void setPos(glm::vec3 pos);
+	void setDir(glm::vec3 dir);
+
 	void rotateRight();
 	void rotateLeft();
 
@@ -1,5 +1,9 @@
 // File and console I/O for logging and error reporting
 #include <iostream>
+#include <cstdio>  // For sscanf()
+#include <cstdlib> // For atoi()
+#include <cstring> // For strcmp()
+#include <string>
 #include "common/TriangleSoup.hpp"
 #include "common/Utilities.hpp"
 #include "common/Shader.hpp"
@@ -8,6 +12,20 @@
 #include "common/glm/gtx/transform.hpp"
 #include "common/glm/gtc/type_ptr.hpp"
 #include "common/camera.hpp"
+#include "common/TileManager.hpp"
+#include "common/CDLODTerrain.hpp"
+#include "common/Profiler.hpp"
+#include "common/Benchmark.hpp"
+#include "common/FrameUniforms.hpp"
+#include "common/RenderQueue.hpp"
+#include "common/Forest.hpp"
+#include "common/Impostor.hpp"
+#include "common/WaterNormals.hpp"
+#include "common/Ocean.hpp"
+#include "common/CloudVolume.hpp"
+#include "common/CloudLayer.hpp"
+#include "common/OverdrawView.hpp"
+#include "common/DynamicResolution.hpp"
 
 
 // In MacOS X, tell GLFW to include the modern OpenGL headers.
@@ -24,6 +42,31 @@ using namespace std;
 int width = 800;
 int height = 600;
 
+/*
+ * viewDistance() - distance from the camera to the origin of a model
+ */
+static float viewDistance(const glm::vec3 &eye, const glm::mat4 &model) {
+    float w = model[3][3]; // 2 for waterTrans
+    glm::vec3 origin(model[3][0] / w, model[3][1] / w, model[3][2] / w);
+    return glm::length(origin - eye);
+}
+
+
+/*
+ * submitMesh() - queue a mesh, if its program is ready. Transparent
+ * (blended) meshes are drawn back to front after the opaque ones.
+ */
+static void submitMesh(RenderQueue &queue, TriangleSoup &mesh, Shader &shader, int object,
+                       float depth, bool transparent, const char *name) {
+    if (!shader.ready()) return;
+    DrawPacket packet = mesh.packet(shader.programID, object);
+    packet.depth = depth;
+    packet.blend = transparent;
+    packet.name = name;
+    queue.submit(packet);
+}
+
+
 /*
  * main(argc, argv) - the standard C++ entry point for the program
  */
@@ -34,36 +77,30 @@ int main(int argc, char *argv[]) {
     Shader planeShader;
     Shader waterShader;
     Shader cloudShader;
+    Shader cloudCompositeShader;
     Shader floatingShader;
     Shader treeShader;
-
-    // ID
-    GLuint sphereID;
-    GLuint planeID;
-    GLuint waterID;
-    GLuint cloudID;
-    GLuint floatingID;
-    GLuint treeID;
-    GLint location_time1;
-    GLint location_time2;
-    GLint location_time3;
-    GLint location_rotMat1;
-    GLint location_rotMat2;
-    GLint location_rotMat3;
-    GLint location_rotMat4;
-    GLint location_rotMat5;
-    GLint light_pos1;
-    GLint light_pos2;
-    GLint light_pos3;
-    GLuint light_pos4;
-    GLuint light_pos5;
-    GLuint light_pos6;
-    GLint eye_pos1;
-    GLint eye_pos2;
-    GLint eye_pos3;
-    GLuint eye_pos4;
-    GLuint eye_pos5;
-    GLuint eye_pos6;
+    Shader forestShader;
+    Shader treeBakeShader;
+    Shader impostorShader;
+    Shader terrainBakeShader;
+    Shader bakedPlaneShader;
+    Shader tileShader;
+    Shader cdlodShader;
+    Shader overdrawShader;
+
+    // position-only variants for the depth pre-pass
+    Shader planeDepthShader;
+    Shader bakedPlaneDepthShader;
+    Shader tileDepthShader;
+    Shader cdlodDepthShader;
+    Shader floatingDepthShader;
+
+    // uniforms shared by all programs, in one buffer per frame
+    FrameUniforms frameUniforms;
+
+    // the draws of a frame, sorted and with redundant state changes skipped
+    RenderQueue renderQueue;
 
     //objects
     TriangleSoup sphere;
@@ -72,6 +109,129 @@ int main(int argc, char *argv[]) {
     TriangleSoup clouds;
     TriangleSoup floating;
     TriangleSoup tree;
+    TriangleSoup bakedTerrain;
+
+    // Endless terrain streamed in tiles around the camera, out to the sky
+    // sphere of radius 15 that hides everything further: a tile within 15
+    // units has its centre within 15 + 4*sqrt(2) < 3*8 units. Only the
+    // tiles in view are drawn. --plane-terrain draws the original single
+    // plane instead.
+    TileManager terrainTiles(8.0f, 64, 3);
+    bool planeTerrain = false;
+
+    // --cdlod draws the terrain as a CDLOD quadtree instead of tiles, with
+    // detail falling off with distance and at most this many triangles
+    CDLODTerrain cdlodTerrain;
+    cdlodTerrain.setTriangleBudget(500000);
+    bool cdlodTerrainMode = false;
+
+    // Trees scattered over the tiled or CDLOD terrain, drawn as instances
+    // of one mesh. --trees N sets about how many are in range (0 for none).
+    // The plane terrain has the single tree of the original scene instead.
+    Forest forest(8.0f, 5);
+    int treeCount = 20000;
+
+    // Trees beyond a few dozen metres are drawn as impostors, quads with
+    // views of the tree baked at load time. --no-impostors draws every
+    // tree as a mesh, to compare.
+    Impostor treeImpostor(8, 128);
+    bool impostors = true;
+
+    // The terrain displacement has no time dependence, so by default it is
+    // baked once at load time. --live-terrain (or the T key) runs it in the
+    // vertex shader every frame instead, to compare frame times.
+    bool liveTerrain = false;
+    bool toggleKeyDown = false;
+    bool profileKeyDown = false;
+    bool overdrawKeyDown = false;
+
+    // Linked shader programs are cached in shadercache/ between runs.
+    // --no-shader-cache compiles them all from source, for a cold start.
+    bool shaderCache = true;
+
+    // --low-quality compiles cheaper variants of the water and terrain
+    // shaders, with one octave of bump noise and no fake shadow
+    bool lowQuality = false;
+
+    // The water detail comes from normal maps computed at startup.
+    // --analytic-water evaluates the noise per fragment instead, the
+    // original quality mode.
+    WaterNormals waterNormals(256, 16, 4.0f, 8.0f);
+    bool analyticWater = false;
+
+    // The waves are an FFT ocean simulated on the worker threads each
+    // frame, see common/Ocean.hpp. --sine-water moves the water with the
+    // two sine waves of the vertex shader instead.
+    Ocean ocean(256, 16.0f, 2.5f, 0.04f);
+    bool fftOcean = true;
+
+    // The cloud noise is a volume computed at startup and scrolled over
+    // time. --analytic-clouds evaluates it per fragment instead.
+    CloudVolume cloudVolume(128, 8.0f);
+    bool analyticClouds = false;
+
+    // --half-res-clouds draws the clouds at a quarter of the pixels,
+    // a different quarter each frame, and composites the last four
+    // frames at full resolution, see common/CloudLayer.hpp.
+    CloudLayer cloudLayer;
+    bool halfResClouds = false;
+
+    // --depth-prepass draws the depth of the opaque objects first, so
+    // their fragment shaders run once per pixel, and culls the faces
+    // turned away, see common/RenderQueue.hpp. --overdraw (or the O key)
+    // shows how many fragments each pixel was shaded with instead.
+    bool depthPrepass = false;
+    bool overdraw = false;
+    OverdrawView overdrawView;
+
+    // --dynamic-resolution MS draws the frame at the resolution that keeps
+    // its GPU time at MS milliseconds, down to half the width and height,
+    // and scales it up to the window, see common/DynamicResolution.hpp
+    DynamicResolution dynamicResolution(16.7f, 0.5f);
+    bool dynamicRes = false;
+
+    // --bench path.txt renders the camera path offscreen with no window
+    // and writes the timings to bench.json (or --bench-out), see
+    // common/Benchmark.hpp. --bench-frames and --bench-size WxH set the
+    // number of frames and the resolution.
+    Benchmark bench;
+    bool benchMode = false;
+    const char *benchOut = "bench.json";
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "--live-terrain")) liveTerrain = true;
+        if(!strcmp(argv[i], "--plane-terrain")) planeTerrain = true;
+        if(!strcmp(argv[i], "--cdlod")) cdlodTerrainMode = true;
+        if(!strcmp(argv[i], "--no-shader-cache")) shaderCache = false;
+        if(!strcmp(argv[i], "--low-quality")) lowQuality = true;
+        if(!strcmp(argv[i], "--no-impostors")) impostors = false;
+        if(!strcmp(argv[i], "--analytic-water")) analyticWater = true;
+        if(!strcmp(argv[i], "--sine-water")) fftOcean = false;
+        if(!strcmp(argv[i], "--analytic-clouds")) analyticClouds = true;
+        if(!strcmp(argv[i], "--half-res-clouds")) halfResClouds = true;
+        if(!strcmp(argv[i], "--depth-prepass")) depthPrepass = true;
+        if(!strcmp(argv[i], "--overdraw")) overdraw = true;
+        if(i+1 < argc) {
+            if(!strcmp(argv[i], "--bench")) {
+                if(!bench.loadPath(argv[++i])) return -1;
+                benchMode = true;
+            }
+            else if(!strcmp(argv[i], "--bench-frames")) bench.setFrames(atoi(argv[++i]));
+            else if(!strcmp(argv[i], "--bench-out")) benchOut = argv[++i];
+            else if(!strcmp(argv[i], "--trees")) treeCount = atoi(argv[++i]);
+            else if(!strcmp(argv[i], "--dynamic-resolution")) {
+                dynamicResolution.setBudget((float)atof(argv[++i]));
+                dynamicRes = true;
+            }
+            else if(!strcmp(argv[i], "--bench-size")) {
+                int w = 0, h = 0;
+                if(sscanf(argv[++i], "%dx%d", &w, &h) == 2 && w > 0 && h > 0) bench.setSize(w, h);
+            }
+        }
+    }
+    // Every frame must draw the same tiles and trees for the same camera position
+    terrainTiles.setSynchronous(benchMode);
+    forest.setSynchronous(benchMode);
+    forest.setCount(treeCount);
 
     // time
     float time;  
@@ -83,11 +243,12 @@ int main(int argc, char *argv[]) {
     const GLFWvidmode *vidmode;  // GLFW struct to hold information about the display
 	GLFWwindow *window;    // GLFW struct to hold information about the window
 
-    // Initialise GLFW
+    // Initialise GLFW, with no display in benchmark mode if possible
+    if (benchMode) Benchmark::initHeadless();
     glfwInit();
 
     // Determine the desktop size
-    vidmode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    vidmode = benchMode ? NULL : glfwGetVideoMode(glfwGetPrimaryMonitor());
 
 	// Make sure we are getting a GL context of at least version 3.3
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -97,7 +258,15 @@ int main(int argc, char *argv[]) {
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
     // Open a square window (aspect 1:1) to fill half the screen height
-    window = glfwCreateWindow(width, height, "Scene", NULL, NULL);
+    // (in benchmark mode an invisible one, at the benchmark size)
+    if (benchMode) {
+        width = bench.width();
+        height = bench.height();
+        window = bench.createWindow();
+    }
+    else {
+        window = glfwCreateWindow(width, height, "Scene", NULL, NULL);
+    }
     if (!window)
     {
         cout << "Unable to open window. Terminating." << endl;
@@ -108,21 +277,103 @@ int main(int argc, char *argv[]) {
     // Make the newly created window the "current context" for OpenGL
     glfwMakeContextCurrent(window);
 
-    // create shaders
-    waterShader.createShader("shaders/waterShaderVert.glsl", "shaders/waterShaderFrag.glsl");
-    //waterShader.createShader("shaders/waterShaderVert.glsl", "shaders/waterShaderWorleyFrag.glsl");
-    sphereShader.createShader("shaders/sphereShaderVert.glsl", "shaders/sphereShaderFrag.glsl");
-    planeShader.createShader("shaders/planeShaderVert.glsl", "shaders/planeShaderFrag.glsl");
-    cloudShader.createShader("shaders/cloudShaderVert.glsl", "shaders/cloudShaderFrag.glsl");
-    floatingShader.createShader("shaders/floatingShaderVert.glsl", "shaders/floatingShaderFrag.glsl");
-    treeShader.createShader("shaders/treeShaderVert.glsl", "shaders/treeShaderFrag.glsl");
-    // load objects
+    // create shaders. They are all submitted before any is waited for, so
+    // the driver can compile them in parallel, and each pass is skipped
+    // until its program is ready.
+    if(!shaderCache) Shader::setCacheDirectory(NULL);
+    double shaderStart = glfwGetTime();
+    std::string waterDefines = analyticWater
+        ? (lowQuality ? "#define NOISE_OCTAVES 1\n#define FAKE_SHADOW 0\n" : "")
+        : (lowQuality ? "#define NORMAL_MAPS 1\n#define FAKE_SHADOW 0\n" : "#define NORMAL_MAPS 1\n");
+    if (fftOcean) waterDefines += "#define OCEAN 1\n";
+    const char *terrainDefines = lowQuality ? "#define NOISE_OCTAVES 1\n" : NULL;
+    waterShader.submitShader("shaders/waterShaderVert.glsl", "shaders/waterShaderFrag.glsl", waterDefines.c_str());
+    //waterShader.submitShader("shaders/waterShaderVert.glsl", "shaders/waterShaderWorleyFrag.glsl");
+    sphereShader.submitShader("shaders/sphereShaderVert.glsl", "shaders/sphereShaderFrag.glsl");
+    planeShader.submitShader("shaders/planeShaderVert.glsl", "shaders/planeShaderFrag.glsl", terrainDefines);
+    cloudShader.submitShader("shaders/cloudShaderVert.glsl", "shaders/cloudShaderFrag.glsl",
+        analyticClouds ? NULL : "#define CLOUD_VOLUME 1\n");
+    cloudCompositeShader.submitShader("shaders/cloudShaderVert.glsl", "shaders/cloudCompositeFrag.glsl", "#define CLOUD_COMPOSITE 1\n");
+    floatingShader.submitShader("shaders/floatingShaderVert.glsl", "shaders/floatingShaderFrag.glsl");
+    treeShader.submitShader("shaders/treeShaderVert.glsl", "shaders/treeShaderFrag.glsl");
+    forestShader.submitShader("shaders/treeShaderVert.glsl", "shaders/treeShaderFrag.glsl", "#define INSTANCED 1\n");
+    treeBakeShader.submitShader("shaders/treeShaderVert.glsl", "shaders/treeShaderFrag.glsl", "#define IMPOSTOR_BAKE 1\n");
+    impostorShader.submitShader("shaders/impostorVert.glsl", "shaders/impostorFrag.glsl");
+    const char *bakeVaryings[] = { "pos", "interpolatedNormal", "st" };
+    terrainBakeShader.submitFeedbackShader("shaders/planeShaderVert.glsl", bakeVaryings, 3);
+    bakedPlaneShader.submitShader("shaders/planeBakedVert.glsl", "shaders/planeShaderFrag.glsl", terrainDefines);
+    tileShader.submitShader("shaders/terrainTileVert.glsl", "shaders/planeShaderFrag.glsl", terrainDefines);
+    cdlodShader.submitShader("shaders/cdlodTerrainVert.glsl", "shaders/planeShaderFrag.glsl", terrainDefines);
+    overdrawShader.submitShader("shaders/overdrawVert.glsl", "shaders/overdrawFrag.glsl");
+    Shader *allShaders[] = { &waterShader, &sphereShader, &planeShader, &cloudShader, &floatingShader,
+        &treeShader, &forestShader, &treeBakeShader, &impostorShader, &terrainBakeShader, &bakedPlaneShader, &tileShader, &cdlodShader,
+        &cloudCompositeShader, &overdrawShader };
+    const int numShaders = sizeof(allShaders) / sizeof(allShaders[0]);
+
+    // the programs of the depth pre-pass, and the faces culled in that
+    // mode: the sky and the clouds are seen from inside. The sky is left
+    // out of the pre-pass, to be drawn right after it: where the terrain
+    // crosses the sky their depths tie, and both would pass GL_EQUAL.
+    // The water waves may turn triangles over and the trees discard
+    // fragments, so both are drawn as before.
+    struct PrepassProgram { Shader *shader, *depthShader; GLenum cullFace; };
+    PrepassProgram prepassPrograms[] = {
+        { &planeShader, &planeDepthShader, GL_BACK },
+        { &bakedPlaneShader, &bakedPlaneDepthShader, GL_BACK },
+        { &tileShader, &tileDepthShader, GL_BACK },
+        { &cdlodShader, &cdlodDepthShader, GL_BACK },
+        { &floatingShader, &floatingDepthShader, GL_BACK },
+        { &sphereShader, NULL, GL_FRONT },
+        { &cloudShader, NULL, GL_FRONT },
+        { &cloudCompositeShader, NULL, GL_FRONT } };
+    const int numPrepassPrograms = sizeof(prepassPrograms) / sizeof(prepassPrograms[0]);
+    bool prepassPending = depthPrepass;
+    if (depthPrepass) {
+        planeDepthShader.submitShader("shaders/planeShaderVert.glsl", "shaders/depthOnlyFrag.glsl", terrainDefines);
+        bakedPlaneDepthShader.submitShader("shaders/planeBakedVert.glsl", "shaders/depthOnlyFrag.glsl", terrainDefines);
+        tileDepthShader.submitShader("shaders/terrainTileVert.glsl", "shaders/depthOnlyFrag.glsl", terrainDefines);
+        cdlodDepthShader.submitShader("shaders/cdlodTerrainVert.glsl", "shaders/depthOnlyFrag.glsl", terrainDefines);
+        floatingDepthShader.submitShader("shaders/floatingShaderVert.glsl", "shaders/depthOnlyFrag.glsl");
+        for (int i=0; i<numPrepassPrograms; i++)
+            renderQueue.setCullFace(prepassPrograms[i].shader->programID, prepassPrograms[i].cullFace);
+        renderQueue.setDepthPrepass(true);
+    }
+    bool shadersPending = true;
+    printf("Shaders submitted in %.1f ms, %d programs from the cache\n",
+        1000.0 * (glfwGetTime() - shaderStart), Shader::cacheHits());
+    // load objects, in compact vertex formats with 16-bit indices where they fit
+    sphere.setVertexFormat(TriangleSoup::VERTEX_SHORT);
+    terrain.setVertexFormat(TriangleSoup::VERTEX_SHORT);
+    water.setVertexFormat(TriangleSoup::VERTEX_SHORT);
+    clouds.setVertexFormat(TriangleSoup::VERTEX_SHORT);
+    floating.setVertexFormat(TriangleSoup::VERTEX_HALF);
+    tree.setVertexFormat(TriangleSoup::VERTEX_SHORT);
+    bakedTerrain.setVertexFormat(TriangleSoup::VERTEX_SHORT);
     sphere.createSphere(15, 40);
     terrain.readOBJ("objects/plane2.obj");
     water.readOBJ("objects/plane2.obj");
     clouds.createSphere(14.5, 40);
     floating.createSphere(0.2, 20);
     tree.readOBJ("objects/Tree.obj");
+    bakedTerrain.readOBJ("objects/plane2.obj");
+    terrainBakeShader.finish(); // The only program needed before the first frame
+    bakedTerrain.bake(terrainBakeShader.programID);
+    if (impostors && !planeTerrain) {
+        treeBakeShader.finish();
+        treeImpostor.bake(tree, treeBakeShader.programID);
+        if (treeImpostor.baked()) printf("Tree impostor baked in %.1f ms\n", treeImpostor.bakeTime());
+    }
+
+    if (!analyticWater) waterNormals.generate();
+    if (!analyticClouds) cloudVolume.generate();
+
+    // report the GPU memory and bandwidth saved by the compact formats
+    sphere.printMemory("sphere");
+    terrain.printMemory("terrain");
+    water.printMemory("water");
+    clouds.printMemory("clouds");
+    floating.printMemory("floating");
+    tree.printMemory("tree");
 
     // define light positions
     float lightPos[3] = {-2.0, 5.0, 13.5};
@@ -134,57 +385,19 @@ int main(int argc, char *argv[]) {
 
     // transformation of objects
     glm::mat4 Model = glm::translate(glm::vec3(0, 0.0, 0));
-    glm::mat4 sphereMVP;
 
     glm::mat4 waterTrans = glm::translate(glm::vec3(0, -0.6, 0.0));
     waterTrans += glm::scale(glm::vec3(1.0, 1.0, 1.0));
-    glm::mat4 waterMVP;
     
     glm::mat4 planeTrans = glm::translate(glm::vec3(0, 0, 3.0));
     planeTrans += glm::scale(glm::vec3(20.0, 1.0, 20.0));
-    glm::mat4 planeMVP;
 
     glm::mat4 cloudTrans = glm::translate(glm::vec3(0, 0.0, 0));
-    glm::mat4 cloudMVP;
 
     glm::mat4 floatingTrans = glm::translate(glm::vec3(2.0, 0.0, -4.0));
-    glm::mat4 floatingMVP;
 
     glm::mat4 treeTrans = glm::translate(glm::vec3(0.0, -0.4, 0.0));
     treeTrans += glm::scale(glm::vec3(0.5, 0.5, 0.5));
-    glm::mat4 treeMVP;
-
-    // set uniforms
-    sphereID = glGetUniformLocation(sphereShader.programID, "MVP");
-    planeID = glGetUniformLocation(planeShader.programID, "MVP");
-    waterID = glGetUniformLocation(waterShader.programID, "MVP");
-    cloudID = glGetUniformLocation(cloudShader.programID, "MVP");
-    floatingID = glGetUniformLocation(floatingShader.programID, "MVP");
-    treeID = glGetUniformLocation(treeShader.programID, "MVP");
-
-    location_rotMat1 = glGetUniformLocation(sphereShader.programID, "rotMat");
-    location_rotMat2 = glGetUniformLocation(planeShader.programID, "rotMat");
-    location_rotMat3 = glGetUniformLocation(waterShader.programID, "rotMat");
-    location_rotMat4 = glGetUniformLocation(floatingShader.programID, "rotMat");
-    location_rotMat5 = glGetUniformLocation(treeShader.programID, "rotMat");
-
-    light_pos1 = glGetUniformLocation(sphereShader.programID, "lightPos");
-    light_pos2 = glGetUniformLocation(planeShader.programID, "lightPos");
-    light_pos3 = glGetUniformLocation(waterShader.programID, "lightPos");
-    light_pos4 = glGetUniformLocation(cloudShader.programID, "lightPos");
-    light_pos5 = glGetUniformLocation(floatingShader.programID, "lightPos");
-    light_pos6 = glGetUniformLocation(treeShader.programID, "lightPos");
-
-    eye_pos1 = glGetUniformLocation(sphereShader.programID, "eyePosition");
-    eye_pos2 = glGetUniformLocation(planeShader.programID, "eyePosition");
-    eye_pos3 = glGetUniformLocation(waterShader.programID, "eyePosition");
-    eye_pos4 = glGetUniformLocation(cloudShader.programID, "eyePosition");
-    eye_pos5 = glGetUniformLocation(floatingShader.programID, "eyePosition");
-    eye_pos6 = glGetUniformLocation(treeShader.programID, "eyePosition");
-
-    location_time1 = glGetUniformLocation(waterShader.programID, "time");
-    location_time2 = glGetUniformLocation(cloudShader.programID, "time");
-    location_time3 = glGetUniformLocation(floatingShader.programID, "time");
 
     // Show some useful information on the GL context
     cout << "GL vendor:       " << glGetString(GL_VENDOR) << endl;
@@ -196,24 +409,67 @@ int main(int argc, char *argv[]) {
     glfwSwapInterval(0); 
     glEnable(GL_DEPTH_TEST);
     glDisable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // The render queue enables blending for transparent draws
+    if (benchMode) {
+        // every measured frame must draw every pass
+        for (int i=0; i<numShaders; i++) allShaders[i]->finish();
+        for (int i=0; i<numPrepassPrograms; i++)
+            if (prepassPrograms[i].depthShader) prepassPrograms[i].depthShader->finish();
+        bench.begin();
+    }
+
     // Main loop
-    while(!glfwWindowShouldClose(window))
+    while(!glfwWindowShouldClose(window) && (!benchMode || bench.running()))
     {
          // Get window size. It may start out different from the requested
         // size, and will change if the user resizes the window.
-        glfwGetWindowSize( window, &width, &height );
+        if (benchMode) {
+            bench.beginFrame(); // Draw into the offscreen framebuffer
+        }
+        else {
+            glfwGetWindowSize( window, &width, &height );
+        }
         // Set viewport. This is the pixel rectangle we want to draw into.
-        glViewport( 0, 0, width, height ); // The entire window
+        int renderWidth = width, renderHeight = height;
+        if (dynamicRes) {
+            // a corner of an offscreen target, bound along with the viewport
+            dynamicResolution.beginFrame(width, height);
+            renderWidth = dynamicResolution.renderWidth();
+            renderHeight = dynamicResolution.renderHeight();
+        }
+        else glViewport( 0, 0, width, height ); // The entire window
 		// Set the clear color and depth, and clear the buffers for drawing
         glClearColor(0.3f, 0.3f, 0.3f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | (overdraw ? GL_STENCIL_BUFFER_BIT : 0));
         //glEnable(GL_CULL_FACE);
 
         /* ---- Rendering code should go here ---- */
+        PROFILE_BEGIN_FRAME();
 		Utilities :: displayFPS ( window );
         time = (float)glfwGetTime(); // Number of seconds since the program was started
+        if (benchMode) time = (float)bench.time(); // Virtual time, the same in every run
+
+        // report when all shader programs are ready
+        if (shadersPending) {
+            int readyShaders = 0;
+            for (int i=0; i<numShaders; i++) if (allShaders[i]->ready()) readyShaders++;
+            if (readyShaders == numShaders) {
+                printf("All shaders ready after %.1f ms\n", 1000.0 * (glfwGetTime() - shaderStart));
+                shadersPending = false;
+            }
+        }
+
+        // the pre-pass starts once all its programs are ready
+        if (prepassPending) {
+            int readyShaders = 0;
+            for (int i=0; i<numPrepassPrograms; i++)
+                if (!prepassPrograms[i].depthShader || prepassPrograms[i].depthShader->ready()) readyShaders++;
+            if (readyShaders == numPrepassPrograms) {
+                for (int i=0; i<numPrepassPrograms; i++) if (prepassPrograms[i].depthShader)
+                    renderQueue.setDepthProgram(prepassPrograms[i].shader->programID, prepassPrograms[i].depthShader->programID);
+                prepassPending = false;
+            }
+        }
 
         //rotation for skydome
         myRotationAxis = glm::vec3(-1.0f, 0.0f, 0.0f);
@@ -247,76 +503,163 @@ int main(int argc, char *argv[]) {
             camera.movePosUp();
         }
 
-        // draw sphere
-        glUseProgram(sphereShader.programID);
-        sphereMVP = camera.getMVPMatrix(Model);
-        
-        //glUniform1f(location_time , time); // Copy the value to the shader program
-        glUniform3fv(light_pos1, 1, lightPos);
-        glUniform3fv(eye_pos1, 1, glm::value_ptr(camera.getPos()));
-        glUniformMatrix4fv(location_rotMat1, 1, GL_FALSE, &rotMat[0][0]);
-        glUniformMatrix4fv(sphereID, 1, GL_FALSE, &sphereMVP[0][0]);
-        
-        sphere.render();
-        glUseProgram(0);
-
-        // draw plane
-        glUseProgram(planeShader.programID);
-        planeMVP = camera.getMVPMatrix(planeTrans);
-        glUniformMatrix4fv(planeID, 1, GL_FALSE, &planeMVP[0][0]);
-        glUniform3fv(light_pos2, 1, lightPos);
-        glUniform3fv(eye_pos2, 1, glm::value_ptr(camera.getPos()));
-        glUniformMatrix4fv(location_rotMat2, 1, GL_FALSE, &rotMat[0][0]);
-
-        terrain.render();
-        glUseProgram(0);
-
-        // draw water
-        glUseProgram(waterShader.programID);
-        waterMVP = camera.getMVPMatrix(waterTrans);
-        glUniformMatrix4fv(waterID, 1, GL_FALSE, &waterMVP[0][0]);
-        glUniform3fv(light_pos3, 1, lightPos);
-        glUniform1f(location_time1 , time); 
-        glUniform3fv(eye_pos3, 1, glm::value_ptr(camera.getPos()));
-        glUniformMatrix4fv(location_rotMat3, 1, GL_FALSE, &rotMat[0][0]);
-        
-        water.render();
-        glUseProgram(0);
-
-        // draw floating sphere
-        glUseProgram(floatingShader.programID);
-        floatingMVP = camera.getMVPMatrix(floatingTrans);
-        glUniformMatrix4fv(floatingID, 1, GL_FALSE, &floatingMVP[0][0]);
-        glUniform3fv(light_pos5, 1, lightPos);
-        glUniform1f(location_time3 , time); 
-        glUniform3fv(eye_pos5, 1, glm::value_ptr(camera.getPos()));
-        
-        floating.render();
-        glUseProgram(0);
-
-        // draw tree
-        glUseProgram(treeShader.programID);
-        treeMVP = camera.getMVPMatrix(treeTrans);
-        glUniformMatrix4fv(treeID, 1, GL_FALSE, &treeMVP[0][0]);
-        glUniform3fv(light_pos6, 1, lightPos);
-        glUniform3fv(eye_pos6, 1, glm::value_ptr(camera.getPos()));
-        //glUniformMatrix4fv(location_rotMat3, 1, GL_FALSE, &rotMat[0][0]);
-        tree.render();
-        glUseProgram(0);
-
-        // draw clouds
-        glUseProgram(cloudShader.programID);
-        cloudMVP = camera.getMVPMatrix(cloudTrans);
-        glUniformMatrix4fv(cloudID, 1, GL_FALSE, &cloudMVP[0][0]);
-        glUniform3fv(light_pos4, 1, lightPos);
-        glUniform1f(location_time2 , time); 
-        glUniform3fv(eye_pos4, 1, glm::value_ptr(camera.getPos()));
-
-        clouds.render();
-        glUseProgram(0);
-        
+        // switch between baked and per-frame terrain displacement
+        if (glfwGetKey( window, GLFW_KEY_T ) == GLFW_PRESS){
+            if (!toggleKeyDown) {
+                liveTerrain = !liveTerrain;
+                cout << "Terrain displacement: " << (liveTerrain ? "live" : "baked") << endl;
+            }
+            toggleKeyDown = true;
+        }
+        else {
+            toggleKeyDown = false;
+        }
+
+        // print the per-pass profile and write a trace (with "make profile")
+        if (glfwGetKey( window, GLFW_KEY_P ) == GLFW_PRESS){
+            if (!profileKeyDown) {
+                PROFILE_REPORT();
+                PROFILE_WRITE_TRACE("profile.json");
+            }
+            profileKeyDown = true;
+        }
+        else {
+            profileKeyDown = false;
+        }
+
+        // show the overdraw instead of the image
+        if (glfwGetKey( window, GLFW_KEY_O ) == GLFW_PRESS){
+            if (!overdrawKeyDown) {
+                overdraw = !overdraw;
+                cout << "Overdraw view: " << (overdraw ? "on" : "off") << endl;
+            }
+            overdrawKeyDown = true;
+        }
+        else {
+            overdrawKeyDown = false;
+        }
+
+        // in benchmark mode the camera follows the path instead
+        if (benchMode) {
+            float pathPos[3], pathTarget[3];
+            bench.camera(pathPos, pathTarget);
+            camera.setPos(glm::make_vec3(pathPos));
+            camera.setDir(glm::make_vec3(pathTarget));
+        }
+
+        // per-frame and per-object uniforms, uploaded in one go
+        FrameBlock &frame = frameUniforms.frame();
+        frame.view = camera.getViewMatrix();
+        frame.projection = camera.getProj();
+        frame.viewProjection = camera.getMVPMatrix(glm::mat4(1.0f));
+        frame.rotMat = rotMat;
+        frame.eyePosition = camera.getPos();
+        frame.lightPos = glm::make_vec3(lightPos);
+        frame.time = time;
+        // the sky, the clouds and the water move along with the camera over
+        // the endless terrain. Their shaders work in world coordinates, so
+        // the waves and the clouds stay where they are.
+        glm::mat4 follow = glm::translate(glm::vec3(camera.getPos().x, 0.0f, camera.getPos().z));
+        glm::mat4 skyModel = follow * Model;
+        glm::mat4 waterModel = follow * waterTrans;
+        glm::mat4 cloudModel = follow * cloudTrans;
+        int sphereDraw = frameUniforms.addObject(camera.getMVPMatrix(skyModel), skyModel);
+        int planeDraw = frameUniforms.addObject(camera.getMVPMatrix(planeTrans), planeTrans);
+        int waterDraw = frameUniforms.addObject(camera.getMVPMatrix(waterModel), waterModel);
+        int floatingDraw = frameUniforms.addObject(camera.getMVPMatrix(floatingTrans), floatingTrans);
+        int treeDraw = frameUniforms.addObject(camera.getMVPMatrix(treeTrans), treeTrans);
+        int cloudDraw = frameUniforms.addObject(camera.getMVPMatrix(cloudModel), cloudModel);
+        int cloudSampleDraw = -1;
+        if (halfResClouds) {
+            cloudLayer.beginFrame(renderWidth, renderHeight, frame.viewProjection);
+            cloudSampleDraw = frameUniforms.addObject(cloudLayer.jitter() * camera.getMVPMatrix(cloudModel), cloudModel);
+        }
+        frameUniforms.upload();
+
+        // submit everything to the render queue, which sorts the draws by
+        // state and depth. The sky and the clouds surround the scene, so
+        // their depth is their radius: the sky is drawn after the other
+        // opaque objects, and the clouds before the water.
+        glm::vec3 eye = camera.getPos();
+        {
+            PROFILE_SCOPE("submit");
+            submitMesh(renderQueue, sphere, sphereShader, sphereDraw, 15.0f, false, "sky");
+
+            // CDLOD terrain, selected from the camera frustum
+            if (!planeTerrain && cdlodTerrainMode) {
+                cdlodTerrain.update(glm::value_ptr(frame.viewProjection), glm::value_ptr(eye));
+                if (cdlodShader.ready()) cdlodTerrain.submit(renderQueue, cdlodShader.programID, "plane");
+            }
+            // terrain tiles, streamed in around the camera
+            else if (!planeTerrain) {
+                terrainTiles.update(eye.x, eye.z, glm::value_ptr(frame.viewProjection));
+                if (tileShader.ready()) terrainTiles.submit(renderQueue, tileShader.programID, "plane");
+            }
+            // plane, unless the tiles above replace it
+            else if (liveTerrain) {
+                submitMesh(renderQueue, terrain, planeShader, planeDraw, viewDistance(eye, planeTrans), false, "plane");
+            }
+            else {
+                submitMesh(renderQueue, bakedTerrain, bakedPlaneShader, planeDraw, viewDistance(eye, planeTrans), false, "plane");
+            }
+
+            // water, with the detail maps and the waves of this frame
+            if (fftOcean) ocean.update(time);
+            if (waterShader.ready()) {
+                DrawPacket packet = water.packet(waterShader.programID, waterDraw);
+                packet.depth = viewDistance(eye, waterModel);
+                packet.blend = true;
+                packet.name = "water";
+                if (!analyticWater) waterNormals.attach(packet);
+                if (fftOcean) ocean.attach(packet);
+                renderQueue.submit(packet);
+            }
+            submitMesh(renderQueue, floating, floatingShader, floatingDraw, viewDistance(eye, floatingTrans), false, "floating");
+            // a forest on the tiled and CDLOD terrain, whose heights it knows
+            if (!planeTerrain) {
+                forest.update(eye.x, eye.z);
+                if (forestShader.ready()) forest.submit(renderQueue, tree, forestShader.programID, "tree",
+                    &treeImpostor, impostorShader.ready() ? impostorShader.programID : 0);
+            }
+            else {
+                submitMesh(renderQueue, tree, treeShader, treeDraw, viewDistance(eye, treeTrans), false, "tree");
+            }
+            if (halfResClouds && cloudShader.ready() && cloudCompositeShader.ready()) {
+                // this frame's samples now, offscreen, and the composite in turn
+                DrawPacket samples = clouds.packet(cloudShader.programID, cloudSampleDraw);
+                samples.name = "cloud samples";
+                if (!analyticClouds) cloudVolume.attach(samples);
+                cloudLayer.render(samples, frameUniforms);
+                DrawPacket packet = clouds.packet(cloudCompositeShader.programID, cloudDraw);
+                packet.depth = 14.5f;
+                packet.blend = true;
+                packet.name = "clouds";
+                cloudLayer.attach(packet);
+                renderQueue.submit(packet);
+            }
+            else if (!halfResClouds && cloudShader.ready()) {
+                DrawPacket packet = clouds.packet(cloudShader.programID, cloudDraw);
+                packet.depth = 14.5f;
+                packet.blend = true;
+                packet.name = "clouds";
+                if (!analyticClouds) cloudVolume.attach(packet);
+                renderQueue.submit(packet);
+            }
+        }
+        renderQueue.setOverdrawCount(overdraw);
+        renderQueue.flush(frameUniforms);
+        if (overdraw && overdrawShader.ready()) overdrawView.draw(overdrawShader.programID, renderWidth, renderHeight);
+        if (dynamicRes) dynamicResolution.endFrame();
+
         // Swap buffers, i.e. display the image and prepare for next frame.
-        glfwSwapBuffers(window);
+        if (benchMode) {
+            bench.endFrame();
+        }
+        else {
+            glfwSwapBuffers(window);
+        }
+        frameUniforms.endFrame();
+        PROFILE_END_FRAME();
 
 		// Poll events (read keyboard and mouse input)
 		glfwPollEvents();
@@ -328,6 +671,18 @@ int main(int argc, char *argv[]) {
 
     }
 
+    if (benchMode) bench.writeResults(benchOut);
+    renderQueue.printStats();
+    dynamicResolution.printStats();
+    if (overdrawView.frames() > 0) printf("Overdraw: %.2f fragments per pixel on average over %d frames\n",
+        overdrawView.average(), overdrawView.frames());
+    if (forest.rebuilds() > 0) printf("Forest: %d trees in range, %d drawn as meshes and %d as impostors, buffer built %d times\n",
+        forest.instances(), forest.meshInstances(), forest.impostorInstances(), forest.rebuilds());
+    if (ocean.steps() > 0) printf("Ocean: %d steps of %.2f ms on the workers, %d frames kept the last step\n",
+        ocean.steps(), ocean.stepTime(), ocean.skipped());
+    PROFILE_REPORT();
+    PROFILE_WRITE_TRACE("profile.json");
+
     // Close the OpenGL window and terminate GLFW.
     glfwDestroyWindow(window);
     glfwTerminate();
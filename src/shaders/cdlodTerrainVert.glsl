@@ -0,0 +1,57 @@
+#version 330 core
+
+// CDLOD terrain (CDLODTerrain.cpp). Each instance is one quadtree node,
+// drawn with the shared grid patch. The vertices are morphed towards the
+// next coarser level near the end of the node's range, then the height
+// and normal are filtered from the node's layer of the height texture,
+// which holds TerrainHeight.cpp at the patch vertices.
+layout(location = 0) in vec2 gridPos; // Position in the patch, [0,1]
+layout(location = 3) in vec4 node;    // Node corner x and z, size, level
+layout(location = 4) in float layer;  // Layer of the node in nodeHeights
+
+#include "frame.glsl"
+uniform vec2 morphConsts[16]; // Per level: end/(end-start), 1/(end-start)
+uniform float gridDim;        // Quads along a patch side
+uniform vec3 cameraPos;
+uniform sampler2DArray nodeHeights; // Height, dh/dx, dh/dz per patch vertex
+
+invariant gl_Position; // See depthOnlyFrag.glsl
+out vec3 interpolatedNormal;
+out vec2 st;
+out vec3 pos;
+
+// Height, dh/dx and dh/dz at a point of the node, given in [0,1]
+// over the node, filtered from the values at the patch vertices
+vec3 nodeHeight(vec2 local) {
+  vec2 uv = (local * gridDim + 0.5) / (gridDim + 1.0);
+  return texture(nodeHeights, vec3(uv, layer)).xyz;
+}
+
+// Move the odd vertices of the patch onto the even ones, so that a fully
+// morphed patch is the same as the next coarser level's patch. Works in
+// the patch, so that a fully morphed vertex sits on a texel centre.
+vec2 morphVertex(ivec2 index, float morphK) {
+  vec2 odd = vec2(index - 2 * (index / 2));
+  return gridPos - odd / gridDim * morphK;
+}
+
+void main () {
+
+  int lod = int(node.w);
+  vec2 world = node.xy + gridPos * node.z;
+
+  ivec2 index = ivec2(gridPos * gridDim + 0.5);
+  float h = texelFetch(nodeHeights, ivec3(index, int(layer)), 0).x;
+  float dist = distance(cameraPos, vec3(world.x, h, world.y));
+  float morphK = clamp(dist * morphConsts[lod].y - morphConsts[lod].x + 1.0, 0.0, 1.0);
+  vec2 local = morphVertex(index, morphK);
+  world = node.xy + local * node.z;
+
+  vec3 height = nodeHeight(local);
+
+  interpolatedNormal = normalize(vec3(-height.y, 1.0, -height.z));
+  st = gridPos;
+  pos = vec3(world.x, height.x, world.y);
+
+  gl_Position = viewProjection * vec4(pos, 1.0);
+}
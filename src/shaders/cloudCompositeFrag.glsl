@@ -0,0 +1,42 @@
+#version 330 core
+
+// The clouds of common/CloudLayer.hpp at full resolution, drawn with
+// the cloud mesh and cloudShaderVert.glsl with CLOUD_COMPOSITE defined,
+// blended and depth tested like the clouds themselves.
+
+// Clip coordinates of this point in the frames of the four layers
+in vec4 layerPosition0, layerPosition1, layerPosition2, layerPosition3;
+
+uniform sampler2DArray cloudSamples; // One sample per 2x2 pixels in each layer
+uniform vec4 cloudValid;             // 1 for the layers drawn at this size
+uniform vec3 cloudFrame;             // Width and height in pixels, this frame's layer
+
+out vec4 color;
+
+// The pixel of each 2x2 block in each layer, and the layer of each pixel
+const ivec2 SAMPLE[4] = ivec2[4](ivec2(0, 0), ivec2(1, 1), ivec2(1, 0), ivec2(0, 1));
+const int LAYER[4] = int[4](0, 2, 3, 1);
+
+// Texture coordinates of pixel position p in a layer with sample pixel s:
+// sample i is at pixel 2i + s
+vec2 samplesUV(vec2 p, ivec2 s) {
+	return (p - vec2(s) + 0.5) / (2.0 * vec2(textureSize(cloudSamples, 0).xy));
+}
+
+void main () {
+
+	ivec2 s = ivec2(gl_FragCoord.xy) & 1;
+	int layer = LAYER[s.x + 2*s.y];
+	vec4 then = (layer == 0) ? layerPosition0 : (layer == 1) ? layerPosition1
+		: (layer == 2) ? layerPosition2 : layerPosition3;
+
+	// Where the layer saw this point of the clouds, or if that was off
+	// screen or before a resize, between the samples of this frame.
+	// One fetch either way: both sides of a branch may be paid for.
+	vec2 p = (0.5 * then.xy / then.w + 0.5) * cloudFrame.xy;
+	int current = int(cloudFrame.z);
+	bool seen = cloudValid[layer] > 0.5 && then.w > 0.0
+		&& all(greaterThanEqual(p, vec2(0.0))) && all(lessThanEqual(p, cloudFrame.xy));
+	vec2 uv = seen ? samplesUV(p, s) : samplesUV(gl_FragCoord.xy, SAMPLE[current]);
+	color = texture(cloudSamples, vec3(uv, seen ? layer : current));
+}
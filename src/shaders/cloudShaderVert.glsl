@@ -1,22 +1,36 @@
 #version 330 core
 
-layout(location = 0) in vec3 Position;
-layout ( location =1) in vec3 Normal;
+layout(location = 0) in vec3 inPosition;
+layout ( location =1) in vec3 inNormal;
 layout ( location =2) in vec2 TexCoord;
 
-//uniform float time;
-uniform mat4 MVP;
-//uniform mat4 rotMat;
-uniform vec3 lightPos;
+#include "vertexDecode.glsl"
+
+#include "frame.glsl"
+#include "object.glsl"
 
 out vec3 interpolatedNormal;
 out vec2 st;
 out vec3 pos;
 
+#ifdef CLOUD_COMPOSITE
+// Where the vertex was in the frames of the sample layers, see cloudCompositeFrag.glsl
+uniform mat4 cloudViewProjections[4];
+out vec4 layerPosition0, layerPosition1, layerPosition2, layerPosition3;
+#endif
+
 void main () {
+	decodeVertex();
 		
 		interpolatedNormal = Normal;
 		st = TexCoord;
-		pos = Position;
+		pos = Position + vec3(model[3].x, 0.0, model[3].z) / model[3].w; // It follows the camera (main.cpp)
 		gl_Position = MVP * vec4 (Position , 1.0);
+#ifdef CLOUD_COMPOSITE
+		vec4 world = model * vec4(Position, 1.0);
+		layerPosition0 = cloudViewProjections[0] * world;
+		layerPosition1 = cloudViewProjections[1] * world;
+		layerPosition2 = cloudViewProjections[2] * world;
+		layerPosition3 = cloudViewProjections[3] * world;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,9 @@
+#version 330 core
+
+// The depth pre-pass of RenderQueue: any vertex shader with this makes
+// a position-only program. The colour pass that follows tests GL_EQUAL
+// against the depth written here, so its vertex shader must declare
+// gl_Position invariant to compute the same depth in both programs.
+
+void main () {
+}
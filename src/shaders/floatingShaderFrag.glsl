@@ -1,10 +1,6 @@
 #version 330 core
 
-uniform float time;
-uniform vec3 lightPos;
-uniform vec3 eyePosition;
-uniform mat4 rotMat;
-uniform mat4 MVP;
+#include "frame.glsl"
 
 vec3 LightColor = vec3(0.9,0.4,0.4);
 float LightPower = 20.0;
@@ -0,0 +1,10 @@
+// Shared per-frame uniforms, see common/FrameUniforms.hpp
+layout(std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 viewProjection;
+  mat4 rotMat;        // Sky rotation
+  vec3 eyePosition;
+  float time;
+  vec3 lightPos;
+};
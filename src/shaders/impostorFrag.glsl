@@ -0,0 +1,41 @@
+#version 330 core
+
+// Three views of the impostor atlas blended, lit like the tree mesh
+// with the baked normals. See impostorVert.glsl.
+
+#include "frame.glsl"
+#include "tree.glsl"
+
+uniform sampler2D impostorAlbedo;  // Material and coverage
+uniform sampler2D impostorNormals; // Object space normal and coverage
+uniform int impostorFrames;
+
+in vec2 corner;
+in vec3 pos;
+flat in vec2 frame0, frame1, frame2;
+flat in vec3 weights;
+flat in vec2 yaw;
+flat in float fade;
+
+out vec3 color;
+
+void main () {
+
+	if (fadeDither() >= fade) discard;
+
+	vec2 local = 0.5 * corner + 0.5;
+	float scale = 1.0 / float(impostorFrames);
+	vec4 albedo = weights.x * texture(impostorAlbedo, (frame0 + local) * scale)
+	            + weights.y * texture(impostorAlbedo, (frame1 + local) * scale)
+	            + weights.z * texture(impostorAlbedo, (frame2 + local) * scale);
+	if (albedo.a < 0.5) discard;
+	vec4 normal = weights.x * texture(impostorNormals, (frame0 + local) * scale)
+	            + weights.y * texture(impostorNormals, (frame1 + local) * scale)
+	            + weights.z * texture(impostorNormals, (frame2 + local) * scale);
+
+	// The atlas holds colour and normal times coverage, see Impostor.cpp
+	vec3 n = normalize(normal.rgb / normal.a * 2.0 - 1.0);
+	mat2 turn = mat2(yaw.x, -yaw.y, yaw.y, yaw.x);
+	n = vec3(turn * n.xz, n.y).xzy;
+	color = treeLight(albedo.rgb / albedo.a, pos, n);
+}
@@ -0,0 +1,76 @@
+#version 330 core
+
+// The far trees of a forest (common/Forest.hpp) as camera-facing quads,
+// textured from the atlas of common/Impostor.hpp. Drawn instanced with
+// the four corners from gl_VertexID. Instance i is tree firstInstance + i
+// of the samplerBuffer 'instances'. Trees nearer than fadeDistance.x are
+// left to the mesh, with a dithered cross-fade out to fadeDistance.y.
+
+#include "frame.glsl"
+
+uniform samplerBuffer instances; // Position and scale, then cos and sin of the yaw
+uniform int firstInstance;
+uniform vec2 fadeDistance;
+
+uniform int impostorFrames;      // Views per side of the atlas
+uniform vec3 impostorCenter;     // Bounding sphere of the mesh
+uniform float impostorRadius;
+
+out vec2 corner;                 // [-1, 1] over the quad
+out vec3 pos;
+flat out vec2 frame0, frame1, frame2; // The three views to blend...
+flat out vec3 weights;                // ...and how much of each
+flat out vec2 yaw;
+flat out float fade;
+
+// The point of view direction d (d.y >= 0) in [-1, 1]^2, see Impostor.cpp
+vec2 hemiOctEncode(vec3 d) {
+	vec2 p = d.xz / (abs(d.x) + abs(d.y) + abs(d.z));
+	return vec2(p.x + p.y, p.x - p.y);
+}
+
+void main () {
+
+	int id = firstInstance + gl_InstanceID;
+	vec4 place = texelFetch(instances, 2*id);
+	yaw = texelFetch(instances, 2*id + 1).xy;
+	mat2 turn = mat2(yaw.x, -yaw.y, yaw.y, yaw.x);
+	vec3 center = place.xyz + vec3(turn * impostorCenter.xz, impostorCenter.y).xzy * place.w;
+
+	// The view direction in the tree's own coordinates, from above
+	vec3 d = eyePosition - center;
+	d.xz = transpose(turn) * d.xz;
+	d.y = max(d.y, 0.0);
+	d = normalize(d + vec3(0.0, 1e-6, 0.0));
+
+	// The three frames of the grid triangle around it
+	float last = float(impostorFrames - 1);
+	vec2 g = (0.5 * hemiOctEncode(d) + 0.5) * last;
+	vec2 f = min(floor(g), vec2(last - 1.0));
+	vec2 t = g - f;
+	if (t.x + t.y < 1.0) {
+		frame0 = f;
+		frame1 = f + vec2(1.0, 0.0);
+		frame2 = f + vec2(0.0, 1.0);
+		weights = vec3(1.0 - t.x - t.y, t.x, t.y);
+	}
+	else {
+		frame0 = f + vec2(1.0, 1.0);
+		frame1 = f + vec2(0.0, 1.0);
+		frame2 = f + vec2(1.0, 0.0);
+		weights = vec3(t.x + t.y - 1.0, 1.0 - t.x, 1.0 - t.y);
+	}
+
+	// The quad across the bounding sphere, in the basis the frames were rendered with
+	vec3 up = (abs(d.y) > 0.999) ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(-d, up));
+	up = cross(right, -d);
+	corner = vec2((gl_VertexID == 1 || gl_VertexID == 2) ? 1.0 : -1.0, (gl_VertexID >= 2) ? 1.0 : -1.0);
+	vec3 offset = (corner.x * right + corner.y * up) * impostorRadius * place.w;
+	pos = center + vec3(turn * offset.xz, offset.y).xzy;
+	gl_Position = viewProjection * vec4(pos, 1.0);
+
+	float distance = length(place.xz - eyePosition.xz);
+	fade = clamp((distance - fadeDistance.x) / (fadeDistance.y - fadeDistance.x), 0.0, 1.0);
+	if (distance < fadeDistance.x) gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // Outside the view, all corners
+}
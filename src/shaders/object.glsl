@@ -0,0 +1,5 @@
+// Per-object uniforms, see common/FrameUniforms.hpp
+layout(std140) uniform Object {
+  mat4 MVP;
+  mat4 model;
+};
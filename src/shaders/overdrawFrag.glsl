@@ -0,0 +1,11 @@
+#version 330 core
+
+// The colour of one overdraw level, see OverdrawView
+
+uniform vec3 overdrawColor;
+
+out vec4 color;
+
+void main () {
+	color = vec4(overdrawColor, 1.0);
+}
@@ -0,0 +1,9 @@
+#version 330 core
+
+// One triangle over the whole viewport, for OverdrawView. No vertex
+// attributes: the corners come from gl_VertexID.
+
+void main () {
+	vec2 corner = vec2(float((gl_VertexID & 1) * 4 - 1), float((gl_VertexID & 2) * 2 - 1));
+	gl_Position = vec4(corner, 0.0, 1.0);
+}
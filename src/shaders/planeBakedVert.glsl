@@ -0,0 +1,28 @@
+#version 330 core
+
+// Terrain drawn from vertices baked by planeShaderVert.glsl with
+// transform feedback (TriangleSoup::bake()). The displacement and the
+// normals are already done, so this is a plain transform.
+// The baked buffer always holds floats, so no decoding is needed.
+layout(location = 0) in vec3 Position;
+layout ( location =1) in vec3 Normal;
+layout ( location =2) in vec2 TexCoord;
+
+#include "frame.glsl"
+#include "object.glsl"
+
+invariant gl_Position; // See depthOnlyFrag.glsl
+out vec3 interpolatedNormal;
+out vec2 st;
+out vec3 pos;
+
+void main () {
+
+	interpolatedNormal = Normal;
+	st = TexCoord;
+	pos = Position;
+
+	// w = 2.0 like planeShaderVert.glsl, where the offset added to
+	// vec4(Position, 1.0) has w = 1.0, so the two modes look the same
+	gl_Position = MVP * vec4(Position, 2.0);
+}
@@ -1,10 +1,6 @@
 #version 330 core
 
-//uniform float time;
-uniform vec3 lightPos;
-uniform vec3 eyePosition;
-uniform mat4 rotMat;
-uniform mat4 MVP;
+#include "frame.glsl"
 
 in vec3 interpolatedNormal;
 in vec2 st;
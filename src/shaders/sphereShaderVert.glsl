@@ -1,22 +1,24 @@
 #version 330 core
 
-layout(location = 0) in vec3 Position;
-layout ( location =1) in vec3 Normal;
+layout(location = 0) in vec3 inPosition;
+layout ( location =1) in vec3 inNormal;
 layout ( location =2) in vec2 TexCoord;
 
-//uniform float time;
-uniform mat4 MVP;
-uniform mat4 rotMat;
-uniform vec3 lightPos;
+#include "vertexDecode.glsl"
 
+#include "frame.glsl"
+#include "object.glsl"
+
+invariant gl_Position; // See depthOnlyFrag.glsl
 out vec3 interpolatedNormal;
 out vec2 st;
 out vec3 pos;
 
 void main () {
+	decodeVertex();
 		
 		interpolatedNormal = Normal;
 		st = TexCoord;
-		pos = Position;
+		pos = Position + vec3(model[3].x, 0.0, model[3].z) / model[3].w; // It follows the camera (main.cpp)
 		gl_Position = MVP * vec4 (Position , 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,26 @@
+#version 330 core
+
+// Streamed terrain tiles (TileManager). The vertices are relative to
+// the tile corner, tileOffset moves them into place. It is one value per
+// tile: per draw command of an indirect draw, or a constant attribute.
+// Heights and normals are made on the CPU, so this is a plain transform.
+layout(location = 0) in vec3 Position;
+layout ( location =1) in vec3 Normal;
+layout ( location =2) in vec2 TexCoord;
+layout(location = 3) in vec3 tileOffset;
+
+#include "frame.glsl"
+
+invariant gl_Position; // See depthOnlyFrag.glsl
+out vec3 interpolatedNormal;
+out vec2 st;
+out vec3 pos;
+
+void main () {
+
+	interpolatedNormal = Normal;
+	st = TexCoord;
+	pos = Position + tileOffset;
+
+	gl_Position = viewProjection * vec4(pos, 1.0);
+}
@@ -0,0 +1,43 @@
+// Tree lighting and the mesh/impostor cross-fade, shared by the fragment
+// shaders treeShaderFrag.glsl and impostorFrag.glsl. Needs frame.glsl.
+
+vec3 LightColor = vec3(0.9,0.9,0.9);
+float LightPower = 5.0;
+
+// The light of the scene on material 'diffuse' at world position pos,
+// with world normal n
+vec3 treeLight(vec3 diffuse, vec3 pos, vec3 n) {
+
+	vec4 light = vec4(lightPos, 1);
+
+	// Material properties
+	vec3 MaterialDiffuseColor = diffuse;
+	vec3 MaterialAmbientColor = vec3(0.5, 0.5, 0.5) * MaterialDiffuseColor;
+	vec3 MaterialSpecularColor = vec3(0.9, 0.9, 0.9) * MaterialDiffuseColor;
+
+	// Distance to the light
+	float distance = length(vec3(light) - pos);
+
+	// Direction of the light (from the fragment to the light)
+	vec3 l = normalize(pos-vec3(light));
+	// Cosine of the angle between the normal and the light direction,
+	float cosTheta = clamp( dot( n,l ), 0,1 );
+
+	// Eye vector (towards the camera)
+	vec3 E = normalize(pos - eyePosition);
+	// Direction in which the triangle reflects the light
+	vec3 R = reflect(-l,n);
+	// Cosine of the angle between the Eye vector and the Reflect vector,
+	float cosAlpha = clamp( dot( E,R ), 0,1 );
+
+	return MaterialAmbientColor
+	+ MaterialDiffuseColor * LightColor * LightPower * cosTheta / (distance/3)
+	+ MaterialSpecularColor * LightColor * LightPower * pow(cosAlpha,5) / (distance*distance);
+}
+
+// A threshold in [0, 1) per pixel, noise without low frequencies. Over
+// the cross-fade a mesh keeps the pixels above its fade and the impostor
+// the ones below, so together they cover the tree once, with no blending.
+float fadeDither() {
+	return fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
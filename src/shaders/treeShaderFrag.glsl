@@ -1,57 +1,45 @@
 #version 330 core
 
-//uniform float time;
-uniform vec3 lightPos;
-uniform vec3 eyePosition;
-uniform mat4 rotMat;
-uniform mat4 MVP;
+#include "frame.glsl"
+#include "tree.glsl"
 
 in vec3 interpolatedNormal;
 in vec2 st;
 in vec3 pos;
-
-vec3 LightColor = vec3(0.9,0.9,0.9);
-float LightPower = 5.0;
-
+in vec3 objectPos; // The trunk is found in the tree's own coordinates
+#ifdef INSTANCED
+in float fade;     // Towards the impostor, see tree.glsl
+#endif
+
+#ifdef IMPOSTOR_BAKE
+// The material and the object space normal, for common/Impostor.hpp
+layout(location = 0) out vec4 albedo;
+layout(location = 1) out vec4 normal;
+#else
 out vec3 color;
+#endif
 
 void main () {
-	
+
+#ifdef INSTANCED
+	if (fadeDither() < fade) discard;
+#endif
+
 	vec4 mat;
 
-	if (abs(pos.x) <0.4 && pos.y < 1.7)
+	if (abs(objectPos.x) <0.4 && objectPos.y < 1.7)
 		mat = vec4(0.3, 0.2,0.01, 1.0);
 	else
 		mat = vec4(0.1, 0.3, 0.1, 1.0);
 
-	vec4 light = vec4(lightPos, 1);
-	//light =  rotMat * light;
-
-	// Material properties
-	vec3 MaterialDiffuseColor = vec3(mat);
-	vec3 MaterialAmbientColor = vec3(0.5, 0.5, 0.5) * MaterialDiffuseColor;
-	vec3 MaterialSpecularColor = vec3(0.9, 0.9, 0.9) * MaterialDiffuseColor;
-	
-	// Distance to the light
-	float distance = length(vec3(light) - pos);
-
-	// Normal of the computed fragment, in camera space
+	// Normal of the computed fragment
 	vec3 n = normalize(interpolatedNormal);
-	// Direction of the light (from the fragment to the light)
-	vec3 l = normalize(pos-vec3(light));
-	// Cosine of the angle between the normal and the light direction, 
-	float cosTheta = clamp( dot( n,l ), 0,1 );
-
-	// Eye vector (towards the camera)
-	vec3 E = normalize(pos - eyePosition);
-	// Direction in which the triangle reflects the light
-	vec3 R = reflect(-l,n);
-	// Cosine of the angle between the Eye vector and the Reflect vector,
-	float cosAlpha = clamp( dot( E,R ), 0,1 );
-
-	color = MaterialAmbientColor
-	+ MaterialDiffuseColor * LightColor * LightPower * cosTheta / (distance/3)
-	+ MaterialSpecularColor * LightColor * LightPower * pow(cosAlpha,5) / (distance*distance);
 
+#ifdef IMPOSTOR_BAKE
+	albedo = vec4(mat.rgb, 1.0);
+	normal = vec4(0.5 * n + 0.5, 1.0);
+#else
+	color = treeLight(vec3(mat), pos, n);
 	//color = color * texture2D(st)
-}
\ No newline at end of file
+#endif
+}
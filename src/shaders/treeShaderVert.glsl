@@ -1,22 +1,57 @@
 #version 330 core
 
-layout(location = 0) in vec3 Position;
-layout ( location =1) in vec3 Normal;
+// One tree, placed by the Object block, or with INSTANCED defined a
+// forest of them (common/Forest.hpp): each instance reads its place
+// from the samplerBuffer 'instances', two texels per tree. Instances
+// farther than fadeDistance are left to their impostors (common/Impostor.hpp),
+// with a dithered cross-fade between the two distances. IMPOSTOR_BAKE
+// takes the matrix from bakeMVP instead of the Object block.
+layout(location = 0) in vec3 inPosition;
+layout ( location =1) in vec3 inNormal;
 layout ( location =2) in vec2 TexCoord;
 
-//uniform float time;
-uniform mat4 MVP;
-uniform mat4 rotMat;
-uniform vec3 lightPos;
+#include "vertexDecode.glsl"
+
+#include "frame.glsl"
+#if defined(INSTANCED)
+uniform samplerBuffer instances; // Position and scale, then cos and sin of the yaw
+uniform vec2 fadeDistance = vec2(1e30, 2e30); // No impostors by default
+out float fade;    // 0 up to fadeDistance.x, 1 from fadeDistance.y
+#elif defined(IMPOSTOR_BAKE)
+uniform mat4 bakeMVP;
+#else
+#include "object.glsl"
+#endif
 
 out vec3 interpolatedNormal;
 out vec2 st;
 out vec3 pos;
+out vec3 objectPos;
 
 void main () {
+	decodeVertex();
 		
-		interpolatedNormal = Normal;
 		st = TexCoord;
+		objectPos = Position;
+#ifdef INSTANCED
+		vec4 place = texelFetch(instances, 2*gl_InstanceID);
+		vec2 yaw = texelFetch(instances, 2*gl_InstanceID + 1).xy;
+		mat2 turn = mat2(yaw.x, -yaw.y, yaw.y, yaw.x);
+		pos = Position * place.w;
+		pos.xz = turn * pos.xz;
+		pos += place.xyz;
+		interpolatedNormal = vec3(turn * Normal.xz, Normal.y).xzy;
+		gl_Position = viewProjection * vec4 (pos , 1.0);
+		float distance = length(place.xz - eyePosition.xz);
+		fade = clamp((distance - fadeDistance.x) / (fadeDistance.y - fadeDistance.x), 0.0, 1.0);
+		if (distance > fadeDistance.y) gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // Outside the view, all corners
+#elif defined(IMPOSTOR_BAKE)
+		interpolatedNormal = Normal;
+		pos = Position;
+		gl_Position = bakeMVP * vec4 (Position , 1.0);
+#else
+		interpolatedNormal = Normal;
 		pos = Position;
 		gl_Position = MVP * vec4 (Position , 1.0);
-}
\ No newline at end of file
+#endif
+}
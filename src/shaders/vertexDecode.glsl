@@ -0,0 +1,25 @@
+// Needs the attributes inPosition and inNormal. Call decodeVertex() first
+// in main(), then use Position and Normal.
+
+// Vertex format decoding, set by TriangleSoup::render().
+// The defaults are right for the plain float format.
+uniform vec3 posScale = vec3(1.0);
+uniform vec3 posBias = vec3(0.0);
+uniform bool octNormals = false;
+
+vec3 Position; // Decoded object space position
+vec3 Normal;   // Decoded object space normal
+
+// Octahedral normals come as 16-bit integers in [-32767, 32767]
+vec3 octDecode(vec2 e) {
+  e /= 32767.0;
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0.0)
+    n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  return normalize(n);
+}
+
+void decodeVertex() {
+  Position = inPosition * posScale + posBias;
+  Normal = octNormals ? octDecode(inNormal.xy) : inNormal;
+}
@@ -4,202 +4,56 @@ in vec3 pos;
 in vec3 interpolatedNormal;
 in vec2 st;
 
-uniform float time;
+#include "frame.glsl"
 uniform sampler2D tex;
-uniform mat4 rotMat;
-uniform vec3 lightPos;
-uniform vec3 eyePosition;
+
+// Variant switches, set with Shader::createShader(..., defines)
+#ifndef NOISE_OCTAVES
+#define NOISE_OCTAVES 3     // Octaves of the bump noise, 1 to 3
+#endif
+#ifndef FAKE_SHADOW
+#define FAKE_SHADOW 1       // Darken the water under the floating ball
+#endif
+#ifndef LIGHT_POWER
+#define LIGHT_POWER 1.0
+#endif
+#ifndef NORMAL_MAPS
+#define NORMAL_MAPS 0       // Precomputed slopes (common/WaterNormals.hpp) instead of noise
+#endif
+#ifndef OCEAN
+#define OCEAN 0             // FFT waves (common/Ocean.hpp), see waterShaderVert.glsl
+#endif
+
+#if OCEAN
+uniform sampler2D oceanSlopes;    // dh/dx and dh/dz of the waves, repeating
+in vec2 oceanUV;
+#endif
 
 //vec3 lightPos = vec3(0.0, 4.0, 2.0);
 vec3 LightColor = vec3(0.9,0.9,0.9);
-float LightPower = 1.0;
+float LightPower = LIGHT_POWER;
 
 
 //out vec4 finalcolor;
 out vec4 color;
 
 
-// Authors : Ian McEwan, Ashima Arts and Stefan Gustavson, LiU.
-// noise functions
-vec3 mod289(vec3 x) {
-  return x - floor(x * (1.0 / 289.0)) * 289.0;
-}
-
-vec4 mod289(vec4 x) {
-  return x - floor(x * (1.0 / 289.0)) * 289.0;
-}
-
-vec4 permute(vec4 x) {
-     return mod289(((x*34.0)+1.0)*x);
-}
+#if NORMAL_MAPS
+uniform sampler2DArray waterMaps; // Slope x, slope z and height per frame, in [0, 1]
+uniform vec4 waterParams;         // Frames, period in world units, loop in seconds, steepest slope
 
-vec4 taylorInvSqrt(vec4 r)
-{
-  return 1.79284291400159 - 0.85373472095314 * r;
-}
-
-// 3-D simplex noise
-//
-float snoise(vec3 v)
-  { 
-  const vec2  C = vec2(1.0/6.0, 1.0/3.0) ;
-  const vec4  D = vec4(0.0, 0.5, 1.0, 2.0);
-
-// First corner
-  vec3 i  = floor(v + dot(v, C.yyy) );
-  vec3 x0 =   v - i + dot(i, C.xxx) ;
-
-// Other corners
-  vec3 g = step(x0.yzx, x0.xyz);
-  vec3 l = 1.0 - g;
-  vec3 i1 = min( g.xyz, l.zxy );
-  vec3 i2 = max( g.xyz, l.zxy );
-
-  //   x0 = x0 - 0.0 + 0.0 * C.xxx;
-  //   x1 = x0 - i1  + 1.0 * C.xxx;
-  //   x2 = x0 - i2  + 2.0 * C.xxx;
-  //   x3 = x0 - 1.0 + 3.0 * C.xxx;
-  vec3 x1 = x0 - i1 + C.xxx;
-  vec3 x2 = x0 - i2 + C.yyy; // 2.0*C.x = 1/3 = C.y
-  vec3 x3 = x0 - D.yyy;      // -1.0+3.0*C.x = -0.5 = -D.y
-
-// Permutations
-  i = mod289(i); 
-  vec4 p = permute( permute( permute( 
-             i.z + vec4(0.0, i1.z, i2.z, 1.0 ))
-           + i.y + vec4(0.0, i1.y, i2.y, 1.0 )) 
-           + i.x + vec4(0.0, i1.x, i2.x, 1.0 ));
-
-// Gradients: 7x7 points over a square, mapped onto an octahedron.
-// The ring size 17*17 = 289 is close to a multiple of 49 (49*6 = 294)
-  float n_ = 0.142857142857; // 1.0/7.0
-  vec3  ns = n_ * D.wyz - D.xzx;
-
-  vec4 j = p - 49.0 * floor(p * ns.z * ns.z);  //  mod(p,7*7)
-
-  vec4 x_ = floor(j * ns.z);
-  vec4 y_ = floor(j - 7.0 * x_ );    // mod(j,N)
-
-  vec4 x = x_ *ns.x + ns.yyyy;
-  vec4 y = y_ *ns.x + ns.yyyy;
-  vec4 h = 1.0 - abs(x) - abs(y);
-
-  vec4 b0 = vec4( x.xy, y.xy );
-  vec4 b1 = vec4( x.zw, y.zw );
-
-  //vec4 s0 = vec4(lessThan(b0,0.0))*2.0 - 1.0;
-  //vec4 s1 = vec4(lessThan(b1,0.0))*2.0 - 1.0;
-  vec4 s0 = floor(b0)*2.0 + 1.0;
-  vec4 s1 = floor(b1)*2.0 + 1.0;
-  vec4 sh = -step(h, vec4(0.0));
-
-  vec4 a0 = b0.xzyw + s0.xzyw*sh.xxyy ;
-  vec4 a1 = b1.xzyw + s1.xzyw*sh.zzww ;
-
-  vec3 p0 = vec3(a0.xy,h.x);
-  vec3 p1 = vec3(a0.zw,h.y);
-  vec3 p2 = vec3(a1.xy,h.z);
-  vec3 p3 = vec3(a1.zw,h.w);
-
-//Normalise gradients
-  vec4 norm = taylorInvSqrt(vec4(dot(p0,p0), dot(p1,p1), dot(p2, p2), dot(p3,p3)));
-  p0 *= norm.x;
-  p1 *= norm.y;
-  p2 *= norm.z;
-  p3 *= norm.w;
-
-// Mix final noise value
-  vec4 m = max(0.6 - vec4(dot(x0,x0), dot(x1,x1), dot(x2,x2), dot(x3,x3)), 0.0);
-  m = m * m;
-  return 42.0 * dot( m*m, vec4( dot(p0,x0), dot(p1,x1), 
-                                dot(p2,x2), dot(p3,x3) ) );
-}
-
-// 3-D simplex noise with gradient
-// (analytical partial derivatives in x,y,z)
-//
-float snoise(vec3 v, out vec3 gradient)
-{
-  const vec2  C = vec2(1.0/6.0, 1.0/3.0) ;
-  const vec4  D = vec4(0.0, 0.5, 1.0, 2.0);
-
-// First corner
-  vec3 i  = floor(v + dot(v, C.yyy) );
-  vec3 x0 =   v - i + dot(i, C.xxx) ;
-
-// Other corners
-  vec3 g = step(x0.yzx, x0.xyz);
-  vec3 l = 1.0 - g;
-  vec3 i1 = min( g.xyz, l.zxy );
-  vec3 i2 = max( g.xyz, l.zxy );
-
-  //   x0 = x0 - 0.0 + 0.0 * C.xxx;
-  //   x1 = x0 - i1  + 1.0 * C.xxx;
-  //   x2 = x0 - i2  + 2.0 * C.xxx;
-  //   x3 = x0 - 1.0 + 3.0 * C.xxx;
-  vec3 x1 = x0 - i1 + C.xxx;
-  vec3 x2 = x0 - i2 + C.yyy; // 2.0*C.x = 1/3 = C.y
-  vec3 x3 = x0 - D.yyy;      // -1.0+3.0*C.x = -0.5 = -D.y
-
-// Permutations
-  i = mod289(i); 
-  vec4 p = permute( permute( permute( 
-             i.z + vec4(0.0, i1.z, i2.z, 1.0 ))
-           + i.y + vec4(0.0, i1.y, i2.y, 1.0 )) 
-           + i.x + vec4(0.0, i1.x, i2.x, 1.0 ));
-
-// Gradients: 7x7 points over a square, mapped onto an octahedron.
-// The ring size 17*17 = 289 is close to a multiple of 49 (49*6 = 294)
-  float n_ = 0.142857142857; // 1.0/7.0
-  vec3  ns = n_ * D.wyz - D.xzx;
-
-  vec4 j = p - 49.0 * floor(p * ns.z * ns.z);  //  mod(p,7*7)
-
-  vec4 x_ = floor(j * ns.z);
-  vec4 y_ = floor(j - 7.0 * x_ );    // mod(j,N)
-
-  vec4 x = x_ *ns.x + ns.yyyy;
-  vec4 y = y_ *ns.x + ns.yyyy;
-  vec4 h = 1.0 - abs(x) - abs(y);
-
-  vec4 b0 = vec4( x.xy, y.xy );
-  vec4 b1 = vec4( x.zw, y.zw );
-
-  //vec4 s0 = vec4(lessThan(b0,0.0))*2.0 - 1.0;
-  //vec4 s1 = vec4(lessThan(b1,0.0))*2.0 - 1.0;
-  vec4 s0 = floor(b0)*2.0 + 1.0;
-  vec4 s1 = floor(b1)*2.0 + 1.0;
-  vec4 sh = -step(h, vec4(0.0));
-
-  vec4 a0 = b0.xzyw + s0.xzyw*sh.xxyy ;
-  vec4 a1 = b1.xzyw + s1.xzyw*sh.zzww ;
-
-  vec3 p0 = vec3(a0.xy,h.x);
-  vec3 p1 = vec3(a0.zw,h.y);
-  vec3 p2 = vec3(a1.xy,h.z);
-  vec3 p3 = vec3(a1.zw,h.w);
-
-//Normalise gradients
-  vec4 norm = taylorInvSqrt(vec4(dot(p0,p0), dot(p1,p1), dot(p2, p2), dot(p3,p3)));
-  p0 *= norm.x;
-  p1 *= norm.y;
-  p2 *= norm.z;
-  p3 *= norm.w;
-
-// Mix final noise value
-  vec4 m = max(0.6 - vec4(dot(x0,x0), dot(x1,x1), dot(x2,x2), dot(x3,x3)), 0.0);
-  vec4 m2 = m * m;
-  vec4 m4 = m2 * m2;
-  vec4 pdotx = vec4(dot(p0,x0), dot(p1,x1), dot(p2,x2), dot(p3,x3));
-
-// Determine noise gradient
-  vec4 temp = m2 * m * pdotx;
-  gradient = -8.0 * (temp.x * x0 + temp.y * x1 + temp.z * x2 + temp.w * x3);
-  gradient += m4.x * p0 + m4.y * p1 + m4.z * p2 + m4.w * p3;
-  gradient *= 42.0;
-
-  return 42.0 * dot(m4, pdotx);
+// The maps at world position p and time t, between the two nearest frames
+vec3 waterMap(vec2 p, float t) {
+	float frame = fract(t / waterParams.z) * waterParams.x;
+	float first = floor(frame);
+	vec2 uv = p / waterParams.y;
+	vec3 a = texture(waterMaps, vec3(uv, first)).xyz;
+	vec3 b = texture(waterMaps, vec3(uv, mod(first + 1.0, waterParams.x))).xyz;
+	return (2.0 * mix(a, b, frame - first) - 1.0) * vec3(waterParams.ww, 1.0);
 }
+#else
+#include "noise.glsl"
+#endif
 
 // main
 void main () {
@@ -213,18 +67,41 @@ void main () {
 
 	// Bump map surface
 	vec3 grad = vec3(0.0); // To store gradient of noise
+#if NORMAL_MAPS
+	// Two layers scrolling apart, the second turned, larger and half a loop
+	// later. Their slopes add up to about the contrast of one.
+	const mat2 turn = mat2(0.8, 0.6, -0.6, 0.8);
+	vec3 layer1 = waterMap(pos.xz + vec2(0.03, 0.02) * time, time);
+	vec3 layer2 = waterMap(0.7 * (turn * pos.xz) + vec2(-0.02, 0.035) * time, time + 0.5 * waterParams.z);
+	vec2 slope = 0.7071 * (layer1.xy + 0.7 * (layer2.xy * turn));
+	float bump = 0.7071 * (layer1.z + layer2.z) + 0.5;
+	grad = vec3(slope.x, 0.0, slope.y);
+#else
 	vec3 gradtemp = vec3(0.0); // Temporary gradient for fractal sum
 	float bump = 0.2 * snoise(2*pos, grad) + 0.5;
 	grad *= 0.4; // Scale gradient with inner derivative
+#if NOISE_OCTAVES >= 2
 	bump += 0.5 * snoise(pos*4.0, gradtemp);
 	grad += 2.0 * gradtemp; // Same influence (double freq, half amp)
+#endif
+#if NOISE_OCTAVES >= 3
 	bump += 0.25 * snoise(pos*10.0, gradtemp);
 	grad += 4.0 * gradtemp; // Same influence (double freq, half amp)
+#endif
+#endif
 	
+#if OCEAN
+	vec2 waveSlope = texture(oceanSlopes, oceanUV).xy;
+	vec3 surfaceNormal = normalize(vec3(-waveSlope.x, 1.0, -waveSlope.y));
+#else
+	vec3 surfaceNormal = interpolatedNormal;
+#endif
+
   // Perturb normal
-	vec3 perturbation = grad - dot(grad, interpolatedNormal) * interpolatedNormal;
-	vec3 norm = interpolatedNormal -  0.2 * perturbation;
+	vec3 perturbation = grad - dot(grad, surfaceNormal) * surfaceNormal;
+	vec3 norm = surfaceNormal -  0.2 * perturbation;
 
+#if FAKE_SHADOW
   vec3 ballPos = vec3(0.0, 0.0, -0.1);
   ballPos += vec3(0.0, sin(ballPos.z - 2.0*time)/15.0 + cos(ballPos.x + time)/25, 0.0);
   vec3 shadow = vec3(0.0,0.0,0.0);
@@ -232,6 +109,7 @@ void main () {
   // fake shadow
   if( length(pos.xyz-ballPos) < 0.1)
     LightPower = 0.1;
+#endif
 
 	// Material properties
 	vec3 MaterialDiffuseColor = mix(colorBlue, colorLightBlue, 0.5);
@@ -1,13 +1,13 @@
 #version 330 core
 
-layout(location = 0) in vec3 Position;
-layout ( location =1) in vec3 Normal;
+layout(location = 0) in vec3 inPosition;
+layout ( location =1) in vec3 inNormal;
 layout ( location =2) in vec2 TexCoord;
 
-uniform float time;
-uniform mat4 MVP;
-uniform vec3 lightPos;
-uniform vec3 eyePosition;
+#include "vertexDecode.glsl"
+
+#include "frame.glsl"
+#include "object.glsl"
 
 out vec3 interpolatedNormal;
 out vec2 st;
@@ -15,21 +15,46 @@ out vec3 pos;
 
 float delta = 0.1;
 
+// Variant switch, set with Shader::createShader(..., defines)
+#ifndef OCEAN
+#define OCEAN 0             // FFT waves (common/Ocean.hpp) instead of two sines
+#endif
+
+#if OCEAN
+uniform sampler2D oceanDisplacement; // x, y and z displacement, repeating
+uniform float oceanPatch;            // Size of one repeat in world units
+out vec2 oceanUV;
+
+vec4 getOffset(vec3 P) {
+	return vec4(textureLod(oceanDisplacement, P.xz / oceanPatch, 0.0).xyz, 0.0);
+}
+#else
 vec4 getOffset(vec3 P) {
  	vec4 offset;
     vec3 grad;
   	offset = vec4(0.0, sin(P.z - 2.0*time)/20.0 + cos(P.x + time)/25.0, 0.0, 0.0);
   	return offset;
 }
+#endif
 
 void main () {
+	decodeVertex();
+
+	// The mesh follows the camera (main.cpp), the waves stay in place
+	vec3 P = Position + vec3(model[3].x, 0.0, model[3].z) / model[3].w;
 
 	vec4 offset;
 
+#if OCEAN
+	// The fragment shader takes the normal from the slope map
+	offset = getOffset(P);
+	oceanUV = P.xz / oceanPatch;
+	vec3 normal = vec3(0.0, 1.0, 0.0);
+#else
 	float delta = 0.09;
-  	vec4 offX = getOffset(Position + vec3(delta, 0.0, 0.0));
-  	vec4 offZ = getOffset(Position + vec3(0.0, 0.0, delta));
-  	offset = getOffset(Position);
+  	vec4 offX = getOffset(P + vec3(delta, 0.0, 0.0));
+  	vec4 offZ = getOffset(P + vec3(0.0, 0.0, delta));
+  	offset = getOffset(P);
 
   	vec3 dx = normalize(vec3(vec3(delta, 0.0, 0.0) + vec3(offX)) - vec3(offset));
   	vec3 dz = normalize(vec3(vec3(0.0, 0.0, delta) + vec3(offZ)) + vec3(offset));
@@ -38,10 +63,11 @@ void main () {
 
   	if( normal.y < 0 )
   		normal = vec3(normal.x, -normal.y, normal.z);
+#endif
 
 	interpolatedNormal = normal;
 	st = TexCoord;
-	pos = Position+vec3(offset);
+	pos = P+vec3(offset);
 	
 	gl_Position =  MVP * (vec4 (Position, 1.0)+ offset);
 }
\ No newline at end of file
@@ -4,11 +4,8 @@ in vec3 pos;
 in vec3 interpolatedNormal;
 in vec2 st;
 
-uniform float time;
+#include "frame.glsl"
 uniform sampler2D tex;
-uniform mat4 rotMat;
-uniform vec3 lightPos;
-uniform vec3 eyePosition;
 
 //vec3 lightPos = vec3(0.0, 4.0, 2.0);
 vec3 LightColor = vec3(0.9,0.9,0.9);
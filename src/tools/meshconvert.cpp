@@ -0,0 +1,55 @@
+/*
+ * meshconvert.cpp
+ * Convert OBJ files offline to the binary mesh cache that
+ * TriangleSoup::readOBJ() maps at startup (see MeshCache.hpp).
+ * The mesh is welded and optimised exactly as readOBJ() does it.
+ * Usage: meshconvert file.obj [file2.obj ...]
+ * Each file.obj gives file.obj.mesh next to it. Run it from the
+ * directory the program is started from, since the cache is keyed on
+ * the path as readOBJ() sees it ("objects/Tree.obj").
+ * The cache is written with float vertices. A mesh that is drawn in a
+ * compact vertex format packs it and rewrites it on its first run.
+ */
+
+#include "../common/ObjLoader.hpp"
+#include "../common/MeshOptimizer.hpp"
+#include "../common/MeshCache.hpp"
+
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s file.obj [file2.obj ...]\n", argv[0]);
+        return 1;
+    }
+
+    int failures = 0;
+    for(int i=1; i<argc; i++) {
+        const char *filename = argv[i];
+        ObjLoader loader;
+        if(!loader.load(filename)) {
+            failures++;
+            continue;
+        }
+
+        int nindices = 3*loader.ntris;
+        int nverts = MeshOptimizer::weldVertices(loader.vertexarray, loader.nverts, 8,
+                                                 loader.indexarray, nindices);
+        MeshOptimizer::optimizeVertexCache(loader.indexarray, nindices, nverts);
+        nverts = MeshOptimizer::optimizeVertexFetch(loader.vertexarray, nverts, 8,
+                                                    loader.indexarray, nindices);
+
+        char cachefile[MESHFILE_MAXPATH + 16];
+        MeshCache::cacheName(filename, cachefile, sizeof(cachefile));
+        if(!MeshCache::writeInterleaved(cachefile, filename, loader.vertexarray, nverts,
+                                        loader.indexarray, nindices)) {
+            failures++;
+            continue;
+        }
+        printf("%s: %d vertices, %d triangles, ACMR %.3f -> %s\n", filename, nverts,
+            loader.ntris, MeshOptimizer::computeACMR(loader.indexarray, nindices, nverts),
+            cachefile);
+    }
+    return failures ? 1 : 0;
+}